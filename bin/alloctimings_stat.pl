@@ -4,7 +4,7 @@
 #
 # The highalloc kernel module (used by bench-stresshighalloc) generates
 # a timing report in /proc/vmregress/test_highalloc_timings that shows
-# the number of clock cycles taken for each allocation. This program
+# the number of nanoseconds taken for each allocation. This program
 # generates a report showing the ranges of times spent allocating the
 # pages
 
@@ -14,6 +14,7 @@ use lib "$Bin/lib";
 use Getopt::Long;
 use Pod::Usage;
 use VMR::File;
+use VMR::Record;
 use VMR::Report;
 use File::Basename;
 use strict;
@@ -53,7 +54,16 @@ my @alloc_timings_range;
 my @failed_timings_range;
 my $timing;
 my @unsorted_alltimings;
-foreach $timing (split /\s+/, $proc) {
+my @rawtimings;
+if (isrecords($proc)) {
+  # Failed allocations are negative as they are in the text output
+  foreach my $record (recordvalues($proc, "highalloc_timing")) {
+    push @rawtimings, $$record{"success"} ? $$record{"ns"} : -$$record{"ns"};
+  }
+} else {
+  @rawtimings = split /\s+/, $proc;
+}
+foreach $timing (@rawtimings) {
   $unsorted_alltimings[$#unsorted_alltimings+1] = $timing / 1000;
 }
 my @alltimings = sort { $a <=> $b } @unsorted_alltimings;
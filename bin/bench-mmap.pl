@@ -34,6 +34,7 @@ use VMR::Pagemap;
 use VMR::Time;
 use VMR::Kernel;
 use VMR::File;
+use VMR::Dev;
 use VMR::Reference;
 use VMR::Graph;
 use VMR::External;
@@ -114,6 +115,8 @@ my $reportTitle="";
 my $proc;				# Information read from a proc entry
 my $procarguments;			# Arguements to write to the proc entry
 my $proc_readwrite="map_read";		# Name of the proc entry to use
+my $dev_readwrite;			# Id of it on /dev/vmregress if used
+my @touch_batch;			# Batch of pages to touch
 
 # External program related
 my $uname_output;			# Output from uname
@@ -217,10 +220,20 @@ reportPrint("Page size $PAGE_SIZE\n");
 
 reportZone("Before Test");
 
+# Use /dev/vmregress if it is available to save a proc write per reference
+if (devopen()) {
+	print "Running entries through /dev/vmregress\n";
+	$dev_readwrite = devlookup($proc_readwrite);
+}
+
 # Map a memory region
 if ($filemap eq "/dev/null") {
 	# Map an anonymous region of memory
-	writeproc("mapanon_open", $mapsize * $PAGE_SIZE);
+	if (defined $dev_readwrite) {
+		$addr = devrun(devlookup("mapanon_open"), $mapsize * $PAGE_SIZE);
+	} else {
+		writeproc("mapanon_open", $mapsize * $PAGE_SIZE);
+	}
 } else {
 	# Memory map the requested file
 	open(MAPFILE, "+<$filemap") || vmrdie("Cannot open $filemap to memory map");
@@ -233,12 +246,22 @@ if ($filemap eq "/dev/null") {
 	$procarguments .= fileno(MAPFILE);
 	$procarguments .= " 0";
 
-	writeproc("mapfd_open", $procarguments);
+	if (defined $dev_readwrite) {
+		$addr = devrun(devlookup("mapfd_open"), split(/ /, $procarguments));
+	} else {
+		writeproc("mapfd_open", $procarguments);
+	}
+}
+if (defined $dev_readwrite) {
+	# The address is the result of the open
+	$pid = $$;
+	$addrhex = sprintf("0x%lX", $addr);
+} else {
+	$proc = readproc("map_addr");
+	($pid, $addr, $addrhex) = split(/ /, $proc);
+	chop($addrhex);
 }
-$proc = readproc("map_addr");
-($pid, $addr, $addrhex) = split(/ /, $proc);
-chop($addrhex);
-if ($addrhex =~ /^0xFFFF/) {
+if ($addrhex =~ /^0xFFFF/ || $addr == -1) {
   die("Mapped address $addrhex looks like a failed mapping, probably due to lack of address space");
 }
 print "Mapped $mapsize pages at $addrhex PID=$pid\n";
@@ -265,6 +288,16 @@ for ($pass=1; $pass <= 2; $pass++) {
 					"% referenced. Running time " . 
 					int($running_time - $starttime) . " sec";
 			}
+		if (defined $dev_readwrite) {
+			# Touch pages a batch at a time
+			push @touch_batch, [ $dev_readwrite,
+				$addr + ($pageindex * $PAGE_SIZE), 1 ];
+			if (@touch_batch == 1024 || $pageindex == 0) {
+				devbatch(@touch_batch);
+				@touch_batch = ();
+			}
+			next;
+		}
 		$procarguments = sprintf "%d %d\n",
 			$addr + ($pageindex * $PAGE_SIZE), 1;
 #print "Touch each page twice to be in stable state $pageindex\n";
@@ -313,7 +346,11 @@ while ($refindex++ < $totalreferences) {
 	# the number of bytes
 	$procarguments = sprintf "%d %d\n", $addr + ($pageindex * $PAGE_SIZE), 1;
 	$timetoken = gettime();
-	writeproc($proc_readwrite, $procarguments);
+	if (defined $dev_readwrite) {
+		devrun($dev_readwrite, $addr + ($pageindex * $PAGE_SIZE), 1);
+	} else {
+		writeproc($proc_readwrite, $procarguments);
+	}
 	$elapsed = difftime($timetoken, gettime(), 0);
 
 	($running_time, $dummy)   = split(/\|/, $timetoken);
@@ -398,7 +435,12 @@ close PLOT;
 
 # Unmap area
 $starttime_token = gettime;
-writeproc("map_close", "$addr " . $mapsize*$PAGE_SIZE);
+if (defined $dev_readwrite) {
+	devrun(devlookup("map_close"), $addr, $mapsize*$PAGE_SIZE);
+	devclose();
+} else {
+	writeproc("map_close", "$addr " . $mapsize*$PAGE_SIZE);
+}
 if ($filemap ne "/dev/null") { close FILEMAP; }
 $unmap_time = int difftime($starttime_token, gettime, 1);
 
@@ -0,0 +1,112 @@
+#!/usr/bin/perl
+#
+# decode_records
+#
+# Print the binary record output of a VM Regress proc entry as text. A
+# module loaded with vmr_binary=1 writes binary records instead of text.
+# Each data record is printed as its schema name followed by name=value
+# pairs, the same as the text output of printp_record. Text records are
+# printed as they are
+
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+
+use Getopt::Long;
+use Pod::Usage;
+use VMR::File;
+use VMR::Record;
+use strict;
+
+# Option variables
+my $man  =0;
+my $help =0;
+my $opt_schema = "";
+
+GetOptions(
+	'help|h'   => \$help,
+	'man'      => \$man,
+	'schema|s=s' => \$opt_schema);
+
+pod2usage(-exitstatus => 0, -verbose => 0) if $help;
+pod2usage(-exitstatus => 0, -verbose => 2) if $man;
+pod2usage(-exitstatus => 1, -verbose => 0) if ($#ARGV != 0);
+
+my $proc;
+if (-f $ARGV[0]) {
+	local $/;
+	open(INPUT, $ARGV[0]) or die("Failed to open $ARGV[0]");
+	binmode INPUT;
+	$proc = <INPUT>;
+	close INPUT;
+} else {
+	$proc = readproc($ARGV[0]);
+}
+
+if (!isrecords($proc)) {
+	print $proc;
+	exit 0;
+}
+
+decoderecords($proc, sub {
+	my $record = shift;
+	my $i;
+
+	if ($$record{"type"} eq "data") {
+		return if ($opt_schema ne "" && $$record{"schema"} ne $opt_schema);
+		print $$record{"schema"};
+		for ($i = 0; $i <= $#{$$record{"fields"}}; $i++) {
+			print " " . $$record{"fields"}[$i] . "=" . $$record{"values"}[$i];
+		}
+		print "\n";
+		return;
+	}
+
+	return if ($opt_schema ne "");
+	print $$record{"text"} if ($$record{"type"} eq "text");
+	print $$record{"map"} if ($$record{"type"} eq "map");
+});
+
+# Below is the help message
+
+=head1 NAME
+
+decode_records.pl - Print binary VM Regress output as text
+
+=head1 SYNOPSIS
+
+decode_records.pl [options] procentry|file
+
+ Options:
+  --help          Print help messages
+  --man           Print man page
+  -s, --schema    Only print data records of this schema
+
+=head1 OPTIONS
+
+=over 8
+
+=item B<--help>
+
+Print a help message and exit
+
+=item B<-s, --schema>
+
+Only print the data records of the named schema such as highalloc_timing
+
+=back
+
+=head1 DESCRIPTION
+
+Reads a proc entry, or a file the output of one was saved to, and prints
+the binary records in it as text. See include/vmr_record.h for the format.
+Output that is not binary is printed unchanged
+
+=head1 AUTHOR
+
+Written by Mel Gorman (mel@csn.ul.ie)
+
+=head1 REPORTING BUGS
+
+Report bugs to the author
+
+=cut
@@ -0,0 +1,130 @@
+#
+# Dev.pm
+#
+# This runs VM Regress proc entries through the /dev/vmregress device
+# instead of writing parameters to proc. A batch of commands costs one
+# ioctl and the result of each test comes back as a number so nothing has
+# to be read back and parsed. See include/vmr_dev.h for the interface.
+# A perl with 64 bit integers is needed
+#
+package VMR::Dev;
+require Exporter;
+use vars qw (@ISA @EXPORT);
+use strict;
+
+@ISA    = qw(Exporter);
+@EXPORT = qw(&devopen &devclose &devlookup &devbatch &devrun &devaffinity);
+
+my $DEV_PATH      = "/dev/vmregress";
+my $DEV_MAXPARAMS = 8;
+my $LOOKUP_SIZE   = 48;		# sizeof(struct vmr_dev_lookup)
+my $BATCH_SIZE    = 16;		# sizeof(struct vmr_dev_batch)
+my $CMD_SIZE      = 96;		# sizeof(struct vmr_dev_cmd)
+my $CMD_FORMAT    = "L L q$DEV_MAXPARAMS q l L Q";
+my $DEV_NOMIGRATE = 0x1;
+
+# CPU mask and flags every command is run with. See devaffinity
+my $cmd_cpus  = 0;
+my $cmd_flags = 0;
+
+##
+# ioc - Return the number of a read/write ioctl on the device
+# @nr: Number of the ioctl
+# @size: Size of the structure passed
+#
+# This is _IOWR as it is on x86, x86_64, ia64 and arm. Other architectures
+# lay out ioctl numbers differently
+sub ioc {
+	my ($nr, $size) = @_;
+	return (3 << 30) | ($size << 16) | (ord('V') << 8) | $nr;
+}
+
+my $IOC_LOOKUP = ioc(1, $LOOKUP_SIZE);
+my $IOC_BATCH  = ioc(2, $BATCH_SIZE);
+
+##
+# devopen - Open /dev/vmregress
+#
+# Returns true if the device could be opened. Callers should fall back
+# to writeproc if it could not
+sub devopen {
+	return 0 if (! -c $DEV_PATH);
+	return open(VMRDEV, "+<", $DEV_PATH);
+}
+
+##
+# devclose - Close /dev/vmregress
+sub devclose {
+	close VMRDEV;
+}
+
+##
+# devlookup - Return the id of a proc entry to pass to devbatch
+# @name: Name of the proc entry such as mapanon_open
+sub devlookup {
+	my $name = shift;
+	my $lookup = pack("Z40 L L", $name, 0, 0);
+
+	ioctl(VMRDEV, $IOC_LOOKUP, $lookup) or die("Failed to look up $name: $!");
+	return (unpack("Z40 L L", $lookup))[1];
+}
+
+##
+# devaffinity - Set the CPUs every following command runs on
+# @cpus: Mask of the first 64 CPUs or 0 for any CPU
+# @nomigrate: If true, commands run on one of the CPUs and never migrate
+sub devaffinity {
+	my ($cpus, $nomigrate) = @_;
+	$cmd_cpus = $cpus;
+	$cmd_flags = $nomigrate ? $DEV_NOMIGRATE : 0;
+}
+
+##
+# devbatch - Run a batch of commands
+# @cmds: List of references to arrays of an id followed by its parameters
+#
+# Returns a list of the value each test returned
+sub devbatch {
+	my @cmds = @_;
+	my ($cmdbuf, $batch, $cmd, $done);
+	my @results;
+
+	foreach $cmd (@cmds) {
+		my ($id, @params) = @$cmd;
+		my $argc = scalar(@params);
+
+		die("Too many parameters for a command") if ($argc > $DEV_MAXPARAMS);
+		push @params, 0 while (scalar(@params) < $DEV_MAXPARAMS);
+		$cmdbuf .= pack($CMD_FORMAT, $id, $argc, @params, 0, 0,
+				$cmd_flags, $cmd_cpus);
+	}
+
+	# The kernel writes the results straight back into $cmdbuf
+	$batch = pack("Q L L", unpack("L!", pack("p", $cmdbuf)), scalar(@cmds), 0);
+	ioctl(VMRDEV, $IOC_BATCH, $batch) or die("Batch failed: $!");
+	$done = (unpack("Q L L", $batch))[2];
+
+	for (my $i = 0; $i <= $done && $i < scalar(@cmds); $i++) {
+		my @values = unpack("x" . ($i * $CMD_SIZE) . " $CMD_FORMAT", $cmdbuf);
+		if ($i == $done) {
+			die("Command $i of batch could not run: error " .
+				$values[$DEV_MAXPARAMS + 3]);
+		}
+		push @results, $values[$DEV_MAXPARAMS + 2];
+	}
+
+	return @results;
+}
+
+##
+# devrun - Run one command
+# @id: Id from devlookup
+# @params: Parameters to pass to the test
+#
+# Returns the value the test returned
+sub devrun {
+	my ($id, @params) = @_;
+	return (devbatch([ $id, @params ]))[0];
+}
+
+1;
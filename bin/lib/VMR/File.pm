@@ -10,7 +10,7 @@ use vars qw (@ISA @EXPORT);
 use strict;
 
 @ISA    = qw(Exporter);
-@EXPORT = qw(&mktempname &readproc &writeproc);
+@EXPORT = qw(&mktempname &readproc &mapproc &waitproc &writeproc);
 
 ##
 # mktempname - Make a temporary filename
@@ -66,6 +66,109 @@ sub readproc {
 	return $proc;
 }
 
+##
+#  mapheader - Take a snapshot of the header of a mapped proc entry
+#  @map: The mapping
+#
+#  The header is retried while the sequence count shows the kernel is
+#  updating it. Returns magic, page size, generation, written and size
+
+sub mapheader {
+	my $map = shift;
+	my ($magic, $pagesize, $seq, $check, @fields);
+
+	do {
+		($magic, $pagesize, $seq, undef, @fields) =
+			unpack("L L L L Q Q Q", $map);
+		(undef, undef, $check) = unpack("L L L", $map);
+	} while (($seq & 1) || $seq != $check);
+
+	return ($magic, $pagesize, @fields);
+}
+
+##
+#  mapproc - Read a proc entry through a read-only memory mapping
+#  @procentry: Name of the proc entry to map
+#
+#  Returns the same output as readproc but the output is taken straight
+#  from a mapping of the proc buffer instead of being copied out a read()
+#  at a time. See include/vmr_mmap.h for the layout of the mapping. The
+#  output can be taken while a test is still running. If the Sys::Mmap
+#  module is not installed, readproc is used instead
+
+sub mapproc {
+	my $procentry = shift;
+	my ($header, $map);
+	my ($magic, $pagesize, $generation, $written, $size, $check);
+	my $proc="";
+	my $tries;
+
+	eval { require Sys::Mmap; };
+	if ($@) {
+		return readproc($procentry);
+	}
+
+	if (! -e $procentry && $procentry !~ /^\//) {
+		$procentry = "/proc/vmregress/$procentry";
+	}
+
+	open(PROC, $procentry) or die("Failed to open $procentry for reading");
+	for ($tries = 0; $tries < 100; $tries++) {
+		# Map the header to find out how much output there is
+		Sys::Mmap::mmap($header, 4096, Sys::Mmap::PROT_READ(), 
+				Sys::Mmap::MAP_SHARED(), *PROC, 0) 
+			or die("Failed to mmap $procentry");
+		($magic, $pagesize, $generation, $written, $size) =
+			mapheader($header);
+		Sys::Mmap::munmap($header);
+		if ($magic != 0x31524d56) {
+			die("$procentry does not have a VM Regress buffer header");
+		}
+
+		# Map the header and all output pages
+		Sys::Mmap::mmap($map, $pagesize + $size, Sys::Mmap::PROT_READ(),
+				Sys::Mmap::MAP_SHARED(), *PROC, 0)
+			or die("Failed to mmap $procentry");
+		$proc = substr($map, $pagesize, $written);
+		(undef, undef, $check) = mapheader($map);
+		Sys::Mmap::munmap($map);
+
+		# The output is only valid if a new test did not start
+		last if ($check == $generation);
+	}
+	close PROC;
+
+	return $proc;
+}
+
+##
+#  waitproc - Sleep until a test writing to a proc entry completes
+#  @procentry: Name of the proc entry to wait on
+#  @timeout: Seconds to wait for. If not provided, wait forever
+#
+#  The proc entry is polled with select() which sleeps until the next time
+#  a test closes the proc buffer. Only tests that finish after waitproc is
+#  called are waited for so it is meant to be called while a test started
+#  in the background is still running. Returns 1 if the test completed or
+#  0 if the timeout expired
+
+sub waitproc {
+	my ($procentry, $timeout) = @_;
+	my ($rin, $rout, $found);
+
+	if (! -e $procentry && $procentry !~ /^\//) {
+		$procentry = "/proc/vmregress/$procentry";
+	}
+
+	open(WAITPROC, $procentry) or die("Failed to open $procentry for polling");
+	$rin = '';
+	vec($rin, fileno(WAITPROC), 1) = 1;
+	$found = select($rout = $rin, undef, undef, $timeout);
+	close WAITPROC;
+
+	return $found > 0 ? 1 : 0;
+}
+
 ##
 #  writeproc - Write to a proc entry
 #  @procentry; Name of the proc entry to write
@@ -12,7 +12,15 @@ use vars qw(@ISA @EXPORT);
 use strict;
 
 @ISA    = qw(Exporter);
-@EXPORT = qw(&decodemap &findmap &stripmap);
+@EXPORT = qw(&decodemap &decodestate &pagestate &findmap &stripmap);
+
+# Names of the states of a page in maps with 2 bits per page
+my @STATE2 = ("none", "gone", "present", "dirty");
+
+# Names of what maps a page in maps with 4 bits per page, indexed by the
+# upper 2 bits. Present pages may also be young and dirty
+my @KIND4 = ("", "anon", "file", "huge");
+my @GONE4 = ("none", "swapped", "filepte", "unknown");
 
 ##
 # decodemap - Decode the map provided by the pagemap module
@@ -61,12 +69,63 @@ sub decodemap {
 	return $decode;
 }
 
+##
+# pagestate - Name the state of a page from a map with 2 or 4 bits a page
+# @state: The bits of state of the page
+# @bits: Bits per page, 2 or 4
+#
+# A present page in a 4 bit map is named for what maps it, anon, file or
+# huge, followed by ",young" and ",dirty" if they are set
+sub pagestate {
+	my ($state, $bits) = @_;
+	my $name;
+
+	return $STATE2[$state & 3] if ($bits == 2);
+
+	return $GONE4[$state & 3] if (($state >> 2) == 0);
+	$name = $KIND4[$state >> 2];
+	$name .= ",young" if ($state & 1);
+	$name .= ",dirty" if ($state & 2);
+	return $name;
+}
+
+##
+# decodestate - Decode a map with 2 or 4 bits of state for every page
+# @map: String provided by pagemap
+# @bits: Bits per page from the BITS of the map header
+#
+# Returns a set of lines, each containing the page offset and the name of
+# its state as given by pagestate. Each character holds 4 bits, the
+# lowest for the first page
+sub decodestate {
+	my ($map, $bits) = @_;
+	my $decode="";	# Decoded string
+	my $perchar = 4 / $bits;
+	my $mask = (1 << $bits) - 1;
+	my ($index, $page, $char);
+
+	for ($index = 0; $index < length($map); $index++) {
+		$char = ord(substr($map, $index, 1));
+		last if ($char == ord("\n"));
+		for ($page = 0; $page < $perchar; $page++) {
+			$decode .= ($index * $perchar + $page) . " " .
+				pagestate(($char >> ($page * $bits)) & $mask, $bits) .
+				"\n";
+		}
+	}
+
+	return $decode;
+}
+
 ##
 # findmap - Find a map belonging to a particular address and decode it
 # @proc: The full output from the proc entry
 # @addr: The address of interest
 # @mark: Used by decodemap
 #
+# Maps with more than 1 bit a page, with BITS in the header, are decoded
+# by decodestate instead
+#
 # If no addr is provided, the first map occured is decoded and returned
 # to the caller. It returns in order
 #
@@ -87,6 +146,8 @@ sub findmap {
 
 	my $decode;		# Decoded map
 
+	my $bits=1;		# Bits of state a page
+
 	my $found=0;		# 0 normal
 				# 1 found map
 				# 2 end map
@@ -118,7 +179,11 @@ sub findmap {
 			
 		# If the map was found, decode it
 		if ($found == 1) {
-			$decode = decodemap($line, $mark);
+			if ($bits == 1) {
+				$decode = decodemap($line, $mark);
+			} else {
+				$decode = decodestate($line, $bits);
+			}
 			$found=2;
 		}
 
@@ -126,7 +191,8 @@ sub findmap {
 		if ($line =~ /^BEGIN PAGE MAP/) {
 			$range = substr($line, 15);
 
-			($start, $dummy, $end) = split(/ /, $range);
+			($start, $dummy, $end, $dummy, $bits) = split(/ /, $range);
+			$bits = 1 if (!defined $bits);
 			$istart = int $start;
 			$iend   = int $end;
 
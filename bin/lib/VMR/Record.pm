@@ -0,0 +1,138 @@
+#
+# Record.pm
+#
+# This is the reference decoder for the binary record output of a VM
+# Regress proc entry. A module loaded with vmr_binary=1 writes a stream of
+# records instead of text. See include/vmr_record.h for the format
+#
+package VMR::Record;
+require Exporter;
+use vars qw(@ISA @EXPORT);
+use strict;
+
+@ISA    = qw(Exporter);
+@EXPORT = qw(&isrecords &decoderecords &recordvalues);
+
+my $RECORD_MAGIC = 0x42524d56;
+my $REC_STREAM   = 1;
+my $REC_SCHEMA   = 2;
+my $REC_DATA     = 3;
+my $REC_TEXT     = 4;
+my $REC_MAP      = 5;
+my $FIELD_S64    = 2;
+
+##
+# byteorder - Return the pack modifier for the byte order of a stream
+# @data: Output read from a proc entry
+#
+# The magic of the stream record is read in both byte orders. Returns
+# undef if the output is not a stream of records
+sub byteorder {
+	my $data = shift;
+
+	return undef if (length($data) < 12);
+	return "<" if (unpack("x8 L<", $data) == $RECORD_MAGIC);
+	return ">" if (unpack("x8 L>", $data) == $RECORD_MAGIC);
+	return undef;
+}
+
+##
+# isrecords - Return true if output is binary records rather than text
+# @data: Output read from a proc entry
+sub isrecords {
+	my $data = shift;
+	return defined byteorder($data);
+}
+
+##
+# decoderecords - Decode every record of a stream
+# @data: Output read from a proc entry
+# @callback: Function called with a hash reference for every record
+#
+# The hash passed to the callback has a type key which is one of stream,
+# data, text or map. A stream record has name, the name of the proc
+# entry. A data record has schema, the schema name, fields, a reference
+# to an array of field names and values, a reference to an array of the
+# values. A text record has text and a map record has map, the page map
+# as printed by vmr_printmap. Schema records are consumed by the decoder.
+# Returns the number of records decoded. A truncated last record is
+# ignored
+sub decoderecords {
+	my ($data, $callback) = @_;
+	my $e = byteorder($data);
+	my $offset = 0;
+	my $length = length($data);
+	my %schemas;
+	my $count = 0;
+	my ($type, $id, $len, $payload);
+
+	if (!defined $e) {
+		die("Output is not a stream of VM Regress records");
+	}
+
+	while ($offset + 8 <= $length) {
+		($type, $id, $len) = unpack("S$e S$e L$e", substr($data, $offset, 8));
+		last if ($offset + 8 + $len > $length);
+		$payload = substr($data, $offset + 8, $len);
+		$offset += 8 + (($len + 7) & ~7);
+		$count++;
+
+		if ($type == $REC_SCHEMA) {
+			my ($nr_fields, $name) = unpack("S$e x2 Z28", $payload);
+			my (@fields, $template, $i);
+			for ($i = 0; $i < $nr_fields; $i++) {
+				my ($ftype, $fname) = unpack("S$e Z30",
+						substr($payload, 32 + $i * 32, 32));
+				push @fields, $fname;
+				$template .= ($ftype == $FIELD_S64) ? "q$e" : "Q$e";
+			}
+			$schemas{$id} = { "name"     => $name,
+					  "fields"   => \@fields,
+					  "template" => $template };
+			next;
+		}
+
+		if ($type == $REC_DATA) {
+			my $schema = $schemas{$id};
+			die("Data record uses undefined schema $id") if (!$schema);
+			my @values = unpack($$schema{"template"}, $payload);
+			&$callback({ "type"   => "data",
+				     "schema" => $$schema{"name"},
+				     "fields" => $$schema{"fields"},
+				     "values" => \@values });
+		} elsif ($type == $REC_STREAM) {
+			my (undef, undef, $name) = unpack("L$e L$e Z40", $payload);
+			&$callback({ "type" => "stream", "name" => $name });
+		} elsif ($type == $REC_TEXT) {
+			&$callback({ "type" => "text", "text" => $payload });
+		} elsif ($type == $REC_MAP) {
+			&$callback({ "type" => "map", "map" => $payload });
+		}
+	}
+
+	return $count;
+}
+
+##
+# recordvalues - Return the values of every data record of one schema
+# @data: Output read from a proc entry
+# @schema: Name of the schema
+#
+# Returns a list of hash references mapping field names to values
+sub recordvalues {
+	my ($data, $schema) = @_;
+	my @records;
+
+	decoderecords($data, sub {
+		my $record = shift;
+		my %values;
+
+		return if ($$record{"type"} ne "data" || $$record{"schema"} ne $schema);
+		@values{@{$$record{"fields"}}} = @{$$record{"values"}};
+		push @records, \%values;
+	});
+
+	return @records;
+}
+
+1;
@@ -1,30 +1,161 @@
 /**
  * nanotime.h
- * 
+ *
  * Support for high-resolution timers
- * TODO: This is x86 specific, make it architecture independant
+ *
+ * vmr_clock_ns() returns a monotonic time in nanoseconds that every test
+ * should use to time operations so results can be compared between
+ * machines and architectures. On x86, it reads the TSC and converts it
+ * with a multiplier calibrated for each CPU when vmregress_core is loaded.
+ * The calibration also records the monotonic time at a known TSC value
+ * so the times read on different CPUs are comparable. Elsewhere, and on
+ * any CPU that was not online at calibration, it is the monotonic clock
+ * which is as fine-grained as the architecture allows.
+ *
+ * Reload vmregress_core after changing the CPU frequency as the TSC rate
+ * changes with it on most processors of this age.
+ *
+ * read_clockcycles() is still available for a raw cycle count but values
+ * from it are only meaningful on the CPU and machine they were read on
+ *
+ * See core/vmregress_core.c
  */
 #ifndef __NANOTIME_H
 #define __NANOTIME_H
 
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,16)
+#include <linux/hrtimer.h>
+#endif
+#include <asm/div64.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#endif
+
+/* ns = cycles * mult >> VMR_CLOCK_SHIFT */
+#define VMR_CLOCK_SHIFT 22
+
+/* How long to calibrate each CPU for */
+#define VMR_CLOCK_CALIBRATE_MS 10
+
+struct vmr_clock {
+	unsigned long long base_cycles;	/* Cycles at calibration */
+	unsigned long long base_ns;	/* Monotonic ns at base_cycles */
+	unsigned long mult;		/* 0 if the CPU is not calibrated */
+};
+
+extern struct vmr_clock vmr_clock[NR_CPUS];
+
+/**
+ * vmr_monotonic_ns - Read the monotonic clock in nanoseconds
+ *
+ * Before 2.6.16 there is no monotonic clock to read so the time of day
+ * is used. It is only fine-grained to a microsecond
+ */
+static inline unsigned long long vmr_monotonic_ns(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,16)
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#else
+	struct timeval tv;
+
+	do_gettimeofday(&tv);
+	return (unsigned long long)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
 #ifdef CONFIG_X86
 /**
- * rdtsc: Read the current number of clock cycles that have passed
+ * read_clockcycles: Read the current number of clock cycles that have passed
  */
-inline unsigned long long read_clockcycles(void)
+static inline unsigned long long read_clockcycles(void)
 {
 	unsigned long low_time, high_time;
-	asm volatile( 
-		"rdtsc \n\t" 
+	asm volatile(
+		"rdtsc \n\t"
 			: "=a" (low_time),
 			  "=d" (high_time));
         return ((unsigned long long)high_time << 32) | (low_time);
 }
+
+/**
+ * read_clockcycles_sync - Read the cycle count after earlier instructions
+ *
+ * rdtsc may execute before instructions preceding it have completed which
+ * would charge part of the timed operation to the one before it. lfence
+ * waits for them and costs far less than cpuid, which traps under a
+ * hypervisor. Processors without SSE2 have no lfence and use cpuid
+ */
+static inline unsigned long long read_clockcycles_sync(void)
+{
+	unsigned int eax = 0, ebx, ecx, edx;
+
+	if (likely(boot_cpu_has(X86_FEATURE_XMM2))) {
+		asm volatile("lfence" : : : "memory");
+	} else {
+		asm volatile("cpuid"
+				: "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+				:
+				: "memory");
+	}
+	return read_clockcycles();
+}
+
+/**
+ * vmr_clock_ns - Read the time in nanoseconds
+ */
+static inline unsigned long long vmr_clock_ns(void)
+{
+	struct vmr_clock *clock;
+	unsigned long long cycles;
+	unsigned long long ns;
+
+	clock = &vmr_clock[get_cpu()];
+	if (unlikely(!clock->mult)) {
+		put_cpu();
+		return vmr_monotonic_ns();
+	}
+
+	/* Split the multiply so it does not overflow */
+	cycles = read_clockcycles_sync() - clock->base_cycles;
+	ns = clock->base_ns +
+		(cycles >> VMR_CLOCK_SHIFT) * clock->mult +
+		(((cycles & ((1ULL << VMR_CLOCK_SHIFT) - 1)) * clock->mult) >>
+			VMR_CLOCK_SHIFT);
+	put_cpu();
+
+	return ns;
+}
 #else
-#warning read_clockcycles not implemented for this arch
-inline unsigned long long read_clockcycles(void)
+/* Without a known cycle counter, the monotonic clock is used instead */
+static inline unsigned long long vmr_clock_ns(void)
 {
-	return jiffies;
+	return vmr_monotonic_ns();
 }
+
+static inline unsigned long long read_clockcycles(void)
+{
+	return vmr_monotonic_ns();
+}
+
+#define read_clockcycles_sync() read_clockcycles()
 #endif /* CONFIG_X86 */
+
+/**
+ * vmr_clock_ms - Milliseconds since a vmr_clock_ns() time for printing
+ * @start: The time to measure from
+ *
+ * do_div is used as 32 bit architectures cannot divide a 64 bit value
+ */
+static inline unsigned long vmr_clock_ms(unsigned long long start)
+{
+	unsigned long long ns = vmr_clock_ns() - start;
+
+	do_div(ns, 1000000);
+	return (unsigned long)ns;
+}
+
 #endif /* __NANOTIME_H */
@@ -8,9 +8,37 @@
 #ifndef __PAGETABLE_H_
 #define __PAGETABLE_H_
 
+/* Pin and read lock the mm of a process, 0 for current, to walk it */
+struct mm_struct *vmr_mm_get(pid_t pid);
+void vmr_mm_put(struct mm_struct *mm);
+
 /* Return a struct page for an addr */
+struct page *get_struct_page_mm(struct mm_struct *mm, unsigned long addr);
 struct page *get_struct_page(unsigned long addr);
 
+/*
+ * For all pte tables within the given range, call func() passing it a copy
+ * of nr ptes starting at addr, the bytes each maps and data. A huge page is
+ * passed alone with a size larger than PAGE_SIZE
+ */
+unsigned long forall_ptes_mm(struct mm_struct *mm, unsigned long addr,
+			unsigned long len, unsigned long *sched_count,
+			void *data,
+			unsigned long (*func)(pte_t *ptes, int nr,
+				unsigned long addr, unsigned long size,
+				void *data));
+
+/*
+ * forall_ptes_mm split across workers CPUs. func() is called from many
+ * threads at once and must not touch the pages
+ */
+unsigned long forall_ptes_mm_parallel(struct mm_struct *mm, unsigned long addr,
+			unsigned long len, unsigned long *sched_count,
+			int workers, void *data,
+			unsigned long (*func)(pte_t *ptes, int nr,
+				unsigned long addr, unsigned long size,
+				void *data));
+
 /* For all pte's within the given range, call func() passing it data */
 unsigned long forall_pte_mm(struct mm_struct *mm, unsigned long addr,
 			unsigned long len, unsigned long *sched_count,
@@ -21,6 +49,35 @@ unsigned long forall_pte_mm(struct mm_struct *mm, unsigned long addr,
 unsigned long countpages_mm(struct mm_struct *mm, unsigned long addr, 
 		unsigned long len, unsigned long *sched_count);
 
+/*
+ * Page map formats, the bits of state of every page. Every character of
+ * a map holds 4 bits, the lowest for the first page, with 0x30 added
+ *
+ * VMR_MAP_PRESENT  1 bit, set if the page is present
+ * VMR_MAP_STATE2   2 bits, VMR_PAGE2_*
+ * VMR_MAP_STATE4   4 bits, VMR_PAGE_* for what maps the page and
+ *                  VMR_PAGE_YOUNG and VMR_PAGE_DIRTY for present pages
+ *
+ * bin/lib/VMR/Pagemap.pm decodes them
+ */
+#define VMR_MAP_PRESENT		1
+#define VMR_MAP_STATE2		2
+#define VMR_MAP_STATE4		4
+
+#define VMR_PAGE2_NONE		0	/* Never touched or discarded */
+#define VMR_PAGE2_GONE		1	/* Swapped or in a file, not present */
+#define VMR_PAGE2_PRESENT	2	/* Present and clean */
+#define VMR_PAGE2_DIRTY		3	/* Present and dirty */
+
+#define VMR_PAGE_NONE		0x0	/* Never touched or discarded */
+#define VMR_PAGE_SWAPPED	0x1	/* Not present, in swap */
+#define VMR_PAGE_FILEPTE	0x2	/* Not present, in a nonlinear file */
+#define VMR_PAGE_ANON		0x4	/* Present anonymous page */
+#define VMR_PAGE_FILE		0x8	/* Present page cache page */
+#define VMR_PAGE_HUGE		0xc	/* Present part of a huge page */
+#define VMR_PAGE_YOUNG		0x1	/* Present and referenced */
+#define VMR_PAGE_DIRTY		0x2	/* Present and dirty */
+
 /*
  * Print out a map showing present/swapped pages in range. Needs to have the
  * testinfo struct passed in as data
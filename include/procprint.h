@@ -15,8 +15,43 @@ void vmrproc_freebuffer(vmr_desc_t *testinfo);
 int  vmrproc_allocbuffer(unsigned int pages, vmr_desc_t *testinfo);
 int  vmrproc_growbuffer(unsigned int pages, vmr_desc_t *testinfo);
 
-/* Tests to make sure buffers exist */
-#define vmrproc_checkbuffer(x) !(x.procbuf) || x.procbuf_size == 0
+/* Appending to and reading back from proc buffers */
+int  vmrproc_printf(vmr_desc_t *testinfo, const char *format, ...)
+		__attribute__ ((format (printf, 2, 3)));
+long vmrproc_write(vmr_desc_t *testinfo, const char *data, unsigned long len);
+long vmrproc_fill(vmr_desc_t *testinfo, int c, unsigned long len);
+char *vmrproc_bufaddr(vmr_desc_t *testinfo, unsigned long offset);
+char *__vmrproc_bufaddr(vmr_desc_t *testinfo, struct vmr_cursor *cursor,
+		unsigned long offset);
+long vmrproc_copyout(vmr_desc_t *testinfo, unsigned long offset,
+		char *buf, unsigned long count);
+unsigned long vmrproc_length(vmr_desc_t *testinfo);
+void vmrproc_newgeneration(vmr_desc_t *testinfo);
+
+/* Binary records, see vmr_record.h */
+void vmrproc_startstream(vmr_desc_t *testinfo);
+long vmrproc_beginrecord(vmr_desc_t *testinfo, int type, int id,
+		unsigned long length);
+long vmrproc_endrecord(vmr_desc_t *testinfo, unsigned long length);
+int  vmrproc_record(vmr_desc_t *testinfo, struct vmr_schema *schema,
+		unsigned long long *values);
+#define vmrproc_binary(testinfo) ((testinfo)->flags & VMR_BINARY)
+
+/* Streaming file operations shared by every proc entry, see proc.c */
+int     vmrproc_file_open(struct inode *inode, struct file *file);
+int     vmrproc_file_release(struct inode *inode, struct file *file);
+ssize_t vmrproc_file_read(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos);
+ssize_t vmrproc_file_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos);
+loff_t  vmrproc_file_llseek(struct file *file, loff_t offset, int whence);
+int     vmrproc_file_mmap(struct file *file, struct vm_area_struct *vma);
+unsigned int vmrproc_file_poll(struct file *file, poll_table *wait);
+#define vmrproc_file_desc(file) \
+	container_of((int *)PDE((file)->f_dentry->d_inode)->data, vmr_desc_t, procentry)
+
+/* Tests to make sure buffers exist. Pages are only taken on the first write */
+#define vmrproc_checkbuffer(x) (!(x).reserve)
 
 /**
  * vmrproc_openbuffer - Attempts to acquire a buffer and clears it
@@ -24,58 +59,98 @@ int  vmrproc_growbuffer(unsigned int pages, vmr_desc_t *testinfo);
  *
  * When a test begins, this function is called. The lock is acquired and
  * the PID examined. If the PID is 0, there is no writers so this process
- * gets it and is allowed to write. Callers should use vmrproc_closebuffer
- * to ensure the proc buffer is freed
+ * gets it and is allowed to write. If there is a writer and VMR_WAITPROC
+ * is set, the caller sleeps until the writer closes the buffer. Callers
+ * should use vmrproc_closebuffer to ensure the proc buffer is freed. If
+ * the caller is running a script with VMR_SCRIPT set, it already has the
+ * buffer and the output is appended
  */
 inline int vmrproc_openbuffer(vmr_desc_t *testinfo) {
-	unsigned long limit = jiffies;
+	long timeout = 5 * HZ;
 
 	spin_lock(&testinfo->lock);
-tryagain:
-	if (testinfo->pid == 0) { 
-		/* We are the new writer */
-		testinfo->pid = current->pid;
-		testinfo->written = 0;
-		if (testinfo->procbuf) {
-			memset(testinfo->procbuf, 0, testinfo->procbuf_size);
-		}
-
+	if (testinfo->pid == current->pid && (testinfo->flags & VMR_SCRIPT)) {
 		spin_unlock(&testinfo->lock);
 		return 1;
 	}
+	while (testinfo->pid != 0) {
+		/* We failed to get access */
+		if (!(testinfo->flags & VMR_WAITPROC)) {
+			spin_unlock(&testinfo->lock);
+			printk("Cannot acquire buffer to print with\n");
+			return 0;
+		}
 
-	/* We failed to get access */
-	if (testinfo->flags & VMR_WAITPROC) {
-		/* Schedule to give the user a chance to free */
+		/* Sleep until the writer closes the buffer */
 		spin_unlock(&testinfo->lock);
-		__set_current_state(TASK_RUNNING);
-		schedule();
+		timeout = wait_event_interruptible_timeout(testinfo->wait,
+				testinfo->pid == 0, timeout);
+		if (timeout <= 0) {
+			if (timeout == 0)
+				printk("Waited 5 seconds for buffer\n");
+			printk("Cannot acquire buffer to print with\n");
+			return 0;
+		}
 		spin_lock(&testinfo->lock);
-
-		/* Check the time. Don't wait more than 5 seconds */
-		if ((jiffies - limit) / HZ <= 5) goto tryagain;
-
-		printk("Waited 5 seconds for buffer\n");
 	}
 
-	printk("Cannot acquire buffer to print with\n");
+	/* We are the new writer */
+	testinfo->pid = current->pid;
+	testinfo->cpu = raw_smp_processor_id();
+	testinfo->written = 0;
+	testinfo->opened++;
+	testinfo->chunk_tail = testinfo->chunks;
+	testinfo->seek.chunk = NULL;
+	vmrproc_newgeneration(testinfo);
 
 	spin_unlock(&testinfo->lock);
-	return 0;
+	vmrproc_startstream(testinfo);
+	if (testinfo->flags & VMR_OVERHEAD)
+		vmr_overhead_start(testinfo);
+	vmr_counters_start(testinfo, &testinfo->counters);
+	vmr_lockstat_start(testinfo);
+	vmr_sampler_open(testinfo);
+	return 1;
 }
 		
 /**
  * vmrproc_closebuffer - Close access to a proc buffer
  * @testinfo: The test descriptor
+ *
+ * Anyone waiting for the buffer in vmrproc_openbuffer or polling the
+ * proc entry for the results is woken up. The writer of a script keeps
+ * the buffer until the script is finished. With VMR_OVERHEAD, the time
+ * spent in instrumentation is printed before the buffer is released,
+ * with VMR_COUNTERS, the event counters of the whole test and with
+ * VMR_LOCKSTAT, the lock contention seen while the test ran. A writer
+ * whose command chose its CPUs prints the CPUs it ran on. A test with a
+ * sampler rate prints the samples taken while it ran
  */
 inline int __vmrproc_closebuffer(vmr_desc_t *testinfo, int force) {
+	if (force == 0 && (testinfo->flags & VMR_SCRIPT) &&
+	    testinfo->pid == current->pid)
+		return 1;
+
+	if ((testinfo->flags & VMR_OVERHEAD) && testinfo->pid == current->pid)
+		vmr_overhead_print(testinfo);
+	if (testinfo->pid == current->pid) {
+		vmr_counters_stop(testinfo, &testinfo->counters);
+		vmr_counters_print(testinfo, &testinfo->counters, -1);
+		if (testinfo->affinity)
+			vmr_affinity_print(testinfo);
+	}
+
 	if (force == 1 ||
 	    testinfo->pid == current->pid || 
 	    (testinfo->written < -1 && -testinfo->written == current->pid)) {
 
+		vmr_lockstat_stop(testinfo);
+		vmr_sampler_close(testinfo);
 		spin_lock(&testinfo->lock);
 		testinfo->pid = 0;
+		testinfo->completed++;
 		spin_unlock(&testinfo->lock);
+		wake_up_interruptible_all(&testinfo->wait);
 
 		return 1;
 	}
@@ -101,35 +176,39 @@ inline int __vmrproc_closebuffer(vmr_desc_t *testinfo, int force) {
 /* Simple printk wrapper */
 #define vmr_printk(x,args...)      printk("<1>" MODULENAME ": " x, ## args)
 
-/* Wrapper for sprintf to check for buffer overruns */
-#define vmr_snprintf(info, x,y,args...) \
-	if (current->pid == info->pid) { \
-		*print_written += snprintf(x, y, ## args); \
-		if (*print_written >= print_size) { \
-			vmr_printk("Proc buffer filled!!! Disabling\n"); \
-			*print_written= -(info->pid); \
-		} \
+/*
+ * Wrapper for vmrproc_printf to check the caller is the writer. The buffer
+ * grows a page at a time as needed. If it cannot grow, written is set
+ * to -pid and further printing is disabled until the buffer is reopened
+ */
+#define vmr_snprintf(info, format, args...) \
+	if (current->pid == (info)->pid && (info)->written >= 0) { \
+		vmrproc_printf(info, format, ## args); \
 	}
 
 /* 
- * Print to a procentry. It is presumed the local proc buffer array is
- * called procbuf and it's size is procbuf_size
+ * Print to a procentry. The testinfo array must be in scope
  */
-#define printp_entry(procentry, format, args...) if (testinfo[procentry].written >= 0) { \
-	char  *print_buf = testinfo[procentry].procbuf + testinfo[procentry].written; \
-	size_t print_len = testinfo[procentry].procbuf_size - testinfo[procentry].written - 128; \
-	size_t print_size = testinfo[procentry].procbuf_size; \
-	int *print_written = &testinfo[procentry].written; \
-	                        \
-	vmr_snprintf((&testinfo[procentry]),  \
-		     print_buf, \
-		     print_len, \
-		     format,    \
-		     ## args);  \
-}
+#define printp_entry(procentry, format, args...) \
+	vmr_snprintf((&testinfo[procentry]), format, ## args)
 
 #define printp(format, args...) printp_entry(procentry, format, ## args)
 
+/*
+ * Print a data record. Every value is passed as an unsigned long long.
+ * Without VMR_BINARY the record is printed as a line of name=value pairs
+ */
+#define vmr_record(info, schema, args...) \
+	if (current->pid == (info)->pid && (info)->written >= 0) { \
+		unsigned long long __vmr_values[VMR_RECORD_MAXFIELDS] = { args }; \
+		vmrproc_record(info, schema, __vmr_values); \
+	}
+
+#define printp_record_entry(procentry, schema, args...) \
+	vmr_record((&testinfo[procentry]), schema, ## args)
+
+#define printp_record(schema, args...) printp_record_entry(procentry, schema, ## args)
+
 int printp_buddyinfo(vmr_desc_t *testinfo, int procentry,
 						int attempt, int success);
 #endif
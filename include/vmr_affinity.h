@@ -0,0 +1,46 @@
+/*
+ * vmr_affinity.h
+ *
+ * CPU affinity of a test. A test runs on whichever CPU the writer is on
+ * and may migrate while it runs which adds noise to cycle counts and
+ * mixes the per-cpu page lists of several CPUs. Every command written to
+ * a proc entry accepts two parameters of its own besides those of the
+ * test
+ *
+ *   cpus=0-3,8   Run only on these CPUs, a list as in /proc/irq
+ *   nomigrate=1  Run on one CPU of cpus, the current one if it is
+ *                allowed, and never migrate
+ *
+ * such as "cpus=2 passes=1 pages=100" or "& cpus=0-3 nomigrate=1 10". The
+ * writer is moved before the test starts and returned to the CPUs it was
+ * allowed before when it finishes. A job is started from the moved writer
+ * so its thread inherits the CPUs. Commands from /dev/vmregress give the
+ * CPUs as a mask in cpus and VMR_DEV_NOMIGRATE in flags. See vmr_dev.h
+ *
+ * When a command chose its CPUs, the CPU the test opened its buffer on,
+ * the CPU it closed it on and the CPUs it was allowed are printed when
+ * the buffer is closed so results can be compared CPU by CPU. Tests run
+ * on any CPU print nothing more than before
+ *
+ * See core/vmregress_core.c
+ */
+#ifndef __VMR_AFFINITY_H_
+#define __VMR_AFFINITY_H_
+
+#include <linux/cpumask.h>
+
+struct vmr_affinity {
+	cpumask_t cpus;		/* CPUs the test may run on */
+	int nomigrate;		/* Run on one CPU of cpus */
+};
+
+struct vmr_desc;
+
+void vmr_affinity_init(struct vmr_affinity *aff);
+int  vmr_affinity_parse(struct vmr_affinity *aff, char *name, char *value);
+int  vmr_affinity_enter(struct vmr_desc *desc, struct vmr_affinity *aff,
+		cpumask_t *saved);
+void vmr_affinity_leave(cpumask_t *saved);
+void vmr_affinity_print(struct vmr_desc *desc);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * vmr_counters.h
+ *
+ * Event counters read around a test and around each pass of the alloc,
+ * fault, highalloc and mmap tests so a slower pass can be explained by
+ * more TLB misses, cache misses or faults rather than only noticed. When
+ * a module is loaded with vmr_counters=1, VMR_COUNTERS is set on its
+ * entries and a counters record is printed after the timing of every pass
+ * and when the buffer is closed with pass -1 for the whole test
+ *
+ *   vmr_counters_start(&testinfo[procentry], &ctr);
+ *   ...
+ *   vmr_counters_stop(&testinfo[procentry], &ctr);
+ *   ...
+ *   vmr_counters_print(&testinfo[procentry], &ctr, pass);
+ *
+ * Printing happens after the stop so the counters do not include it
+ *
+ * The kernel has no performance counter interface so the counters come
+ * from
+ *
+ *   cycles       The TSC on x86, the monotonic clock in ns elsewhere
+ *   instructions Retired instructions           } Intel architectural
+ *   dtlb         Data TLB misses                } PMU, only when
+ *   llc          Last level cache misses        } vmr_pmu=1
+ *   faults       Minor faults of the test thread
+ *   majfaults    Major faults of the test thread
+ *   cswitch      Context switches of the test thread
+ *   oncpu        ns the test thread ran, from its user and system time
+ *   offcpu       ns the test thread did not run. With oncpu, the wall
+ *                time of the pass
+ *   preempted    ns of offcpu it was runnable but waiting for a CPU.
+ *                This is the run_delay of the scheduler so it includes
+ *                the wait for a CPU after every wakeup, not only the
+ *                time it was preempted. Printed as Runnable
+ *   sleep        ns of offcpu it was asleep for any reason. Reclaim and
+ *                swap I/O sleep but so does waiting on a lock or a
+ *                timer so this is NOT the time spent in reclaim
+ *
+ * oncpu is sampled by the timer tick so it is only accurate to a jiffy
+ * per context switch. preempted needs CONFIG_SCHEDSTATS and is -1 without
+ * it as is sleep. The alloc and fault tests always print the last four
+ * for the whole test with vmr_counters_printsched so their times can be
+ * split into what the VM cost and what was lost to the scheduler
+ *
+ * The hardware events of the whole test are counted on every CPU and
+ * summed so they cover everything the machine did while it ran. Reading
+ * another CPU needs an IPI so the events of a pass are only those of the
+ * CPU the thread is bound to and -1 if it is not bound to one. Run with
+ * nomigrate=1 to count them for every pass without disturbing the loop
+ * being timed. A CPU that comes online during a test is programmed when
+ * it is first read and the events that span that are -1 rather than
+ * wrong. The counters are only programmed when vmregress_core is loaded
+ * with vmr_pmu=1 as oprofile and the NMI watchdog use the same counters.
+ * Without them, such as in a VM, the value is -1 and the software events
+ * are still counted
+ *
+ * See core/vmregress_core.c
+ */
+#ifndef __VMR_COUNTERS_H_
+#define __VMR_COUNTERS_H_
+
+#define VMR_CTR_CYCLES		0
+#define VMR_CTR_INSTRUCTIONS	1
+#define VMR_CTR_DTLB		2
+#define VMR_CTR_LLC		3
+#define VMR_CTR_FAULTS		4
+#define VMR_CTR_MAJFAULTS	5
+#define VMR_CTR_CSWITCH		6
+#define VMR_CTR_ONCPU		7
+#define VMR_CTR_OFFCPU		8
+#define VMR_CTR_PREEMPTED	9
+#define VMR_CTR_SLEEP		10
+#define VMR_CTR_MAX		11
+
+struct vmr_counters {
+	long long values[VMR_CTR_MAX];	/* -1 if the event is unavailable */
+	int cpu;			/* CPU the hardware events are of.
+					 * -1 for every CPU
+					 */
+	int pmu_gen;			/* CPUs programmed late when read */
+};
+
+struct vmr_desc;
+
+void vmr_counters_read(struct vmr_counters *ctr);
+void vmr_counters_start(struct vmr_desc *desc, struct vmr_counters *ctr);
+void vmr_counters_stop(struct vmr_desc *desc, struct vmr_counters *ctr);
+void vmr_counters_since(struct vmr_counters *ctr);
+void vmr_counters_add(struct vmr_counters *total, struct vmr_counters *ctr);
+void vmr_counters_print(struct vmr_desc *desc, struct vmr_counters *ctr,
+		int pass);
+void vmr_counters_printsched(struct vmr_desc *desc, struct vmr_counters *ctr);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * vmr_dev.h
+ *
+ * The /dev/vmregress misc device. Every proc entry that takes parameters
+ * can also be run through an ioctl on the device so a benchmark does not
+ * pay for a write and a read of text for every operation. The return
+ * value of the test is passed back too which is how the mmap module
+ * returns the address it mapped.
+ *
+ * An entry is first looked up by name with VMR_IOC_LOOKUP which returns
+ * its id in the test registry, see vmr_registry.h. VMR_IOC_BATCH then
+ * runs a vector of commands in order, each one as if its params had been
+ * written to the proc entry, and writes the result of each command back
+ * into it. Commands run synchronously in the calling process. The batch
+ * stops at the first command that could not be run and done says how
+ * many were. A test that ran but failed is not an error here, it is
+ * whatever the test returned in result.
+ *
+ * A command runs on the CPUs set in cpus, a mask of the first 64 CPUs,
+ * and with VMR_DEV_NOMIGRATE in flags stays on one of them. See
+ * vmr_affinity.h
+ *
+ * The output of a test still goes to its proc buffer.
+ *
+ * This file is shared with userspace tools so only fixed size types are
+ * used. A Perl interface is in
+ * bin/lib/VMR/Dev.pm
+ */
+#ifndef __VMR_DEV_H_
+#define __VMR_DEV_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define VMR_DEV_NAME		"vmregress"
+#define VMR_DEV_MAXPARAMS	8	/* Most params a command can pass */
+#define VMR_DEV_MAXENTRIES	128	/* Most entries that can be registered */
+
+struct vmr_dev_lookup {
+	char name[40];			/* Name of the proc entry */
+	__u32 id;			/* Returned id of the entry */
+	__u32 pad;
+};
+
+struct vmr_dev_cmd {
+	__u32 id;			/* Entry from VMR_IOC_LOOKUP */
+	__u32 argc;			/* Number of params used */
+	__s64 params[VMR_DEV_MAXPARAMS];
+	__s64 result;			/* Returned by the test */
+	__s32 error;			/* 0 or -errno if it could not run */
+	__u32 flags;			/* VMR_DEV_* */
+	__u64 cpus;			/* CPUs to run on, 0 for any */
+};
+
+/* Run the command on one CPU of cpus without migrating */
+#define VMR_DEV_NOMIGRATE	0x1
+
+struct vmr_dev_batch {
+	__u64 cmds;			/* Address of nr_cmds vmr_dev_cmd */
+	__u32 nr_cmds;
+	__u32 done;			/* Returned number of commands run */
+};
+
+#define VMR_IOC_MAGIC	'V'
+#define VMR_IOC_LOOKUP	_IOWR(VMR_IOC_MAGIC, 1, struct vmr_dev_lookup)
+#define VMR_IOC_BATCH	_IOWR(VMR_IOC_MAGIC, 2, struct vmr_dev_batch)
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ * vmr_events.h
+ *
+ * Per-CPU event rings. printp formats text into a proc buffer that only
+ * one PID may own at a time. printp_event instead records a small fixed
+ * size event into a ring belonging to the current CPU without taking any
+ * lock so many threads on many CPUs can log at the same time. When the
+ * test is finished, the owner of the proc buffer merges the rings in
+ * timestamp order and formats every event into the proc buffer with
+ * vmrproc_flushevents. See core/events.c and core/vmregress_core.c
+ *
+ * A typical use is
+ *
+ *   vmrproc_allocevents(&testinfo[procentry], 4096);
+ *   ...
+ *   printp_event("alloc order %llu took %llu cycles\n", order, cycles);
+ *   ...
+ *   vmrproc_flushevents(&testinfo[procentry]);
+ *   vmrproc_freeevents(&testinfo[procentry]);
+ *
+ * The rings are also freed with the proc buffer so a module that is
+ * unloaded does not leak them. test_alloc logs every aborted pass this way
+ *
+ * Up to VMR_EVENT_ARGS arguments are recorded and each one is stored as
+ * an unsigned long long so the format must use %llu, %llx or similar
+ * for every argument. The format string is not copied so it must be a
+ * string constant
+ */
+#ifndef __VMR_EVENTS_H_
+#define __VMR_EVENTS_H_
+
+#define VMR_EVENT_ARGS 4
+
+/* A single event. Kept small and fixed size so logging is a copy */
+struct vmr_event {
+	unsigned long long timestamp;	/* vmr_clock_ns() at log */
+	const char *format;		/* Format to print args with */
+	pid_t pid;			/* PID that logged the event */
+	unsigned int cpu;		/* CPU the event was logged on */
+	unsigned long long args[VMR_EVENT_ARGS];
+};
+
+/*
+ * A ring for one CPU. Only that CPU writes head and lost and only the
+ * flusher writes the rest so no lock is needed
+ */
+struct vmr_eventcpu {
+	unsigned long head;		/* Next event to write */
+	unsigned long tail;		/* Next event to flush */
+	unsigned long lost;		/* Events dropped as the ring was full */
+	unsigned long reported;		/* lost when it was last flushed */
+	unsigned long flushhead;	/* head when the flush started */
+	unsigned long flushlost;	/* lost when the flush started */
+	struct vmr_event events[0];
+};
+
+struct vmr_eventring {
+	unsigned long nr_events;	/* Size of each CPU ring */
+	cpumask_t cpus;			/* CPUs that have a ring */
+	atomic_t nocpu;			/* Events dropped on CPUs that came
+					 * online after the rings were
+					 * allocated
+					 */
+	unsigned long nocpu_reported;	/* nocpu when it was last flushed */
+	int heap[NR_CPUS];		/* Merge heap of the flusher. CPUs
+					 * ordered by their oldest event
+					 */
+	struct vmr_eventcpu *cpu[NR_CPUS];
+};
+
+int  vmrproc_allocevents(vmr_desc_t *testinfo, unsigned long nr_events);
+void vmrproc_freeevents(vmr_desc_t *testinfo);
+unsigned long vmrproc_flushevents(vmr_desc_t *testinfo);
+void vmr_event_log(vmr_desc_t *testinfo, const char *format,
+		unsigned long long *args);
+
+/* Log an event to a procentry. The testinfo array must be in scope */
+#define printp_event_entry(procentry, format, args...) do { \
+	unsigned long long __vmr_args[VMR_EVENT_ARGS] = { args }; \
+	vmr_event_log(&testinfo[procentry], format, __vmr_args); \
+} while (0)
+
+#define printp_event(format, args...) printp_event_entry(procentry, format, ## args)
+
+#endif
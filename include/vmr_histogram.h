@@ -0,0 +1,56 @@
+/*
+ * vmr_histogram.h
+ *
+ * Latency histograms. Tests record the latency of every operation instead
+ * of printing it so the output stays the same size however many
+ * operations there are and the tail is visible. Buckets are log-linear.
+ * Values below VMR_HIST_SUB each have their own bucket and every power of
+ * two above that is split into VMR_HIST_SUB buckets so the error of any
+ * percentile is under 1/VMR_HIST_SUB of the value.
+ *
+ * Every CPU records into its own instance with preemption disabled so
+ * recording takes no lock. The instances are merged when the histogram
+ * is printed. A typical use is
+ *
+ *   hist = vmr_hist_alloc();
+ *   ...
+ *   start = vmr_clock_ns();
+ *   page = alloc_pages(gfp_flags, order);
+ *   vmr_hist_record(hist, vmr_clock_ns() - start);
+ *   ...
+ *   vmr_hist_print(&testinfo[procentry], hist, "alloc", "ns");
+ *   vmr_hist_free(hist);
+ *
+ * See core/vmregress_core.c
+ */
+#ifndef __VMR_HISTOGRAM_H_
+#define __VMR_HISTOGRAM_H_
+
+#define VMR_HIST_SUBBITS	4
+#define VMR_HIST_SUB		(1 << VMR_HIST_SUBBITS)
+#define VMR_HIST_BUCKETS	((64 - VMR_HIST_SUBBITS + 1) * VMR_HIST_SUB)
+
+/* One instance. A histogram has one for every CPU */
+struct vmr_histcpu {
+	unsigned long long count;	/* Values recorded */
+	unsigned long long sum;		/* Sum of values for the mean */
+	unsigned long long min;		/* Smallest value */
+	unsigned long long max;		/* Largest value */
+	unsigned long buckets[VMR_HIST_BUCKETS];
+};
+
+struct vmr_histogram {
+	struct vmr_histcpu *cpu[NR_CPUS];
+};
+
+struct vmr_histogram *vmr_hist_alloc(void);
+void vmr_hist_free(struct vmr_histogram *hist);
+void vmr_hist_reset(struct vmr_histogram *hist);
+void vmr_hist_record(struct vmr_histogram *hist, unsigned long long value);
+void vmr_hist_merge(struct vmr_histcpu *total, struct vmr_histogram *hist);
+unsigned long long vmr_hist_percentile(struct vmr_histcpu *total,
+		unsigned int per100k);
+void vmr_hist_print(vmr_desc_t *testinfo, struct vmr_histogram *hist,
+		char *name, char *unit);
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * vmr_lockstat.h
+ *
+ * VM Regress's own lock waits. How long VM Regress itself waited for and
+ * held zone->lock and the page table locks while a test ran. The page
+ * allocator takes zone->lock for every batch of pages moved to or from
+ * the per-cpu lists so a test that is slower on a larger machine may be
+ * waiting on it rather than doing more work.
+ *
+ * These are not the waits of the kernel. A module cannot see the
+ * acquisitions made by the kernel itself so the locks are only measured
+ * where VM Regress takes them and the output is labelled as such.
+ * printp_buddyinfo takes zone->lock of every zone on each call and
+ * highalloc calls it after every allocation attempt so the wait is at
+ * best a sample of the contention the allocator sees during the
+ * allocation loop. The alloc and fault tests hold zone->lock while
+ * sizing the test from the watermarks. forall_ptes_mm holds the lock of
+ * each PTE table while copying it, which is page_table_lock unless the
+ * kernel has split PTE locks, and get_struct_page holds page_table_lock
+ * for a single lookup. The acquisitions are wrapped with
+ *
+ *   vmr_lockstat_lock(VMR_LOCK_ZONE, spin_lock_irqsave(&zone->lock, flags));
+ *   ...
+ *   vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
+ *
+ * The time taken to acquire the lock is recorded as the wait and the
+ * time until it is released as the hold in a histogram of each lock.
+ * Preemption is disabled from before the lock is taken so the wait is
+ * timed on one CPU. The lock is held until the unlock so the hold is
+ * timed on the CPU that took the lock too.
+ *
+ * When a module is loaded with vmr_lockstat=1, VMR_LOCKSTAT is set on its
+ * entries. The histograms are reset when the first such test opens its
+ * buffer and when the buffer is closed, the acquisitions, wait and hold
+ * of every CPU are printed followed by the wait and hold histograms of
+ * all CPUs under a "VM Regress's own lock waits" heading. While no test
+ * measures them the wrappers test one variable. The statistics are not
+ * per test so the acquisitions of tests running at the same time are
+ * included
+ *
+ * See core/vmregress_core.c
+ */
+#ifndef __VMR_LOCKSTAT_H_
+#define __VMR_LOCKSTAT_H_
+
+#define VMR_LOCK_ZONE		0	/* zone->lock */
+#define VMR_LOCK_PTL		1	/* mm->page_table_lock or PTE lock */
+#define VMR_LOCK_MAX		2
+
+/* Set while a test measures contention */
+extern int vmr_lockstat_active;
+
+/* Take a lock with lock_stmt recording how long it took */
+#define vmr_lockstat_lock(type, lock_stmt) do { \
+	if (unlikely(vmr_lockstat_active)) { \
+		unsigned long long __vmr_start = vmr_lockstat_begin(); \
+		lock_stmt; \
+		vmr_lockstat_acquired(type, __vmr_start); \
+	} else { \
+		lock_stmt; \
+	} \
+} while (0)
+
+/* Release a lock with unlock_stmt recording how long it was held */
+#define vmr_lockstat_unlock(type, unlock_stmt) do { \
+	if (unlikely(vmr_lockstat_active)) \
+		vmr_lockstat_release(type); \
+	unlock_stmt; \
+} while (0)
+
+struct vmr_desc;
+
+unsigned long long vmr_lockstat_begin(void);
+void vmr_lockstat_acquired(int type, unsigned long long start);
+void vmr_lockstat_release(int type);
+void vmr_lockstat_start(struct vmr_desc *desc);
+void vmr_lockstat_stop(struct vmr_desc *desc);
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * vmr_mmap.h
+ *
+ * Every proc entry with a proc buffer can be mmap()ed read-only. The first
+ * page of the mapping is a header described below and page N+1 of the
+ * mapping is page N of the output. Output is packed so byte B of the
+ * output is at offset page_size + B in the mapping.
+ *
+ * The header is updated as the test prints so results can be consumed
+ * while a test is still running. Output only ever grows within a
+ * generation. The generation is bumped whenever the buffer is reopened
+ * for a new test or replaced.
+ *
+ * The 64-bit fields cannot be read in one access on a 32-bit machine so
+ * the header is guarded by sequence. It is odd while the kernel updates
+ * the header and is bumped again when it is done. A snapshot of the
+ * header is taken with
+ *
+ *   do {
+ *           seq = header->sequence;
+ *           rmb();
+ *           generation = header->generation;
+ *           written = header->written;
+ *           size = header->size;
+ *           rmb();
+ *   } while ((seq & 1) || seq != header->sequence);
+ *
+ * The output before written is visible once the snapshot is taken. To
+ * consume output a reader should
+ *
+ *   1. take a snapshot of the header
+ *   2. consume written bytes of output
+ *   3. take another snapshot and start over if the generation changed
+ *
+ * Pages past size are not mapped and will SIGBUS if touched. Remap the
+ * file to see pages added since it was mapped.
+ *
+ * This file is shared with userspace tools so only fixed size types are
+ * used
+ */
+#ifndef __VMR_MMAP_H_
+#define __VMR_MMAP_H_
+
+#include <linux/types.h>
+
+#define VMR_MMAP_MAGIC   0x31524d56	/* "VMR1" */
+
+struct vmr_mmap_header {
+	__u32 magic;		/* VMR_MMAP_MAGIC */
+	__u32 page_size;	/* Size of header and output pages */
+	__u32 sequence;		/* Odd while the header is updated */
+	__u32 reserved;
+	__u64 generation;	/* Bumped when the output is restarted */
+	__u64 written;		/* Bytes of output available */
+	__u64 size;		/* Bytes of output pages allocated */
+};
+
+#endif
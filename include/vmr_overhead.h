@@ -0,0 +1,58 @@
+/*
+ * vmr_overhead.h
+ *
+ * Instrumentation overhead. The primitives tests use to report what they
+ * are doing cost time inside the loops being measured. printp_buddyinfo
+ * takes zone->lock with interrupts off and formats a line per zone and
+ * printp formats text into the proc buffer. Each primitive counts how
+ * often it is called on the CPU it runs on which costs an increment.
+ *
+ * Reading /proc/vmregress/overhead, see core/overhead.c, times a batch of
+ * calls of each primitive and records the cost of one call in
+ * vmr_overhead_cost. The cost of a primitive does not include the other
+ * primitives it calls such as the printp calls made by printp_buddyinfo.
+ *
+ * When a module is loaded with vmr_overhead_report=1, VMR_OVERHEAD is set on
+ * its entries. The counters are read when a test opens its buffer and
+ * again when it closes it and the calls made in between multiplied by
+ * their cost are appended to the output as the time the test spent in
+ * VM Regress itself. The counters are not per test so calls by tests
+ * running at the same time on other entries are included
+ *
+ * See core/vmregress_core.c
+ */
+#ifndef __VMR_OVERHEAD_H_
+#define __VMR_OVERHEAD_H_
+
+#include <linux/cache.h>
+
+#define VMR_OVH_RESCHED		0	/* check_resched */
+#define VMR_OVH_PRINTP		1	/* printp and vmr_snprintf */
+#define VMR_OVH_RECORD		2	/* printp_record and vmr_record */
+#define VMR_OVH_BUDDYINFO	3	/* printp_buddyinfo */
+#define VMR_OVH_PTE		4	/* PTE visited by forall_ptes_mm */
+#define VMR_OVH_MAX		5
+
+struct vmr_overhead {
+	unsigned long calls[VMR_OVH_MAX];
+} ____cacheline_aligned;
+
+extern struct vmr_overhead vmr_overhead[NR_CPUS];
+
+/* ns of one call of each primitive. 0 until calibrated */
+extern unsigned long vmr_overhead_cost[VMR_OVH_MAX];
+extern char *vmr_overhead_names[VMR_OVH_MAX];
+
+/* Count nr calls of a primitive */
+#define vmr_overhead_count(type, nr) do { \
+	vmr_overhead[get_cpu()].calls[type] += (nr); \
+	put_cpu(); \
+} while (0)
+
+struct vmr_desc;
+
+void vmr_overhead_read(unsigned long *calls);
+void vmr_overhead_start(struct vmr_desc *desc);
+void vmr_overhead_print(struct vmr_desc *desc);
+
+#endif
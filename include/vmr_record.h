@@ -0,0 +1,99 @@
+/*
+ * vmr_record.h
+ *
+ * Binary record output. A proc entry with VMR_BINARY set writes its output
+ * as a stream of records instead of text. Load a module with vmr_binary=1
+ * to set it on all of its entries. Every record starts with a
+ * vmr_record_header and is padded with zeros to a multiple of
+ * VMR_RECORD_ALIGN bytes so every header and every value of a data record
+ * is naturally aligned. length does not include the header or padding.
+ *
+ * The stream is
+ *
+ *   VMR_REC_STREAM   Once at the start. struct vmr_record_stream
+ *   VMR_REC_SCHEMA   Before the first data record using it.
+ *                    struct vmr_record_schema followed by nr_fields
+ *                    struct vmr_record_field. id in the header is the
+ *                    schema id data records refer to
+ *   VMR_REC_DATA     One __u64 per field of schema id. Signed fields are
+ *                    two's complement
+ *   VMR_REC_TEXT     Free-form text printed with printp. Not terminated
+ *   VMR_REC_MAP      A page map as printed by vmr_printmap. See
+ *                    bin/lib/VMR/Pagemap.pm
+ *
+ * Values are in the byte order of the machine that ran the test. The
+ * magic in the stream record tells a decoder what that order was. A
+ * stream may be cut short if the proc buffer could not grow. A reference
+ * decoder is in bin/lib/VMR/Record.pm
+ *
+ * The part of this file outside __KERNEL__ is shared with userspace tools
+ * so only fixed size types are used
+ */
+#ifndef __VMR_RECORD_H_
+#define __VMR_RECORD_H_
+
+#include <linux/types.h>
+
+#define VMR_RECORD_MAGIC	0x42524d56	/* "VMRB" */
+#define VMR_RECORD_VERSION	1
+#define VMR_RECORD_ALIGN	8
+
+/* Record types */
+#define VMR_REC_STREAM	1
+#define VMR_REC_SCHEMA	2
+#define VMR_REC_DATA	3
+#define VMR_REC_TEXT	4
+#define VMR_REC_MAP	5
+
+/* Field types */
+#define VMR_FIELD_U64	1
+#define VMR_FIELD_S64	2
+
+struct vmr_record_header {
+	__u16 type;		/* VMR_REC_* */
+	__u16 id;		/* Schema id of a schema or data record */
+	__u32 length;		/* Bytes of payload after the header */
+};
+
+struct vmr_record_stream {
+	__u32 magic;		/* VMR_RECORD_MAGIC */
+	__u32 version;		/* VMR_RECORD_VERSION */
+	char name[40];		/* Name of the proc entry */
+};
+
+struct vmr_record_schema {
+	__u16 nr_fields;	/* Number of vmr_record_field following */
+	__u16 pad;
+	char name[28];		/* Name of the schema */
+};
+
+struct vmr_record_field {
+	__u16 type;		/* VMR_FIELD_* */
+	char name[30];		/* Name of the field */
+};
+
+#ifdef __KERNEL__
+
+#define VMR_RECORD_MAXFIELDS	16	/* Most fields a schema can have */
+#define VMR_RECORD_MAXSCHEMAS	8	/* Most schemas one entry can use */
+
+/* A field and a schema as declared by a module */
+struct vmr_field {
+	char *name;
+	int type;
+};
+
+struct vmr_schema {
+	char *name;
+	int nr_fields;
+	struct vmr_field *fields;
+};
+
+#define VMR_SCHEMA(sname, sfields) { \
+	.name		= sname, \
+	.nr_fields	= sizeof(sfields) / sizeof(struct vmr_field), \
+	.fields		= sfields }
+
+#endif /* __KERNEL__ */
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * vmr_registry.h
+ *
+ * Registry of every test that can be run. init.c registers each proc
+ * entry that takes parameters when its module is loaded and removes it
+ * when the module is unloaded. With every test the registry keeps what
+ * is needed to run it without knowing the module
+ *
+ *   name      The name of the proc entry
+ *   descs     Every entry of its module, as a test may print to more
+ *             entries than its own
+ *   params    Names of its parameters in order from
+ *             PROC_WRITE_PARAMETER_NAMES
+ *   defaults  The value of each parameter when it is not given from
+ *             PROC_WRITE_PARAMETER_DEFAULTS
+ *   danger    What running it may do to the machine, VMR_DANGER_*,
+ *             from VMR_TEST_DANGER(procentry)
+ *   suite     The suite it belongs to from VMR_TEST_SUITE(procentry)
+ *
+ * The id of a test is its index in the registry. /dev/vmregress runs
+ * tests by id, see vmr_dev.h, and /proc/vmregress/suite lists the
+ * registry and runs whole suites, see core/suite.c
+ *
+ * See core/vmregress_core.c
+ */
+#ifndef __VMR_REGISTRY_H_
+#define __VMR_REGISTRY_H_
+
+#define VMR_REGISTRY_MAX	VMR_DEV_MAXENTRIES
+
+#define VMR_DANGER_SAFE		0	/* Stays above the high watermark */
+#define VMR_DANGER_PRESSURE	1	/* Pushes a zone into reclaim */
+#define VMR_DANGER_OOM		2	/* May OOM kill or need a reboot */
+#define VMR_DANGER_MAX		3
+
+/* Runs a test. Defined for every module by init/proc.c */
+typedef long (*vmr_test_run_t)(long *params, int argc, int procentry);
+
+struct vmr_desc;
+struct module;
+
+struct vmr_test {
+	struct vmr_desc *desc;	/* The proc entry */
+	struct vmr_desc *descs;	/* Every entry of the module as a test
+				 * may print to more than its own */
+	int nr_descs;
+	struct module *owner;	/* Module the entry belongs to */
+	vmr_test_run_t run;
+	char **params;		/* Parameter names or NULL */
+	long *defaults;		/* Parameter defaults or NULL */
+	int nparams;		/* Number of parameters */
+	int danger;		/* VMR_DANGER_* */
+	char *suite;		/* Suite the test is in or NULL */
+};
+
+int  vmr_test_register(struct vmr_test *test);
+void vmr_test_unregister(struct vmr_desc *desc);
+int  vmr_test_lookup(const char *name);
+int  vmr_test_get(int id, struct vmr_test *test);
+void vmr_test_put(struct vmr_test *test);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * vmr_repeat.h
+ *
+ * Repetition of a test until its result is stable. A test with passes
+ * normally runs a fixed number of them and the results are averaged by
+ * hand. With a repetition runner the test instead records the key metric
+ * of every pass, such as the time it took, and stops once the
+ * coefficient of variation of the passes so far falls below a target or
+ * a time budget runs out. passes is then the most passes that are run.
+ * A stable test stops after a few passes and a noisy one runs more. A
+ * typical use is
+ *
+ *   vmr_repeat_init(&rep, cv, budget, nopasses);
+ *   do {
+ *           start = vmr_clock_ns();
+ *           ...
+ *   } while (!vmr_repeat_done(&rep, vmr_clock_ns() - start));
+ *   vmr_repeat_print(&testinfo[procentry], &rep, "pass", "ns");
+ *   vmr_repeat_free(&rep);
+ *
+ * cv is in tenths of a percent so 20 stops once the standard deviation
+ * is within 2% of the mean. budget is in milliseconds. With neither, the
+ * test runs exactly nopasses passes. At least VMR_REPEAT_MINPASSES are
+ * run before the CV is trusted. The mean is printed with its 95%
+ * confidence interval from Student's t distribution and the number of
+ * passes used
+ *
+ * See core/vmregress_core.c
+ */
+#ifndef __VMR_REPEAT_H_
+#define __VMR_REPEAT_H_
+
+#define VMR_REPEAT_MINPASSES	3	/* Passes before the CV is checked */
+#define VMR_REPEAT_MAXPASSES	100	/* Passes when only cv or budget is given */
+#define VMR_REPEAT_MAXVALUES	1024	/* Values kept for the statistics */
+
+/* Why the repetitions stopped */
+#define VMR_REPEAT_PASSES	0	/* Ran every pass */
+#define VMR_REPEAT_STABLE	1	/* The CV fell below the target */
+#define VMR_REPEAT_BUDGET	2	/* The time budget ran out */
+
+struct vmr_repeat {
+	unsigned int cv;		/* Target CV in 0.1%. 0 for none */
+	unsigned long deadline;		/* jiffies the budget runs out */
+	int budget;			/* A budget was given */
+	unsigned int max;		/* Most passes */
+	unsigned int n;			/* Passes recorded */
+	unsigned long long *values;	/* Metric of each pass or NULL */
+	int stopped;			/* VMR_REPEAT_* */
+
+	/* Statistics of the passes so far */
+	unsigned long long mean;
+	unsigned long long ci;		/* Half width of the 95% interval */
+	unsigned int cvnow;		/* CV in 0.1% */
+};
+
+/* True if the test was asked to repeat until stable */
+#define vmr_repeat_adaptive(rep) ((rep)->cv || (rep)->budget)
+
+void vmr_repeat_init(struct vmr_repeat *rep, unsigned int cv,
+		unsigned int budget, unsigned int max);
+int  vmr_repeat_done(struct vmr_repeat *rep, unsigned long long value);
+void vmr_repeat_print(vmr_desc_t *desc, struct vmr_repeat *rep,
+		char *name, char *unit);
+void vmr_repeat_free(struct vmr_repeat *rep);
+
+#endif
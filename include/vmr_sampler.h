@@ -0,0 +1,72 @@
+/*
+ * vmr_sampler.h
+ *
+ * Time series of the state of the VM. Instead of a script polling
+ * /proc/vmstat from userspace, a kernel thread in the core takes a sample
+ * at a fixed rate of
+ *
+ *   o the free pages and min, low and high watermarks of every zone
+ *   o the free blocks of each order of every zone as in buddyinfo
+ *   o VMR_SAMPLER_VMSTATS counters from the page state, such as faults,
+ *     pages scanned and reclaimed and pages swapped
+ *
+ * and keeps them in a ring. When the ring is full the oldest samples are
+ * overwritten. Every sample is stamped with vmr_clock_ns() and the phase
+ * it was taken in so it can be placed against the test output. A phase
+ * starts with vmr_sampler_mark(). A test buffer starts a phase named after
+ * the test when it is opened and "idle" when it is closed and the alloc
+ * and fault tests mark each part of a pass.
+ *
+ * The sampler runs while anyone holds a reference from vmr_sampler_start.
+ * /proc/vmregress/sampler starts and stops it and prints the whole ring,
+ * see core/sampler.c. A test module loaded with vmr_sampler=rate samples
+ * while each of its tests run and prints the samples taken during the test
+ * when its buffer is closed. The first to start the sampler sets its rate
+ * and the size of the ring. The thread sleeps in jiffies so the rate is at
+ * most HZ samples a second
+ *
+ * See core/vmregress_core.c
+ */
+#ifndef __VMR_SAMPLER_H_
+#define __VMR_SAMPLER_H_
+
+#define VMR_SAMPLER_ZONES	16	/* Most zones sampled */
+#define VMR_SAMPLER_PHASES	256	/* Phase names kept */
+#define VMR_SAMPLER_NAMELEN	24	/* Longest phase name */
+#define VMR_SAMPLER_RATE	100	/* Samples a second if not given */
+
+/* Page state counters sampled */
+#define VMR_VMSTAT_NR_DIRTY		0
+#define VMR_VMSTAT_NR_WRITEBACK		1
+#define VMR_VMSTAT_NR_MAPPED		2
+#define VMR_VMSTAT_NR_SLAB		3
+#define VMR_VMSTAT_PGPGIN		4
+#define VMR_VMSTAT_PGPGOUT		5
+#define VMR_VMSTAT_PSWPIN		6
+#define VMR_VMSTAT_PSWPOUT		7
+#define VMR_VMSTAT_PGFAULT		8
+#define VMR_VMSTAT_PGMAJFAULT		9
+#define VMR_VMSTAT_PGSCAN_KSWAPD	10
+#define VMR_VMSTAT_PGSCAN_DIRECT	11
+#define VMR_VMSTAT_PGSTEAL		12
+#define VMR_VMSTAT_ALLOCSTALL		13
+#define VMR_SAMPLER_VMSTATS		14
+
+struct vmr_desc;
+
+extern int vmr_sampler_active;
+
+int  vmr_sampler_start(unsigned int rate, unsigned long nr_samples);
+void vmr_sampler_stop(void);
+void __vmr_sampler_mark(const char *name);
+void vmr_sampler_print(struct vmr_desc *desc, unsigned long long since);
+void vmr_sampler_open(struct vmr_desc *desc);
+void vmr_sampler_close(struct vmr_desc *desc);
+
+/* Start a new phase if the sampler is running */
+#define vmr_sampler_mark(name) do { \
+	if (vmr_sampler_active) \
+		__vmr_sampler_mark(name); \
+} while (0)
+
+#endif
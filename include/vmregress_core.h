@@ -1,6 +1,19 @@
 #ifndef __VMREGRESS_CORE_H
 #define __VMREGRESS_CORE_H
 
+#include <linux/completion.h>
+#include <vmr_mmap.h>
+#include <vmr_record.h>
+#include <vmr_dev.h>
+#include <vmr_registry.h>
+#include <vmr_overhead.h>
+#include <vmr_counters.h>
+#include <vmr_lockstat.h>
+#include <vmr_affinity.h>
+#include <vmr_sampler.h>
+
+struct vmr_eventring;
+
 /* vmregress proc directory structure */
 extern struct proc_dir_entry *vmregress_proc_dir;
 
@@ -13,12 +26,86 @@ int check_resched_nocount(void);
 /* This converts a jiffy value to milliseconds */
 #define jiffies_to_ms(start) ((1000 * (jiffies - start)) / HZ)
 
-/* Acquire pgdat_list */
+/* Acquire pgdat_list and the pgdat of a node */
 pg_data_t *get_pgdat_list(void);
+pg_data_t *vmr_get_pgdat(int node);
 
 /* String to long converters */
 unsigned long vmr_strtoul(const char *cp,char **endp,unsigned int base);
 long vmr_strtol(const char *cp,char **endp,unsigned int base);
+int vmr_strtoparam(const char *cp, long *value);
+
+/*
+ * ----- Proc buffer chunks -----
+ *
+ * A proc buffer is a singly linked list of pages. printp appends to the
+ * chunk pointed to by chunk_tail and moves on to the next chunk, allocating
+ * it if necessary, when the page fills. Output is packed so byte N of the
+ * output is always at offset (N & ~PAGE_MASK) in chunk number
+ * (N >> PAGE_SHIFT). Chunks after chunk_tail are spare pages kept around
+ * from previous tests or reserved with vmrproc_growbuffer. The pages come
+ * from the result page pool below
+ */
+struct vmr_chunk {
+	struct vmr_chunk *next;	/* Next page in the buffer */
+	char *data;		/* Page holding the output */
+};
+
+/*
+ * ----- Result page pool -----
+ *
+ * Every proc buffer of every module takes its pages from one pool in the
+ * core so vmregress itself uses a bounded and predictable amount of the
+ * memory the tests are measuring. vmrproc_allocbuffer only records that
+ * an entry has a buffer. No page is taken until the first write to it and
+ * the mmap header page is only taken when the entry is first mapped.
+ *
+ * Pages released when a buffer is replaced or freed are kept as spares
+ * for the next buffer, up to vmr_pool_spare of them, instead of going
+ * back to the page allocator. No more than vmr_pool_quota pages are held
+ * at once. When a buffer needs a page and the quota is reached, the pool
+ * takes the spare pages of buffers no test is writing to. If that is not
+ * enough the write fails as if the buffer could not be grown. Pages still
+ * mapped by a reader are never reused and a buffer a reader is copying
+ * from is not reclaimed from. The page map laid down by vmr_printmap may
+ * go over the quota. /proc/vmregress/pool reports the
+ * pool usage, see core/pool.c
+ */
+struct vmr_pool_stats {
+	unsigned long used;	/* Pages held by buffers */
+	unsigned long spare;	/* Free pages held by the pool */
+	unsigned long peak;	/* Most pages held at once */
+	unsigned long quota;	/* Most pages that may be held */
+	unsigned long buffers;	/* Buffers known to the pool */
+	unsigned long allocated;/* Pages taken from the page allocator */
+	unsigned long reused;	/* Pages taken from the spares */
+	unsigned long reclaimed;/* Spare pages taken from idle buffers */
+	unsigned long failed;	/* Pages refused because of the quota */
+};
+
+void vmr_pool_getstats(struct vmr_pool_stats *stats);
+unsigned long vmr_pool_trim(void);
+
+/*
+ * A cursor caches the last chunk looked up by offset so walking forward
+ * through a buffer is linear. The writer uses the one in vmr_desc_t and
+ * every open proc file has its own
+ */
+struct vmr_cursor {
+	unsigned long layout;	/* desc->layout when the cursor was used */
+	struct vmr_chunk *chunk;/* Last chunk looked up */
+	unsigned long index;	/* Index of chunk in the list */
+};
+
+/*
+ * Private data of an open proc file. completed is the number of tests
+ * that had finished when the file last read to the end of the output.
+ * poll() reports the file readable when another test finishes
+ */
+struct vmr_file {
+	struct vmr_cursor cursor;	/* Read lookup cache */
+	unsigned long completed;	/* desc->completed seen at last EOF */
+};
 
 /* 
  * ----- VMR description structure -----
@@ -38,10 +125,70 @@ typedef struct vmr_desc {
 
 	/* Proc entry info */
 	int procentry;		/* Index of proc buffer been written to */
-	char *procbuf;		/* Buffer to print to */
-	int procbuf_size; 	/* Buffer size */
-	int written;		/* Bytes written to buffer */
+	struct vmr_chunk *chunks;	/* First page of the buffer */
+	struct vmr_chunk *chunk_tail;	/* Page currently printed to */
+	struct vmr_cursor seek;		/* Writers offset lookup cache */
+	struct vmr_cursor mapseek;	/* Page fault lookup cache. 
+					 * Protected by lock */
+	unsigned long procbuf_size; 	/* Buffer size */
+	unsigned int reserve;		/* Pages to take on the first write.
+					 * 0 if there is no buffer
+					 */
+	unsigned long layout;		/* Changed whenever chunks are
+					 * removed so cursors start over
+					 */
+	atomic_t readers;		/* Readers walking the chunks.
+					 * See vmrproc_pin
+					 */
+	struct list_head pool;		/* Buffers known to the pool */
+	long written;		/* Bytes written to buffer */
+	unsigned long opened;	/* Times a writer opened the buffer */
+	struct vmr_mmap_header *header;	/* First page of a mmap of the buffer
+					 * See vmr_mmap.h
+					 */
+	struct vmr_eventring *events;	/* Per-CPU event rings
+					 * See vmr_events.h
+					 */
+	struct vmr_schema *schemas[VMR_RECORD_MAXSCHEMAS];
+					/* Schemas written to the
+					 * output. The index is the
+					 * schema id. See vmr_record.h
+					 */
+	unsigned long overhead[VMR_OVH_MAX];
+					/* Instrumentation calls when
+					 * the buffer was opened. See
+					 * vmr_overhead.h
+					 */
+	struct vmr_counters counters;	/* Event counters when the
+					 * buffer was opened. See
+					 * vmr_counters.h
+					 */
+	int lockstat;		/* Holds a reference on the lock
+				 * statistics. See vmr_lockstat.h
+				 */
+	unsigned int sampler;	/* Samples a second to take while
+				 * the test runs. 0 for none. See
+				 * vmr_sampler.h
+				 */
+	unsigned long long sampled;
+				/* vmr_clock_ns() when sampling
+				 * started for the test. 0 if it
+				 * did not
+				 */
 	pid_t pid;		/* PID of the test writer */
+	int cpu;		/* CPU the writer opened the buffer
+				 * on. See vmr_affinity.h
+				 */
+	int affinity;		/* Set if the last command chose
+				 * its CPUs. See vmr_affinity.h
+				 */
+	wait_queue_head_t wait;	/* Woken when the writer closes the
+				 * buffer. Used by VMR_WAITPROC and
+				 * by poll()
+				 */
+	unsigned long completed;/* Number of times the buffer was
+				 * closed by a writer
+				 */
 
 	/* Persistent info */
 	unsigned long mapaddr;	/*
@@ -51,6 +198,7 @@ typedef struct vmr_desc {
 				 * or swapped within a region.
 				 * See pagetable.c:vmr_printpage
 				 */
+	unsigned long mapoffset;/* Buffer offset the map starts at */
 
 	/* Test configuration */
 	char name[40];		/* Name of the test */
@@ -64,7 +212,12 @@ typedef struct vmr_desc {
 } vmr_desc_t;
  
 /* Small macro to init a struct statically */
-#define VMR_DESC_INIT(a, b, c, d ) {SPIN_LOCK_UNLOCKED, a, 0, 0, 0, 0, 0, b, 0, c, d }
+#define VMR_DESC_INIT(a, b, c, d ) { \
+	.lock		= SPIN_LOCK_UNLOCKED, \
+	.procentry	= a, \
+	.name		= b, \
+	.read_proc	= c, \
+	.write_proc	= d }
 
 /* 
  * Test flags 
@@ -77,18 +230,40 @@ typedef struct vmr_desc {
  *                used to determine what pages are present and what is 
  *                swapped out
  *
- * VMR_PRINTMANY - If set, multiple tests are allowed to print to the proc
- *                buffer. The way to distinguish them is that the PID of
- *                the test will be prepended to every line. A simple grep
- *                will produce the individual results
+ * VMR_PRINTMANY - If set, the PID of the thread that logged an event with
+ *                printp_event is printed at the start of every line when
+ *                the events are flushed to the proc buffer. Many threads
+ *                may log events at the same time. A simple grep will
+ *                produce the individual results. See vmr_events.h
  *
  * VMR_NOGROW -   If set printp and vmr_snprintf will not grow the proc
- *                buffer size
+ *                buffer size beyond the pages already allocated
+ *
+ * VMR_WAITPROC - If this flag is set, a caller will sleep on the wait
+ * 		  queue of the proc buffer for up to 5 seconds waiting
+ * 		  for it to be free. This is important when the caller
+ * 		  must see their own output and are willing to wait for it
+ *
+ * VMR_BINARY -   If set the output is a stream of binary records rather
+ *                than text. printp output becomes text records and tests
+ *                print their results as data records. See vmr_record.h
  *
- * VMR_WAITPROC - If this flag is set, a caller will block waiting for a
- * 		  proc buffer to be free. This is important when the 
- * 		  caller must see their own output and are willing to
- * 		  wait for it
+ * VMR_SCRIPT -   Set by proc.c while it runs a script of many commands
+ *                written at once. The writer keeps the buffer between
+ *                commands so vmrproc_openbuffer appends instead of
+ *                clearing and vmrproc_closebuffer leaves it held
+ *
+ * VMR_OVERHEAD - If set, the time the test spent in the instrumentation
+ *                primitives is printed when the buffer is closed. See
+ *                vmr_overhead.h
+ *
+ * VMR_COUNTERS - If set, event counters are printed after every pass of
+ *                tests that have passes and for the whole test when the
+ *                buffer is closed. See vmr_counters.h
+ *
+ * VMR_LOCKSTAT - If set, the wait and hold times of zone->lock and
+ *                page_table_lock while the test ran are printed when the
+ *                buffer is closed. See vmr_lockstat.h
  *
  */
 
@@ -96,6 +271,63 @@ typedef struct vmr_desc {
 #define VMR_PRINTMANY	0x00000002
 #define VMR_NOGROW	0x00000004
 #define VMR_WAITPROC 	0x00000008
+#define VMR_BINARY	0x00000010
+#define VMR_SCRIPT	0x00000020
+#define VMR_OVERHEAD	0x00000040
+#define VMR_COUNTERS	0x00000080
+#define VMR_LOCKSTAT	0x00000100
+
+/*
+ * ----- Jobs -----
+ *
+ * Writing parameters to a test proc entry with a leading & such as
+ * "& 1 100" runs the test as a job instead of inside the write. The write
+ * returns as soon as the job is started. Each job runs in its own thread
+ * which shares the address space of the writer so tests that map memory
+ * behave as they would if they were run directly. Jobs from different
+ * modules run at the same time. /proc/vmregress/jobs lists every job and
+ * accepts "cancel <id>" and "reap". See core/jobs.c
+ *
+ * A cancelled job has SIGKILL sent to it. Long running tests should check
+ * vmr_test_cancelled() in their main loops which is also true if a test
+ * run directly is interrupted
+ */
+#define VMR_JOB_RUNNING		0
+#define VMR_JOB_DONE		1
+#define VMR_JOB_CANCELLED	2
+
+#define VMR_JOB_MAX		64	/* Jobs kept including finished ones */
+#define VMR_JOB_PARAMSIZE	64	/* Bytes of parameters a job can take */
+
+struct vmr_job {
+	struct list_head list;	/* vmr_job_list */
+	int id;			/* Job id shown in /proc/vmregress/jobs */
+	int state;		/* VMR_JOB_* */
+	pid_t pid;		/* PID of the job thread */
+	pid_t submitter;	/* PID that wrote to the proc entry */
+	unsigned long start;	/* jiffies when the job started */
+	unsigned long end;	/* jiffies when the job finished */
+
+	/* Test to run and its parameters. The name is copied as the module
+	 * and its descriptors may be gone once the job is done */
+	char name[40];
+	vmr_desc_t *desc;	/* Only used while the job runs */
+	struct completion started;	/* The job has its buffer */
+	struct module *owner;
+	int (*run)(void *params, int argc, int procentry);
+	int argc;
+	int procentry;
+	char params[VMR_JOB_PARAMSIZE];
+};
+
+int  vmr_job_submit(vmr_desc_t *desc, struct module *owner,
+		int (*run)(void *params, int argc, int procentry),
+		void *params, int size, int argc, int procentry);
+int  vmr_job_cancel(int id);
+void vmr_job_reap(void);
+void vmr_job_printall(vmr_desc_t *desc);
+
+#define vmr_test_cancelled() signal_pending(current)
 
 /* GFP Flags */
 #ifndef __GFP_EASYRCLM
@@ -30,12 +30,19 @@
  *
  * close takes two parameters, the address to unmap and the length
  *
+ * Reading read or write prints the latency of every page read or written
+ * since the last region was mapped.
+ *
  * addr is a hack and a weird one at that. When a caller uses open to create
  * a mapped region, there is no way to return the address. Returning the
  * addr through procfs gets lost in the ether. What happens is that when
  * an address is opened, it is placed in the map_addr and the buffer
  * locked for the calling pid until the proc entry can be read.
  *
+ * Callers that run the entries through /dev/vmregress get the address
+ * back as the result of the open command instead and map_addr is not
+ * touched. See vmr_dev.h
+ *
  * This module is provided so userland test scripts can perform testing and
  * use VM Regress to dump kernel information about the process when it
  * is finished
@@ -56,6 +63,8 @@
 #include <vmregress_core.h>
 #include <pagetable.h>
 #include <procprint.h>
+#include <nanotime.h>
+#include <vmr_histogram.h>
 #include <linux/spinlock.h>
 #include <linux/file.h>
 #include <linux/mm.h>
@@ -87,6 +96,62 @@ MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
 MODULE_DESCRIPTION("Benchmark module for mmap'ed memory");
 MODULE_LICENSE("GPL");
 
+/* Latency of every page read and written since the last mapping */
+static struct vmr_histogram *hist_read, *hist_write;
+
+/* Events of every read and write since the last mapping */
+static struct vmr_counters counters_read, counters_write;
+
+/**
+ * map_hist - Return the histogram for the read or write entry
+ * @procentry: MAP_READ or MAP_WRITE
+ *
+ * The histogram is allocated the first time it is needed
+ */
+struct vmr_histogram *map_hist(int procentry) {
+	struct vmr_histogram **hist;
+
+	hist = (procentry == MAP_READ) ? &hist_read : &hist_write;
+	if (!*hist)
+		*hist = vmr_hist_alloc();
+
+	return *hist;
+}
+
+/**
+ * map_getproc - Print the latency histogram when read or write is read
+ * @procentry: Which proc buffer is been read
+ *
+ * Until a page is read or written, the help message is left in place
+ */
+void map_getproc(int procentry) {
+	struct vmr_histogram *hist;
+
+	if (procentry != MAP_READ && procentry != MAP_WRITE)
+		return;
+
+	hist = (procentry == MAP_READ) ? hist_read : hist_write;
+	if (!hist)
+		return;
+
+	if (!vmrproc_openbuffer(&testinfo[procentry]))
+		return;
+	vmr_hist_print(&testinfo[procentry], hist,
+			procentry == MAP_READ ? "page read" : "page write",
+			"ns");
+	vmr_counters_print(&testinfo[procentry],
+			procentry == MAP_READ ? &counters_read : &counters_write,
+			-1);
+}
+
+/**
+ * map_cleanup - Free the histograms when the module unloads
+ */
+void map_cleanup(void) {
+	vmr_hist_free(hist_read);
+	vmr_hist_free(hist_write);
+}
+
 /**
  * map_help - Print help message to proc buffer
  * @procentry: Which proc buffer to write to
@@ -134,18 +199,20 @@ void map_help(int procentry) {
 /**
  *
  * do_mapping - Wrapper around do_mmap
+ * @printaddr: Print the address to map_addr for the caller to read
  */
 inline unsigned long do_mapping(size_t length,
 				int prot,
 				int flags,
 				struct file *file,
-				off_t offset)
+				off_t offset,
+				int printaddr)
 {
 	unsigned long addr;
 	int procentry;
 
 	/* Try to lock the addr proc entry */
-	if (!vmrproc_openbuffer(&testinfo[MAP_ADDR])) {
+	if (printaddr && !vmrproc_openbuffer(&testinfo[MAP_ADDR])) {
 		vmr_printk("Failed to lock addr buffer. no mapping occured.\n");
 		return -1;
 	}
@@ -167,19 +234,30 @@ inline unsigned long do_mapping(size_t length,
 		return -1;
 	}
 
+	/* Start the latency histograms again for the new region */
+	if (hist_read)
+		vmr_hist_reset(hist_read);
+	if (hist_write)
+		vmr_hist_reset(hist_write);
+	memset(&counters_read, 0, sizeof(counters_read));
+	memset(&counters_write, 0, sizeof(counters_write));
+
 	/* Print the address */
-	procentry = MAP_ADDR;
-	printp("%d %lu 0x%lX\n", current->pid, addr, addr);
+	if (printaddr) {
+		procentry = MAP_ADDR;
+		printp("%d %lu 0x%lX\n", current->pid, addr, addr);
+	}
 
 	return addr;
 }
 
 /**
  *
- * map_runtest - Perform the requested action from userspace
+ * map_run - Perform the requested action from userspace
  * @params: Parameters read from the proc entry
  * @argc:   Number of parameters actually entered
  * @procentry: Proc buffer to write to
+ * @printaddr: Print mapped addresses to map_addr
  *
  * 4 proc entries determine what the module will do on behalf of the userspace
  * program. procentry determines what the action will be and the two parameters
@@ -190,12 +268,16 @@ inline unsigned long do_mapping(size_t length,
  * Depends on the entry. openmap returns the address opened for example
  *
  */
-unsigned long map_runtest(unsigned long *params, int argc, int procentry) {
+unsigned long map_run(unsigned long *params, int argc, int procentry,
+		int printaddr) {
 	unsigned long addr=0;		/* Address mapped area starts */
 	unsigned long length;
 	struct file *file;
 	char *kernbuf;			/* Buffer to read/write to/from userspace */
 	int bytes;			/* Bytes to read/write */
+	struct vmr_histogram *hist;	/* Latency of each page */
+	unsigned long long start;
+	struct vmr_counters counters;	/* Events during the read or write */
 
 	/* Make sure a buffer is available */
 	if (vmrproc_checkbuffer(testinfo[procentry])) BUG();
@@ -205,7 +287,7 @@ unsigned long map_runtest(unsigned long *params, int argc, int procentry) {
 			return do_mapping(params[0], 
 					PROT_WRITE | PROT_READ,
 					MAP_PRIVATE | MAP_ANONYMOUS,
-					0, 0);
+					0, 0, printaddr);
 			break;
 
 		case MAPFD_OPEN:
@@ -221,7 +303,8 @@ unsigned long map_runtest(unsigned long *params, int argc, int procentry) {
 				   params[1],	/* prot */
 				   params[2],	/* flags */
 				   file,	/* struct file for fd */
-				   params[4]);	/* offset */
+				   params[4],	/* offset */
+				   printaddr);
 					
 			break;
 		
@@ -238,18 +321,24 @@ unsigned long map_runtest(unsigned long *params, int argc, int procentry) {
 
 			/* Simulate a read in maxiumum amounts of PAGE_SIZE */
 			bytes = length;
+			hist = map_hist(MAP_READ);
 
+			vmr_counters_start(&testinfo[procentry], &counters);
 			while (length != 0) {
 				if (bytes > PAGE_SIZE) bytes = PAGE_SIZE;
 				else bytes = length;
 			
+				start = vmr_clock_ns();
 				copy_from_user((unsigned long *)addr, 
 						kernbuf, 
 						bytes);
+				vmr_hist_record(hist, vmr_clock_ns() - start);
 
 				addr += bytes;
 				length -= bytes;
 			}
+			vmr_counters_stop(&testinfo[procentry], &counters);
+			vmr_counters_add(&counters_read, &counters);
 			
 			kfree(kernbuf);
 			return 1;
@@ -271,15 +360,21 @@ unsigned long map_runtest(unsigned long *params, int argc, int procentry) {
 
 			/* Simulate a write in maxiumum amounts of PAGE_SIZE */
 			bytes = length;
+			hist = map_hist(MAP_WRITE);
+			vmr_counters_start(&testinfo[procentry], &counters);
 			while (length != 0) {
 				if (bytes > PAGE_SIZE) bytes = PAGE_SIZE;
 				else bytes = length;
 				
+				start = vmr_clock_ns();
 				copy_to_user((unsigned long *)addr, kernbuf, bytes);
+				vmr_hist_record(hist, vmr_clock_ns() - start);
 
 				addr   += bytes;
 				length -= bytes;
 			}
+			vmr_counters_stop(&testinfo[procentry], &counters);
+			vmr_counters_add(&counters_write, &counters);
 
 			kfree(kernbuf);
 			return 1;
@@ -307,11 +402,30 @@ unsigned long map_runtest(unsigned long *params, int argc, int procentry) {
 	return -1;
 }
 
+/**
+ * map_runtest - Perform an action written to a proc entry
+ */
+unsigned long map_runtest(unsigned long *params, int argc, int procentry) {
+	return map_run(params, argc, procentry, 1);
+}
+
+/**
+ * map_devtest - Perform an action from /dev/vmregress
+ *
+ * The result of an open is the address so map_addr is left alone
+ */
+unsigned long map_devtest(unsigned long *params, int argc, int procentry) {
+	return map_run(params, argc, procentry, 0);
+}
+
+#define VMR_READ_PROC_CALLBACK map_getproc
 #define VMR_READ_PROC_ENDCALLBACK if (procentry == MAP_ADDR) vmrproc_closebuffer_nocheck(&testinfo[MAP_ADDR])
 #define VMR_WRITE_CALLBACK map_runtest
+#define VMR_DEV_CALLBACK map_devtest
 #define PARAM_TYPE unsigned long
 #define NUM_PROC_ENTRIES 6
 #define NUMBER_PROC_WRITE_PARAMETERS 6
 #define VMR_HELP_PROVIDED map_help
+#define VMR_CLEANUP_PROVIDED map_cleanup
 #include "../init/proc.c"
 #include "../init/init.c"
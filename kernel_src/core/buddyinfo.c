@@ -26,6 +26,91 @@ MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
 MODULE_DESCRIPTION("VM Regress Buddyinfo exporter");
 MODULE_LICENSE("GPL");
 
+/* Binary records. The zone record has one field per order */
+static struct vmr_field buddyinfo_fields[] = {
+	{ "attempt",	VMR_FIELD_U64 },
+	{ "success",	VMR_FIELD_U64 },
+	{ "jiffies",	VMR_FIELD_U64 },
+};
+static struct vmr_schema buddyinfo_schema = VMR_SCHEMA("buddyinfo", buddyinfo_fields);
+
+/* Orders a zone record has room for after the node and zone */
+#define BUDDYINFO_ORDERS (MAX_ORDER < VMR_RECORD_MAXFIELDS - 2 ? \
+				MAX_ORDER : VMR_RECORD_MAXFIELDS - 2)
+
+/* The order fields are named when the module is loaded */
+static char buddyinfo_order_names[BUDDYINFO_ORDERS][12];
+static struct vmr_field buddyinfo_zone_fields[2 + BUDDYINFO_ORDERS] = {
+	{ "node",	VMR_FIELD_U64 },
+	{ "zone",	VMR_FIELD_U64 },
+};
+static struct vmr_schema buddyinfo_zone_schema = VMR_SCHEMA("buddyinfo_zone", buddyinfo_zone_fields);
+
+/**
+ * buddyinfo_init - Name a field of the zone record for every order
+ */
+static int buddyinfo_init(void)
+{
+	int order;
+
+	for (order = 0; order < BUDDYINFO_ORDERS; order++) {
+		sprintf(buddyinfo_order_names[order], "order%d", order);
+		buddyinfo_zone_fields[order + 2].name = buddyinfo_order_names[order];
+		buddyinfo_zone_fields[order + 2].type = VMR_FIELD_U64;
+	}
+
+	if (MAX_ORDER > BUDDYINFO_ORDERS)
+		vmr_printk("Only orders below %d are in binary records\n",
+				BUDDYINFO_ORDERS);
+	return 0;
+}
+
+/**
+ * printp_buddyinfo_header - Print the line starting a buddyinfo report
+ *
+ * Every report starts with this so it counts the calls of printp_buddyinfo
+ */
+static void printp_buddyinfo_header(vmr_desc_t *testinfo, int procentry,
+					int attempt, int success)
+{
+	vmr_overhead_count(VMR_OVH_BUDDYINFO, 1);
+	if (vmrproc_binary(&testinfo[procentry])) {
+		printp_record(&buddyinfo_schema, attempt, success, jiffies);
+		return;
+	}
+
+	printp("Buddyinfo %s attempt %d at jiffy index %lu\n", 
+			success ? "success" : "failed", attempt, jiffies);
+}
+
+/**
+ * printp_buddyinfo_zone - Print the free counts of one zone
+ * @nr_free: Number of free blocks of each order
+ */
+static void printp_buddyinfo_zone(vmr_desc_t *testinfo, int procentry,
+		struct pglist_data *pgdat, struct zone *zone,
+		unsigned long *nr_free)
+{
+	unsigned long long values[VMR_RECORD_MAXFIELDS];
+	int order;
+
+	if (vmrproc_binary(&testinfo[procentry])) {
+		values[0] = pgdat->node_id;
+		values[1] = zone - pgdat->node_zones;
+		for (order = 0; order < BUDDYINFO_ORDERS; ++order)
+			values[order + 2] = nr_free[order];
+		if (current->pid == testinfo[procentry].pid)
+			vmrproc_record(&testinfo[procentry],
+					&buddyinfo_zone_schema, values);
+		return;
+	}
+
+	printp("Node %d, zone %8s", pgdat->node_id, zone->name);
+	for (order = 0; order < MAX_ORDER; ++order)
+		printp("%6lu ", nr_free[order]);
+	printp("\n");
+}
+
 #ifdef for_each_rclmtype_order
 int printp_buddyinfo(vmr_desc_t *testinfo, int procentry,
 					int attempt, int success)
@@ -38,8 +123,7 @@ int printp_buddyinfo(vmr_desc_t *testinfo, int procentry,
 	int nid;
 	struct free_area *area;
 	unsigned long nr_free[MAX_ORDER];
-	printp("Buddyinfo %s attempt %d at jiffy index %lu\n", 
-			success ? "success" : "failed", attempt, jiffies);
+	printp_buddyinfo_header(testinfo, procentry, attempt, success);
 
 	for_each_online_node(nid) {
 		pgdat = NODE_DATA(nid);
@@ -49,7 +133,7 @@ int printp_buddyinfo(vmr_desc_t *testinfo, int procentry,
 				continue;
 
 			memset(nr_free, 0, sizeof(nr_free));
-			spin_lock_irqsave(&zone->lock, flags);
+			vmr_lockstat_lock(VMR_LOCK_ZONE, spin_lock_irqsave(&zone->lock, flags));
 #ifdef BITS_PER_RCLM_TYPE
 			for_each_rclmtype_order(t, order) {
 				area = &(zone->free_area_lists[order]);
@@ -61,12 +145,10 @@ int printp_buddyinfo(vmr_desc_t *testinfo, int procentry,
 				nr_free[order] += area->nr_free;
 			}
 #endif
-			spin_unlock_irqrestore(&zone->lock, flags);
+			vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 
-			printp("Node %d, zone %8s", pgdat->node_id, zone->name);
-			for (order = 0; order < MAX_ORDER; ++order)
-				printp("%6lu ", nr_free[order]);
-			printp("\n");
+			printp_buddyinfo_zone(testinfo, procentry, pgdat,
+						zone, nr_free);
 		}
 	};
 
@@ -83,8 +165,7 @@ int printp_buddyinfo(vmr_desc_t *testinfo, int procentry,
 	int order;
 	int nid;
 	unsigned long nr_free[MAX_ORDER];
-	printp("Buddyinfo %s attempt %d at jiffy index %lu\n", 
-			success ? "success" : "failed", attempt, jiffies);
+	printp_buddyinfo_header(testinfo, procentry, attempt, success);
 
 	for_each_online_node(nid) {
 		pgdat = NODE_DATA(nid);
@@ -102,15 +183,13 @@ int printp_buddyinfo(vmr_desc_t *testinfo, int procentry,
 			 * printp is known to have oopsed, so don't use it with
 			 * a spinlock
 			 */
-			spin_lock_irqsave(&zone->lock, flags);
+			vmr_lockstat_lock(VMR_LOCK_ZONE, spin_lock_irqsave(&zone->lock, flags));
 			for (order = 0; order < MAX_ORDER; ++order)
 				nr_free[order] = zone->free_area[order].nr_free;
-			spin_unlock_irqrestore(&zone->lock, flags);
+			vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 
-			printp("Node %d, zone %8s", pgdat->node_id, zone->name);
-			for (order = 0; order < MAX_ORDER; ++order)
-				printp("%6lu ", nr_free[order]);
-			printp("\n");
+			printp_buddyinfo_zone(testinfo, procentry, pgdat,
+						zone, nr_free);
 		}
 	};
 
@@ -119,3 +198,8 @@ int printp_buddyinfo(vmr_desc_t *testinfo, int procentry,
 #endif
 
 EXPORT_SYMBOL(printp_buddyinfo);
+
+/* Module init */
+#define VMR_INIT_PROVIDED buddyinfo_init
+#define VMR_MODULE_HAS_NO_PROC_ENTRIES
+#include "../init/init.c"
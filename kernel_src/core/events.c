@@ -0,0 +1,255 @@
+/*
+ * events - Per-CPU event rings
+ *
+ * printp serialises every test behind the one PID allowed to write a proc
+ * buffer. These functions let any number of threads log fixed size events
+ * into a ring for the CPU they are running on. Logging takes no lock and
+ * touches no shared cache line. When the test completes, the writer of
+ * the proc buffer merges the rings in timestamp order and prints every
+ * event with printp. If VMR_PRINTMANY is set for the test, the PID that
+ * logged the event is printed at the start of every line.
+ *
+ * See include/vmr_events.h for how to use them
+ */
+#include <linux/version.h>
+#include <linux/config.h>
+#include <linux/fs.h>
+#include <linux/types.h>
+#include <linux/proc_fs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/interrupt.h>
+#include <asm/uaccess.h>
+
+#include <vmregress_core.h>
+#include <procprint.h>
+#include <nanotime.h>
+#include <vmr_events.h>
+
+#define MODULENAME "vmr_events"
+/* Module Description */
+MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
+MODULE_DESCRIPTION("VM Regress per-CPU event rings");
+MODULE_LICENSE("GPL");
+
+/**
+ * vmrproc_allocevents - Allocate event rings for a test
+ * @desc: The test descriptor
+ * @nr_events: The number of events each CPU can hold
+ *
+ * Any existing rings are freed. Rings are allocated for every online CPU.
+ * Events logged on a CPU that came online later are counted in nocpu and
+ * reported as lost by the next flush. The rings are freed with
+ * vmrproc_freeevents or with the proc buffer
+ */
+int vmrproc_allocevents(vmr_desc_t *desc, unsigned long nr_events)
+{
+	struct vmr_eventring *ring;
+	struct vmr_eventcpu *cpuring;
+	unsigned long size;
+	int cpu;
+
+	vmrproc_freeevents(desc);
+	if (!nr_events)
+		return 0;
+
+	ring = kmalloc(sizeof(struct vmr_eventring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+	memset(ring, 0, sizeof(struct vmr_eventring));
+	ring->nr_events = nr_events;
+	cpus_clear(ring->cpus);
+	atomic_set(&ring->nocpu, 0);
+
+	size = sizeof(struct vmr_eventcpu) + nr_events * sizeof(struct vmr_event);
+	for_each_online_cpu(cpu) {
+		cpuring = vmalloc(size);
+		if (!cpuring)
+			goto nomem;
+		memset(cpuring, 0, sizeof(struct vmr_eventcpu));
+		ring->cpu[cpu] = cpuring;
+		cpu_set(cpu, ring->cpus);
+	}
+
+	/* Loggers may see the ring as soon as it is published */
+	smp_wmb();
+	desc->events = ring;
+	return 0;
+
+nomem:
+	vmr_printk("Failed to allocate event ring of %lu events\n", nr_events);
+	for_each_cpu_mask(cpu, ring->cpus)
+		vfree(ring->cpu[cpu]);
+	kfree(ring);
+	return -ENOMEM;
+}
+
+/**
+ * vmr_event_log - Record an event in the ring for this CPU
+ * @desc: The test descriptor
+ * @format: Format to print the event with when it is flushed
+ * @args: VMR_EVENT_ARGS arguments for format
+ *
+ * Normally called with the printp_event macro. Interrupts are disabled
+ * rather than taking a lock so the event is not interleaved with one
+ * logged from an interrupt on the same CPU. If the ring is full or the
+ * CPU has no ring, the event is dropped and counted
+ */
+void vmr_event_log(vmr_desc_t *desc, const char *format,
+		unsigned long long *args)
+{
+	struct vmr_eventring *ring = desc->events;
+	struct vmr_eventcpu *cpuring;
+	struct vmr_event *event;
+	unsigned long flags;
+	int cpu;
+
+	if (!ring)
+		return;
+
+	local_irq_save(flags);
+	cpu = smp_processor_id();
+	cpuring = ring->cpu[cpu];
+	if (!cpuring) {
+		atomic_inc(&ring->nocpu);
+		goto out;
+	}
+
+	if (cpuring->head - cpuring->tail >= ring->nr_events) {
+		cpuring->lost++;
+		goto out;
+	}
+
+	event = &cpuring->events[cpuring->head % ring->nr_events];
+	event->timestamp = vmr_clock_ns();
+	event->format = format;
+	event->pid = current->pid;
+	event->cpu = cpu;
+	memcpy(event->args, args, sizeof(event->args));
+
+	/* The event must be visible before the flusher sees the new head */
+	smp_wmb();
+	cpuring->head++;
+
+out:
+	local_irq_restore(flags);
+}
+
+/* Returns the oldest event of a CPU not flushed yet */
+static inline struct vmr_event *vmr_event_tail(struct vmr_eventring *ring,
+		int cpu)
+{
+	struct vmr_eventcpu *cpuring = ring->cpu[cpu];
+
+	return &cpuring->events[cpuring->tail % ring->nr_events];
+}
+
+/**
+ * vmr_event_siftdown - Restore the merge heap below an entry
+ * @ring: The event rings
+ * @i: Index of the entry that may be newer than its children
+ * @nr: Number of CPUs in the heap
+ */
+static void vmr_event_siftdown(struct vmr_eventring *ring, int i, int nr)
+{
+	int *heap = ring->heap;
+	int child, tmp;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= nr)
+			break;
+		if (child + 1 < nr &&
+		    vmr_event_tail(ring, heap[child + 1])->timestamp <
+		    vmr_event_tail(ring, heap[child])->timestamp)
+			child++;
+		if (vmr_event_tail(ring, heap[i])->timestamp <=
+		    vmr_event_tail(ring, heap[child])->timestamp)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+/**
+ * vmrproc_flushevents - Print all logged events to the proc buffer
+ * @desc: The test descriptor
+ *
+ * The per-CPU rings are merged in timestamp order with a heap of the CPUs
+ * that have events so each event costs O(log CPUs). The caller must be
+ * the writer of the proc buffer. Events logged while the flush is in
+ * progress are left for the next flush. Events lost since the last flush
+ * are counted at the end. Returns the number of events printed
+ */
+unsigned long vmrproc_flushevents(vmr_desc_t *desc)
+{
+	struct vmr_eventring *ring = desc->events;
+	struct vmr_eventcpu *cpuring;
+	struct vmr_event *event;
+	unsigned long printed = 0, lost = 0, nocpu;
+	int cpu, i, nr = 0;
+
+	if (!ring)
+		return 0;
+
+	/* Snapshot how far each CPU has got */
+	for_each_cpu_mask(cpu, ring->cpus) {
+		cpuring = ring->cpu[cpu];
+		cpuring->flushhead = cpuring->head;
+		cpuring->flushlost = cpuring->lost;
+		lost += cpuring->flushlost - cpuring->reported;
+	}
+	nocpu = atomic_read(&ring->nocpu);
+	smp_rmb();
+
+	for_each_cpu_mask(cpu, ring->cpus) {
+		cpuring = ring->cpu[cpu];
+		if (cpuring->tail != cpuring->flushhead)
+			ring->heap[nr++] = cpu;
+	}
+	for (i = nr / 2 - 1; i >= 0; i--)
+		vmr_event_siftdown(ring, i, nr);
+
+	while (nr) {
+		cpu = ring->heap[0];
+		cpuring = ring->cpu[cpu];
+		event = vmr_event_tail(ring, cpu);
+
+		if (desc->flags & VMR_PRINTMANY)
+			vmr_snprintf(desc, "%d ", event->pid);
+		vmr_snprintf(desc, event->format,
+				event->args[0], event->args[1],
+				event->args[2], event->args[3]);
+		printed++;
+
+		/* The slot may be reused once tail moves past it */
+		smp_mb();
+		cpuring->tail++;
+		if (cpuring->tail == cpuring->flushhead)
+			ring->heap[0] = ring->heap[--nr];
+		vmr_event_siftdown(ring, 0, nr);
+		check_resched_nocount();
+	}
+
+	/* Lost events are only reported by the flush that finds them */
+	for_each_cpu_mask(cpu, ring->cpus)
+		ring->cpu[cpu]->reported = ring->cpu[cpu]->flushlost;
+	if (lost)
+		vmr_snprintf(desc, "Events lost as rings were full: %lu\n", lost);
+	if (nocpu != ring->nocpu_reported)
+		vmr_snprintf(desc, "Events lost on CPUs without a ring: %lu\n",
+				nocpu - ring->nocpu_reported);
+	ring->nocpu_reported = nocpu;
+
+	return printed;
+}
+
+EXPORT_SYMBOL(vmrproc_allocevents);
+EXPORT_SYMBOL(vmr_event_log);
+EXPORT_SYMBOL(vmrproc_flushevents);
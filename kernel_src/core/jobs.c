@@ -0,0 +1,95 @@
+/*
+ * jobs
+ *
+ * Tests normally run inside the write to their proc entry so the writer
+ * is stuck in the kernel until the test completes and only one test may
+ * be run at a time by a shell. Writing parameters with a leading & such
+ * as
+ *
+ *   echo "& 1 100" > /proc/vmregress/test_fault_zero
+ *
+ * starts the test as a job instead. The first line of the output of the
+ * entry is then "Job <id>" so the id can be read back from the entry
+ * as soon as the write returns. This module provides
+ * /proc/vmregress/jobs which lists every job with its state and how long
+ * it has been running. Writing to it controls the jobs
+ *
+ *   cancel <id>  Send SIGKILL to a running job
+ *   reap         Forget about finished jobs
+ *
+ * The jobs themselves are run by vmregress_core so test modules do not
+ * depend on this module
+ */
+#include <linux/version.h>
+#include <linux/config.h>
+#include <linux/fs.h>
+#include <linux/types.h>
+#include <linux/proc_fs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <asm/uaccess.h>
+
+#include <vmregress_core.h>
+#include <procprint.h>
+
+#define MODULENAME "jobs"
+#define NUM_PROC_ENTRIES 1
+#define MAX_JOBS_WRITE 32
+
+MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
+MODULE_DESCRIPTION("VM Regress job control");
+MODULE_LICENSE("GPL");
+
+int jobs_write_proc(struct file *file, const char *buf,
+		unsigned long count, void *data);
+
+static vmr_desc_t testinfo[] = {
+	VMR_DESC_INIT(0, MODULENAME, vmr_read_proc, jobs_write_proc)
+};
+
+/**
+ * jobs_getproc - Print the status of every job
+ * @procentry: Index into testinfo
+ */
+void jobs_getproc(int procentry) {
+	vmrproc_openbuffer(&testinfo[procentry]);
+	vmr_job_printall(&testinfo[procentry]);
+}
+
+/**
+ * jobs_write_proc - Cancel or reap jobs
+ * @file: unused
+ * @buf: user buffer
+ * @count: data len
+ * @data: unused
+ */
+int jobs_write_proc(struct file *file, const char *buf,
+		unsigned long count, void *data)
+{
+	char readbuf[MAX_JOBS_WRITE];
+	int ret;
+
+	if (count >= MAX_JOBS_WRITE)
+		return -EINVAL;
+	if (copy_from_user(readbuf, buf, count))
+		return -EFAULT;
+	readbuf[count] = '\0';
+
+	if (!strncmp(readbuf, "cancel ", 7)) {
+		ret = vmr_job_cancel(vmr_strtol(readbuf + 7, NULL, 10));
+		if (ret)
+			return ret;
+	} else if (!strncmp(readbuf, "reap", 4)) {
+		vmr_job_reap();
+	} else {
+		vmr_printk("Unknown command %s\n", readbuf);
+		return -EINVAL;
+	}
+
+	return count;
+}
+
+#define VMR_READ_PROC_CALLBACK jobs_getproc
+#include "../init/proc.c"
+#include "../init/init.c"
@@ -0,0 +1,241 @@
+/*
+ * overhead
+ *
+ * Measures what the instrumentation primitives of VM Regress cost so the
+ * time a test spends reporting what it is doing can be told apart from
+ * the time spent in the VM. Reading /proc/vmregress/overhead times a
+ * batch of calls of each primitive, prints the cost of one call and
+ * records it for vmr_overhead_print. Tests in modules loaded with
+ * vmr_overhead_report=1 then print how long they spent in
+ * instrumentation. See vmr_overhead.h
+ *
+ * The primitives are measured in the order of VMR_OVH_* so the cost of
+ * the primitives a primitive calls itself, such as the printp calls of
+ * printp_buddyinfo, are known and subtracted. printp and records are
+ * measured in the output format of this entry so load this module with
+ * vmr_binary=1 to measure the cost of binary output
+ */
+#include <linux/version.h>
+#include <linux/config.h>
+#include <linux/fs.h>
+#include <linux/types.h>
+#include <linux/proc_fs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <asm/mman.h>
+#include <asm/uaccess.h>
+
+#include <vmregress_core.h>
+#include <procprint.h>
+#include <pagetable.h>
+#include <nanotime.h>
+
+#define MODULENAME "overhead"
+#define NUM_PROC_ENTRIES 1
+
+#define OVERHEAD_LOOPS		1000	/* Calls timed of cheap primitives */
+#define OVERHEAD_BUDDYLOOPS	50	/* Calls of printp_buddyinfo */
+#define OVERHEAD_PTEPAGES	512	/* Pages mapped to walk */
+#define OVERHEAD_PTELOOPS	8	/* Walks of the mapped pages */
+
+MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
+MODULE_DESCRIPTION("VM Regress instrumentation overhead");
+MODULE_LICENSE("GPL");
+
+static vmr_desc_t testinfo[] = {
+	VMR_DESC_INIT(0, MODULENAME, vmr_read_proc, NULL)
+};
+
+/* The primitives print to this buffer while they are timed */
+static vmr_desc_t scratch = VMR_DESC_INIT(0, "overhead_scratch", NULL, NULL);
+
+/* A record of a typical size for timing vmr_record */
+static struct vmr_field overhead_fields[] = {
+	{ "pass",	VMR_FIELD_U64 },
+	{ "jiffies",	VMR_FIELD_U64 },
+	{ "pages",	VMR_FIELD_U64 },
+	{ "time",	VMR_FIELD_U64 },
+};
+static struct vmr_schema overhead_schema = VMR_SCHEMA("overhead_sample", overhead_fields);
+
+/* Binary record of the cost of one primitive */
+static struct vmr_field overhead_cost_fields[] = {
+	{ "primitive",	VMR_FIELD_U64 },
+	{ "calls",	VMR_FIELD_U64 },
+	{ "cost",	VMR_FIELD_U64 },
+};
+static struct vmr_schema overhead_cost_schema = VMR_SCHEMA("overhead_cost", overhead_cost_fields);
+
+/**
+ * overhead_nullptes - A forall_ptes_mm callback that does nothing
+ */
+static unsigned long overhead_nullptes(pte_t *ptes, int nr, unsigned long addr,
+		unsigned long size, void *data)
+{
+	return nr;
+}
+
+/**
+ * overhead_cost - Work out the cost of one call of a primitive
+ * @type: The primitive timed
+ * @ns: How long the calls took
+ * @before: Calls of every primitive before the timing started
+ * @calls: Returns the number of calls of the primitive
+ *
+ * The cost of the other primitives called while timing is subtracted.
+ * The cost is never 0 so a primitive is known to be measured
+ */
+static unsigned long overhead_cost(int type, unsigned long long ns,
+		unsigned long *before, unsigned long *calls)
+{
+	unsigned long after[VMR_OVH_MAX];
+	unsigned long long nested;
+	int other;
+
+	vmr_overhead_read(after);
+	for (other = 0; other < VMR_OVH_MAX; other++) {
+		if (other == type)
+			continue;
+		nested = (unsigned long long)(after[other] - before[other]) *
+				vmr_overhead_cost[other];
+		ns = ns > nested ? ns - nested : 0;
+	}
+
+	*calls = after[type] - before[type];
+	if (!*calls)
+		return 0;
+
+	do_div(ns, *calls);
+	return ns ? (unsigned long)ns : 1;
+}
+
+/**
+ * overhead_walk - Time forall_ptes_mm on a region of present pages
+ * @sched_count: Count of schedule() calls
+ *
+ * Returns the time taken or 0 if the region could not be set up
+ */
+static unsigned long long overhead_walk(unsigned long *sched_count)
+{
+	unsigned long addr, len, offset;
+	unsigned long long start, ns;
+	int i;
+
+	if (!current->mm)
+		return 0;
+
+	len = OVERHEAD_PTEPAGES * PAGE_SIZE;
+	addr = do_mmap(NULL, 0, len, PROT_WRITE | PROT_READ,
+			MAP_PRIVATE | MAP_ANONYMOUS, 0);
+	if (addr & ~PAGE_MASK)
+		return 0;
+
+	/* Make every page present */
+	for (offset = 0; offset < len; offset += PAGE_SIZE)
+		if (put_user(0, (char *)(addr + offset)))
+			break;
+
+	start = vmr_clock_ns();
+	for (i = 0; i < OVERHEAD_PTELOOPS; i++)
+		forall_ptes_mm(current->mm, addr, len, sched_count,
+				NULL, overhead_nullptes);
+	ns = vmr_clock_ns() - start;
+
+	do_munmap(current->mm, addr, len);
+	return ns;
+}
+
+/**
+ * overhead_calibrate - Time every primitive and record its cost
+ * @calls: Returns the number of calls timed of each primitive
+ */
+static int overhead_calibrate(unsigned long *calls)
+{
+	unsigned long before[VMR_OVH_MAX];
+	unsigned long sched_count = 0;
+	unsigned long long start, ns;
+	int type, i;
+
+	scratch.flags = testinfo[0].flags & VMR_BINARY;
+	if (vmrproc_allocbuffer(1, &scratch))
+		return -ENOMEM;
+	if (!vmrproc_openbuffer(&scratch)) {
+		vmrproc_freebuffer(&scratch);
+		return -EBUSY;
+	}
+
+	for (type = 0; type < VMR_OVH_MAX; type++) {
+		vmr_overhead_read(before);
+		start = vmr_clock_ns();
+
+		switch (type) {
+		case VMR_OVH_RESCHED:
+			for (i = 0; i < OVERHEAD_LOOPS; i++)
+				check_resched(sched_count);
+			ns = vmr_clock_ns() - start;
+			break;
+		case VMR_OVH_PRINTP:
+			for (i = 0; i < OVERHEAD_LOOPS; i++) {
+				vmr_snprintf(&scratch, "Pass %d at jiffy %lu\n", i, jiffies);
+			}
+			ns = vmr_clock_ns() - start;
+			break;
+		case VMR_OVH_RECORD:
+			for (i = 0; i < OVERHEAD_LOOPS; i++) {
+				vmr_record(&scratch, &overhead_schema, i, jiffies, 0, 0);
+			}
+			ns = vmr_clock_ns() - start;
+			break;
+		case VMR_OVH_BUDDYINFO:
+			for (i = 0; i < OVERHEAD_BUDDYLOOPS; i++)
+				printp_buddyinfo(&scratch, 0, i, 1);
+			ns = vmr_clock_ns() - start;
+			break;
+		default:
+			ns = overhead_walk(&sched_count);
+			break;
+		}
+
+		vmr_overhead_cost[type] = overhead_cost(type, ns, before, &calls[type]);
+	}
+
+	vmrproc_closebuffer(&scratch);
+	vmrproc_freebuffer(&scratch);
+	return 0;
+}
+
+/**
+ * overhead_getproc - Measure and print the cost of every primitive
+ * @procentry: Index into testinfo
+ */
+void overhead_getproc(int procentry) {
+	unsigned long calls[VMR_OVH_MAX];
+	int type, error;
+
+	if (!vmrproc_openbuffer(&testinfo[procentry]))
+		return;
+
+	error = overhead_calibrate(calls);
+	if (error) {
+		printp("Failed to measure instrumentation overhead: %d\n", error);
+		return;
+	}
+
+	printp("Instrumentation cost (ns per call)\n");
+	for (type = 0; type < VMR_OVH_MAX; type++) {
+		if (vmrproc_binary(&testinfo[procentry])) {
+			printp_record(&overhead_cost_schema, type, calls[type],
+					vmr_overhead_cost[type]);
+		} else {
+			printp("o %-10s calls %-8lu cost %lu\n",
+					vmr_overhead_names[type], calls[type],
+					vmr_overhead_cost[type]);
+		}
+	}
+}
+
+#define VMR_READ_PROC_CALLBACK overhead_getproc
+#include "../init/proc.c"
+#include "../init/init.c"
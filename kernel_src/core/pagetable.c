@@ -6,11 +6,15 @@
  * is three main functions provided. They are all pretty expensive so use
  * with care
  *
+ * vmr_mm_get      - Pins the mm of any process and locks it for walking
  * get_struct_page - Returns a struct page for a given address
- * forall_pages_mm - This calls a callback function for every pte within a
- *                   given address range. It will count how many times 
- *                   schedule() was called if requested
- * countpages_mm   - This is a simple use of forall_pages_mm to count how
+ * forall_ptes_mm  - This calls a callback function for every pte table
+ *                   within a given address range, passing it a copy of
+ *                   the ptes. It will count how many times schedule()
+ *                   was called if requested
+ * forall_ptes_mm_parallel - forall_ptes_mm split across many CPUs
+ * forall_pte_mm   - The same but the callback is called for every pte
+ * countpages_mm   - This is a simple use of forall_ptes_mm to count how
  *                   many pages are present within a given addresss range
  * 
  * Mel Gorman 2002
@@ -24,8 +28,14 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/sched.h>
+#include <linux/ptrace.h>
+#include <linux/capability.h>
 #include <linux/mmzone.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
 #include <asm/uaccess.h>
 
 /* Module specific */
@@ -41,6 +51,19 @@ MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
 MODULE_DESCRIPTION("Page Table Related Operations");
 MODULE_LICENSE("GPL");
 
+/* Parallel walks. See forall_ptes_mm_parallel */
+static int vmr_walk_workers;
+static int vmr_walk_parallel_mb = 1024;
+MODULE_PARM(vmr_walk_workers, "i");
+MODULE_PARM_DESC(vmr_walk_workers, "Number of CPUs countpages_mm and vmr_printmap walk large ranges on. 0 walks serially");
+MODULE_PARM(vmr_walk_parallel_mb, "i");
+MODULE_PARM_DESC(vmr_walk_parallel_mb, "Ranges smaller than this many MB are always walked serially");
+
+/* Page maps. See vmr_printmap */
+static int vmr_map_bits = VMR_MAP_PRESENT;
+MODULE_PARM(vmr_map_bits, "i");
+MODULE_PARM_DESC(vmr_map_bits, "Bits of state printed for every page in page maps, 1, 2 or 4. See pagetable.h");
+
 /* RMAP uses pte_offset_map instead of pte_offset. */
 #ifdef _I386_RMAP_H
 #include <linux/highmem.h>
@@ -48,17 +71,61 @@ MODULE_LICENSE("GPL");
 #endif
 
 /**
- * get_struct_page - Gets a struct page for a particular address
- * @address - the address of the page we need
+ * vmr_mm_get - Pin the mm of a process and lock it for walking
+ * @pid: The process. 0 is the current process
  *
- * Two versions of this function have to be provided for working
- * between the 2.4 and 2.5 kernels. Rather than littering the
- * function with #defines, there is just two separate copies.
- * Look at the one that is relevant to the kernel you're using
+ * A reference is taken on the mm so it cannot be freed if the process
+ * exits and mmap_sem is taken for reading so its VMAs and page tables
+ * cannot be unmapped during the walk. Another process may only be walked
+ * by a caller that could ptrace it or has CAP_SYS_ADMIN. Returns NULL if
+ * there is no such process, the caller may not walk it or it has no mm,
+ * such as a kernel thread. Release it with vmr_mm_put
  */
-struct page *get_struct_page(unsigned long addr)
+struct mm_struct *vmr_mm_get(pid_t pid)
 {
+	struct task_struct *task;
 	struct mm_struct *mm;
+
+	if (!pid) {
+		mm = get_task_mm(current);
+	} else {
+		read_lock(&tasklist_lock);
+		task = find_task_by_pid(pid);
+		if (task) get_task_struct(task);
+		read_unlock(&tasklist_lock);
+		if (!task) return NULL;
+
+		/* The page map says what another process has touched */
+		if (!ptrace_may_attach(task) && !capable(CAP_SYS_ADMIN)) {
+			put_task_struct(task);
+			return NULL;
+		}
+
+		mm = get_task_mm(task);
+		put_task_struct(task);
+	}
+
+	if (mm) down_read(&mm->mmap_sem);
+	return mm;
+}
+
+/**
+ * vmr_mm_put - Unlock and unpin an mm from vmr_mm_get
+ * @mm: The mm
+ */
+void vmr_mm_put(struct mm_struct *mm)
+{
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+}
+
+/**
+ * get_struct_page_mm - Gets a struct page for an address in an mm
+ * @mm: The mm, from vmr_mm_get
+ * @address - the address of the page we need
+ */
+struct page *get_struct_page_mm(struct mm_struct *mm, unsigned long addr)
+{
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
@@ -66,11 +133,10 @@ struct page *get_struct_page(unsigned long addr)
 	unsigned long pfn;
 	struct page *page=NULL;
 
-	mm = current->mm;
 	/* Is this possible? */
 	if (!mm) return NULL;
 
-	spin_lock(&mm->page_table_lock);
+	vmr_lockstat_lock(VMR_LOCK_PTL, spin_lock(&mm->page_table_lock));
 
 	pgd = pgd_offset(mm, addr);
 	if (!pgd_none(*pgd) && !pgd_bad(*pgd)) {
@@ -97,89 +163,155 @@ struct page *get_struct_page(unsigned long addr)
 		}
 	}
 
-	spin_unlock(&mm->page_table_lock);
+	vmr_lockstat_unlock(VMR_LOCK_PTL, spin_unlock(&mm->page_table_lock));
 	return page;
 }
 
 /**
- * forall_pte_pmd - Excute a function func for all pages within a range
- * @mm: mm been examined
- * @pmd: The PGD been examined
+ * get_struct_page - Gets a struct page for a particular address
+ * @address - the address of the page we need in the current process
+ */
+struct page *get_struct_page(unsigned long addr)
+{
+	struct mm_struct *mm;
+	struct page *page;
+
+	mm = vmr_mm_get(0);
+	if (!mm) return NULL;
+
+	page = get_struct_page_mm(mm, addr);
+	vmr_mm_put(mm);
+	return page;
+}
+
+/*
+ * A PMD or PUD that maps a huge page directly rather than pointing to the
+ * next level of page table. Hugetlb pages on x86 and x86_64 set the PSE
+ * bit in the PMD, or in the PGD on i386 without PAE where the PUD and PMD
+ * are folded into it. Other architectures are walked as before
+ */
+#ifdef _PAGE_PSE
+#define vmr_pmd_huge(pmd)	(pmd_present(pmd) && (pmd_val(pmd) & _PAGE_PSE))
+#define vmr_pud_huge(pud)	((pud_val(pud) & (_PAGE_PRESENT | _PAGE_PSE)) == \
+					(_PAGE_PRESENT | _PAGE_PSE))
+#else
+#define vmr_pmd_huge(pmd)	0
+#define vmr_pud_huge(pud)	0
+#endif
+
+/*
+ * State of one walk by forall_ptes_mm. The PTEs of a table are copied to
+ * ptes while the lock of that table is held and func is called on the
+ * copy after it is dropped
+ */
+struct vmr_ptewalk {
+	struct mm_struct *mm;
+	unsigned long *sched_count;
+	void *data;
+	unsigned long (*func)(pte_t *, int, unsigned long, unsigned long, void *);
+	pte_t *ptes;			/* PTRS_PER_PTE entries */
+};
+
+/**
+ * forall_pte_call - Call func on copied PTEs
+ * @walk: The walk
+ * @nr: The number of PTEs in walk->ptes
+ * @addr: The address of the first
+ * @size: Bytes each maps within the range walked
+ * @visited: How many are not none
+ */
+static inline unsigned long forall_pte_call(struct vmr_ptewalk *walk, int nr,
+		unsigned long addr, unsigned long size, int visited)
+{
+	unsigned long ret;
+
+	/*
+	 * Call schedule if necessary. func() may block or be preempted so
+	 * the sched_count is not guaranteed accurate
+	 */
+	check_resched(*walk->sched_count);
+	ret = walk->func(walk->ptes, nr, addr, size, walk->data);
+
+	vmr_overhead_count(VMR_OVH_PTE, visited);
+	return ret;
+}
+
+/**
+ * forall_pte_huge - Execute a function func for a huge page
+ * @walk: The walk
+ * @entry: The PMD or PUD mapping the huge page, as a PTE
  * @start: The starting address
- * @end: The end address
- * @sched_count: A running count of how many times schedule() was called
- * @data: A pointer to caller data
- * @func: The function to call
- *
- * This function can context switch and/or block.  So whoever
- * calls this had better be certain the mm_struct being examined
- * isn't changing out from underneath us.
+ * @end: The end address, no further than the end of the huge page
  *
- * TODO: increment the mm_struct usage count or things could go very wrong
- *       Probably just lucky up until this point but it probably explains
- *       some hard to reproduce bugs I remember from the dawn of time
-*/
+ * func is passed the entry alone with the part of the huge page between
+ * start and end as its size
+ */
+static inline unsigned long forall_pte_huge(struct vmr_ptewalk *walk,
+		pte_t entry, unsigned long start, unsigned long end)
+{
+	walk->ptes[0] = entry;
+	return forall_pte_call(walk, 1, start, end - start, 1);
+}
 
-/*
- * Again because of the changes in page table walking, a 2.4 and 2.5
- * version is supplied
+/**
+ * forall_pte_pmd - Execute a function func for the PTEs of one PTE table
+ * @walk: The walk
+ * @pmd: The PMD been examined
+ * @start: The starting address
+ * @end: The end address
+ *
+ * The PTEs from start to end, or the end of the table, are copied with
+ * the lock of the table held once. That is the split PTE lock of the
+ * table if the kernel has them and page_table_lock otherwise. If any of
+ * them is not none, func is called once with all of them after the lock
+ * is dropped so it may sleep or fault. Whoever calls this had better be
+ * certain the mm_struct being examined isn't changing out from
+ * underneath us, see forall_ptes_mm
  */
-inline unsigned long forall_pte_pmd(struct mm_struct *mm, pmd_t *pmd, 
-		unsigned long start, unsigned long end, 
-		unsigned long *sched_count,
-		void *data,
-		unsigned long (*func)(pte_t *, unsigned long, void *))
+static inline unsigned long forall_pte_pmd(struct vmr_ptewalk *walk,
+		pmd_t *pmd, unsigned long start, unsigned long end)
 {
-	
-	pte_t *ptep, pte;
+	pte_t *ptep;
+	spinlock_t *ptl;
 	unsigned long pmd_end;
-	unsigned long ret=0;
+	int nr=0;			/* PTEs copied */
+	int visited=0;			/* PTEs that are not none */
 
 	if (pmd_none(*pmd)) return 0;
 
 	pmd_end = (start + PMD_SIZE) & PMD_MASK;
-	if (end > pmd_end) end = pmd_end;
+	if (pmd_end && end > pmd_end) end = pmd_end;
+
+	/* A huge page is one unit rather than a table of PTEs */
+	if (vmr_pmd_huge(*pmd))
+		return forall_pte_huge(walk, *(pte_t *)pmd, start, end);
+	if (pmd_bad(*pmd)) return 0;
 
+	vmr_lockstat_lock(VMR_LOCK_PTL,
+			ptep = pte_offset_map_lock(walk->mm, pmd, start, &ptl));
 	do {
-		preempt_disable();
-		ptep = pte_offset_map(pmd, start);
-		pte = *ptep;
-		pte_unmap(ptep);
-		preempt_enable();
-
-		/* Call the if a PTE is available */
-		if (!pte_none(pte)) {
-
-			/*
-			 * Call schedule if necessary
-			 *	Can func() block or be preempted?
-			 *	It seems the sched_count won't be guarnateed
-			 *	accurate.
-			 */
-			spin_unlock(&mm->page_table_lock);
-			check_resched(sched_count);
-			ret += func(&pte, start, data);
-			spin_lock(&mm->page_table_lock);
-		}
+		walk->ptes[nr] = ptep[nr];
+		if (!pte_none(walk->ptes[nr])) visited++;
+		nr++;
 		start += PAGE_SIZE;
 	} while (start && (start < end));
+	vmr_lockstat_unlock(VMR_LOCK_PTL, pte_unmap_unlock(ptep, ptl));
 
-	return ret;
+	if (!visited) return 0;
+
+	return forall_pte_call(walk, nr, start - nr * PAGE_SIZE, PAGE_SIZE,
+			visited);
 }
 
 /**
  * forall_pte_pud - Execute a function func for all pages within a range
+ * @walk: The walk
  * @pud: The PUD been examined
  * @start: The starting address
  * @end: The end address
- * @sched_count: A running count of how many times schedule() was called
- * @data: Pointer to caller data
- * @func: The function to call
  */
-inline unsigned long forall_pte_pud(struct mm_struct *mm, pud_t *pud, 
-		unsigned long start, unsigned long end, 
-		unsigned long *sched_count, void *data,
-		unsigned long (*func)(pte_t *, unsigned long, void *)) {
+static inline unsigned long forall_pte_pud(struct vmr_ptewalk *walk,
+		pud_t *pud, unsigned long start, unsigned long end) {
 	
 	pmd_t *pmd;
 	unsigned long pud_end;
@@ -187,14 +319,25 @@ inline unsigned long forall_pte_pud(struct mm_struct *mm, pud_t *pud,
 
 	if (pud_none(*pud)) return 0;
 
+	pud_end = (start + PUD_SIZE) & PUD_MASK;
+	if (pud_end && end > pud_end) end = pud_end;
+
+	/* A huge page is one unit rather than a table of PMDs */
+	if (vmr_pud_huge(*pud))
+		return forall_pte_huge(walk, *(pte_t *)pud, start, end);
+
 	pmd = pmd_offset(pud, start);
 	if (!pmd) return 0;
 
-	pud_end = (start + PUD_SIZE) & PUD_MASK;
-	if (end > pud_end) end = pud_end;
-
 	do {
-		if (!pmd_none(*pmd) ) ret += forall_pte_pmd(mm, pmd, start, end, sched_count, data, func);
+		/* Skip to the next PMD that is not none in one step */
+		while (pmd_none(*pmd)) {
+			start = (start + PMD_SIZE) & PMD_MASK;
+			pmd++;
+			if (!start || start >= end) return ret;
+		}
+
+		ret += forall_pte_pmd(walk, pmd, start, end);
 
 		start = (start + PMD_SIZE) & PMD_MASK;
 		pmd++;
@@ -207,17 +350,13 @@ inline unsigned long forall_pte_pud(struct mm_struct *mm, pud_t *pud,
 
 /**
  * forall_pte_pgd - Execute a function func for all pages within a range
+ * @walk: The walk
  * @pgd: The PGD been examined
  * @start: The starting address
  * @end: The end address
- * @sched_count: A running count of how many times schedule() was called
- * @data: Pointer to caller data
- * @func: The function to call
  */
-inline unsigned long forall_pte_pgd(struct mm_struct *mm, pgd_t *pgd, 
-		unsigned long start, unsigned long end, 
-		unsigned long *sched_count, void *data,
-		unsigned long (*func)(pte_t *, unsigned long, void *)) {
+static inline unsigned long forall_pte_pgd(struct vmr_ptewalk *walk,
+		pgd_t *pgd, unsigned long start, unsigned long end) {
 	
 	pud_t *pud;
 	unsigned long pgd_end;
@@ -229,10 +368,17 @@ inline unsigned long forall_pte_pgd(struct mm_struct *mm, pgd_t *pgd,
 	if (!pud) return 0;
 
 	pgd_end = (start + PGDIR_SIZE) & PGDIR_MASK;
-	if (end > pgd_end) end = pgd_end;
+	if (pgd_end && end > pgd_end) end = pgd_end;
 
 	do {
-		if (!pud_none(*pud) ) ret += forall_pte_pud(mm, pud, start, end, sched_count, data, func);
+		/* Skip to the next PUD that is not none in one step */
+		while (pud_none(*pud)) {
+			start = (start + PUD_SIZE) & PUD_MASK;
+			pud++;
+			if (!start || start >= end) return ret;
+		}
+
+		ret += forall_pte_pud(walk, pud, start, end);
 
 		start = (start + PUD_SIZE) & PUD_MASK;
 		pud++;
@@ -242,23 +388,42 @@ inline unsigned long forall_pte_pgd(struct mm_struct *mm, pgd_t *pgd,
 }
 
 /**
- * forall_pte_mm - Execute a function func for all pages within a range
+ * forall_ptes_mm - Execute a function func for every PTE table in a range
  * @mm: The memory area been examined
  * @addr: The starting address
- * @len: The size of the area to count pages in
+ * @len: The size of the area to walk
  * @sched_count: A running count of how many times schedule() was called
  * @data: Pointer to caller data
  * @func: The function to call
  *
- * This function presumes it will be called for an addr and len
- * with a valid vma.
+ * func is called with a copy of up to PTRS_PER_PTE consecutive PTEs of
+ * one PTE table, how many there are, the address of the first, the bytes
+ * each maps and data. Some of them may be none. Tables with only none
+ * PTEs are skipped. A PMD or PUD that maps a huge page is passed alone,
+ * as a PTE, with the bytes of it within the range as its size so callers
+ * know it is huge when the size is not PAGE_SIZE.
  *
+ * Only the lock of each PTE table is taken, once per table, and it is
+ * not held while func runs so it may touch the pages. As in follow_page,
+ * the upper levels are walked without a lock. Tables are only freed with
+ * mmap_sem held for writing so with it held for reading they can be
+ * populated but not taken away. Walks of different tables, such as the
+ * workers of forall_ptes_mm_parallel, do not share a lock at all when
+ * the kernel has split PTE locks.
+ *
+ * This function presumes it will be called for an addr and len
+ * with a valid vma. The caller pins the mm and holds mmap_sem for reading
+ * with vmr_mm_get, unless func faults in pages of the current mm which
+ * takes mmap_sem itself. Returns the sum of what func returned
  */
-unsigned long forall_pte_mm(struct mm_struct *mm, unsigned long addr, 
+unsigned long forall_ptes_mm(struct mm_struct *mm, unsigned long addr, 
 		unsigned long len, unsigned long *sched_count,
 		void *data,
-		unsigned long (*func)(pte_t *, unsigned long, void *)) {
+		unsigned long (*func)(pte_t *, int, unsigned long, unsigned long,
+			void *)) {
 
+	struct vmr_ptewalk walk;
+	unsigned long sched_ignored=0;	/* If the caller does not count */
 	unsigned long ret=0;		/* Page count */
 	unsigned long end;		/* Start and end of a area */
 
@@ -267,17 +432,22 @@ unsigned long forall_pte_mm(struct mm_struct *mm, unsigned long addr,
 	if (!mm) return 0;
 	if (!func) return 0;
 
-	end = addr + len;
+	walk.mm = mm;
+	walk.sched_count = sched_count ? sched_count : &sched_ignored;
+	walk.data = data;
+	walk.func = func;
+	walk.ptes = kmalloc(PTRS_PER_PTE * sizeof(pte_t), GFP_KERNEL);
+	if (!walk.ptes) {
+		vmr_printk("Unable to allocate a PTE table copy\n");
+		return 0;
+	}
 
-	/* Lock page tables */
-	spin_lock(&mm->page_table_lock);
+	end = addr + len;
 
 	/* Cycle through all PGD's */
 	pgd = pgd_offset(mm, addr);
-	if (pgd_none(*pgd)) return 0;
-
 	do {
-		ret += forall_pte_pgd(mm, pgd, addr, end, sched_count, data, func);
+		ret += forall_pte_pgd(&walk, pgd, addr, end);
 		
 		/* Move to next PGD */
 		addr = (addr + PGDIR_SIZE) & PGDIR_MASK;
@@ -285,27 +455,263 @@ unsigned long forall_pte_mm(struct mm_struct *mm, unsigned long addr,
 
 	} while (addr && (addr < end));
 
-	spin_unlock(&mm->page_table_lock);
+	kfree(walk.ptes);
+	return ret;
+}
+
+/*
+ * A parallel walk. The range is cut into chunks of chunk bytes from addr
+ * which the workers take in turn so a sparse part of the range does not
+ * leave one worker with all the work
+ */
+struct vmr_parwalk {
+	struct mm_struct *mm;
+	unsigned long addr;
+	unsigned long len;
+	unsigned long chunk;		/* Multiple of PMD_SIZE */
+	unsigned long nr_chunks;
+	atomic_t next;			/* Next chunk to walk */
+	void *data;
+	unsigned long (*func)(pte_t *, int, unsigned long, unsigned long,
+			void *);
+
+	spinlock_t lock;		/* Protects the results */
+	unsigned long ret;		/* Sum of what func returned */
+	unsigned long sched_count;	/* Sum of the workers' counts */
+
+	struct completion done;		/* A worker exited */
+};
+
+/* A worker of a parallel walk and the CPU it runs on */
+struct vmr_parworker {
+	struct vmr_parwalk *walk;
+	int cpu;
+};
+
+/**
+ * forall_ptes_chunks - Walk chunks of a parallel walk until none are left
+ * @walk: The parallel walk
+ *
+ * The results are added to those of the walk
+ */
+static void forall_ptes_chunks(struct vmr_parwalk *walk)
+{
+	unsigned long ret=0;
+	unsigned long sched_count=0;
+	unsigned long chunk, start, len;
+
+	while ((chunk = atomic_inc_return(&walk->next) - 1) < walk->nr_chunks) {
+		start = walk->addr + chunk * walk->chunk;
+		len = min(walk->chunk, walk->addr + walk->len - start);
+		ret += forall_ptes_mm(walk->mm, start, len, &sched_count,
+				walk->data, walk->func);
+	}
+
+	spin_lock(&walk->lock);
+	walk->ret += ret;
+	walk->sched_count += sched_count;
+	spin_unlock(&walk->lock);
+}
+
+/**
+ * forall_ptes_worker - Thread of one worker of a parallel walk
+ * @data: The vmr_parworker. It is freed here
+ */
+static int forall_ptes_worker(void *data)
+{
+	struct vmr_parworker *worker = data;
+	struct vmr_parwalk *walk = worker->walk;
+
+	daemonize("vmr_walk/%d", worker->cpu);
+	set_cpus_allowed(current, cpumask_of_cpu(worker->cpu));
+	kfree(worker);
+
+	forall_ptes_chunks(walk);
+	complete_and_exit(&walk->done, 0);
+}
+
+/**
+ * forall_ptes_mm_parallel - forall_ptes_mm on many CPUs at once
+ * @mm: The memory area been examined
+ * @addr: The starting address
+ * @len: The size of the area to walk
+ * @sched_count: A running count of how many times schedule() was called
+ * @workers: The number of CPUs to walk on, the caller's one included
+ * @data: Pointer to caller data
+ * @func: The function to call
+ *
+ * The range is cut into chunks of whole PMDs from addr and a kernel
+ * thread bound to each of workers - 1 other online CPUs walks chunks
+ * alongside the caller. func is called as by forall_ptes_mm but from
+ * many threads at once for different parts of the range and from
+ * threads with no mm of their own. It must be safe to call like that,
+ * so it cannot touch the pages. Latencies recorded in a vmr_histogram
+ * are merged as usual as every CPU has its own instance. Since chunks
+ * are whole PMDs from addr, callbacks that mark a map of 4 pages a
+ * character such as vmr_printmap never share a character
+ *
+ * Returns the sum of what func returned once every worker is done. The
+ * schedule() counts of the workers are added to sched_count. If fewer
+ * threads can be started the walk is shared by those that were
+ */
+unsigned long forall_ptes_mm_parallel(struct mm_struct *mm, unsigned long addr,
+		unsigned long len, unsigned long *sched_count, int workers,
+		void *data,
+		unsigned long (*func)(pte_t *, int, unsigned long, unsigned long,
+			void *)) {
+
+	struct vmr_parwalk walk;
+	struct vmr_parworker *worker;
+	int cpu, started=0;
+
+	if (!mm) return 0;
+	if (!func) return 0;
+
+	if (workers > num_online_cpus())
+		workers = num_online_cpus();
+	if (workers <= 1 || len <= PMD_SIZE)
+		return forall_ptes_mm(mm, addr, len, sched_count, data, func);
+
+	/* A few chunks a worker so they finish close together */
+	walk.mm = mm;
+	walk.addr = addr;
+	walk.len = len;
+	walk.chunk = ALIGN(len / (workers * 4), PMD_SIZE);
+	if (!walk.chunk) walk.chunk = PMD_SIZE;
+	walk.nr_chunks = (len + walk.chunk - 1) / walk.chunk;
+	atomic_set(&walk.next, 0);
+	walk.data = data;
+	walk.func = func;
+	spin_lock_init(&walk.lock);
+	walk.ret = 0;
+	walk.sched_count = 0;
+	init_completion(&walk.done);
+
+	/* Start a worker on every other CPU until there are enough */
+	for_each_online_cpu(cpu) {
+		if (started == workers - 1)
+			break;
+		if (cpu == raw_smp_processor_id())
+			continue;
+
+		worker = kmalloc(sizeof(struct vmr_parworker), GFP_KERNEL);
+		if (!worker)
+			break;
+		worker->walk = &walk;
+		worker->cpu = cpu;
+		if (kernel_thread(forall_ptes_worker, worker,
+					CLONE_FS | CLONE_FILES) < 0) {
+			kfree(worker);
+			break;
+		}
+		started++;
+	}
+
+	/* The caller walks too and then waits for the others */
+	forall_ptes_chunks(&walk);
+	while (started--)
+		wait_for_completion(&walk.done);
+
+	if (sched_count)
+		*sched_count += walk.sched_count;
+	return walk.ret;
+}
+
+/*
+ * forall_ptes_auto - forall_ptes_mm or forall_ptes_mm_parallel
+ *
+ * Ranges of vmr_walk_parallel_mb or more are walked on vmr_walk_workers
+ * CPUs. func must be safe to call from a parallel walk
+ */
+static unsigned long forall_ptes_auto(struct mm_struct *mm, unsigned long addr,
+		unsigned long len, unsigned long *sched_count, void *data,
+		unsigned long (*func)(pte_t *, int, unsigned long, unsigned long,
+			void *)) {
+
+	if (vmr_walk_workers > 1 && (len >> 20) >= vmr_walk_parallel_mb)
+		return forall_ptes_mm_parallel(mm, addr, len, sched_count,
+				vmr_walk_workers, data, func);
+
+	return forall_ptes_mm(mm, addr, len, sched_count, data, func);
+}
+
+/* Caller of forall_pte_mm. See forall_pte_batch */
+struct vmr_pte_caller {
+	void *data;
+	unsigned long (*func)(pte_t *, unsigned long, void *);
+};
+
+/*
+ * forall_pte_batch - Call a forall_pte_mm callback for each PTE in a batch
+ */
+static unsigned long forall_pte_batch(pte_t *ptes, int nr,
+		unsigned long addr, unsigned long size, void *data)
+{
+	struct vmr_pte_caller *caller = data;
+	unsigned long ret=0;
+	int i;
+
+	for (i = 0; i < nr; i++, addr += size) {
+		if (!pte_none(ptes[i]))
+			ret += caller->func(&ptes[i], addr, caller->data);
+	}
 
 	return ret;
 }
 
 /**
- * ispage_present - Returns 1 if a pte is present in memory
- * @pte: The pte been examined
- * @addr: The address the pte is at (unused)
+ * forall_pte_mm - Execute a function func for all pages within a range
+ * @mm: The memory area been examined
+ * @addr: The starting address
+ * @len: The size of the area to count pages in
+ * @sched_count: A running count of how many times schedule() was called
+ * @data: Pointer to caller data
+ * @func: The function to call
+ *
+ * func is called for a copy of every PTE that is not none and once for
+ * each huge page. It is built on forall_ptes_mm which should be used
+ * instead where a callback can handle a whole table at once
+ */
+unsigned long forall_pte_mm(struct mm_struct *mm, unsigned long addr, 
+		unsigned long len, unsigned long *sched_count,
+		void *data,
+		unsigned long (*func)(pte_t *, unsigned long, void *)) {
+
+	struct vmr_pte_caller caller;
+
+	if (!func) return 0;
+
+	caller.data = data;
+	caller.func = func;
+	return forall_ptes_mm(mm, addr, len, sched_count, &caller,
+			forall_pte_batch);
+}
+
+/**
+ * count_present - Returns the number of present pages in a batch
+ * @ptes: The ptes been examined
+ * @nr: The number of ptes
+ * @addr: The address the first pte is at (unused)
+ * @size: Bytes each pte maps
  * @data: Pointer to user data (unused)
  *
- * This is a callback function for forall_pages_mm() to use.
+ * This is a callback function for forall_ptes_mm() to use. The pages of
+ * a present huge page are all counted
  */
-unsigned long ispage_present(pte_t *pte, unsigned long addr, void *data) {
-	if (pte_present(*pte)) return 1;
-	return 0;
+static unsigned long count_present(pte_t *ptes, int nr, unsigned long addr,
+		unsigned long size, void *data) {
+	unsigned long present=0;
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (pte_present(ptes[i])) present++;
+
+	return present * (size / PAGE_SIZE);
 }
 
 /**
  * countpages_mm - Count how many pages are present in a mm
- * @mm: The mm to count pages in
+ * @mm: The mm to count pages in, from vmr_mm_get
  * @addr: The starting address
  * @len: The length of the address space to check
  * @sched_count: A count of how many times schedule() was called
@@ -313,45 +719,152 @@ unsigned long ispage_present(pte_t *pte, unsigned long addr, void *data) {
 unsigned long countpages_mm(struct mm_struct *mm, unsigned long addr,
 		unsigned long len, unsigned long *sched_count) {
 
-	return forall_pte_mm(mm, addr, len, sched_count, NULL, ispage_present);
+	return forall_ptes_auto(mm, addr, len, sched_count, NULL, count_present);
+}
+
+/*
+ * vmr_mapbits - Bits of state vmr_printmap prints for every page
+ */
+static inline int vmr_mapbits(void)
+{
+	if (vmr_map_bits == VMR_MAP_STATE2 || vmr_map_bits == VMR_MAP_STATE4)
+		return vmr_map_bits;
+	return VMR_MAP_PRESENT;
 }
 
 /**
- * vmr_printpage - Sets the corresponding bit in the proc buffer (callback)
- * @pte: The pte been examined
- * @addr: The address the pte is at
- * @data: Pointer to user data (vmr_desc_t)
+ * vmr_pagestate - Encode the state of the pages mapped by a pte
+ * @pte: The pte
+ * @size: Bytes the pte maps, more than PAGE_SIZE for a huge page
+ * @bits: Bits of state to encode. See VMR_MAP_* in pagetable.h
  *
- * This is the callback for the pagetable walk. It will set the appropriate
- * bit in the proc buffer. The beginning of the map is presumed to be 
- * testinfo->written is pointing to
+ * The struct page is only looked at to tell file from anonymous pages.
+ * It may be freed under us as page_table_lock is not held but then the
+ * page is just reported as what it was
+ */
+static inline int vmr_pagestate(pte_t pte, unsigned long size, int bits)
+{
+	struct page *page;
+	int state;
+
+	if (!pte_present(pte)) {
+		if (bits == VMR_MAP_PRESENT || pte_none(pte))
+			return VMR_PAGE_NONE;
+		if (bits == VMR_MAP_STATE2)
+			return VMR_PAGE2_GONE;
+		return pte_file(pte) ? VMR_PAGE_FILEPTE : VMR_PAGE_SWAPPED;
+	}
+
+	if (bits == VMR_MAP_PRESENT)
+		return 1;
+	if (bits == VMR_MAP_STATE2)
+		return pte_dirty(pte) ? VMR_PAGE2_DIRTY : VMR_PAGE2_PRESENT;
+
+	if (size > PAGE_SIZE) {
+		state = VMR_PAGE_HUGE;
+	} else {
+		state = VMR_PAGE_ANON;
+		if (pfn_valid(pte_pfn(pte))) {
+			page = pte_page(pte);
+			if (!PageAnon(page) && page->mapping)
+				state = VMR_PAGE_FILE;
+		}
+	}
+	if (pte_young(pte)) state |= VMR_PAGE_YOUNG;
+	if (pte_dirty(pte)) state |= VMR_PAGE_DIRTY;
+
+	return state;
+}
+
+/*
+ * A map being printed by vmr_printmap. The buffer pages the map lies in
+ * are looked up before the walk so vmr_printpage can be called from the
+ * workers of a parallel walk without sharing a cursor. Workers take
+ * chunks of a multiple of PMD_SIZE from mapaddr so no two of them set
+ * bits in the same character
  */
-unsigned long vmr_printpage(pte_t *pte, unsigned long addr, void *data) {
-	vmr_desc_t *testinfo;	/* Test Descriptor */
-	int index;		/* Index as an offset from written */
-	int bitidx;		/* Which bit within the index for this page */
-	int present;
+struct vmr_mapwalk {
+	unsigned long mapaddr;		/* Address of the first page */
+	unsigned long mapoffset;	/* Buffer offset the map starts at */
+	unsigned long first;		/* Buffer page mapoffset is in */
+	unsigned long nr_pages;		/* Buffer pages the map is in */
+	char **pages;			/* Their addresses */
+	int bits;			/* Bits of state a page */
+};
 
-	/* Get the test descriptor */
-	testinfo = (vmr_desc_t *)data;
+/*
+ * vmr_mapchar - Return the address of a character of a map
+ */
+static inline char *vmr_mapchar(struct vmr_mapwalk *map, unsigned long mapidx)
+{
+	unsigned long offset = map->mapoffset + mapidx;
+	unsigned long page = (offset >> PAGE_SHIFT) - map->first;
 
-	/* Calculate the index and bit offset */
-	index = (addr - testinfo->mapaddr) / PAGE_SIZE;
+	if (page >= map->nr_pages || !map->pages[page]) return NULL;
+	return map->pages[page] + (offset & ~PAGE_MASK);
+}
 
-	bitidx = index % 4;
-	index /= 4;
+/**
+ * vmr_printpage - Sets the state of pages in the proc buffer (callback)
+ * @ptes: The ptes been examined
+ * @nr: The number of ptes
+ * @addr: The address the first pte is at
+ * @size: Bytes each pte maps
+ * @data: Pointer to user data (struct vmr_mapwalk)
+ *
+ * This is the callback for the pagetable walk. It will set the bits of
+ * state in the proc buffer of every page, every page of a huge page
+ */
+static unsigned long vmr_printpage(pte_t *ptes, int nr, unsigned long addr,
+		unsigned long size, void *data) {
+	struct vmr_mapwalk *map;/* Map been printed */
+	unsigned long index;	/* Index as an offset from mapoffset */
+	unsigned long last;	/* Index after the last page of a pte */
+	unsigned long present=0;
+	char *mapchar=NULL;	/* Character in the map for this page */
+	unsigned long mapidx=0;	/* Index of mapchar from mapoffset */
+	int bits, perchar;	/* Bits a page and pages a character */
+	int state;
+	int i;
+
+	/* Get the map */
+	map = (struct vmr_mapwalk *)data;
+	bits = map->bits;
+	perchar = 4 / bits;
+
+	/* Calculate the index of the first page */
+	index = (addr - map->mapaddr) / PAGE_SIZE;
+
+	for (i = 0; i < nr; i++) {
+		last = index + size / PAGE_SIZE;
+		if (pte_present(ptes[i])) present += last - index;
+
+		state = vmr_pagestate(ptes[i], size, bits);
+		if (!state) {
+			index = last;
+			continue;
+		}
 
-	/* Set the bit */
-	present = pte_present(*pte) ? 1 : 0;
-	testinfo->procbuf[testinfo->written + index] |= present << bitidx;
+		for (; index < last; index++) {
+			/* Find the character when starting a new one */
+			if (!mapchar || index / perchar != mapidx) {
+				mapidx = index / perchar;
+				mapchar = vmr_mapchar(map, mapidx);
+			}
+
+			/* Set the bits */
+			if (mapchar)
+				*mapchar |= state << ((index % perchar) * bits);
+		}
+	}
 	
-	/* Return page present to give a running count of present pages */
+	/* Return pages present to give a running count of present pages */
 	return present;
 }
 
 /**
  * vmr_printmap - Print out a map representing a memory range
- * @mm: The mm to print pages from
+ * @mm: The mm to print pages from, from vmr_mm_get
  * @addr: The starting address
  * @len: The len of the address space to print
  * @sched_count: A count of how many times schedule() was called
@@ -362,74 +875,96 @@ unsigned long vmr_printpage(pte_t *pte, unsigned long addr, void *data) {
  * This will guarentee that something printable will show up. Using the
  * whole character for 8 bits leads to unprintable data filled with escape
  * characters.
+ *
+ * When pagetable is loaded with vmr_map_bits=2 or 4, the lower four bits
+ * instead hold 2 bits of state for 2 pages or 4 bits for 1 page, see
+ * VMR_MAP_* in pagetable.h, and the header ends with the bits per page
  */
 unsigned long vmr_printmap(struct mm_struct *mm, unsigned long addr,
 		unsigned long len, unsigned long *sched_count,
 		vmr_desc_t *testinfo)
 {
-	int mapsize;		/* Size of map */
-	int growsize;		/* Number of pages to grow proc */
-	int *print_written;	/* Number of bytes written see vmr_snprintf macro*/
-	int print_size;	/* Size of proc buffer, see vmr_snprinf macro */
-	int present;
+	unsigned long mapsize;	/* Size of map */
+	unsigned long present;
+	struct vmr_mapwalk map;
+	struct vmr_cursor cursor;
+	unsigned long i;
+	int bits = vmr_mapbits();
 
 	/* Make sure we are the writer */
 	if (current->pid != testinfo->pid) return 0;
 
-	print_written = &testinfo->written;
-	print_size    = testinfo->procbuf_size;
-
-	/* Calculate if the current proc area needs to be grown 
-	 * Each 8 pages is one character hence 
+	/* 
+	 * Each 4 bits of state is one character hence 
 	 *   (len / PAGE_SIZE) gives the number of pages
-	 *   no. pages / 4 = number of chars (using only readable chars)
+	 *   no. pages * bits / 4 = number of chars (using only readable chars)
 	 */
-	mapsize = ((len / PAGE_SIZE) / 4);
-
-	/*
-	 * check if we should grow the proc buffer 
-	 * The additional 256 bytes is for the header and footer around
-	 * the map information
-	 * */
-	if (testinfo->procbuf_size - *print_written < mapsize + 256) {
-		/* Proc buffer has to be grown */
-		growsize = PAGE_ALIGN(mapsize + 256) / PAGE_SIZE;
-		vmr_printk("Growing proc buffer by %d pages for mapsize %d\n", growsize, mapsize);
-		vmrproc_growbuffer(growsize, testinfo);
-		print_size = testinfo->procbuf_size;
+	mapsize = ((len / PAGE_SIZE) * bits + 3) / 4;
+
+	/* Print out header for map */
+	if (bits == VMR_MAP_PRESENT) {
+		vmr_snprintf(testinfo,
+				"BEGIN PAGE MAP 0x%lX - 0x%lX\n",
+				addr,
+				addr + len);
+	} else {
+		vmr_snprintf(testinfo,
+				"BEGIN PAGE MAP 0x%lX - 0x%lX BITS %d\n",
+				addr,
+				addr + len,
+				bits);
 	}
 
-	/* Zero out the map */
-	memset(&testinfo->procbuf[*print_written], 0, mapsize);
-
-	/* Print out header for map (40 is for the actual message to print) */
-	vmr_snprintf(testinfo,
-			&testinfo->procbuf[*print_written],
-			testinfo->procbuf_size - *print_written - 40,
-			"BEGIN PAGE MAP 0x%lX - 0x%lX\n",
-			addr,
-			addr + len);
+	/* 
+	 * Lay down the map with the 5th and 6th bit set. The proc buffer
+	 * grows by as many pages as the map needs. The id of a map record
+	 * is the bits per page, 0 for VMR_MAP_PRESENT
+	 */
+	if (vmrproc_binary(testinfo))
+		vmrproc_beginrecord(testinfo, VMR_REC_MAP,
+				bits == VMR_MAP_PRESENT ? 0 : bits, mapsize);
+	testinfo->mapoffset = testinfo->written;
+	if (vmrproc_fill(testinfo, 48, mapsize) != mapsize) return 0;
 
-	/* Set the 5th and 6th bit on the map */
-	memset(&testinfo->procbuf[*print_written], 48, mapsize);
+	/* Look up the buffer pages of the map once for every worker */
+	testinfo->mapaddr = addr;
+	map.mapaddr = addr;
+	map.mapoffset = testinfo->mapoffset;
+	map.first = map.mapoffset >> PAGE_SHIFT;
+	map.nr_pages = ((map.mapoffset + mapsize + PAGE_SIZE - 1) >> PAGE_SHIFT) -
+		map.first;
+	map.bits = bits;
+	map.pages = vmalloc(map.nr_pages * sizeof(char *));
+	if (!map.pages) {
+		vmr_printk("Unable to allocate the page list of a map\n");
+		return 0;
+	}
+	memset(&cursor, 0, sizeof(cursor));
+	for (i = 0; i < map.nr_pages; i++)
+		map.pages[i] = __vmrproc_bufaddr(testinfo, &cursor,
+				(map.first + i) << PAGE_SHIFT);
 
 	/* Print out the map */
-	testinfo->mapaddr = addr;
-	present = forall_pte_mm(mm, addr, len, sched_count, testinfo, vmr_printpage);
+	present = forall_ptes_auto(mm, addr, len, sched_count, &map, vmr_printpage);
+	vfree(map.pages);
+	if (vmrproc_binary(testinfo))
+		vmrproc_endrecord(testinfo, mapsize);
 
-	/* Print out footer (50 is for the message to print) */
-	*print_written += mapsize;
+	/* Print out footer */
 	vmr_snprintf(testinfo,
-			&testinfo->procbuf[*print_written],
-			testinfo->procbuf_size - *print_written - 50,
-			"\nEND PAGE MAP - %d pages of %lu present\n", 
+			"\nEND PAGE MAP - %lu pages of %lu present\n", 
 			present, len / PAGE_SIZE);
 
 	return 0;
 }
 
 /* Export the relevant symbols */
+EXPORT_SYMBOL(vmr_mm_get);
+EXPORT_SYMBOL(vmr_mm_put);
+EXPORT_SYMBOL(get_struct_page_mm);
 EXPORT_SYMBOL(get_struct_page);
+EXPORT_SYMBOL(forall_ptes_mm);
+EXPORT_SYMBOL(forall_ptes_mm_parallel);
 EXPORT_SYMBOL(forall_pte_mm);
 EXPORT_SYMBOL(countpages_mm);
 EXPORT_SYMBOL(vmr_printmap);
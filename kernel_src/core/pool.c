@@ -0,0 +1,96 @@
+/*
+ * pool
+ *
+ * Every proc buffer takes its pages from the result page pool in
+ * vmregress_core. This module provides /proc/vmregress/pool which prints
+ * how many pages the pool holds and how they were obtained so the memory
+ * taken by vmregress itself can be subtracted from or checked against
+ * the results of a test. Writing to it
+ *
+ *   trim         Free the spare pages of the pool and of idle buffers
+ *
+ * The quota and the number of spare pages kept are parameters of
+ * vmregress_core, vmr_pool_quota and vmr_pool_spare
+ */
+#include <linux/version.h>
+#include <linux/config.h>
+#include <linux/fs.h>
+#include <linux/types.h>
+#include <linux/proc_fs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <asm/uaccess.h>
+
+#include <vmregress_core.h>
+#include <procprint.h>
+
+#define MODULENAME "pool"
+#define NUM_PROC_ENTRIES 1
+#define MAX_POOL_WRITE 32
+
+MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
+MODULE_DESCRIPTION("VM Regress result page pool usage");
+MODULE_LICENSE("GPL");
+
+int pool_write_proc(struct file *file, const char *buf,
+		unsigned long count, void *data);
+
+static vmr_desc_t testinfo[] = {
+	VMR_DESC_INIT(0, MODULENAME, vmr_read_proc, pool_write_proc)
+};
+
+/**
+ * pool_getproc - Print the usage of the result page pool
+ * @procentry: Index into testinfo
+ *
+ * The buffer of this entry is in the pool too so it is counted
+ */
+void pool_getproc(int procentry) {
+	struct vmr_pool_stats stats;
+
+	vmrproc_openbuffer(&testinfo[procentry]);
+	vmr_pool_getstats(&stats);
+
+	printp("used      %8lu pages\n", stats.used);
+	printp("spare     %8lu pages\n", stats.spare);
+	printp("peak      %8lu pages\n", stats.peak);
+	printp("quota     %8lu pages\n", stats.quota);
+	printp("buffers   %8lu\n", stats.buffers);
+	printp("allocated %8lu\n", stats.allocated);
+	printp("reused    %8lu\n", stats.reused);
+	printp("reclaimed %8lu\n", stats.reclaimed);
+	printp("failed    %8lu\n", stats.failed);
+}
+
+/**
+ * pool_write_proc - Trim the pool
+ * @file: unused
+ * @buf: user buffer
+ * @count: data len
+ * @data: unused
+ */
+int pool_write_proc(struct file *file, const char *buf,
+		unsigned long count, void *data)
+{
+	char readbuf[MAX_POOL_WRITE];
+
+	if (count >= MAX_POOL_WRITE)
+		return -EINVAL;
+	if (copy_from_user(readbuf, buf, count))
+		return -EFAULT;
+	readbuf[count] = '\0';
+
+	if (!strncmp(readbuf, "trim", 4)) {
+		vmr_printk("Freed %lu spare pages\n", vmr_pool_trim());
+	} else {
+		vmr_printk("Unknown command %s\n", readbuf);
+		return -EINVAL;
+	}
+
+	return count;
+}
+
+#define VMR_READ_PROC_CALLBACK pool_getproc
+#include "../init/proc.c"
+#include "../init/init.c"
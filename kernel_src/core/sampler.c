@@ -0,0 +1,131 @@
+/*
+ * sampler
+ *
+ * Controls the time series sampler of vmregress_core, see vmr_sampler.h.
+ * This module provides /proc/vmregress/sampler which prints every sample
+ * in the ring, whether the sampler is still running or not. Writing to it
+ *
+ *   start [rate] [samples]  Start sampling rate times a second into a ring
+ *                           of samples. The defaults are VMR_SAMPLER_RATE
+ *                           and vmr_sampler_samples of vmregress_core
+ *   mark name               Start a new phase called name
+ *   stop                    Stop sampling
+ *
+ * so the state of the VM can be followed across a test run by a script
+ * with, for example
+ *
+ *   echo start 100 > /proc/vmregress/sampler
+ *   echo 5 > /proc/vmregress/test_fault_zero
+ *   echo stop > /proc/vmregress/sampler
+ *   cat /proc/vmregress/sampler
+ *
+ * The rate is at most HZ and is rounded to a whole number of jiffies
+ * between samples. The rate used is printed with the samples. If a test
+ * is also sampling, the sampler keeps running until both stop
+ */
+#include <linux/version.h>
+#include <linux/config.h>
+#include <linux/fs.h>
+#include <linux/types.h>
+#include <linux/proc_fs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <asm/uaccess.h>
+
+#include <vmregress_core.h>
+#include <procprint.h>
+
+#define MODULENAME "sampler"
+#define NUM_PROC_ENTRIES 1
+#define MAX_SAMPLER_WRITE 64
+
+MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
+MODULE_DESCRIPTION("VM Regress zone and page state sampler");
+MODULE_LICENSE("GPL");
+
+int sampler_write_proc(struct file *file, const char *buf,
+		unsigned long count, void *data);
+
+static vmr_desc_t testinfo[] = {
+	VMR_DESC_INIT(0, MODULENAME, vmr_read_proc, sampler_write_proc)
+};
+
+/* Set while this module holds a reference on the sampler */
+static int sampler_started;
+static DECLARE_MUTEX(sampler_sem);
+
+/**
+ * sampler_getproc - Print the samples
+ * @procentry: Index into testinfo
+ */
+void sampler_getproc(int procentry) {
+	vmrproc_openbuffer(&testinfo[procentry]);
+	vmr_sampler_print(&testinfo[procentry], 0);
+}
+
+/**
+ * sampler_write_proc - Start or stop the sampler or mark a phase
+ * @file: unused
+ * @buf: user buffer
+ * @count: data len
+ * @data: unused
+ */
+int sampler_write_proc(struct file *file, const char *buf,
+		unsigned long count, void *data)
+{
+	char readbuf[MAX_SAMPLER_WRITE];
+	unsigned long rate = 0, samples = 0;
+	char *args;
+	int error = 0;
+
+	if (count >= MAX_SAMPLER_WRITE)
+		return -EINVAL;
+	if (copy_from_user(readbuf, buf, count))
+		return -EFAULT;
+	readbuf[count] = '\0';
+	if (count && readbuf[count - 1] == '\n')
+		readbuf[count - 1] = '\0';
+
+	args = strchr(readbuf, ' ');
+	if (args) *(args++) = '\0';
+
+	down(&sampler_sem);
+	if (!strcmp(readbuf, "start")) {
+		if (args) {
+			rate = vmr_strtoul(args, &args, 0);
+			while (*args == ' ') args++;
+			samples = vmr_strtoul(args, NULL, 0);
+		}
+		if (!sampler_started) {
+			error = vmr_sampler_start(rate, samples);
+			sampler_started = !error;
+		}
+	} else if (!strcmp(readbuf, "stop")) {
+		if (sampler_started)
+			vmr_sampler_stop();
+		sampler_started = 0;
+	} else if (!strcmp(readbuf, "mark") && args) {
+		vmr_sampler_mark(args);
+	} else {
+		vmr_printk("Unknown command %s\n", readbuf);
+		error = -EINVAL;
+	}
+	up(&sampler_sem);
+
+	return error ? error : count;
+}
+
+/**
+ * sampler_cleanup - Drop the reference on the sampler
+ */
+static void sampler_cleanup(void)
+{
+	if (sampler_started)
+		vmr_sampler_stop();
+}
+
+#define VMR_READ_PROC_CALLBACK sampler_getproc
+#define VMR_CLEANUP_PROVIDED sampler_cleanup
+#include "../init/proc.c"
+#include "../init/init.c"
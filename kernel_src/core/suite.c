@@ -0,0 +1,418 @@
+/*
+ * suite
+ *
+ * Runs whole suites of tests from one write instead of a shell step per
+ * test. Every test module adds its entries to the test registry of
+ * vmregress_core when it is loaded, see vmr_registry.h. This module
+ * provides two proc entries
+ *
+ *   /proc/vmregress/registry  Lists every registered test with its id,
+ *                             danger, suite and parameters with their
+ *                             defaults
+ *   /proc/vmregress/suite     Written with one command per line, run in
+ *                             order. Reading it returns the combined
+ *                             output of every test run so far
+ *
+ * The commands are
+ *
+ *   run <suite> [danger]      Run every test of a suite, or of every
+ *                             suite if it is "all", with its defaults.
+ *                             Tests more dangerous than danger are
+ *                             skipped. It is safe, pressure or oom or
+ *                             the VMR_DANGER_* number and is safe if
+ *                             not given
+ *   <test> [params]           Run one test. params are given as they
+ *                             would be written to its proc entry and
+ *                             the defaults are used for the others
+ *
+ * so a regression sweep of every loaded test module is
+ *
+ *   echo "run all pressure" > /proc/vmregress/suite
+ *   cat /proc/vmregress/suite
+ *
+ * The output of each test is appended to the suite output as soon as the
+ * test completes between a line naming the test and its parameters and a
+ * line with its result and how long it took. The suite stops if the
+ * writer is interrupted
+ */
+#include <linux/version.h>
+#include <linux/config.h>
+#include <linux/fs.h>
+#include <linux/types.h>
+#include <linux/proc_fs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/ctype.h>
+#include <asm/uaccess.h>
+
+#include <vmregress_core.h>
+#include <procprint.h>
+#include <nanotime.h>
+
+#define MODULENAME "suite"
+#define NUM_PROC_ENTRIES 2
+#define MAX_SUITE_WRITE PAGE_SIZE
+
+#define SUITE_REGISTRY	0
+#define SUITE_RUN	1
+
+MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
+MODULE_DESCRIPTION("VM Regress test registry and suites");
+MODULE_LICENSE("GPL");
+
+int suite_write_proc(struct file *file, const char *buf,
+		unsigned long count, void *data);
+
+static vmr_desc_t testinfo[] = {
+	VMR_DESC_INIT(SUITE_REGISTRY, "registry", vmr_read_proc, NULL),
+	VMR_DESC_INIT(SUITE_RUN, MODULENAME, vmr_read_proc, suite_write_proc)
+};
+
+static char *suite_danger_names[VMR_DANGER_MAX] = {
+	"safe", "pressure", "oom"
+};
+
+/**
+ * suite_danger - Parse a danger level
+ * @name: A name in suite_danger_names or a VMR_DANGER_* number
+ *
+ * Returns -1 if it is neither
+ */
+static int suite_danger(char *name)
+{
+	int danger;
+
+	for (danger = 0; danger < VMR_DANGER_MAX; danger++)
+		if (!strcmp(name, suite_danger_names[danger]))
+			return danger;
+
+	if (isdigit(*name)) {
+		danger = simple_strtol(name, NULL, 0);
+		if (danger < VMR_DANGER_MAX)
+			return danger;
+	}
+
+	return -1;
+}
+
+/**
+ * suite_getproc - Print the registry
+ * @procentry: Index into testinfo
+ *
+ * Reading the suite entry prints nothing new so the output of the last
+ * suite is returned
+ */
+void suite_getproc(int procentry) {
+	struct vmr_test test;
+	int id, i;
+
+	if (procentry != SUITE_REGISTRY)
+		return;
+
+	vmrproc_openbuffer(&testinfo[procentry]);
+	printp("%-4s %-24s %-9s %-9s %s\n", "Id", "Name", "Danger", "Suite",
+			"Parameters");
+	for (id = 0; id < VMR_REGISTRY_MAX; id++) {
+		if (vmr_test_get(id, &test))
+			continue;
+
+		printp("%-4d %-24s %-9s %-9s", id, test.desc->name,
+				suite_danger_names[test.danger],
+				test.suite ? test.suite : "-");
+		for (i = 0; i < test.nparams; i++) {
+			if (test.params) {
+				printp(" %s", test.params[i]);
+			} else {
+				printp(" p%d", i);
+			}
+			if (test.defaults) {
+				printp("=%ld", test.defaults[i]);
+			}
+		}
+		printp("\n");
+
+		vmr_test_put(&test);
+	}
+}
+
+/* Most entries of one module whose output a suite copies */
+#define SUITE_MAXDESCS	16
+
+/**
+ * suite_copyout - Append the output of a test to the suite output
+ * @desc: The test descriptor
+ * @page: A page to copy through
+ */
+static void suite_copyout(vmr_desc_t *desc, char *page)
+{
+	unsigned long offset = 0;
+	long len;
+
+	while ((len = vmrproc_copyout(desc, offset, page, PAGE_SIZE)) > 0) {
+		vmrproc_write(&testinfo[SUITE_RUN], page, len);
+		offset += len;
+	}
+}
+
+/**
+ * suite_copyall - Append the output of every entry a test printed to
+ * @test: The test
+ * @opened: desc->opened of every entry of the module before the test ran
+ * @page: A page to copy through
+ *
+ * A test such as highalloc prints to several entries of its module. Each
+ * entry opened while it ran is copied, named if it is not the test's own
+ */
+static void suite_copyall(struct vmr_test *test, unsigned long *opened,
+		char *page)
+{
+	int procentry = SUITE_RUN;
+	vmr_desc_t *desc;
+	int i;
+
+	suite_copyout(test->desc, page);
+	for (i = 0; i < test->nr_descs && i < SUITE_MAXDESCS; i++) {
+		desc = &test->descs[i];
+		if (desc == test->desc || desc->opened == opened[i])
+			continue;
+
+		printp("== %s output\n", desc->name);
+		suite_copyout(desc, page);
+	}
+}
+
+/**
+ * suite_runtest - Run one test and append its output
+ * @test: The test taken from the registry
+ * @args: Parameters as written to the proc entry of the test or NULL
+ * @page: A page to copy output through
+ *
+ * Returns 0 or -EINVAL if args could not be parsed
+ */
+static int suite_runtest(struct vmr_test *test, char *args, char *page)
+{
+	int procentry = SUITE_RUN;
+	long params[VMR_DEV_MAXPARAMS];
+	int nparams = min(test->nparams, VMR_DEV_MAXPARAMS);
+	int argc = 0, noread = 0, index, i;
+	char *next, *value;
+	unsigned long long start;
+	unsigned long opened[SUITE_MAXDESCS];
+	long result;
+
+	memset(params, 0, sizeof(params));
+	if (test->defaults) {
+		for (i = 0; i < nparams; i++)
+			params[i] = test->defaults[i];
+		argc = nparams;
+	}
+
+	/* Parameters are in order or name=value */
+	while (args) {
+		while (*args == ' ') args++;
+		if (*args == '\0') break;
+
+		next = strchr(args, ' ');
+		if (next) *(next++) = '\0';
+
+		value = strchr(args, '=');
+		if (value) {
+			*(value++) = '\0';
+			for (index = 0; index < nparams; index++)
+				if (test->params && !strcmp(test->params[index], args))
+					break;
+		} else {
+			value = args;
+			index = noread++;
+		}
+		if (index >= nparams) {
+			printp("== %s has no parameter %s\n", test->desc->name, args);
+			return -EINVAL;
+		}
+
+		if (vmr_strtoparam(value, &params[index])) {
+			printp("== %s has a bad value %s\n", test->desc->name, value);
+			return -EINVAL;
+		}
+		if (index >= argc) argc = index + 1;
+		args = next;
+	}
+
+	printp("== %s", test->desc->name);
+	for (i = 0; i < argc; i++) {
+		if (test->params) {
+			printp(" %s=%ld", test->params[i], params[i]);
+		} else {
+			printp(" %ld", params[i]);
+		}
+	}
+	printp("\n");
+
+	for (i = 0; i < test->nr_descs && i < SUITE_MAXDESCS; i++)
+		opened[i] = test->descs[i].opened;
+
+	start = vmr_clock_ns();
+	result = test->run(params, argc, test->desc->procentry);
+	suite_copyall(test, opened, page);
+	printp("== %s returned %ld after %lums\n\n", test->desc->name,
+			result, vmr_clock_ms(start));
+
+	return 0;
+}
+
+/**
+ * suite_run - Run every test of a suite
+ * @suite: Name of the suite or all
+ * @danger: The most dangerous tests to run
+ * @page: A page to copy output through
+ *
+ * Returns 0 or -EINTR if the writer was interrupted
+ */
+static int suite_run(char *suite, int danger, char *page)
+{
+	int procentry = SUITE_RUN;
+	struct vmr_test test;
+	int id, run = 0, skipped = 0, error = 0;
+
+	for (id = 0; id < VMR_REGISTRY_MAX; id++) {
+		if (vmr_test_get(id, &test))
+			continue;
+
+		if (!test.suite ||
+		    (strcmp(suite, "all") && strcmp(suite, test.suite))) {
+			vmr_test_put(&test);
+			continue;
+		}
+
+		if (vmr_test_cancelled()) {
+			vmr_test_put(&test);
+			error = -EINTR;
+			break;
+		}
+
+		if (test.danger > danger) {
+			printp("== %s skipped, danger %s\n\n", test.desc->name,
+					suite_danger_names[test.danger]);
+			skipped++;
+		} else {
+			suite_runtest(&test, NULL, page);
+			run++;
+		}
+		vmr_test_put(&test);
+	}
+
+	printp("Suite %s: %d run, %d skipped%s\n", suite, run, skipped,
+			error ? ", interrupted" : "");
+	return error;
+}
+
+/**
+ * suite_command - Run one command written to the suite entry
+ * @line: The command. It is modified while it is parsed
+ * @page: A page to copy output through
+ */
+static int suite_command(char *line, char *page)
+{
+	int procentry = SUITE_RUN;
+	struct vmr_test test;
+	char *args, *suite;
+	int danger = VMR_DANGER_SAFE;
+	int error;
+
+	args = strchr(line, ' ');
+	if (args) *(args++) = '\0';
+
+	if (!strcmp(line, "run")) {
+		if (!args) {
+			printp("run needs the name of a suite\n");
+			return -EINVAL;
+		}
+		while (*args == ' ') args++;
+		suite = args;
+		args = strchr(suite, ' ');
+		if (args) {
+			*(args++) = '\0';
+			while (*args == ' ') args++;
+			danger = suite_danger(args);
+			if (danger < 0) {
+				printp("Unknown danger %s\n", args);
+				return -EINVAL;
+			}
+		}
+		return suite_run(suite, danger, page);
+	}
+
+	if (vmr_test_get(vmr_test_lookup(line), &test)) {
+		printp("No test called %s is registered\n", line);
+		return -ENOENT;
+	}
+	error = suite_runtest(&test, args, page);
+	vmr_test_put(&test);
+
+	return error;
+}
+
+/**
+ * suite_write_proc - Run the commands written
+ * @file: unused
+ * @buf: user buffer
+ * @count: data len
+ * @data: unused
+ *
+ * The suite entry is held for every command so the output of all of them
+ * is kept. Empty lines and lines starting with # are ignored
+ */
+int suite_write_proc(struct file *file, const char *buf,
+		unsigned long count, void *data)
+{
+	char *script, *line, *next, *page;
+	int error = 0;
+
+	if (count >= MAX_SUITE_WRITE)
+		return -EINVAL;
+
+	script = kmalloc(count + 1, GFP_KERNEL);
+	page = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!script || !page) {
+		kfree(script);
+		kfree(page);
+		return -ENOMEM;
+	}
+	if (copy_from_user(script, buf, count)) {
+		kfree(script);
+		kfree(page);
+		return -EFAULT;
+	}
+	script[count] = '\0';
+
+	if (!vmrproc_openbuffer(&testinfo[SUITE_RUN])) {
+		kfree(script);
+		kfree(page);
+		return -EBUSY;
+	}
+
+	for (line = script; line && !error; line = next) {
+		next = strchr(line, '\n');
+		if (next) *(next++) = '\0';
+		while (*line == ' ') line++;
+		if (*line == '\0' || *line == '#')
+			continue;
+
+		if (vmr_test_cancelled()) {
+			error = -EINTR;
+			break;
+		}
+		error = suite_command(line, page);
+	}
+
+	vmrproc_closebuffer(&testinfo[SUITE_RUN]);
+	kfree(script);
+	kfree(page);
+	return error ? error : count;
+}
+
+#define VMR_READ_PROC_CALLBACK suite_getproc
+#include "../init/proc.c"
+#include "../init/init.c"
@@ -6,9 +6,15 @@
  *
  * o Creation of the /proc/vmregress entry
  * o alloc/free functions for proc buffer space
+ * o the result page pool proc buffers take their pages from
+ * o appending to and reading back from proc buffers
+ * o streaming reads and read-only mmap of proc buffers
  * o getting a handle to pgdat_list
  * o provide simple strtol functions
  * o handle scheduling when necessary
+ * o calibrate the nanosecond clock in nanotime.h
+ * o event counters around tests and passes
+ * o the /dev/vmregress device for running tests with ioctl
  *
  * (c) Mel Gorman 2002
  */
@@ -20,17 +26,34 @@
 #include <linux/types.h>
 #include <linux/proc_fs.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include <linux/mm.h>
 #include <linux/ctype.h>
 #include <linux/compiler.h>
 #include <linux/sched.h>
 #include <linux/interrupt.h>
+#include <linux/poll.h>
+#include <linux/delay.h>
+#include <linux/miscdevice.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/notifier.h>
 #include <asm/pgtable.h>
+#include <asm/uaccess.h>
+#include <asm/div64.h>
+#ifdef CONFIG_X86
+#include <asm/msr.h>
+#include <asm/processor.h>
+#endif
 
 #define MODULENAME "vmr_core"
 #include <vmregress_core.h>
 #include <vmr_mmzone.h>
 #include <procprint.h>
+#include <vmr_histogram.h>
+#include <vmr_repeat.h>
+#include <nanotime.h>
+#include <vmr_events.h>
 #include <internal.h>
 
 /* Module Description */
@@ -45,266 +68,4124 @@ struct proc_dir_entry *vmregress_proc_dir;
 #define NUM_PROC_ENTRIES 1
 static vmr_desc_t testinfo[] = { VMR_DESC_INIT(0, "vmregress", 0, 0) };
 
-/** 
- * vmrproc_freebuffer - Frees the buffer used for printing proc information
- * @desc: The test descriptor
+/*
+ * Result page pool. See vmregress_core.h. The lock protects the counters,
+ * the spare list and the list of buffers. It is taken before the lock of
+ * any buffer
+ */
+static unsigned int vmr_pool_quota = 4096;
+static unsigned int vmr_pool_spare = 64;
+MODULE_PARM(vmr_pool_quota, "i");
+MODULE_PARM_DESC(vmr_pool_quota, "Most pages all proc buffers may hold at once");
+MODULE_PARM(vmr_pool_spare, "i");
+MODULE_PARM_DESC(vmr_pool_spare, "Most free pages the pool keeps for reuse");
+
+static spinlock_t vmr_pool_lock = SPIN_LOCK_UNLOCKED;
+static LIST_HEAD(vmr_pool_buffers);
+static struct vmr_pool_stats vmr_pool;
+
+/* Pages map output may hold above the quota while it is laid down */
+static unsigned long vmr_pool_extra;
+
+/* Returns true if no page may be taken without reclaiming one first */
+static inline int vmr_pool_full(void)
+{
+	return vmr_pool.used + vmr_pool.spare >= vmr_pool_quota + vmr_pool_extra;
+}
+
+/* Spare pages are linked through their first word */
+static void *vmr_pool_free;
+
+/**
+ * vmr_pool_putspare - Give a page no buffer uses back to the pool
+ * @addr: Address of the page
  *
- * This function will adjust the callers buffer and buffer size parameters. This
- * is handy if the size of the proc buffer is expected to change for the 
- * lifetime of the module
+ * The page is kept as a spare unless there are enough already or a reader
+ * still has it mapped, in which case the mapping keeps it alive until it
+ * is unmapped. Called with vmr_pool_lock held
  */
-void vmrproc_freebuffer(vmr_desc_t *desc)
+static void vmr_pool_putspare(char *addr)
 {
-	if (desc->procbuf) {
-		memset(desc->procbuf, 0, desc->procbuf_size);
-		vfree(desc->procbuf);
+	vmr_pool.used--;
+	if (vmr_pool.spare < vmr_pool_spare &&
+	    page_count(virt_to_page(addr)) == 1) {
+		*(void **)addr = vmr_pool_free;
+		vmr_pool_free = addr;
+		vmr_pool.spare++;
+		return;
 	}
-	desc->procbuf = NULL;
-	desc->procbuf_size = 0;
+
+	free_page((unsigned long)addr);
 }
 
 /**
- * vmrproc_allocbuffer - Allocates a buffer for printing out proc information 
- * @pages - number of pages to allocate
- * @desc - The test descriptor
+ * vmr_pool_reclaim - Take the spare pages of buffers no test is writing to
+ * @nr_pages: The number of pages wanted
+ *
+ * Pages after the write tail of an idle buffer hold no output so they are
+ * unlinked and become spares of the pool. A VMR_NOGROW buffer cannot take
+ * them back when it is next written so it is left alone as is a buffer a
+ * reader is walking. Returns the number of pages taken. Called with
+ * vmr_pool_lock held
  */
-int vmrproc_allocbuffer(unsigned int pages, vmr_desc_t *desc)
-{       
-	unsigned int bytes;
-	char *oldbuf;
+static unsigned long vmr_pool_reclaim(unsigned long nr_pages)
+{
+	struct vmr_chunk *chunk, *next;
+	vmr_desc_t *desc;
+	unsigned long reclaimed = 0;
 
-	/* Return if 0 pages were asked for */
-	if (!pages) return 0;
+	list_for_each_entry(desc, &vmr_pool_buffers, pool) {
+		if (reclaimed >= nr_pages)
+			break;
 
-	/* Make sure too many pages aren't allocated */
-	if (pages > (1 << (MAX_ORDER-1)))
-	{
-		vmr_printk("Too large a proc buffer requested\n");
-		return -ENOMEM;
-	}
+		spin_lock(&desc->lock);
+		if (desc->pid != 0 || (desc->flags & VMR_NOGROW) ||
+		    atomic_read(&desc->readers) ||
+		    !desc->chunk_tail || !desc->chunk_tail->next) {
+			spin_unlock(&desc->lock);
+			continue;
+		}
 
-	/* Allocate buffer */
-	bytes = pages * PAGE_SIZE;
-	oldbuf = desc->procbuf;
-	desc->procbuf = vmalloc(bytes-1);
-	if (!desc->procbuf) {
-		vmr_printk("Failed to allocate proc buffer\n");
-		desc->procbuf=oldbuf;
-		return -ENOMEM;
+		chunk = desc->chunk_tail->next;
+		desc->chunk_tail->next = NULL;
+		desc->layout++;
+		desc->mapseek.chunk = NULL;
+		for (; chunk; chunk = next) {
+			next = chunk->next;
+			desc->procbuf_size -= PAGE_SIZE;
+			vmr_pool_putspare(chunk->data);
+			kfree(chunk);
+			reclaimed++;
+		}
+		spin_unlock(&desc->lock);
 	}
 
-	/* Init desc */
-	desc->written = 0;
-	desc->procbuf_size = bytes;
-	memset(desc->procbuf, 0, desc->procbuf_size);
-
-	/* 
-	 * Delete the old buf if it exists. Intuitively you would expect
-	 * the caller to delete the old buffer but this had to be special
-	 * cased. UML kept behaving *really* odd if the same area was 
-	 * used. This incredibly messy method forces a different vm region
-	 * to be used.
-	 */
-	if (oldbuf) vfree(oldbuf);
-
-	return 0;
+	vmr_pool.reclaimed += reclaimed;
+	return reclaimed;
 }
 
 /**
- * vmrproc_growbuffer - Grow the proc buffer by a number of pages
- * @pages: The number of pages to grow by
- * @desc: The test descriptor struct 
+ * vmr_pool_getpage - Take a page from the result page pool
+ * @gfp: Flags to allocate a new page with
  *
- * This function will grow a buffer of a number of pages and copy in the
- * old contents. It is an expensive function so only use if you have to
+ * A spare page is used if there is one. A new page is allocated if the
+ * quota allows it. Otherwise the spare pages of idle buffers are taken
+ * and if there are none, NULL is returned
  */
-int  vmrproc_growbuffer(unsigned int pages, vmr_desc_t *desc) {
-	int bytes;	/* Number of bytes in the buffer */
-	int oldpages;	/* Number of pages in the old buffer */
-	int newpages;   /* Number of pages in the new buffer */
-	char *newbuf;	/* The new buffer */
+static char *vmr_pool_getpage(gfp_t gfp)
+{
+	char *addr;
 
-	/* Check test flags */
-	if (desc->flags & VMR_NOGROW) return 0;
+	spin_lock(&vmr_pool_lock);
+	if (!vmr_pool_free && vmr_pool_full())
+		vmr_pool_reclaim(1);
 
-	/* Return if 0 pages were asked for */
-	if (!pages) return 0;
+	if (vmr_pool_free) {
+		addr = vmr_pool_free;
+		vmr_pool_free = *(void **)addr;
+		vmr_pool.spare--;
+		vmr_pool.used++;
+		vmr_pool.reused++;
+		spin_unlock(&vmr_pool_lock);
+		return addr;
+	}
 
-	/* Calculate how many pages in the old buffer */
-	oldpages = PAGE_ALIGN(desc->procbuf_size) / PAGE_SIZE;
+	if (vmr_pool_full()) {
+		vmr_pool.failed++;
+		spin_unlock(&vmr_pool_lock);
+		return NULL;
+	}
 
-	/* Make sure too many pages aren't allocated */
-	if (oldpages + pages > 1 << (MAX_ORDER-1))
-	{
-		vmr_printk("Too large a proc buffer requested\n");
-		return -ENOMEM;
+	/* Count the page now so the quota holds while it is allocated */
+	vmr_pool.used++;
+	spin_unlock(&vmr_pool_lock);
+
+	addr = (char *)__get_free_page(gfp);
+
+	spin_lock(&vmr_pool_lock);
+	if (addr) {
+		vmr_pool.allocated++;
+		if (vmr_pool.used + vmr_pool.spare > vmr_pool.peak)
+			vmr_pool.peak = vmr_pool.used + vmr_pool.spare;
+	} else {
+		vmr_pool.used--;
 	}
+	spin_unlock(&vmr_pool_lock);
 
-	/* Allocate buffer */
-	vmr_printk("Growing proc buffer. Consider increasing page count for vmrproc_alloc\n");
-	newpages = oldpages + pages;
-	bytes = newpages * PAGE_SIZE;
-	newbuf = vmalloc(bytes);
-	if (!newbuf) {
-		vmr_printk("Failed to grow proc buffer\n");
-		return -ENOMEM;
+	return addr;
+}
+
+/**
+ * vmr_pool_putpage - Return a page to the result page pool
+ * @addr: The page
+ */
+static void vmr_pool_putpage(char *addr)
+{
+	spin_lock(&vmr_pool_lock);
+	vmr_pool_putspare(addr);
+	spin_unlock(&vmr_pool_lock);
+}
+
+/**
+ * vmr_pool_trim - Give every page the pool can spare back to the kernel
+ *
+ * The spare pages of idle buffers are taken and then every spare page is
+ * freed. Returns the number of pages freed
+ */
+unsigned long vmr_pool_trim(void)
+{
+	unsigned long freed = 0;
+	void *addr;
+
+	spin_lock(&vmr_pool_lock);
+	vmr_pool_reclaim(ULONG_MAX);
+	while (vmr_pool_free) {
+		addr = vmr_pool_free;
+		vmr_pool_free = *(void **)addr;
+		free_page((unsigned long)addr);
+		vmr_pool.spare--;
+		freed++;
 	}
+	spin_unlock(&vmr_pool_lock);
 
-	/* Copy in the old buffer data */
-	memcpy(newbuf, desc->procbuf, oldpages * PAGE_SIZE);
+	return freed;
+}
 
-	/* Delete the old buffer and replace it*/
-	vmrproc_freebuffer(desc);
-	desc->procbuf = newbuf;
-	desc->procbuf_size = bytes;
+/**
+ * vmr_pool_getstats - Return the usage of the result page pool
+ * @stats: Filled with the usage
+ */
+void vmr_pool_getstats(struct vmr_pool_stats *stats)
+{
+	spin_lock(&vmr_pool_lock);
+	*stats = vmr_pool;
+	stats->quota = vmr_pool_quota;
+	spin_unlock(&vmr_pool_lock);
+}
 
-	/* Return success */
-	return 0;
+/*
+ * vmrproc_gfp - The gfp mask printp may allocate output space with
+ *
+ * in_atomic() does not see a spinlock taken on a kernel without
+ * preemption so interrupts being disabled is checked too. A spinlock
+ * taken with interrupts enabled is still not seen there so callers must
+ * not print while holding one
+ */
+static inline gfp_t vmrproc_gfp(void)
+{
+	return (in_atomic() || irqs_disabled()) ? GFP_ATOMIC : GFP_KERNEL;
 }
 
+/**
+ * vmrproc_newchunk - Allocate a single page chunk for a proc buffer
+ *
+ * printp may be called with interrupts disabled in which case the
+ * allocation cannot sleep
+ */
+static struct vmr_chunk *vmrproc_newchunk(void)
+{
+	struct vmr_chunk *chunk;
+	gfp_t gfp = vmrproc_gfp();
+
+	chunk = kmalloc(sizeof(struct vmr_chunk), gfp);
+	if (!chunk)
+		return NULL;
 
-#ifndef PGDAT_LIST_EXPORTED
-	struct page pgdat_page;
-	struct address_space swapper_space;
-	pg_data_t *pgdat_list;
+	chunk->data = vmr_pool_getpage(gfp);
+	if (!chunk->data) {
+		kfree(chunk);
+		return NULL;
+	}
+	chunk->next = NULL;
 
-	/* This could be dangerous :-( */
-	EXPORT_SYMBOL(swapper_space);
-	EXPORT_SYMBOL(pgdat_list);
-#endif
+	return chunk;
+}
+
+/*
+ * The mmap header is a sequence count so readers on a 32-bit machine do
+ * not see half of a 64-bit field. See vmr_mmap.h for the reader side
+ */
+static inline void vmrproc_header_begin(struct vmr_mmap_header *header)
+{
+	header->sequence++;
+	smp_wmb();
+}
+
+static inline void vmrproc_header_end(struct vmr_mmap_header *header)
+{
+	smp_wmb();
+	header->sequence++;
+}
 
 /**
+ * vmrproc_sync_header - Update the mmap header after output is added
+ * @desc: The test descriptor
  *
- * get_pgdat_list - Return the pgdat_list
- * @page - A page provided to track the parent pgdat_list if necessary
+ * The output must be visible before the new length is which the barrier
+ * in vmrproc_header_begin takes care of
+ */
+static inline void vmrproc_sync_header(vmr_desc_t *desc)
+{
+	struct vmr_mmap_header *header = desc->header;
+
+	if (!header)
+		return;
+
+	vmrproc_header_begin(header);
+	header->written = vmrproc_length(desc);
+	header->size = desc->procbuf_size;
+	vmrproc_header_end(header);
+}
+
+/**
+ * vmrproc_newgeneration - Start a new generation of output
+ * @desc: The test descriptor
  *
- * This is the first link in the nodes belonging to the system. Normally to 
- * access it, the pgdat_list must be exported but if it is not exported, a 
- * workaround is provided here which will use a page to get the zone giving 
- * it's pgdat. There is no guarentee that we'll get the first pgdat but on 
- * machines with just one node like the x86, it is not important. For NUMA 
- * machines, the kernel must be patched to export the symbol
+ * Called when the output is reset so readers of a mapping know the bytes
+ * they have consumed are stale
+ */
+void vmrproc_newgeneration(vmr_desc_t *desc)
+{
+	struct vmr_mmap_header *header = desc->header;
+
+	if (!header)
+		return;
+
+	vmrproc_header_begin(header);
+	header->generation++;
+	header->written = vmrproc_length(desc);
+	header->size = desc->procbuf_size;
+	vmrproc_header_end(header);
+}
+
+/**
+ * vmrproc_pin - Stop the chunks of a proc buffer being freed
+ * @desc: The test descriptor
  *
+ * Readers walk the chunks without the lock because copy_to_user may sleep.
+ * While a buffer is pinned the pool does not reclaim from it and
+ * vmrproc_freechunks waits for the pin to be dropped. The count is raised
+ * under the lock so the pool sees it before it unlinks anything
  */
-#ifndef PGDAT_LIST_EXPORTED
-int warned_pgdat=0;
-#endif
-pg_data_t *get_pgdat_list(void) {
-	struct page *page;
+static void vmrproc_pin(vmr_desc_t *desc)
+{
+	spin_lock(&desc->lock);
+	atomic_inc(&desc->readers);
+	spin_unlock(&desc->lock);
+}
 
-#ifdef PGDAT_LIST_EXPORTED
-	return pgdat_list;
-#else
-	C_ZONE  *zone;
+static inline void vmrproc_unpin(vmr_desc_t *desc)
+{
+	atomic_dec(&desc->readers);
+}
 
-	if (!warned_pgdat) {
-		vmr_printk("Warning - No guarentee all memory nodes are visible. Kernel patch required\n");
-		warned_pgdat = 1;
-	}
+/**
+ * vmrproc_freechunks - Return the output pages of a proc buffer to the pool
+ * @desc: The test descriptor
+ *
+ * Pages still mapped by a reader stay around until they are unmapped
+ * because the mapping holds a reference. A reader walking the chunks is
+ * waited for. The caller must be able to sleep
+ */
+static void vmrproc_freechunks(vmr_desc_t *desc)
+{
+	struct vmr_chunk *chunk, *next;
 
-	page = alloc_pages_node(0, GFP_KERNEL, 0);
-	if (!page) {
-		if (!warned_pgdat) {
-			vmr_printk("get_pgdat_list() failued. Could not get page from node 0\n");
-			warned_pgdat = 1;
-		}
-		return NULL;
+	/* Unlink the chunks so the pool cannot reclaim them as well */
+	spin_lock(&vmr_pool_lock);
+	spin_lock(&desc->lock);
+	while (atomic_read(&desc->readers)) {
+		spin_unlock(&desc->lock);
+		spin_unlock(&vmr_pool_lock);
+		msleep(1);
+		spin_lock(&vmr_pool_lock);
+		spin_lock(&desc->lock);
 	}
+	chunk = desc->chunks;
+	desc->chunks = NULL;
+	desc->chunk_tail = NULL;
+	desc->seek.chunk = NULL;
+	desc->mapseek.chunk = NULL;
+	desc->layout++;
+	desc->procbuf_size = 0;
+	desc->written = 0;
+	spin_unlock(&desc->lock);
+	spin_unlock(&vmr_pool_lock);
 
-	zone = page_zone(page);
-	if (!zone) {
-		if (!warned_pgdat) {
-			vmr_printk("get_pgdat_list() failued. Could not zone for zero page\n");
-			warned_pgdat = 1;
-		}
-		return NULL;
+	for (; chunk; chunk = next) {
+		next = chunk->next;
+		vmr_pool_putpage(chunk->data);
+		kfree(chunk);
 	}
-
-	__free_pages(page, 0);
-	return zone->zone_pgdat;
-#endif
 }
 
-/* Taken directly from the Linux Kernel Source lib/vsprinf.c */
-
 /**
- * vmr_strtoul - convert a string to an unsigned long
- * @cp: The start of the string
- * @endp: A pointer to the end of the parsed string will be placed here
- * @base: The number base to use
+ * vmrproc_freeevents - Free the event rings of a test
+ * @desc: The test descriptor
+ *
+ * The caller must be sure no other thread is still logging
  */
-unsigned long vmr_strtoul(const char *cp,char **endp,unsigned int base)
+void vmrproc_freeevents(vmr_desc_t *desc)
 {
-	unsigned long result = 0,value;
+	struct vmr_eventring *ring = desc->events;
+	int cpu;
 
-	if (!base) {
-		base = 10;
-		if (*cp == '0') {
-			base = 8;
-			cp++;
-			if ((*cp == 'x') && isxdigit(cp[1])) {
-				cp++;
-				base = 16;
-			}
-		}
+	if (!ring)
+		return;
+
+	desc->events = NULL;
+	smp_wmb();
+
+	for_each_cpu_mask(cpu, ring->cpus)
+		vfree(ring->cpu[cpu]);
+	kfree(ring);
+}
+
+/** 
+ * vmrproc_freebuffer - Frees the buffer used for printing proc information
+ * @desc: The test descriptor
+ *
+ * This function will adjust the callers buffer and buffer size parameters. This
+ * is handy if the size of the proc buffer is expected to change for the 
+ * lifetime of the module. Any event rings of the test are freed with it
+ */
+void vmrproc_freebuffer(vmr_desc_t *desc)
+{
+	vmrproc_freechunks(desc);
+	vmrproc_freeevents(desc);
+
+	if (desc->header) {
+		vmr_pool_putpage((char *)desc->header);
+		desc->header = NULL;
 	}
-	while (isxdigit(*cp) &&
-	       (value = isdigit(*cp) ? *cp-'0' : toupper(*cp)-'A'+10) < base) {
-		result = result*base + value;
-		cp++;
+
+	spin_lock(&vmr_pool_lock);
+	if (desc->reserve) {
+		list_del(&desc->pool);
+		vmr_pool.buffers--;
+		desc->reserve = 0;
 	}
-	if (endp)
-		*endp = (char *)cp;
-	return result;
+	spin_unlock(&vmr_pool_lock);
 }
 
 /**
- * vmr_strtol - convert a string to a signed long
- * @cp: The start of the string
- * @endp: A pointer to the end of the parsed string will be placed here
- * @base: The number base to use
+ * __vmrproc_growbuffer - Append a number of spare pages to a proc buffer
+ * @pages: The number of pages to grow by
+ * @desc: The test descriptor struct 
  */
-long vmr_strtol(const char *cp,char **endp,unsigned int base)
+static int __vmrproc_growbuffer(unsigned int pages, vmr_desc_t *desc)
 {
-	if(*cp=='-')
-		return -vmr_strtoul(cp+1,endp,base);
-	return vmr_strtoul(cp,endp,base);
+	struct vmr_chunk **last;
+	struct vmr_chunk *chunk;
+
+	while (pages--) {
+		/* The pool may reclaim from other buffers so no lock is held */
+		chunk = vmrproc_newchunk();
+		if (!chunk)
+			return -ENOMEM;
+
+		/* Find the end of the list. Start from the tail if there is one */
+		spin_lock(&desc->lock);
+		last = desc->chunk_tail ? &desc->chunk_tail->next : &desc->chunks;
+		while (*last)
+			last = &(*last)->next;
+		*last = chunk;
+		desc->procbuf_size += PAGE_SIZE;
+		spin_unlock(&desc->lock);
+	}
+
+	return 0;
 }
 
 /**
- * check_resched_nocount - Checks if schedule needs to be called
+ * vmrproc_firstchunk - Take the first pages of a buffer on its first write
+ * @desc: The test descriptor
  *
- * Return Value 
- * 0 If schedule was not called
- * 1 If schedule was called
+ * Returns 0 if the write tail is ready to be written to
  */
-int check_resched_nocount(void) {
-	if (in_interrupt() || !current) return 0;
+static int vmrproc_firstchunk(vmr_desc_t *desc)
+{
+	if (!desc->reserve)
+		return -ENODEV;
 
-#ifdef HAVE_NEED_RESCHED
-	if (need_resched()) {
-#else
-	if (unlikely(current->need_resched)) {
-#endif
-		__set_current_state(TASK_RUNNING);
-		schedule();
-		return 1;
+	if (!desc->chunks && __vmrproc_growbuffer(desc->reserve, desc)) {
+		vmr_printk("Failed to allocate proc buffer\n");
+		if (!desc->chunks) {
+			desc->written = -(desc->pid);
+			return -ENOMEM;
+		}
 	}
 
+	desc->chunk_tail = desc->chunks;
 	return 0;
 }
 
-	
+/**
+ * vmrproc_allocbuffer - Allocates a buffer for printing out proc information 
+ * @pages - number of pages to allocate
+ * @desc - The test descriptor
+ *
+ * Any existing buffer is freed and replaced with one of the requested size.
+ * The pages are taken from the pool on the first write to the buffer so
+ * an entry that is never run holds no memory. Even with VMR_NOGROW, the
+ * first write takes all of them. The wait queue of the test is set up
+ * when it is first given a buffer so it must be before it can be polled
+ */
+int vmrproc_allocbuffer(unsigned int pages, vmr_desc_t *desc)
+{       
+	/* Return if 0 pages were asked for */
+	if (!pages) return 0;
+
+	vmrproc_freechunks(desc);
+
+	/* Let the pool reclaim from the buffer */
+	if (!desc->reserve)
+		init_waitqueue_head(&desc->wait);
+
+	spin_lock(&vmr_pool_lock);
+	if (!desc->reserve) {
+		list_add_tail(&desc->pool, &vmr_pool_buffers);
+		vmr_pool.buffers++;
+	}
+	desc->reserve = pages;
+	spin_unlock(&vmr_pool_lock);
+
+	vmrproc_newgeneration(desc);
+
+	return 0;
+}
+
+/**
+ * vmrproc_growbuffer - Grow the proc buffer by a number of pages
+ * @pages: The number of pages to grow by
+ * @desc: The test descriptor struct 
+ *
+ * The new pages are linked onto the end of the buffer so the old contents
+ * are never copied and the size of the buffer is only limited by available
+ * memory. printp grows the buffer on demand so this is only needed to
+ * reserve pages in advance of a test
+ */
+int  vmrproc_growbuffer(unsigned int pages, vmr_desc_t *desc) {
+	/* Check test flags */
+	if (desc->flags & VMR_NOGROW) return 0;
+
+	/* Return if 0 pages were asked for */
+	if (!pages) return 0;
+
+	if (__vmrproc_growbuffer(pages, desc)) {
+		vmr_printk("Failed to grow proc buffer\n");
+		return -ENOMEM;
+	}
+
+	/* Return success */
+	return 0;
+}
+
+/**
+ * vmrproc_nextchunk - Move the write tail to the next page of the buffer
+ * @desc: The test descriptor
+ *
+ * A spare page is used if one is available, otherwise the buffer is grown
+ * by one page unless VMR_NOGROW is set. Returns 0 on success. On failure,
+ * printing is disabled by setting written to -pid
+ */
+static int vmrproc_nextchunk(vmr_desc_t *desc)
+{
+	struct vmr_chunk *next;
+	int grown = 0;
+
+	if (!desc->chunk_tail)
+		return vmrproc_firstchunk(desc);
+
+	/*
+	 * The pool takes spare pages from buffers without a writer so the
+	 * tail is moved under the lock in case a test prints without
+	 * opening the buffer
+	 */
+	for (;;) {
+		spin_lock(&desc->lock);
+		next = desc->chunk_tail->next;
+		if (next)
+			desc->chunk_tail = next;
+		spin_unlock(&desc->lock);
+		if (next)
+			return 0;
+
+		if (grown || (desc->flags & VMR_NOGROW) ||
+		    __vmrproc_growbuffer(1, desc)) {
+			vmr_printk("Proc buffer filled!!! Disabling\n");
+			desc->written = -(desc->pid);
+			vmrproc_sync_header(desc);
+			return -ENOMEM;
+		}
+		grown = 1;
+	}
+}
+
+/**
+ * vmrproc_write - Append raw bytes to a proc buffer
+ * @desc: The test descriptor
+ * @data: The data to append
+ * @len: The number of bytes to append
+ *
+ * Returns the number of bytes appended which will be less than len if
+ * the buffer could not be grown
+ */
+long vmrproc_write(vmr_desc_t *desc, const char *data, unsigned long len)
+{
+	unsigned long offset, bytes, done = 0;
+
+	if (desc->written < 0)
+		return 0;
+
+	while (done < len) {
+		offset = desc->written & ~PAGE_MASK;
+		if (offset == 0 && (desc->written != 0 || !desc->chunk_tail))
+			if (vmrproc_nextchunk(desc))
+				break;
+
+		bytes = min(len - done, PAGE_SIZE - offset);
+		if (data)
+			memcpy(desc->chunk_tail->data + offset, data + done, bytes);
+		done += bytes;
+		desc->written += bytes;
+	}
+	vmrproc_sync_header(desc);
+
+	return done;
+}
+
+/**
+ * vmrproc_fill - Append a number of copies of a byte to a proc buffer
+ * @desc: The test descriptor
+ * @c: The byte to append
+ * @len: The number of bytes to append
+ *
+ * This is used to lay down space that is later filled in place such as
+ * the page map printed by vmr_printmap. The space is not limited by the
+ * pool quota as a map of a large address space would not fit in it
+ */
+long vmrproc_fill(vmr_desc_t *desc, int c, unsigned long len)
+{
+	unsigned long start = desc->written;
+	unsigned long offset, bytes;
+	unsigned long pages = (len >> PAGE_SHIFT) + 1;
+	long done;
+
+	spin_lock(&vmr_pool_lock);
+	vmr_pool_extra += pages;
+	spin_unlock(&vmr_pool_lock);
+
+	done = vmrproc_write(desc, NULL, len);
+
+	spin_lock(&vmr_pool_lock);
+	vmr_pool_extra -= pages;
+	spin_unlock(&vmr_pool_lock);
+
+	if (done <= 0)
+		return done;
+
+	/* Set the bytes in place one page at a time */
+	len = done;
+	while (len) {
+		offset = start & ~PAGE_MASK;
+		bytes = min(len, PAGE_SIZE - offset);
+		memset(vmrproc_bufaddr(desc, start), c, bytes);
+		start += bytes;
+		len -= bytes;
+	}
+
+	return done;
+}
+
+/**
+ * vmrproc_beginrecord - Append the header of a binary record
+ * @desc: The test descriptor
+ * @type: VMR_REC_* type of the record
+ * @id: Schema id for schema and data records
+ * @length: Bytes of payload that will follow
+ *
+ * The caller appends the payload and then calls vmrproc_endrecord
+ */
+long vmrproc_beginrecord(vmr_desc_t *desc, int type, int id,
+		unsigned long length)
+{
+	struct vmr_record_header header;
+
+	header.type = type;
+	header.id = id;
+	header.length = length;
+	return vmrproc_write(desc, (char *)&header, sizeof(header));
+}
+
+/**
+ * vmrproc_endrecord - Pad a binary record to VMR_RECORD_ALIGN
+ * @desc: The test descriptor
+ * @length: Bytes of payload in the record
+ */
+long vmrproc_endrecord(vmr_desc_t *desc, unsigned long length)
+{
+	unsigned long pad = -length & (VMR_RECORD_ALIGN - 1);
+
+	if (!pad)
+		return 0;
+	return vmrproc_fill(desc, 0, pad);
+}
+
+/**
+ * vmrproc_putrecord - Append a whole binary record
+ * @desc: The test descriptor
+ * @type: VMR_REC_* type of the record
+ * @id: Schema id for schema and data records
+ * @data: The payload
+ * @length: Bytes of payload
+ */
+static void vmrproc_putrecord(vmr_desc_t *desc, int type, int id,
+		void *data, unsigned long length)
+{
+	vmrproc_beginrecord(desc, type, id, length);
+	vmrproc_write(desc, data, length);
+	vmrproc_endrecord(desc, length);
+}
+
+/**
+ * vmrproc_startstream - Start the output of a new test
+ * @desc: The test descriptor
+ *
+ * Called by vmrproc_openbuffer. Schemas are written again for every test
+ * so each test's output can be decoded on its own
+ */
+void vmrproc_startstream(vmr_desc_t *desc)
+{
+	struct vmr_record_stream stream;
+
+	memset(desc->schemas, 0, sizeof(desc->schemas));
+	if (!(desc->flags & VMR_BINARY))
+		return;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.magic = VMR_RECORD_MAGIC;
+	stream.version = VMR_RECORD_VERSION;
+	strncpy(stream.name, desc->name, sizeof(stream.name) - 1);
+	vmrproc_putrecord(desc, VMR_REC_STREAM, 0, &stream, sizeof(stream));
+}
+
+/**
+ * vmrproc_schemaid - Return the id of a schema in a stream
+ * @desc: The test descriptor
+ * @schema: The schema
+ *
+ * The schema record is written the first time a schema is used. Returns
+ * -1 if the entry already uses VMR_RECORD_MAXSCHEMAS other schemas
+ */
+static int vmrproc_schemaid(vmr_desc_t *desc, struct vmr_schema *schema)
+{
+	struct vmr_record_schema rschema;
+	struct vmr_record_field rfield;
+	unsigned long length;
+	int id, i;
+
+	for (id = 0; id < VMR_RECORD_MAXSCHEMAS; id++) {
+		if (desc->schemas[id] == schema)
+			return id;
+		if (!desc->schemas[id])
+			break;
+	}
+	if (id == VMR_RECORD_MAXSCHEMAS)
+		return -1;
+
+	memset(&rschema, 0, sizeof(rschema));
+	rschema.nr_fields = schema->nr_fields;
+	strncpy(rschema.name, schema->name, sizeof(rschema.name) - 1);
+	length = sizeof(rschema) + schema->nr_fields * sizeof(rfield);
+
+	vmrproc_beginrecord(desc, VMR_REC_SCHEMA, id, length);
+	vmrproc_write(desc, (char *)&rschema, sizeof(rschema));
+	for (i = 0; i < schema->nr_fields; i++) {
+		memset(&rfield, 0, sizeof(rfield));
+		rfield.type = schema->fields[i].type;
+		strncpy(rfield.name, schema->fields[i].name, sizeof(rfield.name) - 1);
+		vmrproc_write(desc, (char *)&rfield, sizeof(rfield));
+	}
+	vmrproc_endrecord(desc, length);
+
+	desc->schemas[id] = schema;
+	return id;
+}
+
+/**
+ * vmrproc_record - Append a data record
+ * @desc: The test descriptor
+ * @schema: Schema describing the values
+ * @values: One value for every field of the schema
+ *
+ * Normally called through the printp_record macro. Without VMR_BINARY
+ * the record is printed as the schema name followed by name=value pairs
+ */
+int vmrproc_record(vmr_desc_t *desc, struct vmr_schema *schema,
+		unsigned long long *values)
+{
+	int id, i;
+
+	vmr_overhead_count(VMR_OVH_RECORD, 1);
+	if (!(desc->flags & VMR_BINARY)) {
+		vmrproc_printf(desc, "%s", schema->name);
+		for (i = 0; i < schema->nr_fields; i++) {
+			if (schema->fields[i].type == VMR_FIELD_S64)
+				vmrproc_printf(desc, " %s=%lld",
+					schema->fields[i].name, (long long)values[i]);
+			else
+				vmrproc_printf(desc, " %s=%llu",
+					schema->fields[i].name, values[i]);
+		}
+		return vmrproc_printf(desc, "\n");
+	}
+
+	id = vmrproc_schemaid(desc, schema);
+	if (id < 0) {
+		vmr_printk("Too many schemas used by %s\n", desc->name);
+		return 0;
+	}
+
+	vmrproc_putrecord(desc, VMR_REC_DATA, id, values,
+			schema->nr_fields * sizeof(unsigned long long));
+	return schema->nr_fields;
+}
+
+/**
+ * vmrproc_vtext - Append formatted text as a text record
+ * @desc: The test descriptor
+ * @format: printf style format
+ * @args: Arguments for format
+ */
+static int vmrproc_vtext(vmr_desc_t *desc, const char *format, va_list args)
+{
+	char buf[128], *tmp = buf;
+	va_list copy;
+	int len;
+
+	va_copy(copy, args);
+	len = vsnprintf(buf, sizeof(buf), format, args);
+	if (len >= sizeof(buf)) {
+		tmp = kmalloc(len + 1, vmrproc_gfp());
+		if (!tmp) {
+			va_end(copy);
+			vmr_printk("Failed to allocate space for text record\n");
+			return 0;
+		}
+		vsnprintf(tmp, len + 1, format, copy);
+	}
+	va_end(copy);
+
+	vmrproc_putrecord(desc, VMR_REC_TEXT, 0, tmp, len);
+	if (tmp != buf)
+		kfree(tmp);
+
+	return len;
+}
+
+/**
+ * vmrproc_printf - Format and append a string to a proc buffer
+ * @desc: The test descriptor
+ * @format: printf style format
+ *
+ * Normally called through the printp macro. The string is formatted
+ * straight into the tail page. Only if it crosses into the next page
+ * is it formatted a second time into a temporary buffer and split. If
+ * VMR_BINARY is set, the string is appended as a text record
+ */
+int vmrproc_printf(vmr_desc_t *desc, const char *format, ...)
+{
+	va_list args, copy;
+	unsigned long offset, avail;
+	char *tmp;
+	int len;
+
+	if (desc->written < 0)
+		return 0;
+	vmr_overhead_count(VMR_OVH_PRINTP, 1);
+
+	if (desc->flags & VMR_BINARY) {
+		va_start(args, format);
+		len = vmrproc_vtext(desc, format, args);
+		va_end(args);
+		return len;
+	}
+
+	/* Move to a fresh page if the tail page is exactly full */
+	offset = desc->written & ~PAGE_MASK;
+	if (offset == 0 && (desc->written != 0 || !desc->chunk_tail)) {
+		if (vmrproc_nextchunk(desc))
+			return 0;
+	}
+	avail = PAGE_SIZE - offset;
+
+	va_start(args, format);
+	va_copy(copy, args);
+	len = vsnprintf(desc->chunk_tail->data + offset, avail, format, args);
+	va_end(args);
+
+	if (len < avail) {
+		desc->written += len;
+		vmrproc_sync_header(desc);
+		va_end(copy);
+		return len;
+	}
+
+	/* The string crosses a page boundary */
+	tmp = kmalloc(len + 1, vmrproc_gfp());
+	if (!tmp) {
+		va_end(copy);
+		vmr_printk("Failed to allocate space to split proc output\n");
+		return 0;
+	}
+	vsnprintf(tmp, len + 1, format, copy);
+	va_end(copy);
+
+	len = vmrproc_write(desc, tmp, len);
+	kfree(tmp);
+
+	return len;
+}
+
+/**
+ * __vmrproc_bufaddr - Return the address of a byte in a proc buffer
+ * @desc: The test descriptor
+ * @cursor: Lookup cache to start the search from
+ * @offset: Offset of the byte from the beginning of the output
+ *
+ * The last page looked up is cached in the cursor so walking forward
+ * through the buffer, as vmr_printmap and readers do, is not quadratic
+ */
+char *__vmrproc_bufaddr(vmr_desc_t *desc, struct vmr_cursor *cursor,
+		unsigned long offset)
+{
+	unsigned long index = offset >> PAGE_SHIFT;
+	struct vmr_chunk *chunk = cursor->chunk;
+	unsigned long chunk_index = cursor->index;
+
+	/* Restart from the head if the buffer was replaced or we went back */
+	if (!chunk || cursor->layout != desc->layout || chunk_index > index) {
+		chunk = desc->chunks;
+		chunk_index = 0;
+	}
+
+	while (chunk && chunk_index < index) {
+		chunk = chunk->next;
+		chunk_index++;
+	}
+	if (!chunk)
+		return NULL;
+
+	cursor->layout = desc->layout;
+	cursor->chunk = chunk;
+	cursor->index = chunk_index;
+	return chunk->data + (offset & ~PAGE_MASK);
+}
+
+/**
+ * vmrproc_bufaddr - Return the address of a byte in a proc buffer
+ * @desc: The test descriptor
+ * @offset: Offset of the byte from the beginning of the output
+ *
+ * Uses the writers cursor. Readers have their own
+ */
+char *vmrproc_bufaddr(vmr_desc_t *desc, unsigned long offset)
+{
+	return __vmrproc_bufaddr(desc, &desc->seek, offset);
+}
+
+/**
+ * vmrproc_length - Return the number of bytes of output in a proc buffer
+ * @desc: The test descriptor
+ *
+ * Printing is only disabled when the last page is full and another
+ * could not be added so in that case the whole buffer is output
+ */
+unsigned long vmrproc_length(vmr_desc_t *desc)
+{
+	long written = desc->written;
+
+	return written < 0 ? desc->procbuf_size : written;
+}
+
+/**
+ * vmrproc_copyout - Copy output from a proc buffer
+ * @desc: The test descriptor
+ * @offset: Offset in the output to start copying from
+ * @buf: Kernel buffer to copy to
+ * @count: Maximum number of bytes to copy
+ *
+ * Returns the number of bytes copied. 0 is returned at the end of output.
+ * A private cursor is used so the writers one is left alone
+ */
+long vmrproc_copyout(vmr_desc_t *desc, unsigned long offset,
+		char *buf, unsigned long count)
+{
+	struct vmr_cursor cursor = { 0, NULL, 0 };
+	unsigned long end, bytes, done = 0;
+	char *from;
+
+	end = vmrproc_length(desc);
+	if (offset >= end)
+		return 0;
+	if (count > end - offset)
+		count = end - offset;
+
+	vmrproc_pin(desc);
+	while (done < count) {
+		from = __vmrproc_bufaddr(desc, &cursor, offset + done);
+		if (!from)
+			break;
+		bytes = min(count - done, PAGE_SIZE - ((offset + done) & ~PAGE_MASK));
+		memcpy(buf + done, from, bytes);
+		done += bytes;
+	}
+	vmrproc_unpin(desc);
+
+	return done;
+}
+
+/**
+ * vmrproc_file_open - Open a proc entry for streaming reads
+ * @inode: The proc inode
+ * @file: The file been opened
+ *
+ * Every open file gets its own cursor so a read continues from the page
+ * the last read finished in rather than searching from the start. Tests
+ * that completed before the open are considered seen by poll()
+ */
+int vmrproc_file_open(struct inode *inode, struct file *file)
+{
+	struct vmr_file *vf;
+
+	vf = kmalloc(sizeof(struct vmr_file), GFP_KERNEL);
+	if (!vf)
+		return -ENOMEM;
+	memset(vf, 0, sizeof(struct vmr_file));
+	vf->completed = vmrproc_file_desc(file)->completed;
+
+	file->private_data = vf;
+	return 0;
+}
+
+/**
+ * vmrproc_file_release - Release a proc entry opened for streaming reads
+ * @inode: The proc inode
+ * @file: The file been closed
+ */
+int vmrproc_file_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	file->private_data = NULL;
+	return 0;
+}
+
+/**
+ * vmrproc_file_read - Copy output from a proc buffer to userspace
+ * @file: The proc file been read
+ * @buf: User buffer
+ * @count: Number of bytes requested
+ * @ppos: File position, advanced by the number of bytes copied
+ *
+ * There is no limit on the size of a read. The output is copied a page
+ * at a time straight from the proc buffer. Each page is visited once per
+ * pass through the file so reading the full output is O(n)
+ */
+ssize_t vmrproc_file_read(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	vmr_desc_t *desc = vmrproc_file_desc(file);
+	struct vmr_file *vf = file->private_data;
+	unsigned long pos, end, bytes;
+	unsigned long completed;
+	size_t done = 0;
+	char *from;
+
+	if (*ppos < 0)
+		return -EINVAL;
+
+	completed = desc->completed;
+	smp_rmb();
+	end = vmrproc_length(desc);
+	pos = *ppos;
+	if (pos >= end) {
+		vf->completed = completed;
+		return 0;
+	}
+	if (count > end - pos)
+		count = end - pos;
+
+	/* copy_to_user may sleep so the chunks are pinned, not locked */
+	vmrproc_pin(desc);
+	while (done < count) {
+		from = __vmrproc_bufaddr(desc, &vf->cursor, pos);
+		if (!from)
+			break;
+
+		bytes = min(count - done, PAGE_SIZE - (pos & ~PAGE_MASK));
+		if (copy_to_user(buf + done, from, bytes)) {
+			if (!done) {
+				vmrproc_unpin(desc);
+				return -EFAULT;
+			}
+			break;
+		}
+
+		done += bytes;
+		pos  += bytes;
+		check_resched_nocount();
+	}
+	vmrproc_unpin(desc);
+
+	*ppos = pos;
+	if (pos >= end)
+		vf->completed = completed;
+	return done;
+}
+
+/**
+ * vmrproc_file_poll - Wait for a test to complete
+ * @file: The proc file been polled
+ * @wait: Poll table
+ *
+ * The file is readable once a writer closes the buffer after the file was
+ * opened or was last read to the end. Scripts can sleep in poll() or
+ * select() until results are ready instead of reading the entry again
+ * and again
+ */
+unsigned int vmrproc_file_poll(struct file *file, poll_table *wait)
+{
+	vmr_desc_t *desc = vmrproc_file_desc(file);
+	struct vmr_file *vf = file->private_data;
+
+	poll_wait(file, &desc->wait, wait);
+	if (desc->completed != vf->completed)
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+/**
+ * vmrproc_file_write - Pass a write to a proc entry to its write_proc
+ * @file: The proc file been written
+ * @buf: User buffer
+ * @count: Number of bytes written
+ * @ppos: File position (unused)
+ */
+ssize_t vmrproc_file_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct proc_dir_entry *dp = PDE(file->f_dentry->d_inode);
+
+	if (!dp->write_proc)
+		return -EIO;
+
+	return dp->write_proc(file, buf, count, dp->data);
+}
+
+/**
+ * vmrproc_file_llseek - Seek within the output of a proc entry
+ * @file: The proc file
+ * @offset: Offset to seek to
+ * @whence: SEEK_SET, SEEK_CUR or SEEK_END where the end is the number
+ *          of bytes written
+ */
+loff_t vmrproc_file_llseek(struct file *file, loff_t offset, int whence)
+{
+	vmr_desc_t *desc = vmrproc_file_desc(file);
+
+	switch (whence) {
+		case SEEK_SET:
+			break;
+		case SEEK_CUR:
+			offset += file->f_pos;
+			break;
+		case SEEK_END:
+			offset += vmrproc_length(desc);
+			break;
+		default:
+			return -EINVAL;
+	}
+
+	if (offset < 0)
+		return -EINVAL;
+
+	file->f_pos = offset;
+	return offset;
+}
+
+/**
+ * vmrproc_vma_nopage - Fault in a page of a mapped proc buffer
+ * @vma: The mapping
+ * @address: Faulting address
+ * @type: Returns the fault type
+ *
+ * Page 0 of the mapping is the header and page N+1 is output page N.
+ * The page reference taken here keeps the page alive after the buffer
+ * is freed or replaced until the reader unmaps it
+ */
+static struct page *vmrproc_vma_nopage(struct vm_area_struct *vma,
+		unsigned long address, int *type)
+{
+	vmr_desc_t *desc = vma->vm_private_data;
+	unsigned long pgoff;
+	struct page *page = NOPAGE_SIGBUS;
+	char *addr = NULL;
+
+	pgoff = ((address - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
+
+	spin_lock(&desc->lock);
+	if (pgoff == 0)
+		addr = (char *)desc->header;
+	else
+		addr = __vmrproc_bufaddr(desc, &desc->mapseek, (pgoff - 1) << PAGE_SHIFT);
+
+	if (addr) {
+		page = virt_to_page(addr);
+		get_page(page);
+	}
+	spin_unlock(&desc->lock);
+
+	if (type && page != NOPAGE_SIGBUS)
+		*type = VM_FAULT_MINOR;
+	return page;
+}
+
+static struct vm_operations_struct vmrproc_vm_ops = {
+	.nopage		= vmrproc_vma_nopage,
+};
+
+/**
+ * vmrproc_file_mmap - Map a proc buffer read-only into a process
+ * @file: The proc file
+ * @vma: The new mapping
+ *
+ * See vmr_mmap.h for the layout of the mapping
+ */
+int vmrproc_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	vmr_desc_t *desc = vmrproc_file_desc(file);
+	struct vmr_mmap_header *header;
+
+	if (!desc->reserve)
+		return -ENODEV;
+
+	/* The output may only be changed by the test */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	/* The header page is taken from the pool when first mapped */
+	if (!desc->header) {
+		header = (struct vmr_mmap_header *)vmr_pool_getpage(GFP_KERNEL);
+		if (!header)
+			return -ENOMEM;
+		memset(header, 0, PAGE_SIZE);
+		header->magic = VMR_MMAP_MAGIC;
+		header->page_size = PAGE_SIZE;
+
+		/*
+		 * The header is filled in before it is published so only the
+		 * writer ever updates it after that
+		 */
+		spin_lock(&desc->lock);
+		if (!desc->header) {
+			header->written = vmrproc_length(desc);
+			smp_rmb();
+			header->size = desc->procbuf_size;
+			smp_wmb();
+			desc->header = header;
+			header = NULL;
+		}
+		spin_unlock(&desc->lock);
+
+		if (header)
+			vmr_pool_putpage((char *)header);
+	}
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_RESERVED;
+
+	vma->vm_ops = &vmrproc_vm_ops;
+	vma->vm_private_data = desc;
+	return 0;
+}
+
+#ifndef PGDAT_LIST_EXPORTED
+	struct page pgdat_page;
+	struct address_space swapper_space;
+	pg_data_t *pgdat_list;
+
+	/* This could be dangerous :-( */
+	EXPORT_SYMBOL(swapper_space);
+	EXPORT_SYMBOL(pgdat_list);
+#endif
+
+/**
+ *
+ * get_pgdat_list - Return the pgdat_list
+ * @page - A page provided to track the parent pgdat_list if necessary
+ *
+ * This is the first link in the nodes belonging to the system. Normally to 
+ * access it, the pgdat_list must be exported but if it is not exported, a 
+ * workaround is provided here which will use a page to get the zone giving 
+ * it's pgdat. There is no guarentee that we'll get the first pgdat but on 
+ * machines with just one node like the x86, it is not important. For NUMA 
+ * machines, the kernel must be patched to export the symbol
+ *
+ */
+#ifndef PGDAT_LIST_EXPORTED
+int warned_pgdat=0;
+#endif
+pg_data_t *get_pgdat_list(void) {
+	struct page *page;
+
+#ifdef PGDAT_LIST_EXPORTED
+	return pgdat_list;
+#else
+	C_ZONE  *zone;
+
+	if (!warned_pgdat) {
+		vmr_printk("Warning - No guarentee all memory nodes are visible. Kernel patch required\n");
+		warned_pgdat = 1;
+	}
+
+	page = alloc_pages_node(0, GFP_KERNEL, 0);
+	if (!page) {
+		if (!warned_pgdat) {
+			vmr_printk("get_pgdat_list() failued. Could not get page from node 0\n");
+			warned_pgdat = 1;
+		}
+		return NULL;
+	}
+
+	zone = page_zone(page);
+	if (!zone) {
+		if (!warned_pgdat) {
+			vmr_printk("get_pgdat_list() failued. Could not zone for zero page\n");
+			warned_pgdat = 1;
+		}
+		return NULL;
+	}
+
+	__free_pages(page, 0);
+	return zone->zone_pgdat;
+#endif
+}
+
+/**
+ * vmr_get_pgdat - Return the pgdat of a node
+ * @node: The node id
+ *
+ * Only online nodes visible from get_pgdat_list are found. Returns NULL
+ * if the node does not exist or is offline
+ */
+pg_data_t *vmr_get_pgdat(int node)
+{
+	pg_data_t *pgdat;
+
+	if (node < 0 || node >= MAX_NUMNODES || !node_online(node))
+		return NULL;
+
+	for (pgdat = get_pgdat_list(); pgdat; vmr_next_pgdat(pgdat)) {
+		if (pgdat->node_id == node)
+			return pgdat;
+	}
+
+	return NULL;
+}
+
+/* Taken directly from the Linux Kernel Source lib/vsprinf.c */
+
+/**
+ * vmr_strtoul - convert a string to an unsigned long
+ * @cp: The start of the string
+ * @endp: A pointer to the end of the parsed string will be placed here
+ * @base: The number base to use
+ */
+unsigned long vmr_strtoul(const char *cp,char **endp,unsigned int base)
+{
+	unsigned long result = 0,value;
+
+	if (!base) {
+		base = 10;
+		if (*cp == '0') {
+			base = 8;
+			cp++;
+			if ((*cp == 'x') && isxdigit(cp[1])) {
+				cp++;
+				base = 16;
+			}
+		}
+	}
+	while (isxdigit(*cp) &&
+	       (value = isdigit(*cp) ? *cp-'0' : toupper(*cp)-'A'+10) < base) {
+		result = result*base + value;
+		cp++;
+	}
+	if (endp)
+		*endp = (char *)cp;
+	return result;
+}
+
+/**
+ * vmr_strtol - convert a string to a signed long
+ * @cp: The start of the string
+ * @endp: A pointer to the end of the parsed string will be placed here
+ * @base: The number base to use
+ */
+long vmr_strtol(const char *cp,char **endp,unsigned int base)
+{
+	if(*cp=='-')
+		return -vmr_strtoul(cp+1,endp,base);
+	return vmr_strtoul(cp,endp,base);
+}
+
+/* GFP flags that can be given by name to vmr_strtoparam */
+static struct {
+	char *name;
+	unsigned int flags;
+} vmr_gfp_names[] = {
+	{ "GFP_ATOMIC",		GFP_ATOMIC },
+	{ "GFP_NOIO",		GFP_NOIO },
+	{ "GFP_NOFS",		GFP_NOFS },
+	{ "GFP_KERNEL",		GFP_KERNEL },
+	{ "GFP_USER",		GFP_USER },
+	{ "GFP_HIGHUSER",	GFP_HIGHUSER },
+#ifdef GFP_RCLMUSER
+	{ "GFP_RCLMUSER",	GFP_RCLMUSER },
+#endif
+	{ "__GFP_HIGHMEM",	__GFP_HIGHMEM },
+	{ "__GFP_NOWARN",	__GFP_NOWARN },
+	{ "__GFP_EASYRCLM",	__GFP_EASYRCLM },
+	{ NULL,			0 }
+};
+
+/**
+ * vmr_strtoparam - Convert a parameter written to a proc entry
+ * @cp: The start of the parameter
+ *
+ * @value: Returns the value of the parameter
+ *
+ * Numbers are decimal unless they start with 0x. Anything else is taken
+ * to be GFP flags by name joined with | such as GFP_HIGHUSER|__GFP_NOWARN.
+ * Returns 0 or -EINVAL if the value is empty, a number has anything after
+ * its digits or a GFP flag is not known
+ */
+int vmr_strtoparam(const char *cp, long *value)
+{
+	long flags = 0;
+	int len, i;
+	const char *digits;
+	char *end;
+
+	if (*cp == '\0')
+		return -EINVAL;
+
+	if (*cp == '-' || isdigit(*cp)) {
+		if (cp[0] == '0' && cp[1] == 'x') {
+			digits = cp + 2;
+			*value = vmr_strtoul(digits, &end, 16);
+		} else {
+			digits = *cp == '-' ? cp + 1 : cp;
+			*value = vmr_strtol(cp, &end, 10);
+		}
+		if (end == digits || *end != '\0')
+			return -EINVAL;
+		return 0;
+	}
+
+	while (*cp) {
+		len = strcspn(cp, "|");
+		if (len == 0)
+			return -EINVAL;
+		for (i = 0; vmr_gfp_names[i].name; i++) {
+			if (strlen(vmr_gfp_names[i].name) == len &&
+			    !strncmp(vmr_gfp_names[i].name, cp, len))
+				break;
+		}
+		if (!vmr_gfp_names[i].name) {
+			vmr_printk("Unknown GFP flag in %s\n", cp);
+			return -EINVAL;
+		}
+		flags |= vmr_gfp_names[i].flags;
+
+		cp += len;
+		if (*cp == '|' && *(++cp) == '\0')
+			return -EINVAL;
+	}
+
+	*value = flags;
+	return 0;
+}
+
+/**
+ * check_resched_nocount - Checks if schedule needs to be called
+ *
+ * Return Value 
+ * 0 If schedule was not called
+ * 1 If schedule was called
+ */
+int check_resched_nocount(void) {
+	if (in_interrupt() || !current) return 0;
+	vmr_overhead_count(VMR_OVH_RESCHED, 1);
+
+#ifdef HAVE_NEED_RESCHED
+	if (need_resched()) {
+#else
+	if (unlikely(current->need_resched)) {
+#endif
+		__set_current_state(TASK_RUNNING);
+		schedule();
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/* Binary record printed by vmr_hist_print */
+static struct vmr_field vmr_hist_fields[] = {
+	{ "count",	VMR_FIELD_U64 },
+	{ "mean",	VMR_FIELD_U64 },
+	{ "min",	VMR_FIELD_U64 },
+	{ "p50",	VMR_FIELD_U64 },
+	{ "p90",	VMR_FIELD_U64 },
+	{ "p99",	VMR_FIELD_U64 },
+	{ "p999",	VMR_FIELD_U64 },
+	{ "max",	VMR_FIELD_U64 },
+};
+static struct vmr_schema vmr_hist_schema = VMR_SCHEMA("histogram", vmr_hist_fields);
+
+/**
+ * vmr_div64 - Divide two 64 bit numbers
+ *
+ * do_div only takes a 32 bit divisor so precision is dropped from both
+ * numbers until the divisor fits
+ */
+static unsigned long long vmr_div64(unsigned long long n, unsigned long long d)
+{
+	if (!d)
+		return 0;
+
+	while (d >> 32) {
+		n >>= 1;
+		d >>= 1;
+	}
+	do_div(n, (unsigned long)d);
+	return n;
+}
+
+/**
+ * vmr_hist_bucket - Return the bucket a value is counted in
+ * @value: The value
+ */
+static inline int vmr_hist_bucket(unsigned long long value)
+{
+	int msb;
+
+	if (value < VMR_HIST_SUB)
+		return value;
+
+	if (value >> 32)
+		msb = fls((unsigned int)(value >> 32)) + 31;
+	else
+		msb = fls((unsigned int)value) - 1;
+
+	return ((msb - VMR_HIST_SUBBITS + 1) << VMR_HIST_SUBBITS) +
+		((value >> (msb - VMR_HIST_SUBBITS)) & (VMR_HIST_SUB - 1));
+}
+
+/**
+ * vmr_hist_bucketmax - Return the largest value counted in a bucket
+ * @bucket: The bucket
+ */
+static unsigned long long vmr_hist_bucketmax(int bucket)
+{
+	int group = bucket >> VMR_HIST_SUBBITS;
+	unsigned long long sub = bucket & (VMR_HIST_SUB - 1);
+
+	if (group == 0)
+		return bucket;
+
+	return ((VMR_HIST_SUB + sub + 1) << (group - 1)) - 1;
+}
+
+/**
+ * vmr_hist_alloc - Allocate a histogram
+ *
+ * An instance is allocated for every online CPU. Values recorded on a CPU
+ * that came online later are lost
+ */
+struct vmr_histogram *vmr_hist_alloc(void)
+{
+	struct vmr_histogram *hist;
+	int cpu;
+
+	hist = kmalloc(sizeof(struct vmr_histogram), GFP_KERNEL);
+	if (!hist)
+		return NULL;
+	memset(hist, 0, sizeof(struct vmr_histogram));
+
+	for_each_online_cpu(cpu) {
+		hist->cpu[cpu] = kmalloc(sizeof(struct vmr_histcpu), GFP_KERNEL);
+		if (!hist->cpu[cpu]) {
+			vmr_hist_free(hist);
+			return NULL;
+		}
+	}
+
+	vmr_hist_reset(hist);
+	return hist;
+}
+
+/**
+ * vmr_hist_free - Free a histogram
+ * @hist: The histogram which may be NULL
+ */
+void vmr_hist_free(struct vmr_histogram *hist)
+{
+	int cpu;
+
+	if (!hist)
+		return;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		kfree(hist->cpu[cpu]);
+	kfree(hist);
+}
+
+/**
+ * vmr_hist_reset - Forget all values recorded in a histogram
+ * @hist: The histogram
+ */
+void vmr_hist_reset(struct vmr_histogram *hist)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		if (hist->cpu[cpu])
+			memset(hist->cpu[cpu], 0, sizeof(struct vmr_histcpu));
+}
+
+/**
+ * vmr_hist_record - Record a value in the instance for this CPU
+ * @hist: The histogram. If it failed to allocate and is NULL, nothing
+ *        is recorded
+ * @value: The value, normally a latency
+ */
+void vmr_hist_record(struct vmr_histogram *hist, unsigned long long value)
+{
+	struct vmr_histcpu *h;
+
+	if (!hist)
+		return;
+
+	h = hist->cpu[get_cpu()];
+	if (h) {
+		if (!h->count || value < h->min)
+			h->min = value;
+		if (value > h->max)
+			h->max = value;
+		h->count++;
+		h->sum += value;
+		h->buckets[vmr_hist_bucket(value)]++;
+	}
+	put_cpu();
+}
+
+/**
+ * vmr_hist_merge - Merge the instances of every CPU
+ * @total: Instance the sum is stored in
+ * @hist: The histogram
+ *
+ * total may be a histogram instance of another test to merge results
+ * from many tests
+ */
+void vmr_hist_merge(struct vmr_histcpu *total, struct vmr_histogram *hist)
+{
+	struct vmr_histcpu *h;
+	int cpu, bucket;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		h = hist->cpu[cpu];
+		if (!h || !h->count)
+			continue;
+
+		if (!total->count || h->min < total->min)
+			total->min = h->min;
+		if (h->max > total->max)
+			total->max = h->max;
+		total->count += h->count;
+		total->sum += h->sum;
+		for (bucket = 0; bucket < VMR_HIST_BUCKETS; bucket++)
+			total->buckets[bucket] += h->buckets[bucket];
+	}
+}
+
+/**
+ * vmr_hist_percentile - Return a percentile of a merged histogram
+ * @total: The merged histogram
+ * @per100k: The percentile in thousandths of a percent, 99900 for p99.9
+ *
+ * The largest value of the bucket the percentile falls in is returned so
+ * the percentile is never understated
+ */
+unsigned long long vmr_hist_percentile(struct vmr_histcpu *total,
+		unsigned int per100k)
+{
+	unsigned long long rank, seen = 0, value;
+	int bucket;
+
+	if (!total->count)
+		return 0;
+
+	rank = total->count * per100k + 99999;
+	do_div(rank, 100000);
+	if (rank == 0)
+		rank = 1;
+
+	for (bucket = 0; bucket < VMR_HIST_BUCKETS; bucket++) {
+		seen += total->buckets[bucket];
+		if (seen >= rank)
+			break;
+	}
+
+	value = vmr_hist_bucketmax(bucket);
+	if (value > total->max)
+		value = total->max;
+	if (value < total->min)
+		value = total->min;
+	return value;
+}
+
+/**
+ * vmr_hist_print - Print a summary of a histogram to a proc buffer
+ * @desc: The test descriptor. The caller must be the writer
+ * @hist: The histogram
+ * @name: What was measured
+ * @unit: Unit of the values
+ */
+void vmr_hist_print(vmr_desc_t *desc, struct vmr_histogram *hist,
+		char *name, char *unit)
+{
+	struct vmr_histcpu *total;
+	unsigned long long mean;
+
+	if (!hist)
+		return;
+
+	total = kmalloc(sizeof(struct vmr_histcpu), GFP_KERNEL);
+	if (!total) {
+		vmr_printk("Failed to allocate histogram to print %s\n", name);
+		return;
+	}
+	memset(total, 0, sizeof(struct vmr_histcpu));
+	vmr_hist_merge(total, hist);
+	mean = vmr_div64(total->sum, total->count);
+
+	if (vmrproc_binary(desc)) {
+		vmr_snprintf(desc, "Latency %s (%s)\n", name, unit);
+		vmr_record(desc, &vmr_hist_schema, total->count, mean,
+				total->min,
+				vmr_hist_percentile(total, 50000),
+				vmr_hist_percentile(total, 90000),
+				vmr_hist_percentile(total, 99000),
+				vmr_hist_percentile(total, 99900),
+				total->max);
+	} else {
+		vmr_snprintf(desc, "Latency %s (%s)\n", name, unit);
+		vmr_snprintf(desc, "o Count:  %llu\n", total->count);
+		vmr_snprintf(desc, "o Mean:   %llu\n", mean);
+		vmr_snprintf(desc, "o Min:    %llu\n", total->min);
+		vmr_snprintf(desc, "o p50:    %llu\n", vmr_hist_percentile(total, 50000));
+		vmr_snprintf(desc, "o p90:    %llu\n", vmr_hist_percentile(total, 90000));
+		vmr_snprintf(desc, "o p99:    %llu\n", vmr_hist_percentile(total, 99000));
+		vmr_snprintf(desc, "o p99.9:  %llu\n", vmr_hist_percentile(total, 99900));
+		vmr_snprintf(desc, "o Max:    %llu\n", total->max);
+	}
+
+	kfree(total);
+}
+
+/* Two sided 95% t values * 1000 for 1 to 30 degrees of freedom */
+static unsigned int vmr_repeat_t95[] = {
+	12706, 4303, 3182, 2776, 2571, 2447, 2365, 2306, 2262, 2228,
+	 2201, 2179, 2160, 2145, 2131, 2120, 2110, 2101, 2093, 2086,
+	 2080, 2074, 2069, 2064, 2060, 2056, 2052, 2048, 2045, 2042,
+};
+
+static char *vmr_repeat_reasons[] = { "passes", "stable", "budget" };
+
+/* Binary record printed by vmr_repeat_print */
+static struct vmr_field vmr_repeat_fields[] = {
+	{ "passes",	VMR_FIELD_U64 },
+	{ "mean",	VMR_FIELD_U64 },
+	{ "ci",		VMR_FIELD_U64 },
+	{ "cv",		VMR_FIELD_U64 },
+	{ "stopped",	VMR_FIELD_U64 },
+};
+static struct vmr_schema vmr_repeat_schema = VMR_SCHEMA("repeat", vmr_repeat_fields);
+
+/**
+ * vmr_sqrt64 - Integer square root of a 64 bit number
+ * @x: The number
+ */
+static unsigned long long vmr_sqrt64(unsigned long long x)
+{
+	unsigned long long root = 0, bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit) {
+		if (x >= root + bit) {
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return root;
+}
+
+/**
+ * vmr_repeat_t - Return the two sided 95% t value * 1000
+ * @df: Degrees of freedom
+ */
+static unsigned int vmr_repeat_t(unsigned int df)
+{
+	if (df <= ARRAY_SIZE(vmr_repeat_t95))
+		return vmr_repeat_t95[df - 1];
+	if (df <= 40)
+		return 2021;
+	if (df <= 60)
+		return 2000;
+	if (df <= 120)
+		return 1980;
+	return 1960;
+}
+
+/**
+ * vmr_repeat_stats - Work out the mean, CV and confidence interval
+ * @rep: The repetitions with at least two values recorded
+ *
+ * The values are shifted so the squares of their differences from the
+ * mean cannot overflow. That loses precision below 1 in 2^24 of the
+ * largest value which does not matter to the CV
+ */
+static void vmr_repeat_stats(struct vmr_repeat *rep)
+{
+	unsigned long long sum = 0, max = 0, var = 0, sd, mean, diff;
+	unsigned int i, n, shift = 0;
+
+	n = min(rep->n, (unsigned int)VMR_REPEAT_MAXVALUES);
+	for (i = 0; i < n; i++) {
+		sum += rep->values[i];
+		if (rep->values[i] > max)
+			max = rep->values[i];
+	}
+	rep->mean = vmr_div64(sum, n);
+
+	while ((max >> shift) >= (1ULL << 24))
+		shift++;
+	mean = rep->mean >> shift;
+	for (i = 0; i < n; i++) {
+		diff = rep->values[i] >> shift;
+		diff = diff > mean ? diff - mean : mean - diff;
+		var += diff * diff;
+	}
+	sd = vmr_sqrt64(vmr_div64(var, n - 1)) << shift;
+
+	rep->cvnow = rep->mean ? (unsigned int)vmr_div64(sd * 1000, rep->mean) : 0;
+	rep->ci = vmr_div64((vmr_repeat_t(n - 1) * sd) << 8,
+			1000 * vmr_sqrt64((unsigned long long)n << 16));
+}
+
+/**
+ * vmr_repeat_init - Start repeating a test
+ * @rep: The repetitions
+ * @cv: Stop when the CV is below this in 0.1%. 0 for no target
+ * @budget: Stop after this many milliseconds. 0 for no budget
+ * @max: Most passes to run
+ *
+ * If the values cannot be allocated, exactly max passes are run
+ */
+void vmr_repeat_init(struct vmr_repeat *rep, unsigned int cv,
+		unsigned int budget, unsigned int max)
+{
+	memset(rep, 0, sizeof(struct vmr_repeat));
+	rep->cv = cv;
+	rep->budget = budget != 0;
+	rep->deadline = jiffies + msecs_to_jiffies(budget);
+	rep->max = max;
+	rep->values = kmalloc(sizeof(unsigned long long) *
+			min(max, (unsigned int)VMR_REPEAT_MAXVALUES), GFP_KERNEL);
+}
+
+/**
+ * vmr_repeat_done - Record the metric of a pass and decide whether to stop
+ * @rep: The repetitions
+ * @value: The metric of the pass just run, normally how long it took
+ *
+ * Returns 1 if no more passes should be run
+ */
+int vmr_repeat_done(struct vmr_repeat *rep, unsigned long long value)
+{
+	if (rep->values && rep->n < VMR_REPEAT_MAXVALUES)
+		rep->values[rep->n] = value;
+	rep->n++;
+
+	if (rep->values && rep->n >= 2)
+		vmr_repeat_stats(rep);
+
+	if (rep->n >= rep->max) {
+		rep->stopped = VMR_REPEAT_PASSES;
+		return 1;
+	}
+
+	if (rep->cv && rep->values && rep->n >= VMR_REPEAT_MINPASSES &&
+	    rep->cvnow < rep->cv) {
+		rep->stopped = VMR_REPEAT_STABLE;
+		return 1;
+	}
+
+	if (rep->budget && time_after_eq(jiffies, rep->deadline)) {
+		rep->stopped = VMR_REPEAT_BUDGET;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * vmr_repeat_print - Print the mean and confidence interval of a test
+ * @desc: The test descriptor. The caller must be the writer
+ * @rep: The repetitions
+ * @name: What was measured
+ * @unit: Unit of the values
+ */
+void vmr_repeat_print(vmr_desc_t *desc, struct vmr_repeat *rep,
+		char *name, char *unit)
+{
+	if (!rep->values) {
+		vmr_snprintf(desc, "Repetition of %s: %u passes, no statistics\n",
+				name, rep->n);
+		return;
+	}
+
+	if (vmrproc_binary(desc)) {
+		vmr_snprintf(desc, "Repetition %s (%s)\n", name, unit);
+		vmr_record(desc, &vmr_repeat_schema, rep->n, rep->mean,
+				rep->ci, rep->cvnow, rep->stopped);
+	} else {
+		vmr_snprintf(desc, "Repetition %s (%s)\n", name, unit);
+		vmr_snprintf(desc, "o Passes:  %u\n", rep->n);
+		vmr_snprintf(desc, "o Mean:    %llu\n", rep->mean);
+		vmr_snprintf(desc, "o 95%% CI:  +/- %llu\n", rep->ci);
+		vmr_snprintf(desc, "o CV:      %u.%u%%\n", rep->cvnow / 10,
+				rep->cvnow % 10);
+		vmr_snprintf(desc, "o Stopped: %s\n",
+				vmr_repeat_reasons[rep->stopped]);
+	}
+}
+
+/**
+ * vmr_repeat_free - Free the values of the repetitions
+ * @rep: The repetitions
+ */
+void vmr_repeat_free(struct vmr_repeat *rep)
+{
+	kfree(rep->values);
+	rep->values = NULL;
+}
+
+/* Instrumentation call counters and costs. See vmr_overhead.h */
+struct vmr_overhead vmr_overhead[NR_CPUS];
+unsigned long vmr_overhead_cost[VMR_OVH_MAX];
+char *vmr_overhead_names[VMR_OVH_MAX] = {
+	"resched", "printp", "record", "buddyinfo", "pte"
+};
+
+/* Binary record printed by vmr_overhead_print, one per primitive */
+static struct vmr_field vmr_overhead_fields[] = {
+	{ "primitive",	VMR_FIELD_U64 },
+	{ "calls",	VMR_FIELD_U64 },
+	{ "cost",	VMR_FIELD_U64 },
+	{ "total",	VMR_FIELD_U64 },
+};
+static struct vmr_schema vmr_overhead_schema = VMR_SCHEMA("overhead", vmr_overhead_fields);
+
+/**
+ * vmr_overhead_read - Sum the instrumentation call counters of every CPU
+ * @calls: Returns the number of calls of each primitive
+ */
+void vmr_overhead_read(unsigned long *calls)
+{
+	int cpu, type;
+
+	memset(calls, 0, sizeof(unsigned long) * VMR_OVH_MAX);
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		for (type = 0; type < VMR_OVH_MAX; type++)
+			calls[type] += vmr_overhead[cpu].calls[type];
+}
+
+/**
+ * vmr_overhead_start - Record the instrumentation calls made so far
+ * @desc: The test descriptor of the test starting
+ */
+void vmr_overhead_start(vmr_desc_t *desc)
+{
+	vmr_overhead_read(desc->overhead);
+}
+
+/**
+ * vmr_overhead_print - Print the time a test spent in instrumentation
+ * @desc: The test descriptor of the test finishing
+ *
+ * The calls made since vmr_overhead_start are multiplied by the cost
+ * measured for each primitive by /proc/vmregress/overhead
+ */
+void vmr_overhead_print(vmr_desc_t *desc)
+{
+	unsigned long calls[VMR_OVH_MAX];
+	unsigned long long ns, total = 0;
+	int type;
+
+	/* Read first so the calls made to print are not counted */
+	vmr_overhead_read(calls);
+	for (type = 0; type < VMR_OVH_MAX; type++)
+		calls[type] -= desc->overhead[type];
+
+	vmr_snprintf(desc, "Instrumentation overhead (ns)\n");
+	if (!vmr_overhead_cost[VMR_OVH_PRINTP]) {
+		vmr_snprintf(desc, "o Not calibrated. Read /proc/vmregress/overhead first\n");
+	}
+
+	for (type = 0; type < VMR_OVH_MAX; type++) {
+		ns = (unsigned long long)calls[type] * vmr_overhead_cost[type];
+		total += ns;
+		if (vmrproc_binary(desc)) {
+			vmr_record(desc, &vmr_overhead_schema, type,
+					calls[type], vmr_overhead_cost[type], ns);
+		} else {
+			vmr_snprintf(desc, "o %-10s calls %-10lu cost %-6lu total %llu\n",
+					vmr_overhead_names[type], calls[type],
+					vmr_overhead_cost[type], ns);
+		}
+	}
+	vmr_snprintf(desc, "o Total:     %llu\n", total);
+}
+
+/* Event counters. See vmr_counters.h */
+static int vmr_pmu;
+MODULE_PARM(vmr_pmu, "i");
+MODULE_PARM_DESC(vmr_pmu, "Set to 1 to count instructions, TLB and cache misses with the PMU. Do not use with oprofile");
+
+/* Binary record printed by vmr_counters_print */
+static struct vmr_field vmr_counters_fields[] = {
+	{ "pass",		VMR_FIELD_S64 },
+	{ "cycles",		VMR_FIELD_S64 },
+	{ "instructions",	VMR_FIELD_S64 },
+	{ "dtlb",		VMR_FIELD_S64 },
+	{ "llc",		VMR_FIELD_S64 },
+	{ "faults",		VMR_FIELD_S64 },
+	{ "majfaults",		VMR_FIELD_S64 },
+	{ "cswitch",		VMR_FIELD_S64 },
+	{ "oncpu",		VMR_FIELD_S64 },
+	{ "offcpu",		VMR_FIELD_S64 },
+	{ "preempted",		VMR_FIELD_S64 },
+	{ "sleep",		VMR_FIELD_S64 },
+};
+static struct vmr_schema vmr_counters_schema = VMR_SCHEMA("counters", vmr_counters_fields);
+
+/* Binary record printed by vmr_counters_printsched */
+static struct vmr_field vmr_sched_fields[] = {
+	{ "wall",		VMR_FIELD_S64 },
+	{ "oncpu",		VMR_FIELD_S64 },
+	{ "offcpu",		VMR_FIELD_S64 },
+	{ "preempted",		VMR_FIELD_S64 },
+	{ "sleep",		VMR_FIELD_S64 },
+};
+static struct vmr_schema vmr_sched_schema = VMR_SCHEMA("sched", vmr_sched_fields);
+
+#ifdef CONFIG_X86
+/* Intel architectural performance monitoring */
+#define VMR_MSR_PERFEVTSEL0	0x186
+#define VMR_MSR_PMC0		0xc1
+#define VMR_MSR_GLOBAL_CTRL	0x38f
+#define VMR_EVTSEL_USR		(1 << 16)
+#define VMR_EVTSEL_OS		(1 << 17)
+#define VMR_EVTSEL_EN		(1 << 22)
+
+/*
+ * Events in the order they are given counters. Processors with two
+ * general purpose counters do not count instructions. dTLB misses are
+ * not an architectural event but have the same code on Core 2 and later
+ */
+static struct vmr_pmu_event {
+	int counter;		/* VMR_CTR_* */
+	unsigned int event;	/* Unit mask << 8 | event select */
+} vmr_pmu_events[] = {
+	{ VMR_CTR_DTLB,		0x0108 },	/* DTLB_MISSES.ANY */
+	{ VMR_CTR_LLC,		0x412e },	/* LLC misses */
+	{ VMR_CTR_INSTRUCTIONS,	0x00c0 },	/* Instructions retired */
+};
+#define VMR_PMU_EVENTS ARRAY_SIZE(vmr_pmu_events)
+
+static int vmr_pmu_nr;		/* Counters programmed */
+static int vmr_pmu_version;
+static unsigned long long vmr_pmu_mask;	/* Bits a counter has */
+static unsigned long long vmr_pmu_ctrl[NR_CPUS]; /* Global control at load */
+static cpumask_t vmr_pmu_cpus = CPU_MASK_NONE;	/* CPUs programmed */
+static atomic_t vmr_pmu_gen = ATOMIC_INIT(0);	/* Bumped when a CPU is
+						 * programmed after load
+						 */
+
+/* Sum of the counters of every CPU for one reader */
+struct vmr_pmu_sum {
+	spinlock_t lock;
+	unsigned long long values[VMR_PMU_EVENTS];
+};
+
+/**
+ * vmr_pmu_enable_cpu - Program the counters of the current CPU
+ * @info: unused
+ */
+static void vmr_pmu_enable_cpu(void *info)
+{
+	unsigned long long ctrl;
+	int i;
+
+	for (i = 0; i < vmr_pmu_nr; i++) {
+		wrmsrl(VMR_MSR_PERFEVTSEL0 + i, 0);
+		wrmsrl(VMR_MSR_PMC0 + i, 0);
+		wrmsrl(VMR_MSR_PERFEVTSEL0 + i, vmr_pmu_events[i].event |
+			VMR_EVTSEL_USR | VMR_EVTSEL_OS | VMR_EVTSEL_EN);
+	}
+
+	/* From version 2, counters must also be enabled globally */
+	if (vmr_pmu_version >= 2) {
+		rdmsrl(VMR_MSR_GLOBAL_CTRL, ctrl);
+		vmr_pmu_ctrl[smp_processor_id()] = ctrl;
+		wrmsrl(VMR_MSR_GLOBAL_CTRL, ctrl | ((1ULL << vmr_pmu_nr) - 1));
+	}
+	cpu_set(smp_processor_id(), vmr_pmu_cpus);
+}
+
+/**
+ * vmr_pmu_disable_cpu - Stop the counters of the current CPU
+ * @info: unused
+ */
+static void vmr_pmu_disable_cpu(void *info)
+{
+	int i;
+
+	if (!cpu_isset(smp_processor_id(), vmr_pmu_cpus))
+		return;
+
+	for (i = 0; i < vmr_pmu_nr; i++)
+		wrmsrl(VMR_MSR_PERFEVTSEL0 + i, 0);
+
+	/* Leave the global control as it was found */
+	if (vmr_pmu_version >= 2)
+		wrmsrl(VMR_MSR_GLOBAL_CTRL, vmr_pmu_ctrl[smp_processor_id()]);
+}
+
+/**
+ * vmr_pmu_read_cpu - Add the counters of the current CPU to a sum
+ * @info: The struct vmr_pmu_sum of the reader
+ *
+ * A CPU that came online after the counters were programmed is
+ * programmed here. Its counters start from 0 and vmr_pmu_gen is bumped
+ * so a difference across the programming is reported as unavailable
+ */
+static void vmr_pmu_read_cpu(void *info)
+{
+	struct vmr_pmu_sum *sum = info;
+	unsigned long long values[VMR_PMU_EVENTS];
+	int i;
+
+	if (!cpu_isset(smp_processor_id(), vmr_pmu_cpus)) {
+		vmr_pmu_enable_cpu(NULL);
+		atomic_inc(&vmr_pmu_gen);
+	}
+
+	for (i = 0; i < vmr_pmu_nr; i++)
+		rdmsrl(VMR_MSR_PMC0 + i, values[i]);
+
+	spin_lock(&sum->lock);
+	for (i = 0; i < vmr_pmu_nr; i++)
+		sum->values[i] += values[i];
+	spin_unlock(&sum->lock);
+}
+
+/**
+ * vmr_pmu_cpu_callback - Forget the counters of a CPU that went offline
+ * @nb: The notifier
+ * @action: CPU_*
+ * @hcpu: The CPU
+ *
+ * The counters of a CPU are lost when it goes offline. It is programmed
+ * again the first time it is read after it comes back, see
+ * vmr_pmu_read_cpu
+ */
+static int vmr_pmu_cpu_callback(struct notifier_block *nb,
+		unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD)
+		cpu_clear((long)hcpu, vmr_pmu_cpus);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block vmr_pmu_cpu_notifier = {
+	.notifier_call = vmr_pmu_cpu_callback,
+};
+
+/**
+ * vmr_pmu_init - Program the hardware counters if vmr_pmu is set
+ */
+static void vmr_pmu_init(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!vmr_pmu)
+		return;
+
+	if (boot_cpu_data.x86_vendor != X86_VENDOR_INTEL ||
+	    boot_cpu_data.cpuid_level < 0xa) {
+		vmr_printk("No architectural PMU. Only software events are counted\n");
+		return;
+	}
+
+	cpuid(0xa, &eax, &ebx, &ecx, &edx);
+	vmr_pmu_version = eax & 0xff;
+	vmr_pmu_nr = min_t(int, (eax >> 8) & 0xff, VMR_PMU_EVENTS);
+	vmr_pmu_mask = ((eax >> 16) & 0xff) >= 64 ? ~0ULL :
+		(1ULL << ((eax >> 16) & 0xff)) - 1;
+	if (!vmr_pmu_version || !vmr_pmu_nr || !vmr_pmu_mask) {
+		vmr_printk("No architectural PMU. Only software events are counted\n");
+		vmr_pmu_nr = 0;
+		return;
+	}
+
+	on_each_cpu(vmr_pmu_enable_cpu, NULL, 0, 1);
+	register_cpu_notifier(&vmr_pmu_cpu_notifier);
+	vmr_printk("Counting %d hardware events with PMU version %d\n",
+			vmr_pmu_nr, vmr_pmu_version);
+}
+
+/**
+ * vmr_pmu_cleanup - Stop the hardware counters
+ */
+static void vmr_pmu_cleanup(void)
+{
+	if (vmr_pmu_nr) {
+		unregister_cpu_notifier(&vmr_pmu_cpu_notifier);
+		on_each_cpu(vmr_pmu_disable_cpu, NULL, 0, 1);
+	}
+}
+
+/**
+ * vmr_pmu_read - Read the hardware counters
+ * @ctr: Filled with the counters
+ * @all: Sum the counters of every online CPU
+ *
+ * Reading every CPU takes an IPI to each of them so it is only done at
+ * the start and end of a test. Otherwise only the counters of the CPU the
+ * thread is on are read and only if it is bound to that CPU, such as with
+ * nomigrate=1, as the counters of another CPU cannot be read without an
+ * IPI. An unbound thread gets -1. Many threads may read at once so each
+ * sums into its own storage
+ */
+static void vmr_pmu_read(struct vmr_counters *ctr, int all)
+{
+	struct vmr_pmu_sum sum;
+	int i;
+
+	if (!vmr_pmu_nr)
+		return;
+
+	memset(&sum, 0, sizeof(sum));
+	spin_lock_init(&sum.lock);
+	if (all) {
+		ctr->cpu = -1;
+		on_each_cpu(vmr_pmu_read_cpu, &sum, 0, 1);
+	} else {
+		ctr->cpu = get_cpu();
+		if (cpus_weight(current->cpus_allowed) != 1) {
+			put_cpu();
+			return;
+		}
+		vmr_pmu_read_cpu(&sum);
+		put_cpu();
+	}
+	ctr->pmu_gen = atomic_read(&vmr_pmu_gen);
+
+	for (i = 0; i < vmr_pmu_nr; i++)
+		ctr->values[vmr_pmu_events[i].counter] = sum.values[i];
+}
+
+/**
+ * vmr_pmu_delta - Mask the change in the hardware counters
+ * @ctr: The difference of two reads from vmr_pmu_read
+ * @end: The second read
+ *
+ * The counters are narrower than 64 bits, 40 or 48 on most processors.
+ * Masking to the width makes the difference right when they wrap. Two
+ * reads of different CPUs or with a CPU programmed in between cannot be
+ * compared so the difference is unavailable
+ */
+static void vmr_pmu_delta(struct vmr_counters *ctr, struct vmr_counters *end)
+{
+	long long *value;
+	int i;
+
+	for (i = 0; i < vmr_pmu_nr; i++) {
+		value = &ctr->values[vmr_pmu_events[i].counter];
+		if (ctr->cpu != end->cpu || ctr->pmu_gen != end->pmu_gen)
+			*value = -1;
+		else if (*value != -1)
+			*value &= vmr_pmu_mask;
+	}
+}
+#else
+static void vmr_pmu_init(void)
+{
+	if (vmr_pmu)
+		vmr_printk("No PMU support on this architecture. Only software events are counted\n");
+}
+
+static inline void vmr_pmu_cleanup(void) { }
+static inline void vmr_pmu_read(struct vmr_counters *ctr, int all) { }
+static inline void vmr_pmu_delta(struct vmr_counters *ctr,
+		struct vmr_counters *end) { }
+#endif /* CONFIG_X86 */
+
+/*
+ * vmr_jiffies_ns - Convert jiffies of scheduler accounting to ns
+ */
+static inline long long vmr_jiffies_ns(unsigned long long j)
+{
+	return j * (1000000000 / HZ);
+}
+
+/**
+ * __vmr_counters_read - Read every event counter
+ * @ctr: Filled with the counters. Events that cannot be counted are -1
+ * @all: Read the hardware events of every CPU. See vmr_pmu_read
+ *
+ * The software events are those of the calling thread
+ */
+static void __vmr_counters_read(struct vmr_counters *ctr, int all)
+{
+	int i;
+
+	for (i = 0; i < VMR_CTR_MAX; i++)
+		ctr->values[i] = -1;
+	ctr->cpu = -1;
+	ctr->pmu_gen = 0;
+
+	vmr_pmu_read(ctr, all);
+	ctr->values[VMR_CTR_CYCLES] = read_clockcycles();
+	ctr->values[VMR_CTR_FAULTS] = current->min_flt;
+	ctr->values[VMR_CTR_MAJFAULTS] = current->maj_flt;
+	ctr->values[VMR_CTR_CSWITCH] = current->nvcsw + current->nivcsw;
+
+	/*
+	 * Until vmr_counters_since turns them into times, offcpu and sleep
+	 * hold the wall clock so the difference is the wall time
+	 */
+	ctr->values[VMR_CTR_ONCPU] = vmr_jiffies_ns(cputime_to_jiffies(
+			cputime_add(current->utime, current->stime)));
+	ctr->values[VMR_CTR_OFFCPU] = vmr_clock_ns();
+	ctr->values[VMR_CTR_SLEEP] = ctr->values[VMR_CTR_OFFCPU];
+#ifdef CONFIG_SCHEDSTATS
+	ctr->values[VMR_CTR_PREEMPTED] =
+		vmr_jiffies_ns(current->sched_info.run_delay);
+#endif
+}
+
+/**
+ * vmr_counters_read - Read every event counter
+ * @ctr: Filled with the counters. Events that cannot be counted are -1
+ *
+ * The hardware events are only those of the current CPU. See vmr_pmu_read
+ */
+void vmr_counters_read(struct vmr_counters *ctr)
+{
+	__vmr_counters_read(ctr, 0);
+}
+
+/**
+ * __vmr_counters_since - Count the events since __vmr_counters_read
+ * @ctr: The counters read before. Returns the events counted
+ * @all: Read the hardware events of every CPU
+ */
+static void __vmr_counters_since(struct vmr_counters *ctr, int all)
+{
+	struct vmr_counters end;
+	long long *values = ctr->values;
+	int i;
+
+	__vmr_counters_read(&end, all);
+	for (i = 0; i < VMR_CTR_MAX; i++) {
+		if (end.values[i] != -1 && values[i] != -1)
+			values[i] = end.values[i] - values[i];
+		else
+			values[i] = -1;
+	}
+	vmr_pmu_delta(ctr, &end);
+
+	/*
+	 * offcpu is the wall time less the ticks charged to the thread.
+	 * The ticks are coarser than the clock so clamp at 0
+	 */
+	values[VMR_CTR_OFFCPU] -= values[VMR_CTR_ONCPU];
+	if (values[VMR_CTR_OFFCPU] < 0)
+		values[VMR_CTR_OFFCPU] = 0;
+
+	/* What was not spent waiting for a CPU was spent asleep */
+	if (values[VMR_CTR_PREEMPTED] == -1) {
+		values[VMR_CTR_SLEEP] = -1;
+	} else {
+		if (values[VMR_CTR_PREEMPTED] > values[VMR_CTR_OFFCPU])
+			values[VMR_CTR_PREEMPTED] = values[VMR_CTR_OFFCPU];
+		values[VMR_CTR_SLEEP] = values[VMR_CTR_OFFCPU] -
+			values[VMR_CTR_PREEMPTED];
+	}
+}
+
+/**
+ * vmr_counters_since - Count the events since vmr_counters_read
+ * @ctr: The counters from vmr_counters_read. Returns the events counted
+ *
+ * Unlike vmr_counters_stop, counts whether VMR_COUNTERS is set or not
+ */
+void vmr_counters_since(struct vmr_counters *ctr)
+{
+	__vmr_counters_since(ctr, 0);
+}
+
+/**
+ * vmr_counters_start - Read the counters at the start of a pass
+ * @desc: The test descriptor
+ * @ctr: Where to store the counters
+ *
+ * Does nothing unless VMR_COUNTERS is set. The counters of the whole
+ * test, desc->counters, include the hardware events of every CPU. Those
+ * of a pass only include the current CPU so no IPI is sent in the loop
+ * being timed
+ */
+void vmr_counters_start(vmr_desc_t *desc, struct vmr_counters *ctr)
+{
+	if (desc->flags & VMR_COUNTERS)
+		__vmr_counters_read(ctr, ctr == &desc->counters);
+}
+
+/**
+ * vmr_counters_stop - Count the events since vmr_counters_start
+ * @desc: The test descriptor
+ * @ctr: The counters from vmr_counters_start. Returns the events counted
+ *
+ * Does nothing unless VMR_COUNTERS is set
+ */
+void vmr_counters_stop(vmr_desc_t *desc, struct vmr_counters *ctr)
+{
+	if (desc->flags & VMR_COUNTERS)
+		__vmr_counters_since(ctr, ctr == &desc->counters);
+}
+
+/**
+ * vmr_counters_add - Add the events of one operation to a total
+ * @total: The total. Start it at 0
+ * @ctr: The events counted by vmr_counters_stop
+ */
+void vmr_counters_add(struct vmr_counters *total, struct vmr_counters *ctr)
+{
+	int i;
+
+	for (i = 0; i < VMR_CTR_MAX; i++) {
+		if (total->values[i] != -1 && ctr->values[i] != -1)
+			total->values[i] += ctr->values[i];
+		else
+			total->values[i] = -1;
+	}
+}
+
+/**
+ * vmr_counters_print - Print the events counted by vmr_counters_stop
+ * @desc: The test descriptor
+ * @ctr: The events counted
+ * @pass: The pass the counters are for. -1 is the whole test
+ *
+ * Does nothing unless VMR_COUNTERS is set
+ */
+void vmr_counters_print(vmr_desc_t *desc, struct vmr_counters *ctr, int pass)
+{
+	if (!(desc->flags & VMR_COUNTERS))
+		return;
+
+	vmr_record(desc, &vmr_counters_schema, (long long)pass,
+			ctr->values[VMR_CTR_CYCLES],
+			ctr->values[VMR_CTR_INSTRUCTIONS],
+			ctr->values[VMR_CTR_DTLB],
+			ctr->values[VMR_CTR_LLC],
+			ctr->values[VMR_CTR_FAULTS],
+			ctr->values[VMR_CTR_MAJFAULTS],
+			ctr->values[VMR_CTR_CSWITCH],
+			ctr->values[VMR_CTR_ONCPU],
+			ctr->values[VMR_CTR_OFFCPU],
+			ctr->values[VMR_CTR_PREEMPTED],
+			ctr->values[VMR_CTR_SLEEP]);
+}
+
+/*
+ * vmr_sched_percent - Print a time and its share of the wall time
+ */
+static void vmr_sched_percent(vmr_desc_t *desc, char *name,
+		long long ns, long long wall)
+{
+	unsigned long long permille;
+
+	if (ns == -1) {
+		vmr_snprintf(desc, "o %-10s n/a (needs CONFIG_SCHEDSTATS)\n",
+				name);
+		return;
+	}
+
+	permille = wall ? vmr_div64((unsigned long long)ns * 1000, wall) : 0;
+	vmr_snprintf(desc, "o %-10s %llums (%llu.%llu%%)\n", name,
+			vmr_div64(ns, 1000000), vmr_div64(permille, 10),
+			permille - vmr_div64(permille, 10) * 10);
+}
+
+/**
+ * vmr_counters_printsched - Print where the wall time of a test went
+ * @desc: The test descriptor
+ * @ctr: The events counted by vmr_counters_since
+ *
+ * Printed whether VMR_COUNTERS is set or not. The wall time is rebuilt
+ * from oncpu and offcpu. preempted is printed as Runnable as it is the
+ * run_delay of the scheduler which also counts the wait for a CPU after
+ * every wakeup. Asleep is every sleep, not only reclaim, and the text
+ * output says so as it is easily misread
+ */
+void vmr_counters_printsched(vmr_desc_t *desc, struct vmr_counters *ctr)
+{
+	long long wall = ctr->values[VMR_CTR_ONCPU] +
+			 ctr->values[VMR_CTR_OFFCPU];
+
+	if (vmrproc_binary(desc)) {
+		vmr_record(desc, &vmr_sched_schema, wall,
+				ctr->values[VMR_CTR_ONCPU],
+				ctr->values[VMR_CTR_OFFCPU],
+				ctr->values[VMR_CTR_PREEMPTED],
+				ctr->values[VMR_CTR_SLEEP]);
+		return;
+	}
+
+	vmr_snprintf(desc, "Scheduling\n");
+	vmr_snprintf(desc, "o %-10s %llums\n", "Wall", vmr_div64(wall, 1000000));
+	vmr_sched_percent(desc, "On CPU", ctr->values[VMR_CTR_ONCPU], wall);
+	vmr_sched_percent(desc, "Off CPU", ctr->values[VMR_CTR_OFFCPU], wall);
+	vmr_sched_percent(desc, "Runnable", ctr->values[VMR_CTR_PREEMPTED], wall);
+	vmr_sched_percent(desc, "Asleep", ctr->values[VMR_CTR_SLEEP], wall);
+	vmr_snprintf(desc, "o Runnable includes the wait for a CPU after each wakeup\n");
+	vmr_snprintf(desc, "o Asleep is any sleep such as locks and timers, not reclaim time\n");
+}
+
+/*
+ * Waits and holds of the locks VM Regress takes itself. The kernel's own
+ * acquisitions are not seen. See vmr_lockstat.h
+ */
+int vmr_lockstat_active;
+static char *vmr_lockstat_names[VMR_LOCK_MAX] = {
+	"zone->lock", "page_table_lock"
+};
+static struct vmr_histogram *vmr_lockstat_wait[VMR_LOCK_MAX];
+static struct vmr_histogram *vmr_lockstat_hold[VMR_LOCK_MAX];
+static unsigned long long vmr_lockstat_held[NR_CPUS][VMR_LOCK_MAX];
+static DECLARE_MUTEX(vmr_lockstat_sem);
+static int vmr_lockstat_users;
+
+/* Binary record printed by vmr_lockstat_stop, one per lock and CPU */
+static struct vmr_field vmr_lockstat_fields[] = {
+	{ "lock",	VMR_FIELD_U64 },
+	{ "cpu",	VMR_FIELD_U64 },
+	{ "acquired",	VMR_FIELD_U64 },
+	{ "wait_mean",	VMR_FIELD_U64 },
+	{ "wait_max",	VMR_FIELD_U64 },
+	{ "hold_mean",	VMR_FIELD_U64 },
+	{ "hold_max",	VMR_FIELD_U64 },
+};
+static struct vmr_schema vmr_lockstat_schema = VMR_SCHEMA("lockstat", vmr_lockstat_fields);
+
+/**
+ * vmr_lockstat_begin - Read the clock before taking a lock
+ *
+ * Preemption is disabled until vmr_lockstat_acquired so the wait is
+ * timed with the clock of one CPU
+ */
+unsigned long long vmr_lockstat_begin(void)
+{
+	preempt_disable();
+	return vmr_clock_ns();
+}
+
+/**
+ * vmr_lockstat_acquired - Record the wait for a lock that is now held
+ * @type: The lock, VMR_LOCK_*
+ * @start: Returned by vmr_lockstat_begin before taking the lock
+ *
+ * The lock is held so this CPU will release it and preemption stays
+ * disabled by the lock after it is enabled here
+ */
+void vmr_lockstat_acquired(int type, unsigned long long start)
+{
+	unsigned long long now = vmr_clock_ns();
+
+	vmr_hist_record(vmr_lockstat_wait[type], now - start);
+	vmr_lockstat_held[smp_processor_id()][type] = now;
+	preempt_enable();
+}
+
+/**
+ * vmr_lockstat_release - Record the hold of a lock about to be released
+ * @type: The lock, VMR_LOCK_*
+ *
+ * Nothing is recorded if the lock was taken before measuring started
+ */
+void vmr_lockstat_release(int type)
+{
+	unsigned long long *held = &vmr_lockstat_held[smp_processor_id()][type];
+
+	if (*held) {
+		vmr_hist_record(vmr_lockstat_hold[type], vmr_clock_ns() - *held);
+		*held = 0;
+	}
+}
+
+/**
+ * vmr_lockstat_start - Start measuring lock contention for a test
+ * @desc: The test descriptor
+ *
+ * The statistics are reset by the first test to start measuring. Does
+ * nothing unless VMR_LOCKSTAT is set
+ */
+void vmr_lockstat_start(vmr_desc_t *desc)
+{
+	int type;
+
+	if (!(desc->flags & VMR_LOCKSTAT) || desc->lockstat)
+		return;
+
+	down(&vmr_lockstat_sem);
+	if (!vmr_lockstat_users) {
+		for (type = 0; type < VMR_LOCK_MAX; type++) {
+			if (!vmr_lockstat_wait[type])
+				vmr_lockstat_wait[type] = vmr_hist_alloc();
+			if (!vmr_lockstat_hold[type])
+				vmr_lockstat_hold[type] = vmr_hist_alloc();
+			if (!vmr_lockstat_wait[type] || !vmr_lockstat_hold[type]) {
+				vmr_printk("Failed to allocate lock statistics\n");
+				up(&vmr_lockstat_sem);
+				return;
+			}
+			vmr_hist_reset(vmr_lockstat_wait[type]);
+			vmr_hist_reset(vmr_lockstat_hold[type]);
+		}
+		memset(vmr_lockstat_held, 0, sizeof(vmr_lockstat_held));
+		vmr_lockstat_active = 1;
+	}
+	vmr_lockstat_users++;
+	desc->lockstat = 1;
+	up(&vmr_lockstat_sem);
+}
+
+/**
+ * vmr_lockstat_print - Print the waits of VM Regress on one lock
+ * @desc: The test descriptor. The caller must be the writer
+ * @type: The lock, VMR_LOCK_*
+ *
+ * The heading says whose acquisitions they are so they are not read as
+ * the contention of the whole kernel
+ */
+static void vmr_lockstat_print(vmr_desc_t *desc, int type)
+{
+	struct vmr_histcpu *wait, *hold;
+	unsigned long long wait_mean, hold_mean;
+	char name[32];
+	int cpu;
+
+	vmr_snprintf(desc, "VM Regress's own lock waits on %s\n",
+			vmr_lockstat_names[type]);
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		wait = vmr_lockstat_wait[type]->cpu[cpu];
+		hold = vmr_lockstat_hold[type]->cpu[cpu];
+		if (!wait || !hold || !wait->count)
+			continue;
+
+		wait_mean = vmr_div64(wait->sum, wait->count);
+		hold_mean = vmr_div64(hold->sum, hold->count);
+		if (vmrproc_binary(desc)) {
+			vmr_record(desc, &vmr_lockstat_schema, type, cpu,
+					wait->count, wait_mean, wait->max,
+					hold_mean, hold->max);
+		} else {
+			vmr_snprintf(desc, "o cpu %-3d acquired %-8llu wait mean %-6llu max %-8llu hold mean %-6llu max %llu\n",
+					cpu, wait->count, wait_mean, wait->max,
+					hold_mean, hold->max);
+		}
+	}
+
+	snprintf(name, sizeof(name), "own %s wait", vmr_lockstat_names[type]);
+	vmr_hist_print(desc, vmr_lockstat_wait[type], name, "ns");
+	snprintf(name, sizeof(name), "own %s hold", vmr_lockstat_names[type]);
+	vmr_hist_print(desc, vmr_lockstat_hold[type], name, "ns");
+}
+
+/**
+ * vmr_lockstat_stop - Stop measuring lock waits for a test
+ * @desc: The test descriptor
+ *
+ * If the caller is the writer, the waits on every lock are printed.
+ * The statistics stop being recorded when the last test stops
+ */
+void vmr_lockstat_stop(vmr_desc_t *desc)
+{
+	int type;
+
+	if (!desc->lockstat)
+		return;
+
+	down(&vmr_lockstat_sem);
+	if (desc->pid == current->pid)
+		for (type = 0; type < VMR_LOCK_MAX; type++)
+			vmr_lockstat_print(desc, type);
+
+	desc->lockstat = 0;
+	if (!--vmr_lockstat_users)
+		vmr_lockstat_active = 0;
+	up(&vmr_lockstat_sem);
+}
+
+/**
+ * vmr_lockstat_cleanup - Free the lock statistics
+ */
+static void vmr_lockstat_cleanup(void)
+{
+	int type;
+
+	for (type = 0; type < VMR_LOCK_MAX; type++) {
+		vmr_hist_free(vmr_lockstat_wait[type]);
+		vmr_hist_free(vmr_lockstat_hold[type]);
+	}
+}
+
+/* Binary record printed by vmr_affinity_print */
+static struct vmr_field vmr_affinity_fields[] = {
+	{ "start",	VMR_FIELD_U64 },
+	{ "end",	VMR_FIELD_U64 },
+	{ "allowed",	VMR_FIELD_U64 },
+	{ "nomigrate",	VMR_FIELD_U64 },
+};
+static struct vmr_schema vmr_affinity_schema = VMR_SCHEMA("cpu", vmr_affinity_fields);
+
+/**
+ * vmr_affinity_init - Allow a test to run on any CPU
+ * @aff: The affinity
+ */
+void vmr_affinity_init(struct vmr_affinity *aff)
+{
+	cpus_setall(aff->cpus);
+	aff->nomigrate = 0;
+}
+
+/**
+ * vmr_affinity_parse - Parse a parameter of a command if it is cpus or nomigrate
+ * @aff: The affinity of the command
+ * @name: Name of a name=value parameter
+ * @value: The value
+ *
+ * Returns 1 if the parameter was an affinity parameter, 0 if it was not
+ * or -EINVAL if its value could not be parsed
+ */
+int vmr_affinity_parse(struct vmr_affinity *aff, char *name, char *value)
+{
+	if (!strcmp(name, "cpus")) {
+		if (cpulist_parse(value, aff->cpus) || cpus_empty(aff->cpus))
+			return -EINVAL;
+		return 1;
+	}
+
+	if (!strcmp(name, "nomigrate")) {
+		long nomigrate;
+
+		if (vmr_strtoparam(value, &nomigrate))
+			return -EINVAL;
+		aff->nomigrate = nomigrate != 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * vmr_affinity_enter - Move the current thread to the CPUs of a test
+ * @desc: The test descriptor. Records if the CPUs were chosen
+ * @aff: The affinity of the test
+ * @saved: Returns the CPUs the thread was allowed to restore later
+ *
+ * With nomigrate, the thread stays on the CPU it is on if it is one of
+ * cpus and moves to the first of them otherwise. Returns -EINVAL if
+ * none of cpus are online
+ */
+int vmr_affinity_enter(vmr_desc_t *desc, struct vmr_affinity *aff,
+		cpumask_t *saved)
+{
+	cpumask_t mask;
+	int cpu;
+
+	*saved = current->cpus_allowed;
+	desc->affinity = !cpus_full(aff->cpus) || aff->nomigrate;
+	if (!desc->affinity)
+		return 0;
+
+	cpus_and(mask, aff->cpus, cpu_online_map);
+	if (cpus_empty(mask))
+		return -EINVAL;
+
+	if (aff->nomigrate) {
+		cpu = raw_smp_processor_id();
+		if (!cpu_isset(cpu, mask))
+			cpu = first_cpu(mask);
+		mask = cpumask_of_cpu(cpu);
+	}
+
+	return set_cpus_allowed(current, mask);
+}
+
+/**
+ * vmr_affinity_leave - Return the current thread to the CPUs it was allowed
+ * @saved: Set by vmr_affinity_enter
+ */
+void vmr_affinity_leave(cpumask_t *saved)
+{
+	if (!cpus_equal(current->cpus_allowed, *saved))
+		set_cpus_allowed(current, *saved);
+}
+
+/**
+ * vmr_affinity_print - Print the CPUs a test ran on
+ * @desc: The test descriptor. The caller must be the writer
+ *
+ * Printed when the command of the test chose its CPUs. allowed in the
+ * binary record is the mask of the first 64 CPUs
+ */
+void vmr_affinity_print(vmr_desc_t *desc)
+{
+	cpumask_t allowed = current->cpus_allowed;
+	unsigned long long mask = 0;
+	char list[64];
+	int nomigrate, cpu;
+
+	cpus_and(allowed, allowed, cpu_online_map);
+	nomigrate = cpus_weight(allowed) == 1;
+	if (vmrproc_binary(desc)) {
+		for_each_cpu_mask(cpu, allowed)
+			if (cpu < 64)
+				mask |= 1ULL << cpu;
+		vmr_record(desc, &vmr_affinity_schema, desc->cpu,
+				raw_smp_processor_id(), mask, nomigrate);
+	} else {
+		cpulist_scnprintf(list, sizeof(list), allowed);
+		vmr_snprintf(desc, "CPU %d to %d of %s%s\n", desc->cpu,
+				raw_smp_processor_id(), list,
+				nomigrate ? " without migration" : "");
+	}
+}
+
+/*
+ * Time series sampler. See vmr_sampler.h. vmr_sampler_sem serialises
+ * starting, stopping and printing. vmr_sampler_lock protects the ring
+ * head, the slot being written and the phases
+ */
+int vmr_sampler_active;
+static unsigned long vmr_sampler_samples = 4096;
+MODULE_PARM(vmr_sampler_samples, "l");
+MODULE_PARM_DESC(vmr_sampler_samples, "Samples the sampler ring holds. See vmr_sampler.h");
+
+#define VMR_SAMPLER_ORDERS (MAX_ORDER < 11 ? MAX_ORDER : 11)
+
+struct vmr_zonesample {
+	unsigned int free;
+	unsigned int min, low, high;
+	unsigned int nr_free[VMR_SAMPLER_ORDERS];
+};
+
+struct vmr_sample {
+	unsigned long long timestamp;	/* vmr_clock_ns() */
+	unsigned long phase;		/* Phase it was taken in */
+	unsigned long vmstat[VMR_SAMPLER_VMSTATS];
+	struct vmr_zonesample zone[0];	/* One per sampled zone */
+};
+
+struct vmr_sampler_phase {
+	unsigned long long timestamp;	/* vmr_clock_ns() at the mark */
+	unsigned long id;
+	char name[VMR_SAMPLER_NAMELEN];
+};
+
+static DECLARE_MUTEX(vmr_sampler_sem);
+static spinlock_t vmr_sampler_lock = SPIN_LOCK_UNLOCKED;
+static struct completion vmr_sampler_done;
+static int vmr_sampler_users;
+static int vmr_sampler_stopping;
+static unsigned int vmr_sampler_rate;
+static unsigned long vmr_sampler_interval;	/* jiffies between samples */
+static unsigned long long vmr_sampler_started;	/* vmr_clock_ns() at start */
+static unsigned long vmr_sampler_missed;	/* Samples not taken in time */
+
+static struct zone *vmr_sampler_zones[VMR_SAMPLER_ZONES];
+static int vmr_sampler_nr_zones;
+
+/* The ring. Sample n is in slot n % vmr_sampler_nr_samples */
+static char *vmr_sampler_ring;
+static unsigned long vmr_sampler_nr_samples;
+static unsigned long vmr_sampler_stride;	/* Bytes of a sample */
+static unsigned long vmr_sampler_head;		/* Samples taken */
+static struct vmr_sample *vmr_sampler_scratch;
+
+static struct vmr_sampler_phase vmr_sampler_phases[VMR_SAMPLER_PHASES];
+static unsigned long vmr_sampler_phase;
+
+/* Binary record of a sample. The fields after phase are the VMR_VMSTAT_* */
+static struct vmr_field vmr_sample_fields[] = {
+	{ "time",		VMR_FIELD_U64 },
+	{ "phase",		VMR_FIELD_U64 },
+	{ "nr_dirty",		VMR_FIELD_U64 },
+	{ "nr_writeback",	VMR_FIELD_U64 },
+	{ "nr_mapped",		VMR_FIELD_U64 },
+	{ "nr_slab",		VMR_FIELD_U64 },
+	{ "pgpgin",		VMR_FIELD_U64 },
+	{ "pgpgout",		VMR_FIELD_U64 },
+	{ "pswpin",		VMR_FIELD_U64 },
+	{ "pswpout",		VMR_FIELD_U64 },
+	{ "pgfault",		VMR_FIELD_U64 },
+	{ "pgmajfault",		VMR_FIELD_U64 },
+	{ "pgscan_kswapd",	VMR_FIELD_U64 },
+	{ "pgscan_direct",	VMR_FIELD_U64 },
+	{ "pgsteal",		VMR_FIELD_U64 },
+	{ "allocstall",		VMR_FIELD_U64 },
+};
+static struct vmr_schema vmr_sample_schema = VMR_SCHEMA("sample", vmr_sample_fields);
+
+/* Binary record of each zone following a sample record */
+static struct vmr_field vmr_sample_zone_fields[] = {
+	{ "zone",	VMR_FIELD_U64 },
+	{ "free",	VMR_FIELD_U64 },
+	{ "min",	VMR_FIELD_U64 },
+	{ "low",	VMR_FIELD_U64 },
+	{ "high",	VMR_FIELD_U64 },
+	{ "order0",	VMR_FIELD_U64 },
+	{ "order1",	VMR_FIELD_U64 },
+	{ "order2",	VMR_FIELD_U64 },
+	{ "order3",	VMR_FIELD_U64 },
+	{ "order4",	VMR_FIELD_U64 },
+	{ "order5",	VMR_FIELD_U64 },
+	{ "order6",	VMR_FIELD_U64 },
+	{ "order7",	VMR_FIELD_U64 },
+	{ "order8",	VMR_FIELD_U64 },
+	{ "order9",	VMR_FIELD_U64 },
+	{ "order10",	VMR_FIELD_U64 },
+};
+static struct vmr_schema vmr_sample_zone_schema = {
+	.name		= "sample_zone",
+	.nr_fields	= 5 + VMR_SAMPLER_ORDERS,
+	.fields		= vmr_sample_zone_fields,
+};
+
+/* Counters that are a number of pages rather than of events */
+static int vmr_sampler_gauge[VMR_SAMPLER_VMSTATS] = {
+	[VMR_VMSTAT_NR_DIRTY]		= 1,
+	[VMR_VMSTAT_NR_WRITEBACK]	= 1,
+	[VMR_VMSTAT_NR_MAPPED]		= 1,
+	[VMR_VMSTAT_NR_SLAB]		= 1,
+};
+
+#define vmr_sampler_slot(n) ((struct vmr_sample *) \
+	(vmr_sampler_ring + ((n) % vmr_sampler_nr_samples) * vmr_sampler_stride))
+
+/**
+ * vmr_sampler_take - Take one sample into the ring
+ *
+ * The zones are read without zone->lock. Each value is read once so it
+ * may be a moment out of date but is never torn
+ */
+static void vmr_sampler_take(void)
+{
+	struct vmr_sample *sample = vmr_sampler_scratch;
+	struct vmr_zonesample *zs;
+	struct page_state ps;
+	unsigned long nr_free[MAX_ORDER];
+	struct zone *zone;
+	int i, order;
+#ifdef for_each_rclmtype_order
+	int t;
+#endif
+
+	get_full_page_state(&ps);
+	sample->vmstat[VMR_VMSTAT_NR_DIRTY] = ps.nr_dirty;
+	sample->vmstat[VMR_VMSTAT_NR_WRITEBACK] = ps.nr_writeback;
+	sample->vmstat[VMR_VMSTAT_NR_MAPPED] = ps.nr_mapped;
+	sample->vmstat[VMR_VMSTAT_NR_SLAB] = ps.nr_slab;
+	sample->vmstat[VMR_VMSTAT_PGPGIN] = ps.pgpgin;
+	sample->vmstat[VMR_VMSTAT_PGPGOUT] = ps.pgpgout;
+	sample->vmstat[VMR_VMSTAT_PSWPIN] = ps.pswpin;
+	sample->vmstat[VMR_VMSTAT_PSWPOUT] = ps.pswpout;
+	sample->vmstat[VMR_VMSTAT_PGFAULT] = ps.pgfault;
+	sample->vmstat[VMR_VMSTAT_PGMAJFAULT] = ps.pgmajfault;
+	sample->vmstat[VMR_VMSTAT_PGSCAN_KSWAPD] = ps.pgscan_kswapd_high +
+		ps.pgscan_kswapd_normal + ps.pgscan_kswapd_dma32 +
+		ps.pgscan_kswapd_dma;
+	sample->vmstat[VMR_VMSTAT_PGSCAN_DIRECT] = ps.pgscan_direct_high +
+		ps.pgscan_direct_normal + ps.pgscan_direct_dma32 +
+		ps.pgscan_direct_dma;
+	sample->vmstat[VMR_VMSTAT_PGSTEAL] = ps.pgsteal_high +
+		ps.pgsteal_normal + ps.pgsteal_dma32 + ps.pgsteal_dma;
+	sample->vmstat[VMR_VMSTAT_ALLOCSTALL] = ps.allocstall;
+
+	for (i = 0; i < vmr_sampler_nr_zones; i++) {
+		zone = vmr_sampler_zones[i];
+		zs = &sample->zone[i];
+		zs->free = zone->free_pages;
+		zs->min = zone->pages_min;
+		zs->low = zone->pages_low;
+		zs->high = zone->pages_high;
+
+		memset(nr_free, 0, sizeof(nr_free));
+#ifdef for_each_rclmtype_order
+#ifdef BITS_PER_RCLM_TYPE
+		for_each_rclmtype_order(t, order)
+			nr_free[order] += zone->free_area_lists[order].nr_free;
+#else
+		for_each_rclmtype_order(t, order)
+			nr_free[order] += zone->free_area[order].nr_free;
+#endif
+#else
+		for (order = 0; order < MAX_ORDER; order++)
+			nr_free[order] = zone->free_area[order].nr_free;
+#endif
+		for (order = 0; order < VMR_SAMPLER_ORDERS; order++)
+			zs->nr_free[order] = nr_free[order];
+	}
+
+	/* The clock is read last so the sample is stamped when complete */
+	sample->timestamp = vmr_clock_ns();
+
+	spin_lock(&vmr_sampler_lock);
+	sample->phase = vmr_sampler_phase;
+	memcpy(vmr_sampler_slot(vmr_sampler_head), sample, vmr_sampler_stride);
+	vmr_sampler_head++;
+	spin_unlock(&vmr_sampler_lock);
+}
+
+/**
+ * vmr_sampler_thread - Take samples until told to stop
+ * @data: unused
+ *
+ * A sample that could not be taken on time, because the thread was not
+ * scheduled soon enough, is skipped rather than taken late
+ */
+static int vmr_sampler_thread(void *data)
+{
+	unsigned long next = jiffies;
+	long timeout;
+
+	daemonize("vmr_sampler");
+
+	while (!vmr_sampler_stopping) {
+		vmr_sampler_take();
+
+		next += vmr_sampler_interval;
+		while (time_after_eq(jiffies, next)) {
+			next += vmr_sampler_interval;
+			vmr_sampler_missed++;
+		}
+
+		/* jiffies may pass next after the check above */
+		timeout = (long)(next - jiffies);
+		if (timeout < 0)
+			timeout = 0;
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_timeout(timeout);
+	}
+
+	complete_and_exit(&vmr_sampler_done, 0);
+}
+
+/**
+ * vmr_sampler_findzones - Find the zones to sample
+ *
+ * Returns the number found. Zones with no pages are skipped
+ */
+static int vmr_sampler_findzones(void)
+{
+	pg_data_t *pgdat;
+	int nr_zones = 0;
+	int i;
+
+	for (pgdat = get_pgdat_list(); pgdat; vmr_next_pgdat(pgdat)) {
+		for (i = 0; i < MAX_NR_ZONES; i++) {
+			if (!pgdat->node_zones[i].present_pages)
+				continue;
+			if (nr_zones == VMR_SAMPLER_ZONES)
+				return nr_zones;
+			vmr_sampler_zones[nr_zones++] = &pgdat->node_zones[i];
+		}
+	}
+
+	return nr_zones;
+}
+
+/**
+ * vmr_sampler_start - Take a reference on the sampler
+ * @rate: Samples a second. 0 for VMR_SAMPLER_RATE
+ * @nr_samples: Samples the ring holds. 0 for vmr_sampler_samples
+ *
+ * The first reference starts the thread with an empty ring. Later
+ * references share it and their rate and ring size are ignored. Returns
+ * 0 or a negative errno
+ */
+int vmr_sampler_start(unsigned int rate, unsigned long nr_samples)
+{
+	int pid;
+
+	down(&vmr_sampler_sem);
+	if (vmr_sampler_users) {
+		vmr_sampler_users++;
+		up(&vmr_sampler_sem);
+		return 0;
+	}
+
+	if (!rate)
+		rate = VMR_SAMPLER_RATE;
+	if (rate > HZ) {
+		vmr_printk("Sampling rate %u is above HZ, using %d\n", rate, HZ);
+		rate = HZ;
+	}
+	if (!nr_samples)
+		nr_samples = vmr_sampler_samples;
+
+	/* The ring of the last run is kept until now so it can be printed */
+	vfree(vmr_sampler_ring);
+	kfree(vmr_sampler_scratch);
+	vmr_sampler_nr_zones = vmr_sampler_findzones();
+	vmr_sampler_stride = sizeof(struct vmr_sample) +
+		vmr_sampler_nr_zones * sizeof(struct vmr_zonesample);
+	vmr_sampler_stride = ALIGN(vmr_sampler_stride, sizeof(unsigned long long));
+	vmr_sampler_ring = vmalloc(nr_samples * vmr_sampler_stride);
+	vmr_sampler_scratch = kmalloc(vmr_sampler_stride, GFP_KERNEL);
+	if (!vmr_sampler_ring || !vmr_sampler_scratch) {
+		vfree(vmr_sampler_ring);
+		kfree(vmr_sampler_scratch);
+		vmr_sampler_ring = NULL;
+		vmr_sampler_scratch = NULL;
+		up(&vmr_sampler_sem);
+		return -ENOMEM;
+	}
+
+	/* Samples are a whole number of jiffies apart */
+	vmr_sampler_nr_samples = nr_samples;
+	vmr_sampler_interval = HZ / rate;
+	vmr_sampler_rate = HZ / vmr_sampler_interval;
+	if (vmr_sampler_rate != rate)
+		vmr_printk("Sampling %u times a second as HZ is %d\n",
+				vmr_sampler_rate, HZ);
+	vmr_sampler_head = 0;
+	vmr_sampler_missed = 0;
+	vmr_sampler_phase = 0;
+	memset(vmr_sampler_phases, 0, sizeof(vmr_sampler_phases));
+	vmr_sampler_stopping = 0;
+	vmr_sampler_started = vmr_clock_ns();
+	init_completion(&vmr_sampler_done);
+
+	pid = kernel_thread(vmr_sampler_thread, NULL, CLONE_FS | CLONE_FILES);
+	if (pid < 0) {
+		up(&vmr_sampler_sem);
+		return pid;
+	}
+
+	vmr_sampler_users = 1;
+	vmr_sampler_active = 1;
+	up(&vmr_sampler_sem);
+
+	return 0;
+}
+
+/**
+ * vmr_sampler_stop - Drop a reference on the sampler
+ *
+ * The last reference stops the thread. It may take one interval to
+ * notice. The ring is kept until the sampler is next started
+ */
+void vmr_sampler_stop(void)
+{
+	down(&vmr_sampler_sem);
+	if (vmr_sampler_users && !--vmr_sampler_users) {
+		vmr_sampler_active = 0;
+		vmr_sampler_stopping = 1;
+		wait_for_completion(&vmr_sampler_done);
+	}
+	up(&vmr_sampler_sem);
+}
+
+/**
+ * __vmr_sampler_mark - Start a new phase
+ * @name: Name of the phase. It is copied
+ *
+ * Samples taken from now on are in the new phase. Use vmr_sampler_mark
+ * which does nothing if the sampler is not running
+ */
+void __vmr_sampler_mark(const char *name)
+{
+	struct vmr_sampler_phase *phase;
+
+	spin_lock(&vmr_sampler_lock);
+	vmr_sampler_phase++;
+	phase = &vmr_sampler_phases[vmr_sampler_phase % VMR_SAMPLER_PHASES];
+	phase->id = vmr_sampler_phase;
+	phase->timestamp = vmr_clock_ns();
+	strlcpy(phase->name, name, VMR_SAMPLER_NAMELEN);
+	spin_unlock(&vmr_sampler_lock);
+}
+
+/**
+ * vmr_sampler_printphases - Print the phases started since the last sample
+ * @desc: The proc buffer to print to
+ * @from: First phase to print
+ * @to: Phase of the sample about to be printed
+ *
+ * Phases whose names were overwritten are printed without a name
+ */
+static void vmr_sampler_printphases(vmr_desc_t *desc, unsigned long from,
+		unsigned long to)
+{
+	struct vmr_sampler_phase phase;
+	unsigned long id;
+
+	if (to - from >= VMR_SAMPLER_PHASES)
+		from = to - VMR_SAMPLER_PHASES + 1;
+
+	for (id = from; id <= to; id++) {
+		/* Phase 0 is before the first mark */
+		if (id == 0)
+			continue;
+
+		spin_lock(&vmr_sampler_lock);
+		phase = vmr_sampler_phases[id % VMR_SAMPLER_PHASES];
+		spin_unlock(&vmr_sampler_lock);
+
+		if (phase.id != id) {
+			vmr_snprintf(desc, "# phase %lu\n", id);
+			continue;
+		}
+		vmr_snprintf(desc, "# phase %lu %s at %lluus\n", id, phase.name,
+				vmr_div64(phase.timestamp - vmr_sampler_started, 1000));
+	}
+}
+
+/**
+ * vmr_sampler_printsample - Print one sample
+ * @desc: The proc buffer to print to
+ * @sample: The sample
+ * @prev: The sample printed before it or NULL
+ *
+ * Watermarks are printed only when they change. In text, counters of
+ * events are printed as the change since prev
+ */
+static void vmr_sampler_printsample(vmr_desc_t *desc, struct vmr_sample *sample,
+		struct vmr_sample *prev)
+{
+	unsigned long long values[VMR_RECORD_MAXFIELDS];
+	unsigned long long time;
+	struct vmr_zonesample *zs;
+	unsigned long value;
+	int i, order;
+
+	time = vmr_div64(sample->timestamp - vmr_sampler_started, 1000);
+
+	if (vmrproc_binary(desc)) {
+		values[0] = time;
+		values[1] = sample->phase;
+		for (i = 0; i < VMR_SAMPLER_VMSTATS; i++)
+			values[i + 2] = sample->vmstat[i];
+		vmrproc_record(desc, &vmr_sample_schema, values);
+
+		for (i = 0; i < vmr_sampler_nr_zones; i++) {
+			zs = &sample->zone[i];
+			values[0] = i;
+			values[1] = zs->free;
+			values[2] = zs->min;
+			values[3] = zs->low;
+			values[4] = zs->high;
+			for (order = 0; order < VMR_SAMPLER_ORDERS; order++)
+				values[order + 5] = zs->nr_free[order];
+			vmrproc_record(desc, &vmr_sample_zone_schema, values);
+		}
+		return;
+	}
+
+	for (i = 0; i < vmr_sampler_nr_zones; i++) {
+		zs = &sample->zone[i];
+		if (prev && zs->min == prev->zone[i].min &&
+		    zs->low == prev->zone[i].low &&
+		    zs->high == prev->zone[i].high)
+			continue;
+		vmr_snprintf(desc, "# watermarks z%d min %u low %u high %u\n",
+				i, zs->min, zs->low, zs->high);
+	}
+
+	vmr_snprintf(desc, "%llu %lu", time, sample->phase);
+	for (i = 0; i < vmr_sampler_nr_zones; i++) {
+		zs = &sample->zone[i];
+		vmr_snprintf(desc, " %u", zs->free);
+		for (order = 0; order < VMR_SAMPLER_ORDERS; order++) {
+			vmr_snprintf(desc, " %u", zs->nr_free[order]);
+		}
+	}
+	for (i = 0; i < VMR_SAMPLER_VMSTATS; i++) {
+		value = sample->vmstat[i];
+		if (!vmr_sampler_gauge[i])
+			value = prev ? value - prev->vmstat[i] : 0;
+		vmr_snprintf(desc, " %lu", value);
+	}
+	vmr_snprintf(desc, "\n");
+}
+
+/**
+ * vmr_sampler_print - Print the samples in the ring
+ * @desc: The proc buffer to print to. The caller must be the writer
+ * @since: Print samples taken after this vmr_clock_ns() time. 0 for all
+ *
+ * Times are in microseconds since the sampler started. A line starting
+ * with # names the zones and columns, starts a phase or gives the
+ * watermarks of a zone when they change. Each other line is one sample
+ * of the free pages and the free blocks of each order of every zone and
+ * then the page state counters. The sampler may still be running
+ */
+void vmr_sampler_print(vmr_desc_t *desc, unsigned long long since)
+{
+	struct vmr_sample *sample, *prev, *swap;
+	unsigned long head, seq, first, lastphase = 0;
+	struct zone *zone;
+	int i, order, printed = 0;
+	char *buf;
+
+	if (desc->pid != current->pid)
+		return;
+
+	down(&vmr_sampler_sem);
+	if (!vmr_sampler_ring) {
+		up(&vmr_sampler_sem);
+		vmr_snprintf(desc, "Sampler has not run\n");
+		return;
+	}
+
+	buf = kmalloc(vmr_sampler_stride * 2, GFP_KERNEL);
+	if (!buf) {
+		up(&vmr_sampler_sem);
+		vmr_printk("Failed to allocate a sample to print\n");
+		return;
+	}
+	sample = (struct vmr_sample *)buf;
+	prev = (struct vmr_sample *)(buf + vmr_sampler_stride);
+
+	spin_lock(&vmr_sampler_lock);
+	head = vmr_sampler_head;
+	spin_unlock(&vmr_sampler_lock);
+	first = head > vmr_sampler_nr_samples ? head - vmr_sampler_nr_samples : 0;
+
+	vmr_snprintf(desc, "Sampler %uHz %lu samples %lu overwritten %lu missed\n",
+			vmr_sampler_rate, head, first, vmr_sampler_missed);
+	for (i = 0; i < vmr_sampler_nr_zones; i++) {
+		zone = vmr_sampler_zones[i];
+		vmr_snprintf(desc, "# zone z%d node %d %s\n", i,
+				zone->zone_pgdat->node_id, zone->name);
+	}
+	if (!vmrproc_binary(desc)) {
+		vmr_snprintf(desc, "# time phase");
+		for (i = 0; i < vmr_sampler_nr_zones; i++) {
+			vmr_snprintf(desc, " z%d_free", i);
+			for (order = 0; order < VMR_SAMPLER_ORDERS; order++) {
+				vmr_snprintf(desc, " z%d_o%d", i, order);
+			}
+		}
+		for (i = 0; i < VMR_SAMPLER_VMSTATS; i++) {
+			vmr_snprintf(desc, " %s", vmr_sample_fields[i + 2].name);
+		}
+		vmr_snprintf(desc, "\n");
+	}
+
+	for (seq = first; seq < head; seq++) {
+		spin_lock(&vmr_sampler_lock);
+		if (vmr_sampler_head - seq > vmr_sampler_nr_samples) {
+			/* Overwritten while printing */
+			spin_unlock(&vmr_sampler_lock);
+			continue;
+		}
+		memcpy(sample, vmr_sampler_slot(seq), vmr_sampler_stride);
+		spin_unlock(&vmr_sampler_lock);
+
+		if (sample->timestamp < since)
+			continue;
+
+		if (!printed || sample->phase != lastphase)
+			vmr_sampler_printphases(desc, printed ? lastphase + 1 :
+					sample->phase, sample->phase);
+		lastphase = sample->phase;
+
+		vmr_sampler_printsample(desc, sample, printed ? prev : NULL);
+		printed = 1;
+
+		/* This sample is the previous one of the next */
+		swap = prev;
+		prev = sample;
+		sample = swap;
+	}
+
+	kfree(buf);
+	up(&vmr_sampler_sem);
+}
+
+/**
+ * vmr_sampler_open - Start sampling for a test
+ * @desc: The test descriptor
+ *
+ * Does nothing unless the test has a sampler rate. A phase named after
+ * the test is started
+ */
+void vmr_sampler_open(vmr_desc_t *desc)
+{
+	if (!desc->sampler || desc->sampled)
+		return;
+
+	if (vmr_sampler_start(desc->sampler, 0)) {
+		vmr_printk("Failed to start the sampler for %s\n", desc->name);
+		return;
+	}
+	desc->sampled = vmr_clock_ns();
+	__vmr_sampler_mark(desc->name);
+}
+
+/**
+ * vmr_sampler_close - Stop sampling for a test
+ * @desc: The test descriptor
+ *
+ * If the caller is the writer, the samples taken since the test started
+ * are printed
+ */
+void vmr_sampler_close(vmr_desc_t *desc)
+{
+	if (!desc->sampled)
+		return;
+
+	__vmr_sampler_mark("idle");
+	if (desc->pid == current->pid)
+		vmr_sampler_print(desc, desc->sampled);
+	desc->sampled = 0;
+	vmr_sampler_stop();
+}
+
+/**
+ * vmr_sampler_cleanup - Stop the sampler and free the ring
+ */
+static void vmr_sampler_cleanup(void)
+{
+	down(&vmr_sampler_sem);
+	if (vmr_sampler_users) {
+		vmr_sampler_users = 1;
+		up(&vmr_sampler_sem);
+		vmr_sampler_stop();
+	} else {
+		up(&vmr_sampler_sem);
+	}
+
+	vfree(vmr_sampler_ring);
+	kfree(vmr_sampler_scratch);
+}
+
+/* Jobs started with a leading & written to a test proc entry */
+static LIST_HEAD(vmr_job_list);
+static DECLARE_MUTEX(vmr_job_sem);
+static int vmr_job_count;
+static int vmr_job_nextid = 1;
+
+/**
+ * vmr_job_thread - Run a job
+ * @data: The job to run
+ *
+ * The thread is a child of the writer but nothing will ever wait for it
+ * so it reaps itself when it exits. The job takes the proc buffer before
+ * the test runs and starts the output with its id so whoever started it
+ * can read the id back from the entry. The buffer is kept across the
+ * test as it is for a script
+ */
+static int vmr_job_thread(void *data)
+{
+	struct vmr_job *job = data;
+	struct module *owner = job->owner;
+	vmr_desc_t *desc = job->desc;
+	int opened, script = 0;
+
+	current->exit_signal = -1;
+	snprintf(current->comm, sizeof(current->comm), "vmr_job/%d", job->id);
+
+	opened = vmrproc_openbuffer(desc);
+	if (opened) {
+		vmr_snprintf(desc, "Job %d\n", job->id);
+		if (!(desc->flags & VMR_SCRIPT)) {
+			desc->flags |= VMR_SCRIPT;
+			script = 1;
+		}
+	}
+	complete(&job->started);
+
+	job->run(job->params, job->argc, job->procentry);
+
+	if (opened) {
+		if (script)
+			desc->flags &= ~VMR_SCRIPT;
+		vmrproc_closebuffer_nocheck(desc);
+	}
+
+	down(&vmr_job_sem);
+	job->end = jiffies;
+	if (job->state == VMR_JOB_RUNNING)
+		job->state = VMR_JOB_DONE;
+	up(&vmr_job_sem);
+
+	module_put(owner);
+	return 0;
+}
+
+/**
+ * __vmr_job_reap - Free finished jobs
+ * @max: The most jobs to free
+ *
+ * vmr_job_sem must be held. The oldest jobs are freed first
+ */
+static void __vmr_job_reap(int max)
+{
+	struct vmr_job *job, *next;
+
+	list_for_each_entry_safe(job, next, &vmr_job_list, list) {
+		if (max == 0)
+			break;
+		if (job->state == VMR_JOB_RUNNING)
+			continue;
+
+		list_del(&job->list);
+		kfree(job);
+		vmr_job_count--;
+		max--;
+	}
+}
+
+/**
+ * vmr_job_submit - Start a test running as a job
+ * @desc: The proc entry the test prints to
+ * @owner: The module the test belongs to
+ * @run: Function that runs the test
+ * @params: Parameters to pass to run. They are copied
+ * @size: Size of params in bytes
+ * @argc: Number of parameters
+ * @procentry: Index of desc in the testinfo[] of owner
+ *
+ * The module is pinned until the job finishes. If VMR_JOB_MAX jobs
+ * exist, the oldest finished job is freed to make room. Returns the job
+ * id, once the job has written it to the proc buffer, or a negative errno
+ */
+int vmr_job_submit(vmr_desc_t *desc, struct module *owner,
+		int (*run)(void *params, int argc, int procentry),
+		void *params, int size, int argc, int procentry)
+{
+	struct vmr_job *job;
+	int pid;
+
+	if (size > VMR_JOB_PARAMSIZE)
+		return -EINVAL;
+
+	job = kmalloc(sizeof(struct vmr_job), GFP_KERNEL);
+	if (!job)
+		return -ENOMEM;
+	memset(job, 0, sizeof(struct vmr_job));
+	job->state = VMR_JOB_RUNNING;
+	job->submitter = current->pid;
+	strncpy(job->name, desc->name, sizeof(job->name) - 1);
+	job->desc = desc;
+	init_completion(&job->started);
+	job->owner = owner;
+	job->run = run;
+	job->argc = argc;
+	job->procentry = procentry;
+	memcpy(job->params, params, size);
+
+	if (!try_module_get(owner)) {
+		kfree(job);
+		return -ENODEV;
+	}
+
+	down(&vmr_job_sem);
+	if (vmr_job_count >= VMR_JOB_MAX)
+		__vmr_job_reap(1);
+	if (vmr_job_count >= VMR_JOB_MAX) {
+		up(&vmr_job_sem);
+		module_put(owner);
+		kfree(job);
+		return -EBUSY;
+	}
+
+	job->id = vmr_job_nextid++;
+	job->start = jiffies;
+
+	/* The job cannot finish until the semaphore is released */
+	pid = kernel_thread(vmr_job_thread, job,
+			CLONE_VM | CLONE_FS | CLONE_FILES);
+	if (pid < 0) {
+		up(&vmr_job_sem);
+		module_put(owner);
+		kfree(job);
+		return pid;
+	}
+
+	/*
+	 * The id is in the output once the job has the buffer. The job is
+	 * not on the list yet so it cannot be reaped under us
+	 */
+	wait_for_completion(&job->started);
+
+	job->pid = pid;
+	list_add_tail(&job->list, &vmr_job_list);
+	vmr_job_count++;
+	up(&vmr_job_sem);
+
+	return job->id;
+}
+
+/**
+ * vmr_job_cancel - Cancel a running job
+ * @id: The job id
+ *
+ * The job is sent SIGKILL. It stops when the test next checks
+ * vmr_test_cancelled() or when it finishes
+ */
+int vmr_job_cancel(int id)
+{
+	struct vmr_job *job;
+	int ret = -ESRCH;
+
+	down(&vmr_job_sem);
+	list_for_each_entry(job, &vmr_job_list, list) {
+		if (job->id != id)
+			continue;
+
+		if (job->state != VMR_JOB_RUNNING) {
+			ret = -EINVAL;
+			break;
+		}
+
+		job->state = VMR_JOB_CANCELLED;
+		ret = kill_proc(job->pid, SIGKILL, 1);
+		break;
+	}
+	up(&vmr_job_sem);
+
+	return ret;
+}
+
+/**
+ * vmr_job_reap - Free all finished jobs
+ */
+void vmr_job_reap(void)
+{
+	down(&vmr_job_sem);
+	__vmr_job_reap(-1);
+	up(&vmr_job_sem);
+}
+
+/**
+ * vmr_job_printall - Print the status of every job
+ * @desc: The proc buffer to print to. The caller must be the writer
+ */
+void vmr_job_printall(vmr_desc_t *desc)
+{
+	static char *states[] = { "running", "done", "cancelled" };
+	struct vmr_job *job;
+	unsigned long end;
+
+	vmr_snprintf(desc, "%-6s %-10s %-7s %-7s %10s %s\n",
+			"id", "state", "pid", "writer", "time", "test");
+
+	down(&vmr_job_sem);
+	list_for_each_entry(job, &vmr_job_list, list) {
+		end = job->end ? job->end : jiffies;
+		vmr_snprintf(desc, "%-6d %-10s %-7d %-7d %8lums %s\n",
+				job->id, states[job->state],
+				job->pid, job->submitter,
+				(1000 * (end - job->start)) / HZ,
+				job->name);
+	}
+	up(&vmr_job_sem);
+}
+
+/* Per-CPU conversion of cycles to ns. See nanotime.h */
+struct vmr_clock vmr_clock[NR_CPUS];
+
+/**
+ * vmr_clock_calibrate_cpu - Calibrate the clock of the current CPU
+ * @clock: The clock of the CPU
+ *
+ * The cycle counter is compared against the monotonic clock over
+ * VMR_CLOCK_CALIBRATE_MS. Both are read with interrupts disabled so an
+ * interrupt between the two reads does not skew the multiplier
+ */
+static void vmr_clock_calibrate_cpu(struct vmr_clock *clock)
+{
+	unsigned long long start_cycles, start_ns;
+	unsigned long long end_cycles, end_ns;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	start_ns = vmr_monotonic_ns();
+	start_cycles = read_clockcycles_sync();
+	local_irq_restore(flags);
+
+	mdelay(VMR_CLOCK_CALIBRATE_MS);
+
+	local_irq_save(flags);
+	end_ns = vmr_monotonic_ns();
+	end_cycles = read_clockcycles_sync();
+	local_irq_restore(flags);
+
+	clock->base_cycles = end_cycles;
+	clock->base_ns = end_ns;
+	clock->mult = (unsigned long)vmr_div64(
+			(end_ns - start_ns) << VMR_CLOCK_SHIFT,
+			end_cycles - start_cycles);
+}
+
+/**
+ * vmr_clock_calibrate - Calibrate the clock of every online CPU
+ *
+ * The calling thread is bound to each CPU in turn so it stays there for
+ * the whole calibration. CPUs that are not online now or fail to
+ * calibrate use the monotonic clock instead
+ */
+static int vmr_clock_calibrate(void)
+{
+#ifdef CONFIG_X86
+	cpumask_t saved = current->cpus_allowed;
+	int cpu;
+
+	int this;
+
+	for_each_online_cpu(cpu) {
+		if (set_cpus_allowed(current, cpumask_of_cpu(cpu))) {
+			vmr_printk("Failed to calibrate clock for cpu %d\n", cpu);
+			continue;
+		}
+
+		/* Only hotplug can move a bound thread off cpu now */
+		this = get_cpu();
+		put_cpu();
+		if (this != cpu) {
+			vmr_printk("Failed to calibrate clock for cpu %d\n", cpu);
+			continue;
+		}
+
+		vmr_clock_calibrate_cpu(&vmr_clock[cpu]);
+		vmr_printk("cpu %d clock %lu.%03lu ns/cycle\n", cpu,
+			vmr_clock[cpu].mult >> VMR_CLOCK_SHIFT,
+			((vmr_clock[cpu].mult & ((1UL << VMR_CLOCK_SHIFT) - 1)) * 1000)
+				>> VMR_CLOCK_SHIFT);
+	}
+
+	set_cpus_allowed(current, saved);
+#endif
+	return 0;
+}
+
+/* Every test that can be run. The index is its id. See vmr_registry.h */
+static struct vmr_test vmr_registry[VMR_REGISTRY_MAX];
+static DECLARE_MUTEX(vmr_registry_sem);
+
+/**
+ * vmr_test_register - Add a test to the registry
+ * @test: The test. It is copied
+ *
+ * Called by init.c for every entry that takes parameters. Returns the id
+ * of the test
+ */
+int vmr_test_register(struct vmr_test *test)
+{
+	int id;
+
+	down(&vmr_registry_sem);
+	for (id = 0; id < VMR_REGISTRY_MAX; id++) {
+		if (!vmr_registry[id].desc) {
+			vmr_registry[id] = *test;
+			up(&vmr_registry_sem);
+			return id;
+		}
+	}
+	up(&vmr_registry_sem);
+
+	vmr_printk("No room to register %s\n", test->desc->name);
+	return -ENOSPC;
+}
+
+/**
+ * vmr_test_unregister - Remove a test from the registry
+ * @desc: The test descriptor
+ *
+ * Tests already running hold a reference to the module so the module
+ * cannot go away under them
+ */
+void vmr_test_unregister(vmr_desc_t *desc)
+{
+	int id;
+
+	down(&vmr_registry_sem);
+	for (id = 0; id < VMR_REGISTRY_MAX; id++) {
+		if (vmr_registry[id].desc == desc)
+			memset(&vmr_registry[id], 0, sizeof(struct vmr_test));
+	}
+	up(&vmr_registry_sem);
+}
+
+/**
+ * vmr_test_lookup - Return the id of a test
+ * @name: Name of the proc entry of the test
+ *
+ * Returns -ENOENT if no test has that name
+ */
+int vmr_test_lookup(const char *name)
+{
+	int id;
+
+	down(&vmr_registry_sem);
+	for (id = 0; id < VMR_REGISTRY_MAX; id++) {
+		if (vmr_registry[id].desc &&
+		    !strcmp(vmr_registry[id].desc->name, name))
+			break;
+	}
+	up(&vmr_registry_sem);
+
+	return id == VMR_REGISTRY_MAX ? -ENOENT : id;
+}
+
+/**
+ * vmr_test_get - Copy a test out of the registry to run it
+ * @id: The id of the test
+ * @test: Returns the test
+ *
+ * A reference is taken on the module of the test which must be dropped
+ * with vmr_test_put. Returns -ENOENT if there is no test with that id
+ */
+int vmr_test_get(int id, struct vmr_test *test)
+{
+	if (id < 0 || id >= VMR_REGISTRY_MAX)
+		return -ENOENT;
+
+	down(&vmr_registry_sem);
+	*test = vmr_registry[id];
+	if (!test->desc || !try_module_get(test->owner)) {
+		up(&vmr_registry_sem);
+		return -ENOENT;
+	}
+	up(&vmr_registry_sem);
+
+	return 0;
+}
+
+/**
+ * vmr_test_put - Drop the reference taken by vmr_test_get
+ * @test: The test
+ */
+void vmr_test_put(struct vmr_test *test)
+{
+	module_put(test->owner);
+}
+
+/**
+ * vmr_dev_lookup - Handle VMR_IOC_LOOKUP
+ * @ulookup: Lookup request in userspace
+ */
+static int vmr_dev_lookup(struct vmr_dev_lookup __user *ulookup)
+{
+	struct vmr_dev_lookup lookup;
+	int id;
+
+	if (copy_from_user(&lookup, ulookup, sizeof(lookup)))
+		return -EFAULT;
+	lookup.name[sizeof(lookup.name) - 1] = '\0';
+
+	id = vmr_test_lookup(lookup.name);
+	if (id < 0)
+		return id;
+
+	lookup.id = id;
+	if (copy_to_user(ulookup, &lookup, sizeof(lookup)))
+		return -EFAULT;
+	return 0;
+}
+
+/**
+ * vmr_dev_runcmd - Run one command of a batch
+ * @cmd: The command copied from userspace
+ *
+ * Returns 0 if the test was run with its return value in cmd->result.
+ * The command runs on the CPUs in cmd->cpus if any are given
+ */
+static int vmr_dev_runcmd(struct vmr_dev_cmd *cmd)
+{
+	struct vmr_test test;
+	long params[VMR_DEV_MAXPARAMS];
+	struct vmr_affinity affinity;
+	cpumask_t saved;
+	int i, error;
+
+	if (cmd->id >= VMR_DEV_MAXENTRIES || cmd->argc > VMR_DEV_MAXPARAMS)
+		return -EINVAL;
+
+	vmr_affinity_init(&affinity);
+	if (cmd->cpus) {
+		cpus_clear(affinity.cpus);
+		for (i = 0; i < 64 && i < NR_CPUS; i++)
+			if (cmd->cpus & (1ULL << i))
+				cpu_set(i, affinity.cpus);
+		if (cpus_empty(affinity.cpus))
+			return -EINVAL;
+	}
+	affinity.nomigrate = (cmd->flags & VMR_DEV_NOMIGRATE) != 0;
+
+	if (vmr_test_get(cmd->id, &test))
+		return -ENOENT;
+
+	for (i = 0; i < cmd->argc; i++)
+		params[i] = (long)cmd->params[i];
+
+	error = vmr_affinity_enter(test.desc, &affinity, &saved);
+	if (!error) {
+		cmd->result = test.run(params, cmd->argc,
+				test.desc->procentry);
+		vmr_affinity_leave(&saved);
+	}
+	vmr_test_put(&test);
+
+	return error;
+}
+
+/**
+ * vmr_dev_batch - Handle VMR_IOC_BATCH
+ * @ubatch: Batch in userspace
+ *
+ * Commands are copied in, run and copied back one at a time so a batch
+ * can be any length
+ */
+static int vmr_dev_batch(struct vmr_dev_batch __user *ubatch)
+{
+	struct vmr_dev_batch batch;
+	struct vmr_dev_cmd __user *ucmds;
+	struct vmr_dev_cmd cmd;
+	int error = 0;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	ucmds = (struct vmr_dev_cmd __user *)(unsigned long)batch.cmds;
+
+	for (batch.done = 0; batch.done < batch.nr_cmds; batch.done++) {
+		if (vmr_test_cancelled()) {
+			error = -EINTR;
+			break;
+		}
+
+		if (copy_from_user(&cmd, &ucmds[batch.done], sizeof(cmd))) {
+			error = -EFAULT;
+			break;
+		}
+
+		cmd.result = 0;
+		cmd.error = vmr_dev_runcmd(&cmd);
+
+		if (copy_to_user(&ucmds[batch.done], &cmd, sizeof(cmd))) {
+			error = -EFAULT;
+			break;
+		}
+		if (cmd.error)
+			break;
+	}
+
+	if (put_user(batch.done, &ubatch->done))
+		return -EFAULT;
+	return error;
+}
+
+/**
+ * vmr_dev_ioctl - ioctl on /dev/vmregress
+ * @file: The open device
+ * @cmd: VMR_IOC_*
+ * @arg: Address of the request in userspace
+ *
+ * The BKL is not taken as a batch may run for as long as its tests do.
+ * Every request is made of fixed size types so 32 bit callers on a 64 bit
+ * kernel use the same handler
+ */
+static long vmr_dev_ioctl(struct file *file, unsigned int cmd,
+		unsigned long arg)
+{
+	switch (cmd) {
+	case VMR_IOC_LOOKUP:
+		return vmr_dev_lookup((struct vmr_dev_lookup __user *)arg);
+	case VMR_IOC_BATCH:
+		return vmr_dev_batch((struct vmr_dev_batch __user *)arg);
+	}
+
+	return -ENOTTY;
+}
+
+static struct file_operations vmr_dev_fops = {
+	.owner		= THIS_MODULE,
+	.unlocked_ioctl	= vmr_dev_ioctl,
+	.compat_ioctl	= vmr_dev_ioctl,
+};
+
+static struct miscdevice vmr_dev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= VMR_DEV_NAME,
+	.fops		= &vmr_dev_fops,
+};
+
+/**
+ * vmr_core_init - Set up what the core needs before any test is loaded
+ */
+static int vmr_core_init(void)
+{
+	int error;
+
+	vmr_clock_calibrate();
+	vmr_pmu_init();
+
+	error = misc_register(&vmr_dev);
+	if (error)
+		vmr_printk("Failed to register /dev/%s\n", VMR_DEV_NAME);
+	return error;
+}
+
+/**
+ * vmr_core_cleanup - Undo vmr_core_init
+ */
+static void vmr_core_cleanup(void)
+{
+	misc_deregister(&vmr_dev);
+	vmr_pool_trim();
+	vmr_pmu_cleanup();
+	vmr_lockstat_cleanup();
+	vmr_sampler_cleanup();
+}
+
 /* Export function symbols to other modules */
 EXPORT_SYMBOL(vmregress_proc_dir);
 EXPORT_SYMBOL(vmrproc_freebuffer);
+EXPORT_SYMBOL(vmrproc_freeevents);
 EXPORT_SYMBOL(vmrproc_allocbuffer);
 EXPORT_SYMBOL(vmrproc_growbuffer);
+EXPORT_SYMBOL(vmrproc_printf);
+EXPORT_SYMBOL(vmrproc_write);
+EXPORT_SYMBOL(vmrproc_fill);
+EXPORT_SYMBOL(vmrproc_bufaddr);
+EXPORT_SYMBOL(__vmrproc_bufaddr);
+EXPORT_SYMBOL(vmrproc_length);
+EXPORT_SYMBOL(vmrproc_copyout);
+EXPORT_SYMBOL(vmrproc_file_open);
+EXPORT_SYMBOL(vmrproc_file_release);
+EXPORT_SYMBOL(vmrproc_file_read);
+EXPORT_SYMBOL(vmrproc_file_write);
+EXPORT_SYMBOL(vmrproc_file_llseek);
+EXPORT_SYMBOL(vmrproc_file_mmap);
+EXPORT_SYMBOL(vmrproc_file_poll);
+EXPORT_SYMBOL(vmrproc_startstream);
+EXPORT_SYMBOL(vmrproc_beginrecord);
+EXPORT_SYMBOL(vmrproc_endrecord);
+EXPORT_SYMBOL(vmrproc_record);
+EXPORT_SYMBOL(vmr_pool_getstats);
+EXPORT_SYMBOL(vmr_pool_trim);
+EXPORT_SYMBOL(vmr_clock);
+EXPORT_SYMBOL(vmr_overhead);
+EXPORT_SYMBOL(vmr_overhead_cost);
+EXPORT_SYMBOL(vmr_overhead_names);
+EXPORT_SYMBOL(vmr_overhead_read);
+EXPORT_SYMBOL(vmr_overhead_start);
+EXPORT_SYMBOL(vmr_overhead_print);
+EXPORT_SYMBOL(vmr_counters_read);
+EXPORT_SYMBOL(vmr_counters_start);
+EXPORT_SYMBOL(vmr_counters_stop);
+EXPORT_SYMBOL(vmr_counters_since);
+EXPORT_SYMBOL(vmr_counters_add);
+EXPORT_SYMBOL(vmr_counters_print);
+EXPORT_SYMBOL(vmr_counters_printsched);
+EXPORT_SYMBOL(vmr_lockstat_active);
+EXPORT_SYMBOL(vmr_lockstat_begin);
+EXPORT_SYMBOL(vmr_lockstat_acquired);
+EXPORT_SYMBOL(vmr_lockstat_release);
+EXPORT_SYMBOL(vmr_lockstat_start);
+EXPORT_SYMBOL(vmr_lockstat_stop);
+EXPORT_SYMBOL(vmr_affinity_init);
+EXPORT_SYMBOL(vmr_affinity_parse);
+EXPORT_SYMBOL(vmr_affinity_enter);
+EXPORT_SYMBOL(vmr_affinity_leave);
+EXPORT_SYMBOL(vmr_affinity_print);
+EXPORT_SYMBOL(vmr_sampler_active);
+EXPORT_SYMBOL(vmr_sampler_start);
+EXPORT_SYMBOL(vmr_sampler_stop);
+EXPORT_SYMBOL(__vmr_sampler_mark);
+EXPORT_SYMBOL(vmr_sampler_print);
+EXPORT_SYMBOL(vmr_sampler_open);
+EXPORT_SYMBOL(vmr_sampler_close);
+EXPORT_SYMBOL(vmr_hist_alloc);
+EXPORT_SYMBOL(vmr_hist_free);
+EXPORT_SYMBOL(vmr_hist_reset);
+EXPORT_SYMBOL(vmr_hist_record);
+EXPORT_SYMBOL(vmr_hist_merge);
+EXPORT_SYMBOL(vmr_hist_percentile);
+EXPORT_SYMBOL(vmr_hist_print);
+EXPORT_SYMBOL(vmr_repeat_init);
+EXPORT_SYMBOL(vmr_repeat_done);
+EXPORT_SYMBOL(vmr_repeat_print);
+EXPORT_SYMBOL(vmr_repeat_free);
+EXPORT_SYMBOL(vmr_job_submit);
+EXPORT_SYMBOL(vmr_job_cancel);
+EXPORT_SYMBOL(vmr_job_reap);
+EXPORT_SYMBOL(vmr_job_printall);
+EXPORT_SYMBOL(vmr_test_register);
+EXPORT_SYMBOL(vmr_test_unregister);
+EXPORT_SYMBOL(vmr_test_lookup);
+EXPORT_SYMBOL(vmr_test_get);
+EXPORT_SYMBOL(vmr_test_put);
+EXPORT_SYMBOL(vmrproc_newgeneration);
 EXPORT_SYMBOL(get_pgdat_list);
 EXPORT_SYMBOL(vmr_strtoul);
 EXPORT_SYMBOL(vmr_strtol);
+EXPORT_SYMBOL(vmr_strtoparam);
+EXPORT_SYMBOL(vmr_get_pgdat);
 EXPORT_SYMBOL(check_resched_nocount);
 
 /* Module init */
 #define VMR_MODULE_HAS_NO_FILE_ENTRIES
+#define VMR_INIT_PROVIDED vmr_core_init
+#define VMR_CLEANUP_PROVIDED vmr_core_cleanup
 #include "../init/init.c"
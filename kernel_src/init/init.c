@@ -18,6 +18,33 @@
 
 #include <linux/init.h>
 
+#ifndef VMR_MODULE_HAS_NO_PROC_ENTRIES
+/* Set VMR_BINARY on every entry of the module */
+static int vmr_binary;
+MODULE_PARM(vmr_binary, "i");
+MODULE_PARM_DESC(vmr_binary, "Set to 1 to print binary records instead of text. See vmr_record.h");
+
+/* Set VMR_OVERHEAD on every entry of the module */
+static int vmr_overhead_report;
+MODULE_PARM(vmr_overhead_report, "i");
+MODULE_PARM_DESC(vmr_overhead_report, "Set to 1 to print the time each test spent in instrumentation. See vmr_overhead.h");
+
+/* Set VMR_COUNTERS on every entry of the module */
+static int vmr_counters;
+MODULE_PARM(vmr_counters, "i");
+MODULE_PARM_DESC(vmr_counters, "Set to 1 to print event counters for every test and pass. See vmr_counters.h");
+
+/* Set VMR_LOCKSTAT on every entry of the module */
+static int vmr_lockstat;
+MODULE_PARM(vmr_lockstat, "i");
+MODULE_PARM_DESC(vmr_lockstat, "Set to 1 to print VM Regress's own waits on zone->lock and page table locks for every test. See vmr_lockstat.h");
+
+/* Sampler rate of every entry of the module */
+static int vmr_sampler;
+MODULE_PARM(vmr_sampler, "i");
+MODULE_PARM_DESC(vmr_sampler, "Samples a second of zone and page state to print with every test. See vmr_sampler.h");
+#endif
+
 /**
  *
  * init_module - Initialise module
@@ -31,11 +58,28 @@
  * expected that modules which use this will define the macro to be
  * a function which writes a help information message into the proc entry.
  * See alloc.c for example
+ *
+ * If VMR_INIT_PROVIDED is defined, it is called with no arguments before
+ * any proc entry is created. A non-zero return fails the load. See
+ * vmregress_core.c for example
+ *
+ * If VMR_CLEANUP_PROVIDED is defined, it is called with no arguments when
+ * the module is unloaded to free anything the module allocated itself.
+ * See mmap.c for example
  */
 int vmr_init_module(void) {
 #ifndef VMR_MODULE_HAS_NO_PROC_ENTRIES
 	int procentry=0;
 	vmr_desc_t *entry = &testinfo[0];
+#endif
+#ifdef VMR_INIT_PROVIDED
+	int error;
+
+	error = VMR_INIT_PROVIDED();
+	if (error)
+		return error;
+#endif
+#ifndef VMR_MODULE_HAS_NO_PROC_ENTRIES
 
 	/* Cycle through all entries */
 	for (procentry=0; procentry<NUM_PROC_ENTRIES;procentry++) {
@@ -48,6 +92,25 @@ int vmr_init_module(void) {
 		if (entry->read_proc) {
 			struct proc_dir_entry *direntry;
 
+			if (vmr_binary)
+				entry->flags |= VMR_BINARY;
+			if (vmr_overhead_report)
+				entry->flags |= VMR_OVERHEAD;
+			if (vmr_counters)
+				entry->flags |= VMR_COUNTERS;
+			if (vmr_lockstat)
+				entry->flags |= VMR_LOCKSTAT;
+			if (vmr_sampler > 0)
+				entry->sampler = vmr_sampler;
+
+			/*
+			 * Give the entry a buffer before it can be opened.
+			 * Pages are taken on first write
+			 */
+			if (vmrproc_allocbuffer(1, &testinfo[procentry])) {
+				goto freebuffers;
+			}
+
 			/* Create a proc entry of requested permissions */
 			direntry = create_proc_read_entry(
 					entry->name,
@@ -56,19 +119,37 @@ int vmr_init_module(void) {
 					entry->read_proc,
 					(void *)&testinfo[procentry].procentry);
 
+			if (!direntry) {
+				vmr_printk("Failed to create proc entry %s\n", entry->name);
+				vmrproc_freebuffer(&testinfo[procentry]);
+				goto freebuffers;
+			}
+
 			/* Create the write procedure if it exists */
 			if (entry->write_proc) 
 				direntry->write_proc = entry->write_proc;
 
-			/* Allocate buffer for writing to */
-			if (vmrproc_allocbuffer(1, &testinfo[procentry])) {
-				goto freebuffers;
-			}
+			/* Read through the streaming file operations */
+			direntry->proc_fops = &vmr_proc_fops;
 
 #ifdef VMR_HELP_PROVIDED
 			VMR_HELP_PROVIDED(procentry);
 #endif
 
+#ifdef NUMBER_PROC_WRITE_PARAMETERS
+			/*
+			 * Add the entry to the test registry so it can be run
+			 * through /dev/vmregress and suites. If there is no
+			 * room it can still be run through proc
+			 */
+			if (entry->write_proc) {
+				struct vmr_test test;
+
+				vmr_test_describe(&test, procentry);
+				vmr_test_register(&test);
+			}
+#endif
+
 		} else {
 #endif
 			/* Create vmregress proc directory */
@@ -93,6 +174,9 @@ freebuffers:
 	vmr_printk("Failed to create all proc entries. out of memory\n");
 	while (--procentry >= 0) {
 		entry--;
+#ifdef NUMBER_PROC_WRITE_PARAMETERS
+		vmr_test_unregister(&testinfo[procentry]);
+#endif
 		vmrproc_freebuffer(&testinfo[procentry]);
 		remove_proc_entry(entry->name, vmregress_proc_dir);
 	}
@@ -109,12 +193,18 @@ freebuffers:
  * buffer freed
  */
 void vmr_cleanup_module(void) {
+#ifdef VMR_CLEANUP_PROVIDED
+	VMR_CLEANUP_PROVIDED();
+#endif
 #ifndef VMR_MODULE_HAS_NO_PROC_ENTRIES
 	vmr_desc_t *entry = &testinfo[0];
 	int procentry=0;
 	for (procentry=0; procentry<NUM_PROC_ENTRIES; procentry++,entry++) {
 #ifndef VMR_MODULE_HAS_NO_FILE_ENTRIES
 		if (entry->read_proc) {
+#ifdef NUMBER_PROC_WRITE_PARAMETERS
+			vmr_test_unregister(entry);
+#endif
 			/* Delete proc entry */
 			remove_proc_entry(entry->name, vmregress_proc_dir);
 			vmrproc_freebuffer(&testinfo[procentry]);
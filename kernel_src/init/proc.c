@@ -29,12 +29,49 @@
  * PARAM_TYPE			- Optional to define the type of parameters
  * 				  being passed. If not specified, it defaults
  * 				  to int
+ * PROC_WRITE_PARAMETER_NAMES	- Optional names of the parameters in order
+ * 				  such as "passes", "pages" so they can be
+ * 				  written as passes=10
+ * VMR_WRITE_RESULT		- Define if VMR_WRITE_CALLBACK returns a value
+ * 				  that should be passed back to callers of
+ * 				  /dev/vmregress. Otherwise they get 0
+ * VMR_DEV_CALLBACK		- Optional callback to use instead of
+ * 				  VMR_WRITE_CALLBACK for commands from
+ * 				  /dev/vmregress and suites. Takes the same
+ * 				  parameters and its return value is passed
+ * 				  back
+ * PROC_WRITE_PARAMETER_DEFAULTS - Optional value of each parameter in order
+ * 				  used when it is not given. Otherwise it
+ * 				  is 0
+ * VMR_TEST_DANGER(procentry)	- Optional VMR_DANGER_* of an entry. The
+ * 				  default is VMR_DANGER_SAFE
+ * VMR_TEST_SUITE(procentry)	- Optional name of the suite an entry is in
+ * 				  or NULL if it is in none
+ *
+ * If the parameters written start with &, the write callback is run as a
+ * job in its own thread. See the Jobs section of vmregress_core.h
+ *
+ * Parameters may also be given as name=value if the includer defines
+ * PROC_WRITE_PARAMETER_NAMES to the names of its parameters in order.
+ * Many commands can be written at once, one per line, and are run as a
+ * script. See vmr_write_proc
+ *
+ * Every command also takes cpus= and nomigrate= which set the CPUs the
+ * test runs on. See vmr_affinity.h
+ *
+ * Every entry that takes parameters is added to the test registry with
+ * the description from vmr_test_describe and can be run through
+ * vmr_test_run by an ioctl on /dev/vmregress or as part of a suite. See
+ * vmr_registry.h
+ *
+ * vmr_read_proc is the original page at a time read_proc. init.c installs
+ * vmr_proc_fops on every entry instead which streams the output
  */
 
-#ifdef MAX_PROC_WRITE
-#error MAX_PROC_WRITE already defined
+#ifdef MAX_PROC_SCRIPT
+#error MAX_PROC_SCRIPT already defined
 #else
-#define MAX_PROC_WRITE 256
+#define MAX_PROC_SCRIPT (4 * PAGE_SIZE)
 #endif
 
 #ifndef PARAM_TYPE
@@ -45,7 +82,7 @@
  * vmr_read_proc - Routine to call if a proc entry is read from userspace
  * 
  * @buf:    buffer to write to
- * @start:  Local allocated page used for printing large proc entries
+ * @start:  Returns the number of bytes to advance offset by
  * @offset: Number of bytes read so far
  * @count:  Number of bytes to read
  * @eof:    EOF flag (returned)
@@ -64,26 +101,18 @@ int vmr_read_proc(char *buf, char **start, off_t offset, int count, int *eof, vo
 	if (offset == 0) VMR_READ_PROC_CALLBACK(procentry);
 #endif
 
-	/* Set start */
-	*start = testinfo[procentry].procbuf + offset;
-
-	/* Get length of proc entry */
-	len = strlen(*start);
+	/* Never copy more than the page proc provides */
+	if (count > PAGE_SIZE) count = PAGE_SIZE;
+	if (count < 0) count = 0;
 
 	/*
-	 * Check if
-	 *   o this read will be the last read
-	 *   o if the reader would go past the buffer end
-	 *   o that more than PAGE_SIZE was requested
-	 *   o a negative length was asked for
+	 * Copy the output at this offset to the start of the page. Setting
+	 * *start to the number of bytes copied tells proc to advance the
+	 * offset by that much for the next read
 	 */
-	if (len <= count) *eof=1;
-	if (len > count) len = count;
-	if (len > PAGE_SIZE) len = PAGE_SIZE;
-	if (len < 0) len = 0;
-
-	/* Copy string into buffer */
-	strncpy(buf, *start, len);
+	len = vmrproc_copyout(&testinfo[procentry], offset, buf, count);
+	*start = (char *)(unsigned long)len;
+	if (len < count) *eof=1;
 
 #ifdef VMR_READ_PROC_CALLBACK
 	if (*eof) vmrproc_closebuffer(&testinfo[procentry]);
@@ -95,7 +124,302 @@ int vmr_read_proc(char *buf, char **start, off_t offset, int count, int *eof, vo
 	return len;
 }
 
+/**
+ * vmr_proc_read - Streaming read of a proc entry
+ * @file:  The proc file been read
+ * @buf:   User buffer
+ * @count: Number of bytes to read
+ * @ppos:  File position
+ *
+ * This is the read method of vmr_proc_fops which replaces the page at a
+ * time vmr_read_proc for every entry created by init.c. The callbacks
+ * are run exactly as they are for vmr_read_proc but the output is copied
+ * straight from the proc buffer by vmrproc_file_read so reads can be of
+ * any size, the file is seekable and reading all output is O(n)
+ */
+static ssize_t vmr_proc_read(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	vmr_desc_t *desc = vmrproc_file_desc(file);
+	int procentry = desc->procentry;
+	ssize_t len;
+	int eof;
+
+#ifdef VMR_READ_PROC_CALLBACK
+	/* Populate proc buffer */
+	if (*ppos == 0) VMR_READ_PROC_CALLBACK(procentry);
+#endif
+
+	len = vmrproc_file_read(file, buf, count, ppos);
+	eof = len >= 0 && *ppos >= vmrproc_length(desc);
+
+#ifdef VMR_READ_PROC_CALLBACK
+	if (eof) vmrproc_closebuffer(&testinfo[procentry]);
+#endif
+
+#ifdef VMR_READ_PROC_ENDCALLBACK
+	VMR_READ_PROC_ENDCALLBACK;
+#endif
+	return len;
+}
+
+static struct file_operations vmr_proc_fops = {
+	.owner		= THIS_MODULE,
+	.open		= vmrproc_file_open,
+	.release	= vmrproc_file_release,
+	.read		= vmr_proc_read,
+	.write		= vmrproc_file_write,
+	.llseek		= vmrproc_file_llseek,
+	.mmap		= vmrproc_file_mmap,
+	.poll		= vmrproc_file_poll,
+};
+
 #ifdef NUMBER_PROC_WRITE_PARAMETERS
+#ifdef PROC_WRITE_PARAMETER_DEFAULTS
+/* Values of parameters not given */
+static long vmr_param_defaults[NUMBER_PROC_WRITE_PARAMETERS] = {
+	PROC_WRITE_PARAMETER_DEFAULTS
+};
+#endif
+
+/**
+ * vmr_param_init - Set parameters from a given one on to their defaults
+ * @params: The parameters
+ * @from: The first parameter to set
+ *
+ * Tests cannot tell a parameter that was not given from one written as
+ * 0 so it takes its default instead, such as node -1 for any node
+ */
+static void vmr_param_init(PARAM_TYPE *params, int from)
+{
+	int i;
+
+	for (i = from; i < NUMBER_PROC_WRITE_PARAMETERS; i++) {
+#ifdef PROC_WRITE_PARAMETER_DEFAULTS
+		params[i] = (PARAM_TYPE)vmr_param_defaults[i];
+#else
+		params[i] = 0;
+#endif
+	}
+}
+
+/**
+ * vmr_job_run - Run the write callback from a job thread
+ * @params: Copy of the parameters written
+ * @argc: Number of parameters written
+ * @procentry: Index into testinfo[] which was written
+ */
+static int vmr_job_run(void *params, int argc, int procentry)
+{
+	VMR_WRITE_CALLBACK((PARAM_TYPE *)params, argc, procentry);
+	return 0;
+}
+
+/**
+ * vmr_test_run - Run the write callback for a test from the registry
+ * @devparams: Parameters of the command
+ * @argc: Number of parameters in the command
+ * @procentry: Index into testinfo[] the command is for
+ */
+static long vmr_test_run(long *devparams, int argc, int procentry)
+{
+	PARAM_TYPE params[NUMBER_PROC_WRITE_PARAMETERS];
+	int i;
+
+	if (argc > NUMBER_PROC_WRITE_PARAMETERS)
+		argc = NUMBER_PROC_WRITE_PARAMETERS;
+	for (i = 0; i < argc; i++)
+		params[i] = (PARAM_TYPE)devparams[i];
+	vmr_param_init(params, argc);
+
+#ifdef CHECK_PROC_PARAMETERS
+	/* Sanity check parameters */
+	CHECK_PROC_PARAMETERS(params, argc);
+#endif
+
+#ifdef VMR_DEV_CALLBACK
+	return (long)VMR_DEV_CALLBACK(params, argc, procentry);
+#else
+#ifdef VMR_WRITE_RESULT
+	return (long)VMR_WRITE_CALLBACK(params, argc, procentry);
+#else
+	VMR_WRITE_CALLBACK(params, argc, procentry);
+	return 0;
+#endif
+#endif
+}
+
+#ifdef PROC_WRITE_PARAMETER_NAMES
+/* Names that parameters can be given by in the order they are passed */
+static char *vmr_param_names[NUMBER_PROC_WRITE_PARAMETERS] = {
+	PROC_WRITE_PARAMETER_NAMES
+};
+#endif
+
+/**
+ * vmr_test_describe - Describe an entry for the test registry
+ * @test: Returns the description
+ * @procentry: Index into testinfo[] of the entry
+ */
+static void vmr_test_describe(struct vmr_test *test, int procentry)
+{
+	memset(test, 0, sizeof(struct vmr_test));
+	test->desc = &testinfo[procentry];
+	test->descs = testinfo;
+	test->nr_descs = NUM_PROC_ENTRIES;
+	test->owner = THIS_MODULE;
+	test->run = vmr_test_run;
+	test->nparams = NUMBER_PROC_WRITE_PARAMETERS;
+#ifdef PROC_WRITE_PARAMETER_NAMES
+	test->params = vmr_param_names;
+#endif
+#ifdef PROC_WRITE_PARAMETER_DEFAULTS
+	test->defaults = vmr_param_defaults;
+#endif
+#ifdef VMR_TEST_DANGER
+	test->danger = VMR_TEST_DANGER(procentry);
+#endif
+#ifdef VMR_TEST_SUITE
+	test->suite = VMR_TEST_SUITE(procentry);
+#endif
+}
+
+/**
+ * vmr_param_index - Return the index of a named parameter
+ * @name: Name before the = of a key=value parameter
+ *
+ * Returns -1 if the module does not name a parameter that
+ */
+static int vmr_param_index(char *name)
+{
+#ifdef PROC_WRITE_PARAMETER_NAMES
+	int index;
+
+	for (index = 0; index < NUMBER_PROC_WRITE_PARAMETERS; index++) {
+		if (vmr_param_names[index] &&
+		    !strcmp(vmr_param_names[index], name))
+			return index;
+	}
+#endif
+	return -1;
+}
+
+/**
+ * vmr_write_command - Parse and run one command
+ * @from: The command. It is modified while it is parsed
+ * @procentry: Index into testinfo[] which was written
+ * @script: Set if the command is one of many in a script
+ *
+ * Parameters are separated by spaces and are either a plain value which
+ * is taken as the next parameter in order or name=value. Values are
+ * converted by vmr_strtoparam. cpus= and nomigrate= are taken by every
+ * command and set the CPUs the test runs on, see vmr_affinity.h. Returns
+ * 0 or -errno if the command could not be run
+ */
+static int vmr_write_command(char *from, int procentry, int script)
+{
+	char *to;		/* Pointer to end of parameter */
+	char *value;		/* Pointer to value of a name=value */
+	PARAM_TYPE params[NUMBER_PROC_WRITE_PARAMETERS]; /* Array of ints read */
+	int noread=0;				  /* Number of params in order */
+	int argc=0;				  /* Highest param given + 1 */
+	int index;
+	long param;
+	int job=0;				  /* Run as a job */
+	struct vmr_affinity affinity;		  /* CPUs to run on */
+	cpumask_t saved;			  /* CPUs of the writer */
+	int error;
+
+	/* Parameters not written take their defaults */
+	vmr_param_init(params, 0);
+	vmr_affinity_init(&affinity);
+
+	/* A leading & runs the test as a job */
+	if (*from == '&') {
+		if (script) {
+			vmr_printk("Jobs cannot be started by a script\n");
+			return -EINVAL;
+		}
+		job = 1;
+		from++;
+	}
+
+	while (from) {
+		while (*from == ' ') from++;
+		if (*from == '\0') break;
+
+		/* Split input by the space char */
+		to = strchr(from, ' ');
+		if (to) *(to++)='\0';
+
+		/* Find which parameter this is */
+		value = strchr(from, '=');
+		if (value) {
+			*(value++) = '\0';
+			error = vmr_affinity_parse(&affinity, from, value);
+			if (error < 0) {
+				vmr_printk("Bad value %s for %s\n", value, from);
+				return error;
+			}
+			if (error) {
+				from = to;
+				continue;
+			}
+			index = vmr_param_index(from);
+			if (index < 0) {
+				vmr_printk("Unknown parameter %s\n", from);
+				return -EINVAL;
+			}
+		} else {
+			value = from;
+			index = noread++;
+		}
+		if (index >= NUMBER_PROC_WRITE_PARAMETERS) break;
+
+		/* Convert this parameter */
+		if (vmr_strtoparam(value, &param)) {
+			vmr_printk("Bad value %s\n", value);
+			return -EINVAL;
+		}
+		params[index] = (PARAM_TYPE)param;
+		if (index >= argc) argc = index + 1;
+
+		/* Move to next parameter */
+		from = to;
+	}
+
+#ifdef CHECK_PROC_PARAMETERS
+	/* Sanity check parameters */
+	CHECK_PROC_PARAMETERS(params, argc);
+#endif
+
+	/* A job thread inherits the CPUs of the writer */
+	error = vmr_affinity_enter(&testinfo[procentry], &affinity, &saved);
+	if (error) {
+		vmr_printk("Cannot run on the CPUs given\n");
+		return error;
+	}
+
+	if (job) {
+		job = vmr_job_submit(&testinfo[procentry], THIS_MODULE,
+				vmr_job_run, params, sizeof(params),
+				argc, procentry);
+		vmr_affinity_leave(&saved);
+		if (job < 0) {
+			vmr_printk("Failed to start job\n");
+			return job;
+		}
+		vmr_printk("Started job %d\n", job);
+		return 0;
+	}
+
+	/* Run the test */
+	VMR_WRITE_CALLBACK(params, argc, procentry);
+	vmr_affinity_leave(&saved);
+
+	return 0;
+}
+
 /**
  * vmr_write_proc - Routine to call if proc entry is written to
  * @file: unused
@@ -103,57 +427,96 @@ int vmr_read_proc(char *buf, char **start, off_t offset, int count, int *eof, vo
  * @count: data len
  * @data:  Index into testinfo[] which is being written
  *
+ * Each line written is a command. Empty lines and lines starting with #
+ * are ignored. If there is more than one command, they are run as a
+ * script one after the other. The writer holds the proc buffer for the
+ * whole script with VMR_SCRIPT set so the output of every command is
+ * kept, each one after a line with the command that produced it. The
+ * script stops at the first command that cannot be run or if the writer
+ * is interrupted
+ *
  * This function will only exist if NUMBER_PROC_WRITE_PARAMETERS is defined,
  * hence this function is wrapped around an #ifdef
  */
 int vmr_write_proc (struct file *file, const char *buf, 
 		    unsigned long count, void *data)
 {
-	char readbuf[MAX_PROC_WRITE];
-	char *from = readbuf; 	/* Pointer to beginning of parameter */
-	char *to;		/* Pointer to end of parameter */
-	PARAM_TYPE params[NUMBER_PROC_WRITE_PARAMETERS]; /* Array of ints read */
-	int noread=0;				  /* Number ints read */
+	vmr_desc_t *desc;
+	char *script;		/* Everything written */
+	char *line, *next;
+	int nrcmds=0;		/* Number of commands in the script */
 	int procentry;
+	int error=0;
 
 	/* Which proc buffer we are writing to is passed in with *data */
 	procentry = *(int *)data;
-
-	/* Clear parameters */
-	memset(params, 0, sizeof(params));
+	desc = &testinfo[procentry];
 
 	/* Read input */
-	if (count >= MAX_PROC_WRITE) {
-		vmr_printk("count >= MAX_PROC_WRITE\n");
+	if (count >= MAX_PROC_SCRIPT) {
+		vmr_printk("count >= MAX_PROC_SCRIPT\n");
 		return -EINVAL;
 	}
-	if (copy_from_user(&readbuf, buf, count)) {
+	script = kmalloc(count + 1, GFP_KERNEL);
+	if (!script) {
+		vmr_printk("Failed to allocate %lu bytes for script\n", count);
+		return -ENOMEM;
+	}
+	if (copy_from_user(script, buf, count)) {
 		vmr_printk("copy_from_user failed\n");
+		kfree(script);
 		return -EFAULT;
 	}
-	readbuf[count] = '\0';
+	script[count] = '\0';
 
-	while (from && noread < NUMBER_PROC_WRITE_PARAMETERS) {
-		/* Split input by the space char */
-		to = strchr(from, ' ');
-		if (to) *(to++)='\0';
+	/* Split into lines and count the commands */
+	for (line = script; line < script + count; line += strlen(line) + 1) {
+		next = strchr(line, '\n');
+		if (next) *next = '\0';
+		while (*line == ' ') line++;
+		if (*line != '\0' && *line != '#') nrcmds++;
+		if (!next) break;
+	}
 
-		/* Convert this parameter */
-		params[noread] = vmr_strtol(from, NULL, 10);
-		
-		/* Move to next parameter */
-		from = to;
-		noread++;
+	/* Hold the buffer so every command appends to it */
+	if (nrcmds > 1) {
+		if (!vmrproc_openbuffer(desc)) {
+			kfree(script);
+			return -EBUSY;
+		}
+		spin_lock(&desc->lock);
+		desc->flags |= VMR_SCRIPT;
+		spin_unlock(&desc->lock);
 	}
 
-#ifdef CHECK_PROC_PARAMETERS
-	/* Sanity check parameters */
-	CHECK_PROC_PARAMETERS(params, noread);
-#endif
+	for (line = script; line < script + count; line = next) {
+		/* The command is modified as it is parsed */
+		next = line + strlen(line) + 1;
+		while (*line == ' ') line++;
+		if (*line == '\0' || *line == '#') continue;
 
-	/* Run the test */
-	VMR_WRITE_CALLBACK(params, noread, procentry);
+		if (nrcmds > 1) {
+			if (vmr_test_cancelled()) {
+				vmr_snprintf(desc, "# Script interrupted\n");
+				error = -EINTR;
+				break;
+			}
+			vmr_snprintf(desc, "# %s\n", line);
+		}
+
+		error = vmr_write_command(line, procentry, nrcmds > 1);
+		if (error)
+			break;
+	}
+
+	if (nrcmds > 1) {
+		spin_lock(&desc->lock);
+		desc->flags &= ~VMR_SCRIPT;
+		spin_unlock(&desc->lock);
+		vmrproc_closebuffer(desc);
+	}
 
-	return count;
+	kfree(script);
+	return error ? error : count;
 }
 #endif /* NUMBER_PROC_WRITE_PARAMETERS */
@@ -3,7 +3,10 @@
  *
  * This module will cycle through all address spaces in the current process 
  * and print out an encoded page map which determines which pages are present
- * and which are free. See pagetable.c for details on the encoding
+ * and which are free. See pagetable.c for details on the encoding. Writing
+ * a pid to pagemap_pid prints the same for that process instead, so the
+ * layout of a running workload can be read without it reading the proc
+ * entry itself
  *
  * Mel Gorman 2002
  */
@@ -30,10 +33,12 @@
 
 /* Test names */ 
 #define SENSE_PAGEMAP 0
+#define SENSE_PAGEMAP_PID 1
 
 /* Proc functions */
 static vmr_desc_t testinfo[] = {
 	VMR_DESC_INIT(SENSE_PAGEMAP, MODULENAME "_read", vmr_read_proc, NULL),
+	VMR_DESC_INIT(SENSE_PAGEMAP_PID, MODULENAME "_pid", vmr_read_proc, vmr_write_proc),
 };
 
 MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
@@ -41,45 +46,41 @@ MODULE_DESCRIPTION("Print out all pages present/swapped for a process");
 MODULE_LICENSE("GPL");
 
 /**
- *
- * pagemap_runtest - Run a test function
+ * pagemap_printmm - Print the page map of every VMA of a process
  * @procentry: Proc buffer to write to
- * @argument: Parameters of the test
+ * @pid: The process. 0 is the current process
  *
  * Returns
  * 0  on success
  * -1 on failure
- *
  */
-int pagemap_runtest(int procentry) {
-	struct mm_struct *mm;		/* mm struct of current */
+static int pagemap_printmm(int procentry, pid_t pid) {
+	struct mm_struct *mm;		/* mm struct of the process */
 	struct vm_area_struct *start;	/* Starting vma */
 	struct vm_area_struct *vma;	/* VMA been dumped */
-	unsigned long sched_count;	/* Schedule count */
+	unsigned long sched_count=0;	/* Schedule count */
 
-	/* Check we have an MM (pretty much impossible not to) */
-	if (!current->mm) return 0;
-
-	/* Make sure a buffer is available */
-	if (vmrproc_checkbuffer(testinfo[procentry])) BUG();
-	vmrproc_openbuffer(&testinfo[procentry]);
-
-	mm = current->mm;
+	/* Pin the mm so the process may exit or unmap during the walk */
+	mm = vmr_mm_get(pid);
+	if (!mm) {
+		printp("No process %d with an address space that may be read\n", pid);
+		return -1;
+	}
 
 	/* Print header */
 	printp("Process Page Address Test Results.\n\n");
-	printp("o PID:       %d\n",  current->pid);
+	printp("o PID:       %d\n",  pid ? pid : current->pid);
 	printp("o VMA count: %d\n",  mm->map_count);
-	printp("o RSS:       Unknown, need to update tool to calculate\n");
+	printp("o RSS:       %lu\n", get_mm_rss(mm));
 	printp("o Total VM:  %lu\n", mm->total_vm);
 	printp("\n");
 
 	/* Get the first area */
 	start = vma = mm->mmap;
 
-	do {
+	while (vma) {
 		/* Print out the address map */
-		vmr_printmap(current->mm, 
+		vmr_printmap(mm, 
 			     vma->vm_start, 
 			     vma->vm_end - vma->vm_start,
 			     &sched_count,
@@ -87,12 +88,58 @@ int pagemap_runtest(int procentry) {
 
 		/* Move to next VMA */
 		vma = vma->vm_next;
-	} while (vma && vma != start); 
+		if (vma == start) break;
+	}
 
+	vmr_mm_put(mm);
 	return 0;
 }
 
-#define NUM_PROC_ENTRIES 1
+/**
+ *
+ * pagemap_runtest - Print the page map of the reader
+ * @procentry: Proc buffer to write to
+ *
+ * Returns
+ * 0  on success
+ * -1 on failure
+ *
+ */
+int pagemap_runtest(int procentry) {
+	/* pagemap_pid is printed when it is written */
+	if (procentry != SENSE_PAGEMAP) return 0;
+
+	/* Make sure a buffer is available */
+	if (vmrproc_checkbuffer(testinfo[procentry])) BUG();
+	vmrproc_openbuffer(&testinfo[procentry]);
+
+	return pagemap_printmm(procentry, 0);
+}
+
+/**
+ * pagemap_pid_runtest - Print the page map of another process
+ * @params: Parameters read from the proc entry, the pid
+ * @argc: Number of parameters actually entered
+ * @procentry: Proc buffer to write to
+ */
+int pagemap_pid_runtest(int *params, int argc, int procentry) {
+	int ret;
+
+	/* Make sure a buffer is available */
+	if (vmrproc_checkbuffer(testinfo[procentry])) BUG();
+	vmrproc_openbuffer(&testinfo[procentry]);
+
+	ret = pagemap_printmm(procentry, params[0]);
+
+	vmrproc_closebuffer(&testinfo[procentry]);
+	return ret;
+}
+
+#define NUM_PROC_ENTRIES 2
 #define VMR_READ_PROC_CALLBACK pagemap_runtest
+#define NUMBER_PROC_WRITE_PARAMETERS 1
+#define PROC_WRITE_PARAMETER_NAMES "pid"
+#define VMR_WRITE_CALLBACK pagemap_pid_runtest
+#define VMR_WRITE_RESULT
 #include "../init/proc.c"
 #include "../init/init.c"
@@ -72,7 +72,7 @@ void sizes_getproc(int procentry) {
 	vma = NULL;
 
 	/* Make sure a buffer is available */
-	if (vmrproc_checkbuffer(&testinfo[procentry])) BUG();
+	if (vmrproc_checkbuffer(testinfo[procentry])) BUG();
 
 	vmrproc_openbuffer(&testinfo[procentry]);
 
@@ -8,6 +8,7 @@
  * Mel Gorman 2002
  */
 
+#include <linux/version.h>
 #include <linux/config.h>
 #include <linux/fs.h>
 #include <linux/types.h>
@@ -51,6 +52,52 @@ static char *zone_names[MAX_NR_ZONES] = {
 	"ZONE_NORMAL",
 	"ZONE_HIGHMEM" };
 
+/* Binary record of one zone. present and spanned are the size on 2.4 */
+static struct vmr_field zone_fields[] = {
+	{ "node",	VMR_FIELD_U64 },
+	{ "zone",	VMR_FIELD_U64 },
+	{ "present",	VMR_FIELD_U64 },
+	{ "spanned",	VMR_FIELD_U64 },
+	{ "free",	VMR_FIELD_U64 },
+	{ "high",	VMR_FIELD_U64 },
+	{ "low",	VMR_FIELD_U64 },
+	{ "min",	VMR_FIELD_U64 },
+};
+static struct vmr_schema zone_schema = VMR_SCHEMA("zone", zone_fields);
+
+/**
+ * zone_record - Print a binary record for every zone of a node
+ * @procentry: Proc buffer to write to
+ * @pgdat: The node
+ *
+ * The fields are read under zone->lock and recorded after it is released
+ */
+static void zone_record(int procentry, pg_data_t *pgdat) {
+	unsigned long long values[8];
+	unsigned long flags;
+	C_ZONE *zone;
+	int zcount;
+
+	for (zcount=0; zcount<pgdat->nr_zones; zcount++) {
+		zone = pgdat->node_zones + zcount;
+		values[0] = pgdat->node_id;
+		values[1] = zcount;
+		spin_lock_irqsave(&zone->lock, flags);
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,5,62))
+		values[2] = values[3] = zone->size;
+#else
+		values[2] = zone->present_pages;
+		values[3] = zone->spanned_pages;
+#endif
+		values[4] = zone->free_pages;
+		values[5] = zone->pages_high;
+		values[6] = zone->pages_low;
+		values[7] = zone->pages_min;
+		spin_unlock_irqrestore(&zone->lock, flags);
+		vmrproc_record(&testinfo[procentry], &zone_schema, values);
+	}
+}
+
 /**
  *
  * zone_getproc - Get information for the proc entry and fill the buffer
@@ -60,6 +107,7 @@ static char *zone_names[MAX_NR_ZONES] = {
 void zone_getproc(int procentry) {
 	int ncount, zcount, pcount;	/* No. nodes, zones and pages */
 	unsigned long flags;		/* IRQ flags */
+	unsigned long value;		/* Field read under zone->lock */
 	pg_data_t *pgdat=NULL;
 	C_ZONE    *zone=NULL;
 	
@@ -87,32 +135,43 @@ void zone_getproc(int procentry) {
 	 * do it this way 
 	 */
 	do {
+		/* Free pages and watermarks are numbers in a binary stream */
+		if (vmrproc_binary(&testinfo[procentry])) {
+			zone_record(procentry, pgdat);
+			continue;
+		}
+
 		printp("Node %d\n------\n", ncount);
 		ncount++;
 
-		/* Macro to read all zones in this node */
-#define all_zones(print_info) for (zcount=0;zcount<pgdat->nr_zones; zcount++) {\
+		/*
+		 * Macro to read a field of all zones in this node. The field
+		 * is read under zone->lock and printed after it is released
+		 * as printp may need to allocate
+		 */
+#define all_zones(format, field) for (zcount=0;zcount<pgdat->nr_zones; zcount++) {\
 	zone = pgdat->node_zones + zcount; \
-	if (zone) { \
-		spin_lock_irqsave(&zone->lock, flags); \
-		print_info \
-		spin_unlock_irqrestore(&zone->lock, flags); \
-	} else { printp("ZONE NULL\n"); } \
+	spin_lock_irqsave(&zone->lock, flags); \
+	value = zone->field; \
+	spin_unlock_irqrestore(&zone->lock, flags); \
+	printp(format, value); \
 	} \
 	printp("\n");
 
 		/* Print Zone information */
-		all_zones(printp("%-32s", zone_names[zcount]);)
+		for (zcount=0;zcount<pgdat->nr_zones; zcount++)
+			printp("%-32s", zone_names[zcount]);
+		printp("\n");
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2,5,62))
-		all_zones(printp("zone->size          = %8lu  ", zone->size);)
+		all_zones("zone->size          = %8lu  ", size)
 #else
-		all_zones(printp("zone->present_pages = %8lu  ", zone->present_pages);)
-		all_zones(printp("zone->spanned_pages = %8lu  ", zone->spanned_pages);)
+		all_zones("zone->present_pages = %8lu  ", present_pages)
+		all_zones("zone->spanned_pages = %8lu  ", spanned_pages)
 #endif
-		all_zones(printp("zone->free_pages    = %8lu  ", zone->free_pages);)
-		all_zones(printp("zone->pages_high    = %8lu  ", zone->pages_high);)
-		all_zones(printp("zone->pages_low     = %8lu  ", zone->pages_low);)
-		all_zones(printp("zone->pages_min     = %8lu  ", zone->pages_min);)
+		all_zones("zone->free_pages    = %8lu  ", free_pages)
+		all_zones("zone->pages_high    = %8lu  ", pages_high)
+		all_zones("zone->pages_low     = %8lu  ", pages_low)
+		all_zones("zone->pages_min     = %8lu  ", pages_min)
 		printp("\n\n");
 
 		/* Update node ID */
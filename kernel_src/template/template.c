@@ -27,6 +27,7 @@
 /* Module specific */
 #include <vmregress_core.h>
 #include <procprint.h>
+#include <nanotime.h>
 #include <linux/mmzone.h>
 #include <linux/mm.h>
 #include <linux/vmalloc.h>
@@ -111,7 +112,7 @@ int template_runtest(int *params, int argc, int procentry) {
 	int nopasses;			/* Number of passes to make */
 	int arguement;			/* Arguement passed via proc */
 
-	unsigned long start;		/* Start time in jiffies */
+	unsigned long long start;	/* Start time in ns */
 	unsigned long sched_count;	/* Number of schedule calls */
 
 	/* Get the parameters */
@@ -147,7 +148,7 @@ int template_runtest(int *params, int argc, int procentry) {
 	while (nopasses-- > 0) {
 
 		printp("o Pass - %d", nopasses);
-		start = jiffies;
+		start = vmr_clock_ns();
 
 		/* --- Perform test here --- */
 
@@ -155,7 +156,7 @@ int template_runtest(int *params, int argc, int procentry) {
 		check_resched(sched_count);
 
 		/* Print how many milliseconds it took to allocate */
-		printp("\t %lums\n", jiffies_to_ms(start));
+		printp("\t %lums\n", vmr_clock_ms(start));
 
 	}
 	
@@ -172,8 +173,10 @@ int vmr_sanity(int *params, int noread) {
 }
 
 #define NUMBER_PROC_WRITE_PARAMETERS 2
+#define PROC_WRITE_PARAMETER_NAMES "passes", "argument"
 #define CHECK_PROC_PARAMETERS vmr_sanity
 #define VMR_WRITE_CALLBACK template_runtest
+#define VMR_WRITE_RESULT
 #include "../init/proc.c"
 
 #define VMR_HELP_PROVIDED template_help
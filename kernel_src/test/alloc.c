@@ -58,6 +58,19 @@
  *
  * echo numpasses numpages > /proc/vmregress/test_alloc_fast                   
  *                                                                           
+ * With cv= or budget=, the test repeats until the coefficient of variation
+ * of the time of a pass, in tenths of a percent, is below cv or budget
+ * milliseconds have passed and numpasses is the most passes to run. See
+ * vmr_repeat.h
+ *
+ * echo cv=20 budget=60000 > /proc/vmregress/test_alloc_fast
+ *
+ * With hist=1, every alloc and free is timed on its own and histograms of
+ * their latency are printed after the test. Reading the clock twice for
+ * every page costs about as much as a fast path allocation so it is off
+ * by default and the time of a pass is only comparable between runs with
+ * the same setting
+ *
  * Cat the /proc/vmregress/test_alloc_fast to read the results of the test.
  *
  * Mel Gorman 2002
@@ -75,6 +88,10 @@
 /* Module specific */
 #include <vmregress_core.h>
 #include <procprint.h>
+#include <nanotime.h>
+#include <vmr_histogram.h>
+#include <vmr_repeat.h>
+#include <vmr_events.h>
 #include <linux/mmzone.h>
 #include <linux/mm.h>
 #include <linux/vmalloc.h>
@@ -111,6 +128,15 @@ MODULE_PARM_DESC(gfp_kernel, "Set to 1 if GFP_KERNEL is to be used with alloc_pa
 /* GFP flags to use with __alloc_pages. defaults to GFP_ATOMIC */
 unsigned int gfp_flags=GFP_ATOMIC;
 
+/* Binary record printed for every pass */
+static struct vmr_field alloc_pass_fields[] = {
+	{ "pass",	VMR_FIELD_U64 },
+	{ "alloced",	VMR_FIELD_U64 },
+	{ "alloc_ns",	VMR_FIELD_U64 },
+	{ "free_ns",	VMR_FIELD_U64 },
+};
+static struct vmr_schema alloc_pass = VMR_SCHEMA("alloc_pass", alloc_pass_fields);
+
 /**
  * test_alloc_help - Print help message to proc buffer
  * @procentry: Which proc buffer to write to
@@ -123,6 +149,13 @@ void test_alloc_help(int procentry) {
 	printp("echo numpasses [numpages] > /proc/vmregress/%s%s\n\n", MODULENAME, testinfo[procentry].name);
 	printp("Where numpasses is how many times to allocate a block of pages\n");
 	printp("and numpages is an optional parameter of how many pages to allocate\n");
+	printp("Parameters may also be named as passes=, pages=, gfp= and node= where\n");
+	printp("gfp overrides the GFP flags and node picks the node to test\n");
+	printp("A gfp of -1, the default, uses the GFP flags of the module\n");
+	printp("With cv= or budget=, passes are repeated until the CV of their time\n");
+	printp("in 0.1%% is below cv or until budget ms have passed, up to numpasses\n");
+	printp("With hist=1, histograms of the latency of every alloc and free are\n");
+	printp("printed. Timing every page slows the test so it is off by default\n");
 	printp("When the test completes, cat this proc entry again to see the results.\n");
 	printp("For more information, read the comment at the top of src/test/alloc.c\n\n");
 	
@@ -151,6 +184,8 @@ void test_alloc_help(int procentry) {
 /**
  * test_alloc_calculate_parameters - Calculate the parameters of the test
  * @procentry: Indicates which test is been run
+ * @gfp: GFP flags the test allocates with
+ * @node: Node to test or -1 for the first node
  * @rzone: Return the zone been tested on
  * @rnopages: Return the number of pages to allocate
  * @rfreelimit: The number of pages that must be free for the test to continue
@@ -169,7 +204,8 @@ void test_alloc_help(int procentry) {
  * 0  on success
  * -1 on failure
  */
-int test_alloc_calculate_parameters(int procentry, C_ZONE **rzone,
+int test_alloc_calculate_parameters(int procentry, unsigned int gfp, int node,
+				    C_ZONE **rzone,
 				    unsigned long *rnopages, unsigned long *rfreelimit) {
 	pg_data_t *pgdat;		/* node to allocate from */
 	unsigned long       flags;	/* IRQ flags */
@@ -179,7 +215,7 @@ int test_alloc_calculate_parameters(int procentry, C_ZONE **rzone,
 	nopages = *rnopages;
 	
 	/* Get the zone we are to alloc from */
-	pgdat = get_pgdat_list();
+	pgdat = node < 0 ? get_pgdat_list() : vmr_get_pgdat(node);
 	if (pgdat) zone = &pgdat->node_zones[ZONE_NORMAL]; 
 	if (!zone) {
 		printp("ERROR: Could not find ZONE_NORMAL\n");
@@ -187,7 +223,7 @@ int test_alloc_calculate_parameters(int procentry, C_ZONE **rzone,
 	}
 
 	/* Lock the zone so we are sure the zone won't change */
-	spin_lock_irqsave(&zone->lock, flags);
+	vmr_lockstat_lock(VMR_LOCK_ZONE, spin_lock_irqsave(&zone->lock, flags));
 
 	/* Calculate watermark for test */
 	switch (procentry) {
@@ -223,12 +259,12 @@ int test_alloc_calculate_parameters(int procentry, C_ZONE **rzone,
 			 * a chance of going totally OOM with a freelimit of
 			 * 0 so it is set to 1.
 			 */
-			if (gfp_flags == GFP_KERNEL) freelimit = 1;
+			if (gfp == GFP_KERNEL) freelimit = 1;
 			break;
 
 		default:
 			printp("Test %d does not exist\n", procentry);
-			spin_unlock_irqrestore(&zone->lock, flags);
+			vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 			goto failed;
 			break;
 	}
@@ -238,7 +274,7 @@ int test_alloc_calculate_parameters(int procentry, C_ZONE **rzone,
 		printp("ERROR: Only %lu pages free on zone with watermark of %lu\n", 
 			zone->free_pages,
 			freelimit);
-		spin_unlock_irqrestore(&zone->lock, flags);
+		vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 		goto failed;
 	}
 
@@ -250,7 +286,7 @@ int test_alloc_calculate_parameters(int procentry, C_ZONE **rzone,
 			printp("Requested test of %lu pages where %lu is the limit\n", 
 					nopages,
 					zone->free_pages - freelimit);
-			spin_unlock_irqrestore(&zone->lock, flags);
+			vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 			goto failed;
 		}
 	} else nopages = zone->free_pages - freelimit;
@@ -262,7 +298,7 @@ int test_alloc_calculate_parameters(int procentry, C_ZONE **rzone,
 	 * size of the zone. This will place the zone under extreme
 	 * pressure
 	 */
-	if (procentry == TEST_ZERO && gfp_flags != GFP_KERNEL) {
+	if (procentry == TEST_ZERO && gfp != GFP_KERNEL) {
 		nopages = zone->free_pages + ( (vmr_zone_size(zone) - zone->free_pages) / 2);
 
 		/* 
@@ -280,7 +316,7 @@ int test_alloc_calculate_parameters(int procentry, C_ZONE **rzone,
 	nopages -= (nopages * sizeof(struct page *)) / PAGE_SIZE + 1;
 
 	/* Unlock zone */
-	spin_unlock_irqrestore(&zone->lock, flags);
+	vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 
 	/* Final sanity check */
 	if (nopages > num_physpages) {
@@ -307,7 +343,10 @@ failed:
  * @procentry: Proc buffer to write to
  *
  * If pages is set to 0, pages will be allocated until the pages_high watermark
- * is hit
+ * is hit. The optional third and fourth parameters are the GFP flags to
+ * use instead of the module default unless -1 and the node to test. The fifth and
+ * sixth are the target CV and time budget to repeat passes until stable.
+ * The seventh turns on the latency histograms
  * Returns
  * 0  on success
  * -1 on failure
@@ -316,6 +355,8 @@ failed:
 int test_alloc_runtest(int *params, int argc, int procentry) {
 	unsigned long nopages;		/* Number of pages to allocate */
 	int nopasses;			/* Number of times to run test */
+	unsigned int gfp;		/* GFP flags to allocate with */
+	int node;			/* Node to test or -1 */
 	C_ZONE *zone;			/* Zone been tested on */
 	unsigned long freelimit;	/* The min no. free pages in zone */
 	unsigned long alloccount;	/* Number of pages alloced */
@@ -323,13 +364,24 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 	struct page **pages;		/* An array of allocations */
 	unsigned int sched_count=0;	/* Counts for schedule() */
 
-	unsigned long start;		/* Start time of test in jiffies */
+	unsigned long long start;	/* Start time of a pass in ns */
+	unsigned long long alloc_ns;	/* Time to alloc in a pass */
+	unsigned long long free_ns;	/* Time to free in a pass */
+	struct vmr_repeat repeat;	/* Passes until stable */
+	unsigned long passalloced;	/* Pages alloced in a pass */
+	unsigned long long start_ns=0;	/* Start of one alloc or free */
+	struct vmr_histogram *hist_alloc=NULL, *hist_free=NULL;
+	struct vmr_counters counters;	/* Events at the start of a pass */
+	struct vmr_counters sched;	/* Scheduling of the whole test */
+	int pass=0;			/* Current pass */
 	unsigned long totalalloced=0;	/* Total count of pages allocated */
 	unsigned long totalfreed=0;	/* Total count of pages freed */
 
 	/* Get the parameters */
 	nopasses = params[0];
 	nopages = params[1];
+	gfp = params[2] != -1 ? params[2] : gfp_flags;
+	node = params[3];
 
 	/* Make sure a buffer is available */
 	if (vmrproc_checkbuffer(testinfo[procentry])) BUG();
@@ -341,10 +393,13 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 		vmr_printk("Cannot make 0 or negative number of passes\n");
 		return -1;
 	}
+	vmr_repeat_init(&repeat, params[4], params[5], nopasses);
 
 	/* Get the parameters for the test */
-	if (test_alloc_calculate_parameters(procentry, &zone, &nopages, &freelimit) == -1) {
+	if (test_alloc_calculate_parameters(procentry, gfp, node,
+				&zone, &nopages, &freelimit) == -1) {
 		printp("Test failed\n");
+		vmr_repeat_free(&repeat);
 		return -1;
 	}
 
@@ -360,24 +415,42 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 	{
 		printp("ERROR: Unable to vmalloc memory (%lu pages) for page pointers\n", nopages);
 		printp("Test failed\n");
+		vmr_repeat_free(&repeat);
 		return -1;
 	}
 	memset(pages, 0, nopages*sizeof(struct page **));
+
+	/* Latency of every alloc and free if asked for */
+	if (params[6]) {
+		hist_alloc = vmr_hist_alloc();
+		hist_free = vmr_hist_alloc();
+	}
 	
 	/* Begin test */
 	printp("Test Parameters\n");
 	printp("o Passes:               %d\n",  nopasses);
+	if (vmr_repeat_adaptive(&repeat)) {
+		printp("o Target CV:            %d.%d%%\n", params[4] / 10, params[4] % 10);
+		printp("o Budget:               %dms\n", params[5]);
+	}
 	printp("o Starting Free pages:  %lu\n", zone->free_pages);
 	printp("o Allocations per pass: %lu\n", nopages);
 	printp("o Free page limit:      %lu\n", freelimit);
+	printp("o Latency histograms:   %s\n", params[6] ? "yes" : "no");
+	/* Aborted passes are logged and printed after the test */
+	vmrproc_allocevents(&testinfo[procentry], 256);
+
 	printp("\nTest Output (Time to alloc/free)\n");
 	printp("\tAlloc\tFree\n");
 
-	while (nopasses-- > 0) {
+	vmr_counters_read(&sched);
+	do {
 
 		/* Allocate all the pages */
 		alloccount=0;
-		start = jiffies-1;
+		vmr_sampler_mark("alloc");
+		vmr_counters_start(&testinfo[procentry], &counters);
+		start = vmr_clock_ns();
 		
 		while (--nopages > 0 && zone->free_pages > freelimit)
 		{
@@ -385,7 +458,14 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 			check_resched(sched_count);
 
 			/* Allocate page */
-			pages[alloccount] = alloc_pages(gfp_flags,0);
+			if (hist_alloc)
+				start_ns = vmr_clock_ns();
+			if (node < 0)
+				pages[alloccount] = alloc_pages(gfp,0);
+			else
+				pages[alloccount] = alloc_pages_node(node,gfp,0);
+			if (hist_alloc)
+				vmr_hist_record(hist_alloc, vmr_clock_ns() - start_ns);
 			if (pages[alloccount] == NULL) break;
 	
 			alloccount++;
@@ -393,32 +473,57 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 		}
 
 		/* Print how many milliseconds it took to allocate */
-		printp("\t %lums\t", jiffies_to_ms(start));
+		alloc_ns = vmr_clock_ns() - start;
+		if (!vmrproc_binary(&testinfo[procentry])) {
+			printp("\t %lums\t", vmr_clock_ms(start));
+		}
 
 		/*
 		 * Ideally, this won't happen but could if there is other
 		 * processes allocating memory
 		 */
-		if (nopages) failed++;
+		if (nopages) {
+			printp_event("Pass %llu aborted after %llu pages with %llu free\n",
+					(unsigned long long)pass + 1,
+					(unsigned long long)alloccount,
+					(unsigned long long)zone->free_pages);
+			failed++;
+		}
 
 		/* Reset nopages for next pass */
 		nopages += alloccount;
+		passalloced = alloccount;
+		pass++;
 
 		/* Free the pages */
-		start=jiffies-1;
+		vmr_sampler_mark("free");
+		start = vmr_clock_ns();
 		do {
 			alloccount--;
 			if (pages[alloccount]) {
+				if (hist_free)
+					start_ns = vmr_clock_ns();
 				__free_pages(pages[alloccount],0);
+				if (hist_free)
+					vmr_hist_record(hist_free, vmr_clock_ns() - start_ns);
 				totalfreed++;
 			}
 		} while (alloccount != 0);
+		free_ns = vmr_clock_ns() - start;
+		vmr_counters_stop(&testinfo[procentry], &counters);
 
 		/* Print how many milliseconds it took to free */
-		printp("%lums\n", jiffies_to_ms(start));
-	}
+		if (vmrproc_binary(&testinfo[procentry])) {
+			printp_record(&alloc_pass, pass, passalloced,
+					alloc_ns, free_ns);
+		} else {
+			printp("%lums\n", vmr_clock_ms(start));
+		}
+		vmr_counters_print(&testinfo[procentry], &counters, pass);
+	} while (!vmr_repeat_done(&repeat, alloc_ns + free_ns));
 	vfree(pages);
 	
+	vmr_counters_since(&sched);
 	printp("\nPost Test Information\n");
 	printp("o Finishing Free pages: %lu\n", zone->free_pages);
 	printp("o Schedule() calls:     %u\n",  sched_count);
@@ -426,6 +531,23 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 	printp("o Total alloced:        %lu\n", totalalloced);
 	printp("o Total freed:          %lu\n", totalfreed);
 	printp("\n");
+	vmr_counters_printsched(&testinfo[procentry], &sched);
+	printp("\n");
+	if (vmrproc_flushevents(&testinfo[procentry]))
+		printp("\n");
+	vmrproc_freeevents(&testinfo[procentry]);
+
+	vmr_hist_print(&testinfo[procentry], hist_alloc, "alloc", "ns");
+	vmr_hist_print(&testinfo[procentry], hist_free, "free", "ns");
+	vmr_hist_free(hist_alloc);
+	vmr_hist_free(hist_free);
+	printp("\n");
+
+	if (vmr_repeat_adaptive(&repeat)) {
+		vmr_repeat_print(&testinfo[procentry], &repeat, "pass", "ns");
+		printp("\n");
+	}
+	vmr_repeat_free(&repeat);
 
 	printp("Test completed successfully\n");
 
@@ -435,14 +557,24 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 
 /* Sanity check the parameters */
 int vmr_sanity(int *params, int noread) {
-	if (params[0] <= 0) params[0] = 1; /* Number passes */
+	if (params[4] < 0)  params[4] = 0; /* Target CV     */
+	if (params[5] < 0)  params[5] = 0; /* Budget in ms  */
+	if (params[0] <= 0) params[0] = params[4] || params[5] ?
+				VMR_REPEAT_MAXPASSES : 1; /* Number passes */
 	if (params[1] < 0)  params[1] = 0; /* Number pages  */
 	return 1;
 }
 	
-#define NUMBER_PROC_WRITE_PARAMETERS 2
+#define NUMBER_PROC_WRITE_PARAMETERS 7
+#define PROC_WRITE_PARAMETER_NAMES "passes", "pages", "gfp", "node", "cv", "budget", "hist"
+#define PROC_WRITE_PARAMETER_DEFAULTS 1, 0, -1, -1, 0, 0, 0
+#define VMR_TEST_DANGER(procentry) \
+	((procentry) == TEST_FAST ? VMR_DANGER_SAFE : \
+	 (procentry) == TEST_ZERO ? VMR_DANGER_OOM : VMR_DANGER_PRESSURE)
+#define VMR_TEST_SUITE(procentry) "regress"
 #define CHECK_PROC_PARAMETERS vmr_sanity
 #define VMR_WRITE_CALLBACK test_alloc_runtest
+#define VMR_WRITE_RESULT
 #include "../init/proc.c"
 
 #define VMR_HELP_PROVIDED test_alloc_help
@@ -34,7 +34,10 @@
  *
  * echo nopasses [nopages] > /proc/vmregres/test_fault_X
  *
- * where X is the test to run
+ * where X is the test to run. With cv= or budget=, the pages are
+ * referenced until the coefficient of variation of the time of a pass, in
+ * tenths of a percent, is below cv or budget milliseconds have passed and
+ * nopasses is the most passes to run. See vmr_repeat.h
  * 
  * Mel Gorman 2002
  */
@@ -53,6 +56,9 @@
 #include <vmregress_core.h>
 #include <pagetable.h>
 #include <procprint.h>
+#include <nanotime.h>
+#include <vmr_histogram.h>
+#include <vmr_repeat.h>
 #include <linux/mmzone.h>
 #include <linux/mm.h>
 #include <linux/vmalloc.h>
@@ -94,6 +100,15 @@ MODULE_LICENSE("GPL");
 /* Test string to copy to user space */
 static char test_string[] = "Mel";
 
+/* Binary record printed for every pass */
+static struct vmr_field fault_pass_fields[] = {
+	{ "pass",	VMR_FIELD_U64 },
+	{ "referenced",	VMR_FIELD_U64 },
+	{ "present",	VMR_FIELD_U64 },
+	{ "ns",		VMR_FIELD_U64 },
+};
+static struct vmr_schema fault_pass = VMR_SCHEMA("fault_pass", fault_pass_fields);
+
 /*
  * Select which zone to base the test on. mmaps are normally highmem so if
  * highmem is available, select it
@@ -120,6 +135,8 @@ void test_fault_help(int procentry) {
 	printp("a mapped area in memory numpages is an optional parameter of how many\n");
 	printp("pages to allocate. When the test completes, cat this proc entry again\n");
 	printp("to see the results.\n");
+	printp("With cv= or budget=, passes are repeated until the CV of their time\n");
+	printp("in 0.1%% is below cv or until budget ms have passed, up to numpasses\n");
 	printp("For more information, read the comment at the top of src/test/fault.c\n\n");
 
 	vmrproc_closebuffer(&testinfo[procentry]);
@@ -167,7 +184,7 @@ int test_fault_calculate_parameters(int procentry, C_ZONE **rzone,
 	}
 
 	/* Lock the zone so we are sure the zone won't change */
-	spin_lock_irqsave(&zone->lock, flags);
+	vmr_lockstat_lock(VMR_LOCK_ZONE, spin_lock_irqsave(&zone->lock, flags));
 
 	/* Calculate watermark for test */
 	switch (procentry) {
@@ -201,7 +218,7 @@ int test_fault_calculate_parameters(int procentry, C_ZONE **rzone,
 
 		default:
 			printp("Test %d does not exist\n", procentry);
-			spin_unlock_irqrestore(&zone->lock, flags);
+			vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 			goto failed;
 			break;
 	}
@@ -211,7 +228,7 @@ int test_fault_calculate_parameters(int procentry, C_ZONE **rzone,
 		printp("ERROR: Only %lu pages free on zone with watermark of %lu\n", 
 			zone->free_pages,
 			freelimit);
-		spin_unlock_irqrestore(&zone->lock, flags);
+		vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 		goto failed;
 	}
 
@@ -223,7 +240,7 @@ int test_fault_calculate_parameters(int procentry, C_ZONE **rzone,
 			printp("Requested test of %lu pages where %lu is the limit\n", 
 					nopages,
 					zone->free_pages - freelimit);
-			spin_unlock_irqrestore(&zone->lock, flags);
+			vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 			goto failed;
 		}
 	} else {
@@ -247,7 +264,7 @@ int test_fault_calculate_parameters(int procentry, C_ZONE **rzone,
 	sigfillset(&current->blocked);
 
 	/* Unlock zone */
-	spin_unlock_irqrestore(&zone->lock, flags);
+	vmr_lockstat_unlock(VMR_LOCK_ZONE, spin_unlock_irqrestore(&zone->lock, flags));
 
 	*rzone = zone;
 	*rnopages = nopages;
@@ -259,29 +276,40 @@ failed:
 }
 
 /**
- * touch_pte - Touches a pte page and returns 1 if it was swapped out
- * @pte: The pte been touched
- * @addr: The address the pte is at
- * @data: Pointer to user data (unused)
+ * touch_ptes - Touches the pages of a pte table and returns how many were swapped out
+ * @ptes: The ptes been touched
+ * @nr: The number of ptes
+ * @addr: The address the first pte is at
+ * @size: Bytes each pte maps. A huge page is touched once
+ * @data: Histogram the latency of the fault is recorded in
  * 
- * This function is used as a callback to forall_pages_mm in the pagetables
+ * This function is used as a callback to forall_ptes_mm in the pagetables
  * module
  */
-unsigned long touch_pte(pte_t *pte, unsigned long addr, void *data) {
+unsigned long touch_ptes(pte_t *ptes, int nr, unsigned long addr,
+		unsigned long size, void *data) {
+	unsigned long long start;
+	unsigned long swapped=0;
+	int i;
 
-	if (pte_present(*pte)) return 0;
+	for (i = 0; i < nr; i++, addr += size) {
+		if (pte_none(ptes[i]) || pte_present(ptes[i])) continue;
 
-	/*
-	 * Copy a string into the page. This will force a
-	 * page fault and swap in a real page for this
-	 * entry in the memory mapped area
-	 */
-	copy_to_user((unsigned long *)addr,
-			test_string,
-			strlen(test_string));
+		/*
+		 * Copy a string into the page. This will force a
+		 * page fault and swap in a real page for this
+		 * entry in the memory mapped area
+		 */
+		start = vmr_clock_ns();
+		copy_to_user((unsigned long *)addr,
+				test_string,
+				strlen(test_string));
+		vmr_hist_record(data, vmr_clock_ns() - start);
+		swapped++;
+	}
 
-	/* Return 1 indicating the page has been swapped in */
-	return 1;
+	/* Return the number of pages that have been swapped in */
+	return swapped;
 }
 
 
@@ -293,7 +321,8 @@ unsigned long touch_pte(pte_t *pte, unsigned long addr, void *data) {
  * @procentry: Proc buffer to write to
  *
  * If pages is set to 0, pages will be allocated until the pages_high watermark
- * is hit
+ * is hit. The optional third and fourth parameters are the target CV and
+ * time budget to repeat passes until stable
  * Returns
  * 0  on success
  * -1 on failure
@@ -309,13 +338,24 @@ int test_fault_runtest(int *params, int argc, int procentry) {
 	unsigned long addr=0;		/* Address mapped area starts */
 	unsigned long len;		/* Length of mapped area */
 	unsigned long sched_count;	/* How many times schedule is called */
-	unsigned long start;		/* Start of a test in jiffies */
-	int totalpasses;		/* Total number of passes */
+	unsigned long long start;	/* Start of a pass in ns */
+	unsigned long long pass_ns;	/* Time of a pass */
+	int pass=0;			/* Current pass */
+	struct vmr_repeat repeat;	/* Passes until stable */
 	int failed=0;			/* Failed mappings */
+	unsigned long long start_ns;	/* Start of one fault */
+	struct vmr_histogram *hist_first, *hist_refault;
+	struct vmr_counters counters;	/* Events at the start of a pass */
+	struct vmr_counters sched;	/* Scheduling of the whole test */
+	struct mm_struct *mm;		/* Pinned mm of the test to walk */
 
 	/* Get the parameters */
 	nopasses = params[0];
 	nopages  = params[1];
+	if (params[2] < 0) params[2] = 0;
+	if (params[3] < 0) params[3] = 0;
+	if (nopasses <= 0 && (params[2] || params[3]))
+		nopasses = VMR_REPEAT_MAXPASSES;
 
 	/* Make sure a buffer is available */
 	if (vmrproc_checkbuffer(testinfo[procentry])) BUG();
@@ -327,6 +367,7 @@ int test_fault_runtest(int *params, int argc, int procentry) {
 		vmr_printk("Cannot make 0 or negative number of passes\n");
 		return -1;
 	}
+	vmr_repeat_init(&repeat, params[2], params[3], nopasses);
 
 	/* Print header */
 	printp("%s Test Results (" UTS_RELEASE ").\n\n", testinfo[procentry].name);
@@ -334,6 +375,7 @@ int test_fault_runtest(int *params, int argc, int procentry) {
 	/* Get the parameters for the test */
 	if (test_fault_calculate_parameters(procentry, &zone, &nopages, &freelimit) == -1) {
 		printp("Test failed\n");
+		vmr_repeat_free(&repeat);
 		return -1;
 	}
 	len = nopages * PAGE_SIZE;
@@ -353,6 +395,7 @@ int test_fault_runtest(int *params, int argc, int procentry) {
 	/* get_unmapped area has a horrible way of returning errors */
 	if (addr == -1) {
 		printp("Failed to mmap");
+		vmr_repeat_free(&repeat);
 		return -1;
 	}
 
@@ -365,6 +408,10 @@ int test_fault_runtest(int *params, int argc, int procentry) {
 	/* Begin test */
 	printp("Test Parameters\n");
 	printp("o Passes:	       %d\n",  nopasses);
+	if (vmr_repeat_adaptive(&repeat)) {
+		printp("o Target CV:	       %d.%d%%\n", params[2] / 10, params[2] % 10);
+		printp("o Budget:	       %dms\n", params[3]);
+	}
 	printp("o Starting Free pages: %lu\n", zone->free_pages);
 	printp("o Free page limit:     %lu\n", freelimit);
 	printp("o References:	       %lu\n", nopages);
@@ -372,17 +419,27 @@ int test_fault_runtest(int *params, int argc, int procentry) {
 
 	printp("Test Results\n");
 	printp("Pass       Refd     Present   Time\n");
-	totalpasses = nopasses;
+
+	/* Latency of the first fault and of faulting pages back in */
+	hist_first = vmr_hist_alloc();
+	hist_refault = vmr_hist_alloc();
+
+	vmr_counters_read(&sched);
 
 	/* Copy the string into every page once to alloc all ptes */
 	alloccount=0;
-	start = jiffies;
+	vmr_sampler_mark("fault");
+	vmr_counters_start(&testinfo[procentry], &counters);
+	start = vmr_clock_ns();
 	while (nopages-- > 0) {
 		check_resched(sched_count);
+		if (vmr_test_cancelled()) break;
 
+		start_ns = vmr_clock_ns();
 		copy_to_user((unsigned long *)(addr + (nopages * PAGE_SIZE)),
 			test_string,
 			strlen(test_string));
+		vmr_hist_record(hist_first, vmr_clock_ns() - start_ns);
 
 		alloccount++;
 	}
@@ -394,33 +451,77 @@ int test_fault_runtest(int *params, int argc, int procentry) {
 	for (;;) {
 
 		/* Count the number of pages present */
-		present = countpages_mm(current->mm, addr, len, &sched_count);
+		present = 0;
+		mm = vmr_mm_get(0);
+		if (mm) {
+			present = countpages_mm(mm, addr, len, &sched_count);
+			vmr_mm_put(mm);
+		}
+		pass_ns = vmr_clock_ns() - start;
+		vmr_counters_stop(&testinfo[procentry], &counters);
 
 		/* Print test info */
-		printp("%-8d %8lu %8lu %8lums\n", totalpasses-nopasses,
+		if (vmrproc_binary(&testinfo[procentry])) {
+			printp_record(&fault_pass, pass,
+					alloccount, present, pass_ns);
+		} else {
+			printp("%-8d %8lu %8lu %8lums\n", pass,
 							alloccount,
 							present,
-							jiffies_to_ms(start));
+							vmr_clock_ms(start));
+		}
+		vmr_counters_print(&testinfo[procentry], &counters, pass);
+
+		/* Pass 0 faults the pages in and is not repeated */
+		if (pass++ > 0 && vmr_repeat_done(&repeat, pass_ns))
+			break;
 
-		if (nopasses-- == 0) break;
+		if (vmr_test_cancelled()) {
+			printp("Test cancelled\n");
+			break;
+		}
 
-		/* Touch all the pages in the mapped area */
-		start = jiffies;
-		alloccount = forall_pte_mm(current->mm, addr, len, 
-				&sched_count, NULL, touch_pte);
+		/*
+		 * Touch all the pages in the mapped area. The faults take
+		 * mmap_sem so it is not held for this walk
+		 */
+		vmr_sampler_mark("refault");
+		vmr_counters_start(&testinfo[procentry], &counters);
+		start = vmr_clock_ns();
+		alloccount = forall_ptes_mm(current->mm, addr, len, 
+				&sched_count, hist_refault, touch_ptes);
 
 	}
 	
+	vmr_counters_since(&sched);
 	printp("\nPost Test Information\n");
 	printp("o Finishing Free pages: %lu\n", zone->free_pages);
 	printp("o Schedule() calls:     %lu\n", sched_count);
 	printp("o Failed mappings:      %u\n",  failed);
 	printp("\n");
+	vmr_counters_printsched(&testinfo[procentry], &sched);
+	printp("\n");
+
+	vmr_hist_print(&testinfo[procentry], hist_first, "first fault", "ns");
+	vmr_hist_print(&testinfo[procentry], hist_refault, "refault", "ns");
+	vmr_hist_free(hist_first);
+	vmr_hist_free(hist_refault);
+	printp("\n");
+
+	if (vmr_repeat_adaptive(&repeat)) {
+		vmr_repeat_print(&testinfo[procentry], &repeat, "pass", "ns");
+		printp("\n");
+	}
+	vmr_repeat_free(&repeat);
 
 	printp("Test completed successfully\n");
 
 	/* Print out a process map */
-	vmr_printmap(current->mm, addr, len, &sched_count, &testinfo[procentry]);
+	mm = vmr_mm_get(0);
+	if (mm) {
+		vmr_printmap(mm, addr, len, &sched_count, &testinfo[procentry]);
+		vmr_mm_put(mm);
+	}
 	/* Unmap the area */
 	if (do_munmap(current->mm, addr, len) == -1) {
 		printp("WARNING: Failed to unmap memory area"); }
@@ -429,8 +530,15 @@ int test_fault_runtest(int *params, int argc, int procentry) {
 	return 0;
 }
 
-#define NUMBER_PROC_WRITE_PARAMETERS 2
+#define NUMBER_PROC_WRITE_PARAMETERS 4
+#define PROC_WRITE_PARAMETER_NAMES "passes", "pages", "cv", "budget"
+#define PROC_WRITE_PARAMETER_DEFAULTS 1, 0, 0, 0
+#define VMR_TEST_DANGER(procentry) \
+	((procentry) == TEST_FAST ? VMR_DANGER_SAFE : \
+	 (procentry) == TEST_ZERO ? VMR_DANGER_OOM : VMR_DANGER_PRESSURE)
+#define VMR_TEST_SUITE(procentry) "regress"
 #define VMR_WRITE_CALLBACK test_fault_runtest
+#define VMR_WRITE_RESULT
 #include "../init/proc.c"
 
 #define VMR_HELP_PROVIDED test_fault_help
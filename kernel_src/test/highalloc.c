@@ -17,6 +17,7 @@
 #include <vmregress_core.h>
 #include <procprint.h>
 #include <nanotime.h>
+#include <vmr_histogram.h>
 #include <linux/mmzone.h>
 #include <linux/mm.h>
 #include <linux/vmalloc.h>
@@ -53,6 +54,14 @@ MODULE_PARM_DESC(hz_fraction, "Number to divide HZ by. The value determines the
 /* GFP flags to use with __alloc_pages. defaults to GFP_USER */
 unsigned int gfp_flags=GFP_USER;
 
+/* Binary record printed to the timings entry for every attempt */
+static struct vmr_field highalloc_timing_fields[] = {
+	{ "attempt",	VMR_FIELD_U64 },
+	{ "success",	VMR_FIELD_U64 },
+	{ "ns",		VMR_FIELD_U64 },
+};
+static struct vmr_schema highalloc_timing = VMR_SCHEMA("highalloc_timing", highalloc_timing_fields);
+
 /**
  * test_alloc_help - Print help message to proc buffer
  * @procentry: Which proc buffer to write to
@@ -63,6 +72,9 @@ void test_alloc_help(int procentry) {
 	printp("%s%s\n\n", MODULENAME, testinfo[procentry].name);
 	printp("To run test, run \n");
 	printp("echo order number > /proc/vmregress/%s\n\n", MODULENAME);
+	printp("Parameters may also be named as order=, pages=, gfp= and node= where\n");
+	printp("gfp overrides the GFP flags and node picks the node to allocate from\n");
+	printp("A gfp of -1, the default, uses the GFP flags of the module\n");
 	
 	vmrproc_closebuffer(&testinfo[procentry]);
 }
@@ -84,6 +96,8 @@ void test_alloc_help(int procentry) {
 int test_alloc_runtest(int *params, int argc, int procentry) {
 	unsigned long order;		/* Order of pages */
 	unsigned long numpages;		/* Number of pages to allocate */
+	unsigned int gfp;		/* GFP flags to allocate with */
+	int node;			/* Node to allocate from or -1 */
 	struct page **pages;		/* Pages that were allocated */
 	unsigned long attempts=0;
 	unsigned long alloced=0;
@@ -93,12 +107,15 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 	unsigned long fail=0;
 	unsigned long resched_count=0;
 	unsigned long aborted=0;
-	unsigned long long start_cycles, cycles;
+	int cancelled=0;
+	unsigned long long start_ns, ns;
 	unsigned long page_dma=0, page_normal=0, page_highmem=0, page_easyrclm=0;
 	int oomkilladj;
 	struct zone *zone;
 	char finishString[60];
 	int timing_pages, pages_required;
+	struct vmr_histogram *hist_success, *hist_fail;
+	struct vmr_counters counters;	/* Events during one attempt */
 
 	/* Set gfp_flags based on the module parameter */
 	if (gfp_highuser) {
@@ -117,6 +134,8 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 	/* Get the parameters */
 	order = params[0];
 	numpages = params[1];
+	gfp = params[2] != -1 ? params[2] : gfp_flags;
+	node = params[3];
 
 	/* Make sure a buffer is available */
 	if (vmrproc_checkbuffer(testinfo[HIGHALLOC_REPORT])) BUG();
@@ -137,6 +156,11 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 		return -1;
 	}
 
+	if (node >= 0 && !vmr_get_pgdat(node)) {
+		vmr_printk("Node %d is not online\n", node);
+		return -1;
+	}
+
 	/* 
 	 * Allocate memory to store pointers to pages.
 	 */
@@ -149,6 +173,10 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 		return 0;
 	}
 
+	/* Latency of every allocation */
+	hist_success = vmr_hist_alloc();
+	hist_fail = vmr_hist_alloc();
+
 	/* Setup proc buffer for timings */
 	timing_pages = testinfo[HIGHALLOC_TIMING].procbuf_size / PAGE_SIZE;
 	pages_required = (numpages * 14) / PAGE_SIZE;
@@ -177,6 +205,15 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 	 */
 	while (attempts++ != numpages) {
 		struct page *page;
+
+		/* Stop if the test was cancelled */
+		if (vmr_test_cancelled()) {
+			printp("High order alloc test cancelled\n");
+			aborted = attempts;
+			cancelled = 1;
+			break;
+		}
+
 		if (lastjiffies > jiffies) nextjiffies = jiffies;
 		while (jiffies < nextjiffies) check_resched(resched_count);
 		nextjiffies = jiffies + (HZ / hz_fraction);
@@ -189,20 +226,35 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 
 		/* Print out a message every so often anyway */
 		if (attempts > 1 && (attempts-1) % 10 == 0) {
-			printp_entry(HIGHALLOC_TIMING, "\n");
+			if (!vmrproc_binary(&testinfo[HIGHALLOC_TIMING])) {
+				printp_entry(HIGHALLOC_TIMING, "\n");
+			}
 			printk("High order alloc test attempts: %lu (%lu)\n",
 					attempts-1, alloced);
 		}
 
 		lastjiffies = jiffies;
 
-		start_cycles = read_clockcycles();
-		page = alloc_pages(gfp_flags | __GFP_NOWARN, order);
-		cycles = read_clockcycles() - start_cycles;
+		vmr_counters_start(&testinfo[HIGHALLOC_BUDDYINFO], &counters);
+		start_ns = vmr_clock_ns();
+		if (node < 0)
+			page = alloc_pages(gfp | __GFP_NOWARN, order);
+		else
+			page = alloc_pages_node(node, gfp | __GFP_NOWARN, order);
+		ns = vmr_clock_ns() - start_ns;
+		vmr_counters_stop(&testinfo[HIGHALLOC_BUDDYINFO], &counters);
 
 		if (page) {
-			printp_entry(HIGHALLOC_TIMING, "%-11Lu ", cycles);
+			vmr_hist_record(hist_success, ns);
+			if (vmrproc_binary(&testinfo[HIGHALLOC_TIMING])) {
+				printp_record_entry(HIGHALLOC_TIMING,
+					&highalloc_timing, attempts, 1, ns);
+			} else {
+				printp_entry(HIGHALLOC_TIMING, "%-11Lu ", ns);
+			}
 			printp_buddyinfo(testinfo, HIGHALLOC_BUDDYINFO, attempts, 1);
+			vmr_counters_print(&testinfo[HIGHALLOC_BUDDYINFO],
+					&counters, attempts);
 			success++;
 			pages[alloced++] = page;
 
@@ -223,8 +275,16 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 			}
 
 		} else {
-			printp_entry(HIGHALLOC_TIMING, "-%-10Lu ", cycles);
+			vmr_hist_record(hist_fail, ns);
+			if (vmrproc_binary(&testinfo[HIGHALLOC_TIMING])) {
+				printp_record_entry(HIGHALLOC_TIMING,
+					&highalloc_timing, attempts, 0, ns);
+			} else {
+				printp_entry(HIGHALLOC_TIMING, "-%-10Lu ", ns);
+			}
 			printp_buddyinfo(testinfo, HIGHALLOC_BUDDYINFO, attempts, 0);
+			vmr_counters_print(&testinfo[HIGHALLOC_BUDDYINFO],
+					&counters, attempts);
 			fail++;
 
 			/* Give up if it takes more than 30 seconds to fail */
@@ -256,6 +316,11 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 	printp("HighMem zone allocs:   %lu\n", page_highmem);
 	printp("EasyRclm zone allocs:  %lu\n", page_easyrclm);
 	printp("%% Success:            %lu\n", (success * 100) / (unsigned long)numpages);
+	printp("\n");
+	vmr_hist_print(&testinfo[procentry], hist_success, "success", "ns");
+	vmr_hist_print(&testinfo[procentry], hist_fail, "fail", "ns");
+	vmr_hist_free(hist_success);
+	vmr_hist_free(hist_fail);
 
 	/*
 	 * Free up the pages
@@ -272,6 +337,8 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 	
 	if (aborted == 0)
 		strcpy(finishString, "Test completed successfully\n");
+	else if (cancelled)
+		sprintf(finishString, "Test cancelled after %lu allocations\n", aborted);
 	else
 		sprintf(finishString, "Test aborted after %lu allocations due to delays\n", aborted);
 	
@@ -285,8 +352,16 @@ int test_alloc_runtest(int *params, int argc, int procentry) {
 	return 0;
 }
 
-#define NUMBER_PROC_WRITE_PARAMETERS 2
+#define NUMBER_PROC_WRITE_PARAMETERS 4
+#define PROC_WRITE_PARAMETER_NAMES "order", "pages", "gfp", "node"
+#define PROC_WRITE_PARAMETER_DEFAULTS 4, 100, -1, -1
+#define VMR_TEST_DANGER(procentry) VMR_DANGER_PRESSURE
+
+/* The test prints to every entry so a suite runs it once */
+#define VMR_TEST_SUITE(procentry) \
+	((procentry) == HIGHALLOC_REPORT ? "regress" : NULL)
 #define VMR_WRITE_CALLBACK test_alloc_runtest
+#define VMR_WRITE_RESULT
 #include "../init/proc.c"
 
 #define VMR_HELP_PROVIDED test_alloc_help
@@ -40,28 +40,24 @@ MODULE_AUTHOR("Mel Gorman <mel@csn.ul.ie>");
 MODULE_DESCRIPTION("Test /proc interface");
 MODULE_LICENSE("GPL");
 
-char *testproc_buf;
-unsigned int testproc_size=0;
-
 /**
  * testproc_runtest - Get information for the proc entry and fill the buffer
  *
- * testproc_readproc needs a buffer to read from if the output is going to be 
- * more than one page in size. This function populates a large buffer for 
- * printing out
+ * The proc buffer is filled with almost as many pages of data as were
+ * requested so reads spanning many pages of the buffer can be checked
  */
 void testproc_runtest(int procentry) {
 	char *procBlock;	/* Small 100k block to write out */
 	int i;
-	int written=0, endwrite;
+	unsigned long endwrite;
+	unsigned int pages;
 
 	/* Make sure a buffer is available */
 	if (vmrproc_checkbuffer(testinfo[procentry])) {
 		vmr_printk("Buffer is somehow invalid\n");
 		return;
 	}
-	testproc_buf = testinfo[procentry].procbuf;
-	testproc_size = testinfo[procentry].procbuf_size;
+	pages = PAGE_ALIGN(testinfo[procentry].procbuf_size) / PAGE_SIZE;
 
 	/* malloc procBlock and fill it */
 	procBlock = kmalloc(101, GFP_KERNEL);
@@ -72,26 +68,26 @@ void testproc_runtest(int procentry) {
 	for (i=0;i<100;i++) procBlock[i] = '0' + (i % 10);
 	procBlock[100] = '\0';
 
-	/* Write almost two pages of data into buffer */
-	written = sprintf(testproc_buf, "Testing proc interface \n\n");
-	endwrite = testproc_size - 120 - strlen(PROCFOOTER);
-	while (written < endwrite) {
-		written += sprintf(&testproc_buf[written], "%d - %d: ", 
-					written, 
-					written+100);
-
-		if (written < endwrite)
-			written += sprintf(&testproc_buf[written], "%s\n", 
-							procBlock);
+	/* Write almost the full buffer of data */
+	vmrproc_openbuffer(&testinfo[procentry]);
+	printp("Testing proc interface \n\n");
+	endwrite = testinfo[procentry].procbuf_size - 120 - strlen(PROCFOOTER);
+	while (testinfo[procentry].written >= 0 && 
+	       testinfo[procentry].written < endwrite) {
+		printp("%ld - %ld: ", 
+				testinfo[procentry].written, 
+				testinfo[procentry].written+100);
+
+		if (testinfo[procentry].written < endwrite)
+			printp("%s\n", procBlock);
 	}
 	
 	/* Write out remainder */
-	written += sprintf(&testproc_buf[written], PROCFOOTER, (int)(PAGE_ALIGN(testproc_size) / PAGE_SIZE));
+	printp(PROCFOOTER, pages);
+	vmrproc_closebuffer(&testinfo[procentry]);
 
 	/* Free procBlock */
 	kfree(procBlock);
-
-	testinfo[procentry].written = written;
 }
 
 /* Callback function for proc write. Allocate a procentry and get it filled */
@@ -119,6 +115,9 @@ int vmr_sanity(int *params, int noread) {
 }
 
 #define NUMBER_PROC_WRITE_PARAMETERS 1
+#define PROC_WRITE_PARAMETER_NAMES "pages"
+#define PROC_WRITE_PARAMETER_DEFAULTS 2
+#define VMR_TEST_SUITE(procentry) "regress"
 #define CHECK_PROC_PARAMETERS vmr_sanity
 #define VMR_WRITE_CALLBACK testproc_fillproc
 #include "../init/proc.c"
@@ -1,7 +1,14 @@
 #!/bin/bash
 
 insmod ./src/core/vmregress_core.o
+insmod ./src/core/events.o
+insmod ./src/core/buddyinfo.o
 insmod ./src/core/pagetable.o
+insmod ./src/core/pool.o
+insmod ./src/core/overhead.o
+insmod ./src/core/sampler.o
+insmod ./src/core/jobs.o
+insmod ./src/core/suite.o
 insmod ./src/sense/kvirtual.o
 insmod ./src/sense/pagemap.o
 insmod ./src/sense/sizes.o
@@ -7,5 +7,12 @@ rmmod zone
 rmmod sizes
 rmmod pagemap
 rmmod kvirtual
+rmmod suite
+rmmod jobs
+rmmod sampler
+rmmod overhead
+rmmod pool
 rmmod pagetable
+rmmod buddyinfo
+rmmod events
 rmmod vmregress_core